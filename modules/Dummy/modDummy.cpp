@@ -45,44 +45,26 @@ ModDummy::ModDummy()
 	setName("Dummy");
 }
 
-void ModDummy::freePage(Page *page)
-{
-	if (page == NULL)
-		return;
-	delete page;
-}
-
 void ModDummy::initRouter(Router *router)
 {
 	RouteTarget *tgt;
 	// Create a target for the "Hello World" page
 	tgt = router->createTarget(this);
 	tgt->setName("hello");
+	tgt->setPage<PageHello>();
 	tgt->enable();
 	// Create a target for the Json version of "Hello World" page
 	tgt = router->createTarget(this);
 	tgt->setName("hello_json");
+	tgt->setPage<PageHelloJson>();
 	tgt->enable();
 	// Create a target for the error 404 page
 	tgt = router->createTarget(this);
 	tgt->setName("err_404");
+	tgt->setPage<Page404>();
 	tgt->enable();
 }
 
-Page *ModDummy::newPage(const String &name)
-{
-	Page *page = NULL;
-	
-	if (name == "err_404")
-		page = new Page404();
-	else if (name == "hello")
-		page = new PageHello();
-	else if (name == "hello_json")
-		page = new PageHelloJson();
-	
-	return page;
-}
-
 	} // namespace Dummy
 } // namespace hermod
 /* EOF */
@@ -26,9 +26,7 @@ class ModDummy : public Module
 {
 public:
 	ModDummy();
-	void   freePage(Page *page);
 	void   initRouter(Router *router);
-	Page  *newPage(const String &name);
 };
 
 	} // namespace Dummy
@@ -23,6 +23,9 @@
 namespace hermod {
 	namespace Files {
 
+// Root path for files, read from config once (and after each reload)
+static ConfigHandle<std::string> cfgFileRoot("mod:Files", "root");
+
 PageFile::PageFile(void)
     : Page()
 {
@@ -33,9 +36,8 @@ int PageFile::process(void)
 {
 	File reqFile;
 	
-	Config  *cfg = Config::getInstance();
 	// Get the root path for files
-	std::string fileRoot = cfg->get("mod:Files", "root");
+	const std::string &fileRoot = cfgFileRoot.get();
 	if (fileRoot.empty())
 		throw runtime_error("Missing config (root)");
 	
@@ -43,31 +43,16 @@ ModFiles::ModFiles()
 	setName("Files");
 }
 
-void ModFiles::freePage(Page *page)
-{
-	if (page == NULL)
-		return;
-	delete page;
-}
-
 void ModFiles::initRouter(Router *router)
 {
 	RouteTarget *tgt;
 	// Create a target for File page
 	tgt = router->createTarget(this);
 	tgt->setName("file");
+	tgt->setPage<PageFile>();
 	tgt->enable();
 }
 
-Page *ModFiles::newPage(const std::string &name)
-{
-	Page *page = NULL;
-	
-	if (name.compare("file") == 0)
-		page = new PageFile();
-
-	return page;
-}
 	} // namespace Files
 } // namespace hermod
 /* EOF */
@@ -26,9 +26,7 @@ class ModFiles : public Module
 {
 public:
 	ModFiles();
-	void   freePage(Page *page);
 	void   initRouter(Router *router);
-	Page  *newPage(const std::string &name);
 };
 
 	} // namespace Files
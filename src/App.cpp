@@ -12,11 +12,21 @@
  *
  * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
  */
+#include <cerrno>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "App.hpp"
 #include "Config.hpp"
@@ -26,10 +36,28 @@
 #include "Router.hpp"
 #include "SessionCache.hpp"
 #include "ServerFastcgi.hpp"
+#include "ServerHttp.hpp"
+#include "ServerScgi.hpp"
+#include "ServerUring.hpp"
+#include "ServerUwsgi.hpp"
 #include "ServerLibFcgi.hpp"
 
 namespace hermod {
 
+// Period (in seconds) of the housekeeping timer
+#define APP_HOUSEKEEPING_PERIOD 5
+// Min time (in seconds) between two starts of a worker process
+#define APP_RESPAWN_DELAY 1
+// Period (in milliseconds) of the tests of end of connections during a drain
+#define APP_DRAIN_POLL 100
+// Environment variable used by a new instance to signal that it is ready
+#define APP_ENV_READY "HERMOD_READY_FD"
+
+// Flag of close_range() to set close-on-exec (not defined by old headers)
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
 App*  App::mAppInstance = NULL;
 
 /**
@@ -39,8 +67,29 @@ App*  App::mAppInstance = NULL;
 App::App()
 {
 	mRunning  = false;
+	mReload   = false;
+	mTimerFd  = -1;
+	mSignalFd = -1;
+	mQuit     = false;
+	mDraining = false;
+	mDrainStart   = 0;
+	mDrainTimeout = 30;
+	mUpgrade   = false;
+	mUpgradeFd = -1;
+	mArgv      = NULL;
+	mReactors = 1;
+	mAffinity = false;
+	mWorkers  = 0;
+	mProcesses = 1;
+	mIndex    = 0;
+	mPids.clear();
+	mExecutor = NULL;
+	mReactor  = NULL;
 	mRouter   = NULL;
 	mServer   = NULL;
+	mThreads.clear();
+	mStatsAccepted = 0;
+	mStatsRefused  = 0;
 }
 
 /**
@@ -54,6 +103,50 @@ App::~App()
 		delete mServer;
 		mServer = 0;
 	}
+	if (mExecutor)
+	{
+		delete mExecutor;
+		mExecutor = 0;
+	}
+	if (mTimerFd >= 0)
+	{
+		close(mTimerFd);
+		mTimerFd = -1;
+	}
+	if (mUpgradeFd >= 0)
+	{
+		close(mUpgradeFd);
+		mUpgradeFd = -1;
+	}
+	if (mSignalFd >= 0)
+	{
+		close(mSignalFd);
+		mSignalFd = -1;
+	}
+	if (mReactor)
+	{
+		delete mReactor;
+		mReactor = 0;
+	}
+}
+
+/**
+ * @brief Delete the old routers that are not used anymore (after a reload)
+ *
+ */
+void App::cleanRouters(void)
+{
+	std::vector<Router *>::iterator it;
+	for (it = mRetired.begin(); it != mRetired.end(); )
+	{
+		if ((*it)->isUsed())
+		{
+			++it;
+			continue;
+		}
+		delete (*it);
+		it = mRetired.erase(it);
+	}
 }
 
 /**
@@ -83,6 +176,37 @@ void App::destroy(void)
 	mAppInstance = NULL;
 }
 
+/**
+ * @brief Stop accepting connections, and exit when the current ones are done
+ *
+ * Into the master process (prefork mode) the drain is forwarded to the
+ * workers, and the master exits when all of them are stopped.
+ */
+void App::drain(void)
+{
+	if (mDraining)
+		return;
+	mDraining   = true;
+	mDrainStart = std::time(0);
+
+	if (mPids.size())
+	{
+		Log::info() << "App: Drain worker processes" << Log::endl;
+		for (unsigned int i = 0; i < mPids.size(); i++)
+			if (mPids[i])
+				kill(mPids[i], SIGQUIT);
+		// Close the sockets of the master (workers close their own copy)
+		mServer->stop();
+		return;
+	}
+
+	Log::info() << "App: Stop accepting connections, wait for current ones"
+	            << Log::endl;
+	for (unsigned int i = 0; i < mThreads.size(); i++)
+		mThreads[i]->drain();
+	mServer->drain();
+}
+
 /**
  * @brief Get access to the global App object (singlaton) ... or create it
  *
@@ -103,7 +227,12 @@ App* App::getInstance()
  *
  * This method is the main place of an App. It must be called to start the
  * application, and the app is stopped when this method returns. An app works
- * using events on descriptors, a big loop wait and dispatch events.
+ * using events on descriptors : the Reactor wait and dispatch events to the
+ * server(s) and to the App itself (for timers).
+ *
+ * In prefork mode, the master process only supervises the worker processes.
+ * Workers are created by fork() into supervise() and continue here, like a
+ * standalone App.
  *
  * @return App* Pointer to the App object
  */
@@ -115,50 +244,40 @@ App* App::exec(void)
 	try {
 		mRunning = true;
 
+		if (mProcesses > 1)
+			supervise();
+
 		while(mRunning)
 		{
-			fd_set rfds;
-			struct timeval tv;
-			int retval;
-			int maxFd  = 0;
-			int i;
-
-			FD_ZERO(&rfds);
-			for (i = 0; /**/; i++)
+			// Wait and dispatch events (with a timeout during a drain, to
+			// test the end of connections of the other event loops)
+			mReactor->wait(mDraining ? APP_DRAIN_POLL : -1);
+
+			if (mReload)
 			{
-				// Get the next server fd
-				int fd = mServer->getFd(i);
-				// If this is the last fd (or no fd available)
-				if (fd < 0)
-					break;
-				// Insert this fd into the "select" list
-				FD_SET(fd, &rfds);
-				// Update the highest fd number
-				if (fd >= maxFd)
-					maxFd = (fd + 1);
+				mReload = false;
+				reload();
 			}
-
-			tv.tv_sec = 5;
-			tv.tv_usec = 0;
-			retval = select(maxFd, &rfds, NULL, NULL, &tv);
-			if (retval > 0)
+			if (mQuit)
 			{
-				for (i = 0; i < maxFd; i++)
-				{
-					if ( ! FD_ISSET(i, &rfds))
-						continue;
-					mServer->processFd(i);
-				}
+				mQuit = false;
+				drain();
 			}
-			else if (retval == 0)
+			if (mUpgrade)
 			{
-				// Case of timeout reserved for future use
-				SessionCache::clean();
-				continue;
+				mUpgrade = false;
+				upgrade();
 			}
 
 			// Flush Log
 			Log::sync();
+
+			if (mDraining && isDrained())
+			{
+				Log::info() << "App: Drain complete" << Log::endl;
+				Log::sync();
+				mRunning = false;
+			}
 		} /* while */
 	}
 	catch(std::exception& e) {
@@ -167,9 +286,25 @@ App* App::exec(void)
 	}
 	
 	try {
-		// Clear the local Router
+		// Stop the other event loops (and delete their servers)
+		while (mThreads.size())
+		{
+			delete mThreads.back();
+			mThreads.pop_back();
+		}
+		// Wait the end of running pages, before deleting their resources
+		if (mExecutor)
+			mExecutor->stop();
+		if (mServer)
+			mServer->stop();
+		// Clear the local Router (and the old ones)
 		delete mRouter;
 		mRouter = NULL;
+		while (mRetired.size())
+		{
+			delete mRetired.back();
+			mRetired.pop_back();
+		}
 		// Clear the Session cache
 		SessionCache::destroy();
 		// Clear Config cache
@@ -194,7 +329,8 @@ App* App::init(void)
 	try {
 		String cfgFile;
 		cfgFile = cfg->get("global", "log_file");
-		Log::setFile(cfgFile);
+		// Started by an upgrade, the previous instance still writes logs
+		Log::setFile(cfgFile, (getenv(APP_ENV_READY) != 0));
 	} catch (std::exception& e) {
 		// ToDo: print some message ?
 	}
@@ -202,6 +338,27 @@ App* App::init(void)
 	// Init random number generator
 	std::srand(std::time(0));
 
+	// Create the Reactor used to wait for events
+	mReactor = new Reactor;
+
+	// Number of event loops (one thread for each)
+	ConfigKey *keyReactors = cfg->getKey("global", "reactors");
+	if (keyReactors && (keyReactors->getInteger() > 1))
+		mReactors = keyReactors->getInteger();
+	ConfigKey *keyAffinity = cfg->getKey("global", "reactor_affinity");
+	if (keyAffinity)
+		mAffinity = keyAffinity->getBoolean(false);
+
+	// Number of worker processes (prefork mode)
+	ConfigKey *keyProcesses = cfg->getKey("global", "processes");
+	if (keyProcesses && (keyProcesses->getInteger() > 1))
+		mProcesses = keyProcesses->getInteger();
+
+	// Max time (in seconds) to wait for connections during a drain
+	ConfigKey *keyDrain = cfg->getKey("global", "drain_timeout");
+	if (keyDrain && (keyDrain->getInteger() >= 0))
+		mDrainTimeout = keyDrain->getInteger();
+
 	// Create a Router for this App
 	mRouter = new Router;
 
@@ -237,37 +394,63 @@ App* App::init(void)
 	}
 	Log::info() << "App: server type = " << cfgServer << Log::endl;
 
+	if ((mReactors > 1) && (cfgServer != "fastcgi") &&
+	    (cfgServer != "uring") && (cfgServer != "http") &&
+	    (cfgServer != "scgi")  && (cfgServer != "uwsgi"))
+	{
+		Log::warning() << "App: many reactors are only supported by "
+		               << "fastcgi, uring, http, scgi and uwsgi servers"
+		               << Log::endl;
+		mReactors = 1;
+	}
+
+	// Number of threads used to process pages (if enabled)
+	ConfigKey *keyWorkers = cfg->getKey("global", "workers");
+	if (keyWorkers && (keyWorkers->getInteger() > 0) && (mReactors > 1))
+		Log::warning() << "App: workers not used with many reactors" << Log::endl;
+	else if (keyWorkers && (keyWorkers->getInteger() > 0))
+		mWorkers = keyWorkers->getInteger();
+
 	// Start FCGI server
 	try {
+		// Create the server of the configured protocol
 		if (cfgServer == "fastcgi")
-		{
-			ServerFastcgi *server;
-			// Create a new FastCGI server
-			server = new ServerFastcgi();
-
-			// Register the local router into server
-			server->setRouter(mRouter);
-
-			// Start server ! :)
-			mServer = server;
-		}
+			mServer = new ServerFastcgi();
+		// FastCGI server based on io_uring
+		else if (cfgServer == "uring")
+			mServer = new ServerUring();
+		// HTTP server (no web server in front)
+		else if (cfgServer == "http")
+			mServer = new ServerHttp();
+		// SCGI and uwsgi servers (one connection per request)
+		else if (cfgServer == "scgi")
+			mServer = new ServerScgi();
+		else if (cfgServer == "uwsgi")
+			mServer = new ServerUwsgi();
+		// FCGI default interface
 		else if (cfgServer == "libfcgi")
-		{
-			ServerLibFcgi *server;
-			// Create the FCGI default interface
-			server = new ServerLibFcgi();
-
-			// Register the local router into server
-			server->setRouter(mRouter);
-
-			// Start server ! :)
-			mServer = server;
-		}
+			mServer = new ServerLibFcgi();
 		else
 			throw std::runtime_error("Unknown server type declared");
 
+		// Register the local router into server
+		mServer->setRouter(mRouter);
+		mServer->setReactor(mReactor);
+		// Other event loops listen on the same addresses
+		if (mReactors > 1)
+		{
+			mServer->setReusePort(true);
+			mServer->setLoops(mReactors);
+		}
+
+		// Start server ! :)
 		mServer->start();
 
+		// In prefork mode, threads and timers are created by each worker
+		// process (see supervise)
+		if (mProcesses <= 1)
+			initProcess();
+
 	} catch (std::exception& e) {
 		Log::error() << "Failed to start Hermod server: "
 		             << e.what() << Log::endl;
@@ -278,9 +461,414 @@ App* App::init(void)
 	Log::info() << "Hermod (FCGI) started" << Log::endl;
 	Log::sync();
 
+	// Started by an upgrade : the previous instance can now be stopped
+	const char *envReady = getenv(APP_ENV_READY);
+	if (envReady)
+	{
+		int fd = atoi(envReady);
+		if ((fd > 2) && (write(fd, "1", 1) != 1))
+			Log::warning() << "App: Failed to signal previous instance" << Log::endl;
+		if (fd > 2)
+			close(fd);
+		unsetenv(APP_ENV_READY);
+	}
+
 	return getInstance();
 }
 
+/**
+ * @brief Initialize the resources owned by one process
+ *
+ * Timers and threads are not shared by processes, so this is called by each
+ * worker in prefork mode (or by init for a standalone App).
+ */
+void App::initProcess(void)
+{
+	sigset_t mask;
+
+	// Create a periodic timer for housekeeping tasks
+	mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (mTimerFd >= 0)
+	{
+		struct itimerspec its;
+		its.it_interval.tv_sec  = APP_HOUSEKEEPING_PERIOD;
+		its.it_interval.tv_nsec = 0;
+		its.it_value = its.it_interval;
+		timerfd_settime(mTimerFd, 0, &its, NULL);
+		mReactor->add(mTimerFd, this, false);
+	}
+	else
+		Log::warning() << "App: Failed to create housekeeping timer" << Log::endl;
+
+	// Signals are received by the event loop (signalfd). They are blocked
+	// before creating threads, so no other thread receives them
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	mSignalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (mSignalFd >= 0)
+		mReactor->add(mSignalFd, this, false);
+	else
+		Log::warning() << "App: Failed to create signalfd" << Log::endl;
+
+	// The libfcgi server uses his own threads (one request for each)
+	ServerLibFcgi *libfcgi = dynamic_cast<ServerLibFcgi *>(mServer);
+	if (libfcgi && (mWorkers > 0))
+	{
+		libfcgi->startWorkers(mWorkers);
+		Log::info() << "App: " << (int)mWorkers
+		            << " libfcgi worker threads started" << Log::endl;
+	}
+	// Create the pool of threads used to process pages (if enabled)
+	else if (mWorkers > 0)
+	{
+		mExecutor = new Executor;
+		mExecutor->start(mWorkers, mReactor);
+		mServer->setExecutor(mExecutor);
+		Log::info() << "App: " << (int)mExecutor->size()
+		            << " worker threads started" << Log::endl;
+	}
+
+	// CPUs are given in turn to the event loops of all processes
+	unsigned int cpu = mIndex * mReactors;
+
+	// Start the other event loops
+	for (unsigned int i = 1; i < mReactors; i++)
+	{
+		ReactorThread *rt = new ReactorThread(i);
+		mThreads.push_back(rt);
+		rt->start(&mModuleCache, mServer,
+		          mAffinity ? ReactorThread::getCpu(cpu + i) : -1);
+	}
+
+	if (mAffinity)
+		ReactorThread::setAffinity(pthread_self(), ReactorThread::getCpu(cpu));
+	if (mReactors > 1)
+		Log::info() << "App: " << (int)mReactors << " reactors started"
+		            << (mAffinity ? " (pinned)" : "") << Log::endl;
+}
+
+/**
+ * @brief Test if all the connections are finished after a drain
+ *
+ * @return boolean True if the App can exit
+ */
+bool App::isDrained(void)
+{
+	if (mDrainTimeout && (std::time(0) >= mDrainStart + (time_t)mDrainTimeout))
+	{
+		Log::warning() << "App: Drain timeout, pending connections are closed"
+		               << Log::endl;
+		return true;
+	}
+
+	if ( ! mServer->isIdle())
+		return false;
+	for (unsigned int i = 0; i < mThreads.size(); i++)
+		if ( ! mThreads[i]->isDrained())
+			return false;
+	return true;
+}
+
+/**
+ * @brief Handler called by the Reactor for descriptors owned by App
+ *
+ * @param fd Descriptor where an event has been detected
+ */
+void App::processFd(int fd)
+{
+	if (fd == mTimerFd)
+	{
+		uint64_t expirations;
+		// Acknowledge the timer event
+		if (read(mTimerFd, &expirations, sizeof(expirations)) < 0)
+			return;
+		// Remove expired sessions from cache
+		SessionCache::clean();
+		// Delete the routers replaced by a reload
+		cleanRouters();
+
+		// Report the activity of the listening sockets
+		if (mServer)
+		{
+			ServerStats st = mServer->getStats();
+			unsigned long accepted = st.accepted - mStatsAccepted;
+			unsigned long refused  = st.refused  - mStatsRefused;
+			if (accepted || refused)
+			{
+				unsigned long rate = accepted / (expirations * APP_HOUSEKEEPING_PERIOD);
+				Log::debug() << "Server: " << (int)accepted << " connections"
+				             << " accepted (" << (int)rate << "/s) "
+				             << (int)refused << " refused, max "
+				             << (int)st.batchMax << " per event" << Log::endl;
+			}
+			mStatsAccepted = st.accepted;
+			mStatsRefused  = st.refused;
+		}
+	}
+	else if ((fd == mSignalFd) && (fd >= 0))
+	{
+		struct signalfd_siginfo info;
+		while (read(mSignalFd, &info, sizeof(info)) == sizeof(info))
+		{
+			// Same processing as signal handlers : the event loop tests
+			// the flags when this method returns
+			if (info.ssi_signo == SIGHUP)
+				sigHup();
+			else if (info.ssi_signo == SIGINT)
+				sigInt();
+			else if (info.ssi_signo == SIGQUIT)
+				sigQuit();
+			else if (info.ssi_signo == SIGTERM)
+				sigTerm();
+			else if (info.ssi_signo == SIGUSR2)
+				sigUpgrade();
+		}
+	}
+	else if ((fd == mUpgradeFd) && (fd >= 0))
+	{
+		char ready;
+		int  len = read(mUpgradeFd, &ready, 1);
+		if ((len < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+			return;
+		mReactor->remove(mUpgradeFd);
+		close(mUpgradeFd);
+		mUpgradeFd = -1;
+
+		// Pipe closed without message : the new instance has failed
+		if (len != 1)
+		{
+			Log::error() << "App: Upgrade failed, new instance not started"
+			             << Log::endl;
+			return;
+		}
+		Log::info() << "App: New instance ready" << Log::endl;
+		// Sockets (and socket files) are now owned by the new instance
+		mServer->releaseListeners();
+		drain();
+	}
+}
+
+/**
+ * @brief Reload the configuration file, and the routes
+ *
+ * A new Router is created for each event loop from the new configuration.
+ * Requests in progress finish with the old one, it is deleted later (see
+ * cleanRouters). Settings used at startup (listen, reactors, workers, ...)
+ * are not modified : an upgrade is needed to change them.
+ */
+void App::reload(void)
+{
+	Log::info() << "App: Reload configuration" << Log::endl;
+	try {
+		Config::reload();
+	} catch (std::exception &e) {
+		Log::error() << "App: Failed to reload configuration: "
+		             << e.what() << Log::endl;
+		return;
+	}
+
+	Router *router = new Router;
+	router->setModuleCache(&mModuleCache);
+	router->reload();
+	mServer->setRouter(router);
+	mRetired.push_back(mRouter);
+	mRouter = router;
+
+	// Other event loops swap their router by themselves
+	for (unsigned int i = 0; i < mThreads.size(); i++)
+	{
+		router = new Router;
+		router->setModuleCache(&mModuleCache);
+		router->reload();
+		mThreads[i]->setRouter(router);
+	}
+
+	cleanRouters();
+}
+
+/**
+ * @brief Set the command line used to start a new instance (upgrade)
+ *
+ * @param argv Arguments of the command line (as received by main)
+ * @return App* Pointer to the App object
+ */
+App* App::setCommand(char **argv)
+{
+	mArgv = argv;
+	return this;
+}
+
+/**
+ * @brief Main loop of the master process (prefork mode)
+ *
+ * The master starts the worker processes, then waits for signals : a worker
+ * that exits is started again, SIGHUP reloads the configuration and is
+ * forwarded to all the workers, SIGTERM or SIGQUIT drains them, SIGINT (or a
+ * second SIGTERM) stops them and SIGUSR2 starts an upgrade. Signals are
+ * blocked and received with sigtimedwait(), so they can not be lost between
+ * two tests.
+ *
+ * This method returns into the master when all workers are stopped, and into
+ * each new worker (just after fork) to run his own event loop.
+ */
+void App::supervise(void)
+{
+	std::vector<time_t> started;
+	sigset_t mask, prevMask;
+	pid_t master = getpid();
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &mask, &prevMask);
+
+	mPids.resize(mProcesses, 0);
+	started.resize(mProcesses, 0);
+
+	while (mRunning)
+	{
+		// Start the missing workers
+		for (unsigned int i = 0; i < mProcesses; i++)
+		{
+			// No new worker during a drain
+			if ((mPids[i] != 0) || mDraining)
+				continue;
+			// A worker that crash at startup is not restarted immediately
+			if (std::time(0) < started[i] + APP_RESPAWN_DELAY)
+				continue;
+
+			// Flush Log, so pending messages are not duplicated
+			Log::sync();
+			pid_t pid = fork();
+			if (pid < 0)
+			{
+				Log::error() << "App: Failed to start worker " << (int)i << Log::endl;
+				continue;
+			}
+			if (pid == 0)
+			{
+				// Into the new worker process
+				sigprocmask(SIG_SETMASK, &prevMask, NULL);
+				// Stop the worker if the master exits
+				prctl(PR_SET_PDEATHSIG, SIGTERM);
+				if (getppid() != master)
+					mRunning = false;
+				mIndex = i;
+				// The upgrade in progress (if any) is followed by the master
+				if (mUpgradeFd >= 0)
+				{
+					close(mUpgradeFd);
+					mUpgradeFd = -1;
+				}
+				mPids.clear();
+				// Each process needs his own epoll instance
+				mReactor->reopen();
+				// Sockets (and socket files) are owned by the master
+				mServer->releaseListeners();
+				std::srand(std::time(0) ^ getpid());
+				initProcess();
+				return;
+			}
+			mPids[i]   = pid;
+			started[i] = std::time(0);
+			Log::info() << "App: Worker " << (int)i << " started (pid="
+			            << (int)pid << ")" << Log::endl;
+		}
+		Log::sync();
+
+		// Wait for a signal (with a timeout to retry delayed starts)
+		struct timespec timeout;
+		timeout.tv_sec  = APP_RESPAWN_DELAY;
+		timeout.tv_nsec = 0;
+		int sig = sigtimedwait(&mask, NULL, &timeout);
+		if ((sig == SIGINT) || ((sig == SIGTERM) && mDraining))
+			mRunning = false;
+		else if (sig == SIGHUP)
+		{
+			// New workers will use the new configuration
+			reload();
+			Log::info() << "App: SIGHUP forwarded to workers" << Log::endl;
+			for (unsigned int i = 0; i < mProcesses; i++)
+				if (mPids[i])
+					kill(mPids[i], SIGHUP);
+		}
+		else if ((sig == SIGQUIT) || (sig == SIGTERM))
+			drain();
+		else if (sig == SIGUSR2)
+			upgrade();
+
+		// Test if the new instance is ready (upgrade in progress)
+		if (mUpgradeFd >= 0)
+			processFd(mUpgradeFd);
+
+		// Collect the workers that have exited
+		int   status;
+		pid_t pid;
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+		{
+			for (unsigned int i = 0; i < mProcesses; i++)
+			{
+				if (mPids[i] != pid)
+					continue;
+				mPids[i] = 0;
+				if (WIFSIGNALED(status))
+					Log::warning() << "App: Worker " << (int)i << " killed by signal "
+					               << WTERMSIG(status) << Log::endl;
+				else
+					Log::warning() << "App: Worker " << (int)i << " exited with status "
+					               << WEXITSTATUS(status) << Log::endl;
+			}
+		}
+
+		// End of the drain when all the workers are stopped
+		if (mDraining)
+		{
+			unsigned int count = 0;
+			for (unsigned int i = 0; i < mProcesses; i++)
+				if (mPids[i])
+					count++;
+			if (count == 0)
+				mRunning = false;
+		}
+	}
+
+	// Stop all the workers (immediately), and wait for them
+	for (unsigned int i = 0; i < mProcesses; i++)
+		if (mPids[i])
+			kill(mPids[i], SIGINT);
+	for (unsigned int i = 0; i < mProcesses; i++)
+	{
+		if (mPids[i] == 0)
+			continue;
+		while ((waitpid(mPids[i], NULL, 0) < 0) && (errno == EINTR))
+			;
+		mPids[i] = 0;
+	}
+	Log::info() << "App: All workers stopped" << Log::endl;
+	Log::sync();
+
+	sigprocmask(SIG_SETMASK, &prevMask, NULL);
+}
+
+/**
+ * @brief This static method handle the SIGHUP signal
+ *
+ */
+void App::sigHup(void)
+{
+	if (mAppInstance)
+		mAppInstance->mReload = true;
+}
+
 /**
  * @brief This static method handle OS based signals (mainly SIGINT)
  *
@@ -293,5 +881,185 @@ void App::sigInt(void)
 	FCGX_ShutdownPending();
 }
 
+/**
+ * @brief This static method handle the SIGQUIT signal (graceful stop)
+ *
+ */
+void App::sigQuit(void)
+{
+	if (mAppInstance)
+		mAppInstance->mQuit = true;
+}
+
+/**
+ * @brief This static method handle the SIGTERM signal
+ *
+ * The first SIGTERM drains the App (the current requests are finished), a
+ * second one stops it immediately.
+ */
+void App::sigTerm(void)
+{
+	if (mAppInstance && mAppInstance->mDraining)
+		sigInt();
+	else if (mAppInstance)
+		mAppInstance->mQuit = true;
+}
+
+/**
+ * @brief This static method handle the SIGUSR2 signal (binary upgrade)
+ *
+ */
+void App::sigUpgrade(void)
+{
+	if (mAppInstance)
+		mAppInstance->mUpgrade = true;
+}
+
+/**
+ * @brief Start a new instance of hermod, and give it the listening sockets
+ *
+ * The new instance is started with the same command line (so a new binary
+ * can be installed before) and receives the sockets into the HERMOD_FDS
+ * environment variable. When it is ready, it writes on a pipe given into
+ * HERMOD_READY_FD : then this instance stops accepting connections, and exits
+ * when the current ones are finished (see processFd). If the new instance
+ * fails, this one continue to work as before.
+ */
+void App::upgrade(void)
+{
+	// In prefork mode, sockets are owned by the master process
+	if ((mProcesses > 1) && mPids.empty())
+	{
+		Log::warning() << "App: Upgrade must be requested to master process"
+		               << Log::endl;
+		return;
+	}
+	// Each event loop has its own TCP sockets, only the ones of the main
+	// server could be given to the new instance
+	if (mReactors > 1)
+	{
+		Log::warning() << "App: Upgrade not supported with many reactors"
+		               << Log::endl;
+		return;
+	}
+	if ((mUpgradeFd >= 0) || mDraining || (mArgv == 0))
+	{
+		Log::warning() << "App: Upgrade not available now" << Log::endl;
+		return;
+	}
+
+	// Pipe used by the new instance to signal that it is ready
+	int fdReady[2];
+	if (pipe2(fdReady, O_CLOEXEC | O_NONBLOCK) < 0)
+	{
+		Log::error() << "App: Upgrade failed, no pipe" << Log::endl;
+		return;
+	}
+
+	// Environment of the new instance (prepared before fork)
+	std::vector<int> fds;
+	std::vector<std::string> env;
+	for (char **var = environ; *var; var++)
+		env.push_back(*var);
+	env.push_back(mServer->exportListeners(fds));
+	env.push_back(std::string(APP_ENV_READY "=") +
+	              String::number(fdReady[1]).toStdStr());
+	std::vector<char *> envp;
+	for (unsigned int i = 0; i < env.size(); i++)
+		envp.push_back((char *)env[i].c_str());
+	envp.push_back(NULL);
+	fds.push_back(fdReady[1]);
+
+	// Descriptors open now, closed by exec if close_range is not available
+	std::vector<int> openFds;
+	DIR *dir = opendir("/proc/self/fd");
+	if (dir)
+	{
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			int fd = atoi(entry->d_name);
+			if ((fd > 2) && (fd != dirfd(dir)))
+				openFds.push_back(fd);
+		}
+		closedir(dir);
+	}
+	else
+	{
+		long maxFd = sysconf(_SC_OPEN_MAX);
+		for (long fd = 3; fd < maxFd; fd++)
+			openFds.push_back(fd);
+	}
+
+	// Pipe used to get the pid of the new instance
+	int fdPid[2];
+	if (pipe2(fdPid, O_CLOEXEC) < 0)
+	{
+		close(fdReady[0]);
+		close(fdReady[1]);
+		Log::error() << "App: Upgrade failed, no pipe" << Log::endl;
+		return;
+	}
+
+	// The new instance is started by an intermediate process, so it is not
+	// a child of this one (and is never left as a zombie)
+	Log::sync();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		pid_t child = fork();
+		if (child != 0)
+		{
+			if (child > 0)
+				(void)!write(fdPid[1], &child, sizeof(child));
+			_exit(child > 0 ? 0 : 1);
+		}
+		// Into the new process : only the sockets are kept by exec, other
+		// descriptors (log file, connections, ...) are closed
+		bool cloexec = false;
+#ifdef SYS_close_range
+		cloexec = (syscall(SYS_close_range, 3, ~0U, CLOSE_RANGE_CLOEXEC) == 0);
+#endif
+		if ( ! cloexec)
+		{
+			for (unsigned int i = 0; i < openFds.size(); i++)
+				fcntl(openFds[i], F_SETFD, FD_CLOEXEC);
+		}
+		for (unsigned int i = 0; i < fds.size(); i++)
+			fcntl(fds[i], F_SETFD, 0);
+		execvpe(mArgv[0], mArgv, &envp[0]);
+		_exit(127);
+	}
+	close(fdReady[1]);
+	close(fdPid[1]);
+	// Collect the intermediate process, it exits after the fork
+	int status = -1;
+	if (pid > 0)
+	{
+		while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR))
+			;
+	}
+	pid_t child = 0;
+	if ((pid < 0) || ( ! WIFEXITED(status)) || (WEXITSTATUS(status) != 0) ||
+	    (read(fdPid[0], &child, sizeof(child)) != sizeof(child)))
+	{
+		close(fdPid[0]);
+		close(fdReady[0]);
+		Log::error() << "App: Upgrade failed, fork error" << Log::endl;
+		return;
+	}
+	close(fdPid[0]);
+	pid = child;
+
+	mUpgradeFd = fdReady[0];
+	if (mPids.empty())
+		mReactor->add(mUpgradeFd, this, false);
+	Log::info() << "App: Upgrade started, new instance pid=" << (int)pid
+	            << Log::endl;
+}
+
 } // namespace hermod
 /* EOF */
@@ -14,7 +14,12 @@
  */
 #ifndef APP_HPP
 #define APP_HPP
+#include <vector>
+#include <sys/types.h>
+#include "Executor.hpp"
 #include "ModuleCache.hpp"
+#include "Reactor.hpp"
+#include "ReactorThread.hpp"
 #include "Router.hpp"
 #include "Server.hpp"
 
@@ -29,23 +34,63 @@ namespace hermod {
  * a session manager, ...) Each server has one App object that manage everything
  *
  */
-class App
+class App : public ReactorHandler
 {
 public:
 	static void destroy();
 	App * exec (void);
 	App * init (void);
+	void  processFd(int fd = -1);
+	App * setCommand(char **argv);
 	static App* getInstance();
 public:
+	static void sigHup(void);
 	static void sigInt(void);
+	static void sigQuit(void);
+	static void sigTerm(void);
+	static void sigUpgrade(void);
 private:
 	App();
 	~App();
+	void cleanRouters(void);
+	void drain      (void);
+	void initProcess(void);
+	bool isDrained  (void);
+	void reload     (void);
+	void supervise  (void);
+	void upgrade    (void);
 private:
     	static App*  mAppInstance;
 	bool         mRunning;
+	bool         mReload;
+	int          mTimerFd;
+	int          mSignalFd;
+	// Graceful stop : connections are finished before exit
+	bool         mQuit;
+	bool         mDraining;
+	time_t       mDrainStart;
+	unsigned int mDrainTimeout;
+	// Binary upgrade : command line, and pipe to the new instance
+	bool         mUpgrade;
+	int          mUpgradeFd;
+	char       **mArgv;
+	// Settings of the event loops of each process
+	unsigned int mReactors;
+	bool         mAffinity;
+	unsigned int mWorkers;
+	// Prefork mode : number of worker processes, and their pids (master)
+	unsigned int mProcesses;
+	unsigned int mIndex;
+	std::vector<pid_t> mPids;
+	Executor    *mExecutor;
+	Reactor     *mReactor;
 	Server      *mServer;
+	std::vector<ReactorThread *> mThreads;
+	unsigned long mStatsAccepted;
+	unsigned long mStatsRefused;
 	Router      *mRouter;
+	// Routers replaced by a reload, still used by some requests
+	std::vector<Router *> mRetired;
 	ModuleCache  mModuleCache;
 };
 
@@ -23,6 +23,8 @@
 namespace hermod {
 
 Config* Config::mInstance = NULL;  
+pthread_mutex_t Config::mFilesLock = PTHREAD_MUTEX_INITIALIZER;
+unsigned int Config::mSerialCount = 0;
 
 /**
  * @brief Delete the global config instance (singleton)
@@ -61,6 +63,13 @@ Config::~Config()
 		mFiles.pop_back();
 		delete cfg;
 	}
+
+	// Delete the config replaced by a reload (if any)
+	if (mPrevious)
+	{
+		delete mPrevious;
+		mPrevious = 0;
+	}
 }
 
 /**
@@ -70,12 +79,15 @@ Config::~Config()
  */
 Config* Config::getInstance(void)
 {
-	if ( ! mInstance)
+	// The instance may be replaced by a reload (see reload)
+	Config *cfg = __atomic_load_n(&mInstance, __ATOMIC_ACQUIRE);
+	if ( ! cfg)
 	{
-		mInstance = new Config;
-		mInstance->mName = "main";
+		cfg = new Config;
+		cfg->mName = "main";
+		mInstance = cfg;
 	}
-	return mInstance;
+	return cfg;
 }
 
 /**
@@ -86,10 +98,28 @@ Config* Config::getInstance(void)
  */
 Config* Config::getInstance(const String &filename)
 {
-	Config *mainCfg = getInstance();
+	Config *cfg;
 
 	if ( filename.isEmpty() )
-		return mainCfg;
+		return getInstance();
+
+	// Files may be searched (or loaded) by many threads at the same time
+	pthread_mutex_lock(&mFilesLock);
+	cfg = loadFile(filename);
+	pthread_mutex_unlock(&mFilesLock);
+
+	return cfg;
+}
+
+/**
+ * @brief Search a secondary configuration file, and load it if needed
+ *
+ * @param  filename Name of the configuration file
+ * @return Config* Pointer to the config object for the specified file
+ */
+Config* Config::loadFile(const String &filename)
+{
+	Config *mainCfg = getInstance();
 
 	// Search into the already loaded files
 	std::vector<Config *>::iterator it;
@@ -156,6 +186,7 @@ ConfigGroup *Config::createGroup(const std::string &name)
 	
 	grp->setName(name);
 	mGroups.push_back(grp);
+	mGroupIndex[name] = grp;
 	
 	return grp;
 }
@@ -168,18 +199,12 @@ ConfigGroup *Config::createGroup(const std::string &name)
  */
 ConfigGroup *Config::getGroup(const std::string &name)
 {
-	size_t nbGroups;
-	
-	nbGroups = mGroups.size();
-	
-	// Look into the list of known groups
-	for (size_t i = 0; i < nbGroups; i++)
-	{
-		ConfigGroup *grp = mGroups.at(i);
-		if (grp->getName() == name)
-			return grp;
-	}
-	return NULL;
+	// Look into the index of known groups
+	std::unordered_map<std::string, ConfigGroup *>::const_iterator it;
+	it = mGroupIndex.find(name);
+	if (it == mGroupIndex.end())
+		return NULL;
+	return it->second;
 }
 
 /**
@@ -263,6 +288,19 @@ String Config::getName(void) const
 	return mName;
 }
 
+/**
+ * @brief Get the unique number of this Config object
+ *
+ * Each Config object (main file, reloaded file ...) has a different serial,
+ * so a ConfigHandle knows when the key must be searched again.
+ *
+ * @return integer Serial number of this object
+ */
+unsigned int Config::getSerial(void) const
+{
+	return mSerial;
+}
+
 /**
  * @brief Read the content of a config file, and load values
  *
@@ -318,6 +356,41 @@ void Config::load(const std::string &filename)
 	cfgFile.close();
 }
 
+/**
+ * @brief Load again the main configuration file
+ *
+ * The file is loaded into a new Config object, then it replaces the current
+ * one. Other threads may still read the old object, so it is only deleted
+ * with the new one (see destroy). Keys set by the program (default values)
+ * are set again when the file does not define them.
+ */
+void Config::reload(void)
+{
+	Config *current = getInstance();
+	if (current->mFilename.empty())
+		throw std::runtime_error("Config: No file to reload");
+
+	Config *cfg = new Config;
+	cfg->mName = "main";
+	try {
+		cfg->load(current->mFilename);
+	} catch (...) {
+		delete cfg;
+		throw;
+	}
+
+	for (size_t i = 0; i + 2 < current->mDefaults.size(); i += 3)
+	{
+		const std::string &group = current->mDefaults[i];
+		const std::string &key   = current->mDefaults[i + 1];
+		if (cfg->getKey(group, key) == 0)
+			cfg->set(group, key, current->mDefaults[i + 2]);
+	}
+
+	cfg->mPrevious = current;
+	__atomic_store_n(&mInstance, cfg, __ATOMIC_RELEASE);
+}
+
 /**
  * @brief Set the value of an existing key, or create it
  *
@@ -338,6 +411,11 @@ void Config::set(const std::string &group,
 	k = g->createKey(key);
 	
 	k->setValue(value);
+
+	// Remember this value, to set it again after a reload
+	mDefaults.push_back(group);
+	mDefaults.push_back(key);
+	mDefaults.push_back(value);
 }
 
 /**
@@ -405,6 +483,7 @@ ConfigKey *ConfigGroup::createKey(const std::string &name, bool multiple)
 	}
 	
 	mKeys.push_back(key);
+	mKeyIndex[name].push_back(key);
 	
 	key->setPos(mKeys.size() - 1);
 	
@@ -413,24 +492,26 @@ ConfigKey *ConfigGroup::createKey(const std::string &name, bool multiple)
 
 ConfigKey *ConfigGroup::getKey(const std::string &name, size_t *pos)
 {
-	size_t nbKeys;
+	std::unordered_map<std::string, std::vector<ConfigKey *> >::const_iterator it;
 	
-	nbKeys = mKeys.size();
+	it = mKeyIndex.find(name);
+	if (it == mKeyIndex.end())
+		return NULL;
 	
-	int first = 0;
+	size_t first = 0;
 	if (pos)
 		first = *pos;
 	
-	// Look into the list of known keys
-	for (size_t i = first; i < nbKeys; i++)
+	// Look into the keys with this name, for the first one at "pos" or after
+	const std::vector<ConfigKey *> &keys = it->second;
+	for (size_t i = 0; i < keys.size(); i++)
 	{
-		ConfigKey *key = mKeys.at(i);
-		if (name.compare(key->getName()) == 0)
-		{
-			if (pos)
-				*pos = i;
-			return key;
-		}
+		ConfigKey *key = keys[i];
+		if ((size_t)key->getPos() < first)
+			continue;
+		if (pos)
+			*pos = key->getPos();
+		return key;
 	}
 	return NULL;
 }
@@ -17,7 +17,9 @@
 
 #include <string>
 #include <cstddef> // std::size_t
+#include <unordered_map>
 #include <vector>
+#include <pthread.h>
 #include "String.hpp"
 #include "ConfigKey.hpp"
 
@@ -29,6 +31,14 @@ class ConfigGroup;
  * @class Config
  * @brief This class define the main object to handle configuration keys
  *
+ * The main configuration is loaded before the start of the worker threads,
+ * then it is only read (a reload creates a new object, see reload).
+ * Additional files can be loaded later by any thread, the list of loaded
+ * files is protected by a mutex.
+ *
+ * Groups and keys are indexed by name into hash tables, and values are parsed
+ * when they are loaded (see ConfigKey). Code that reads a key often should
+ * keep a ConfigHandle, that finds the key once for each Config object.
  */
 class Config
 {
@@ -40,26 +50,41 @@ public:
 	ConfigKey  *getKey(const std::string &group, const std::string &key);
 	ConfigKey  *getKey(const std::string &group, int index);
 	String      getName(void) const;
+	unsigned int getSerial(void) const;
 	void set(const std::string &group,
 	         const std::string &key,
 	         const std::string &value);
 	void load (const std::string &filename);
+	static void reload(void);
 protected:
 	ConfigGroup *createGroup(const std::string &name);
 	ConfigGroup *getGroup   (const std::string &name);
+	static Config *loadFile (const String &filename);
 private:
 	Config() {
 		mGroups.clear();
 		mFiles.clear();
+		mDefaults.clear();
+		mPrevious = 0;
+		mSerial = __atomic_add_fetch(&mSerialCount, 1, __ATOMIC_RELAXED);
 	};
 	~Config();
 	void setName(const String &name);
 private:
 	static Config* mInstance;
+	static pthread_mutex_t mFilesLock;
+	static unsigned int mSerialCount;
 	String         mName;
 	std::string    mFilename;
+	// Unique number of this object (see ConfigHandle)
+	unsigned int   mSerial;
 	std::vector<ConfigGroup *> mGroups;
+	std::unordered_map<std::string, ConfigGroup *> mGroupIndex;
 	std::vector<Config *> mFiles;
+	// Keys set by the program (group, key, value), kept on reload
+	std::vector<std::string> mDefaults;
+	// Config replaced by a reload (may still be used by other threads)
+	Config *mPrevious;
 };
 
 /**
@@ -79,6 +104,60 @@ public:
 private:
 	String mName;
 	std::vector<ConfigKey *> mKeys;
+	// Keys indexed by name (many keys may have the same name)
+	std::unordered_map<std::string, std::vector<ConfigKey *> > mKeyIndex;
+};
+
+/**
+ * @class ConfigHandle
+ * @brief Typed access to a configuration key, that can be kept by callers
+ *
+ * The key is searched on the first read, then a pointer to its parsed value
+ * (int, bool or std::string) is kept and next reads are a dereference. When
+ * the configuration is reloaded, the key is searched again into the new
+ * Config. When the key is not defined (or is not a valid boolean) the
+ * default value is used.
+ */
+template <class T>
+class ConfigHandle
+{
+public:
+	ConfigHandle(const std::string &group, const std::string &key,
+	             const T &def = T())
+	  : mGroup(group), mKey(key), mDefault(def)
+	{
+		mSerial = 0;
+		mValue  = 0;
+	}
+	/**
+	 * @brief Get the value of the key
+	 *
+	 */
+	const T &get(void)
+	{
+		Config *cfg = Config::getInstance();
+		if (__atomic_load_n(&mSerial, __ATOMIC_ACQUIRE) != cfg->getSerial())
+			resolve(cfg);
+		return *__atomic_load_n(&mValue, __ATOMIC_RELAXED);
+	}
+private:
+	void resolve(Config *cfg)
+	{
+		const T   *value = 0;
+		ConfigKey *key   = cfg->getKey(mGroup, mKey);
+		if (key)
+			value = key->getTyped<T>();
+		if (value == 0)
+			value = &mDefault;
+		__atomic_store_n(&mValue,  value, __ATOMIC_RELAXED);
+		__atomic_store_n(&mSerial, cfg->getSerial(), __ATOMIC_RELEASE);
+	}
+private:
+	std::string  mGroup;
+	std::string  mKey;
+	T            mDefault;
+	unsigned int mSerial;
+	const T     *mValue;
 };
 
 } // namespace hermod
@@ -25,6 +25,9 @@ ConfigKey::ConfigKey(const std::string &name) : mName(name)
 {
 	mPos  = 0;
 	mValue.clear();
+	mInteger = 0;
+	mBoolean = false;
+	mBooleanValid = false;
 }
 
 /**
@@ -34,23 +37,10 @@ ConfigKey::ConfigKey(const std::string &name) : mName(name)
  */
 bool ConfigKey::getBoolean(bool def = false)
 {
-	if ( (mValue.compare("yes") == 0) ||
-	     (mValue.compare("YES") == 0) ||
-	     (mValue.compare("on")  == 0) ||
-	     (mValue.compare("ON")  == 0) )
-	{
-		return true;
-	}
+	if ( ! mBooleanValid)
+		return def;
 
-	if ( (mValue.compare("no")  == 0) ||
-	     (mValue.compare("NO")  == 0) ||
-	     (mValue.compare("off") == 0) ||
-	     (mValue.compare("OFF") == 0) )
-	{
-		return false;
-	}
-
-	return def;
+	return mBoolean;
 }
 
 /**
@@ -60,9 +50,7 @@ bool ConfigKey::getBoolean(bool def = false)
  */
 int ConfigKey::getInteger(void)
 {
-	int value = atoi(mValue.c_str());
-
-	return value;
+	return mInteger;
 }
 
 /**
@@ -103,6 +91,41 @@ void ConfigKey::setPos(int pos)
 	mPos = pos;
 }
 
+/**
+ * @brief Get a pointer to the boolean value of the key
+ *
+ * @return bool* Pointer to the value (NULL if the key is not a boolean)
+ */
+template <>
+const bool *ConfigKey::getTyped<bool>(void) const
+{
+	if ( ! mBooleanValid)
+		return NULL;
+	return &mBoolean;
+}
+
+/**
+ * @brief Get a pointer to the integer value of the key
+ *
+ * @return int* Pointer to the value
+ */
+template <>
+const int *ConfigKey::getTyped<int>(void) const
+{
+	return &mInteger;
+}
+
+/**
+ * @brief Get a pointer to the string value of the key
+ *
+ * @return string* Pointer to the value
+ */
+template <>
+const std::string *ConfigKey::getTyped<std::string>(void) const
+{
+	return &mValue;
+}
+
 /**
  * @brief Get the key value as string
  *
@@ -116,11 +139,35 @@ std::string ConfigKey::getValue()
 /**
  * @brief Set the value of this key
  *
+ * The integer and boolean values are parsed here, so getInteger, getBoolean
+ * and getTyped do not parse the text on each call.
+ *
  * @param value The new value to save
  */
 void ConfigKey::setValue(const std::string &value)
 {
 	mValue = value;
+
+	// Parse the value once, for typed accessors
+	mInteger = atoi(mValue.c_str());
+	if ( (mValue.compare("yes") == 0) ||
+	     (mValue.compare("YES") == 0) ||
+	     (mValue.compare("on")  == 0) ||
+	     (mValue.compare("ON")  == 0) )
+	{
+		mBoolean = true;
+		mBooleanValid = true;
+	}
+	else if ( (mValue.compare("no")  == 0) ||
+	          (mValue.compare("NO")  == 0) ||
+	          (mValue.compare("off") == 0) ||
+	          (mValue.compare("OFF") == 0) )
+	{
+		mBoolean = false;
+		mBooleanValid = true;
+	}
+	else
+		mBooleanValid = false;
 }
 
 } // namespace hermod
@@ -31,6 +31,7 @@ public:
 	int         getInteger(void);
 	std::string getName();
 	int         getPos();
+	template <class T> const T *getTyped(void) const;
 	std::string getValue();
 	void setPos  (int pos);
 	void setValue(const std::string &value);
@@ -38,7 +39,15 @@ private:
 	std::string mName;
 	std::string mValue;
 	int mPos;
+	// Values parsed when the key is set
+	int  mInteger;
+	bool mBoolean;
+	bool mBooleanValid;
 };
 
+template <> const bool *ConfigKey::getTyped<bool>(void) const;
+template <> const int  *ConfigKey::getTyped<int> (void) const;
+template <> const std::string *ConfigKey::getTyped<std::string>(void) const;
+
 } // namespace hermod
 #endif
@@ -0,0 +1,356 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cerrno>
+#include <stdexcept>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "Executor.hpp"
+#include "Log.hpp"
+
+namespace hermod {
+
+/**
+ * @brief Default constructor
+ *
+ */
+Executor::Executor()
+{
+	mRunning = false;
+	mEventFd = -1;
+	mReactor = 0;
+	mNext    = 0;
+	mPending = 0;
+	mWorkers.clear();
+	mDone.clear();
+
+	pthread_mutex_init(&mIdleLock, NULL);
+	pthread_cond_init (&mIdleCond, NULL);
+	pthread_mutex_init(&mDoneLock, NULL);
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+Executor::~Executor()
+{
+	stop();
+
+	pthread_mutex_destroy(&mDoneLock);
+	pthread_cond_destroy (&mIdleCond);
+	pthread_mutex_destroy(&mIdleLock);
+}
+
+/**
+ * @brief Handler called by the Reactor when some jobs are finished
+ *
+ * @param fd Descriptor where the event has been detected (eventfd)
+ */
+void Executor::processFd(int fd)
+{
+	std::vector<ExecutorJob *> done;
+	uint64_t count;
+
+	(void)fd;
+
+	// Acknowledge the event
+	if (read(mEventFd, &count, sizeof(count)) < 0)
+	{
+		if ((errno != EAGAIN) && (errno != EINTR))
+			Log::error() << "Executor: Failed to read event" << Log::endl;
+	}
+
+	// Get the list of finished jobs
+	pthread_mutex_lock(&mDoneLock);
+	done.swap(mDone);
+	pthread_mutex_unlock(&mDoneLock);
+
+	std::vector<ExecutorJob *>::iterator it;
+	for (it = done.begin(); it != done.end(); ++it)
+	{
+		try {
+			(*it)->complete();
+		} catch (std::exception &e) {
+			Log::error() << "Executor: Exception during job completion: "
+			             << e.what() << Log::endl;
+		}
+		delete (*it);
+	}
+}
+
+/**
+ * @brief Get the number of worker threads
+ *
+ * @return integer Number of workers
+ */
+unsigned int Executor::size(void) const
+{
+	return mWorkers.size();
+}
+
+/**
+ * @brief Start the worker threads
+ *
+ * @param count   Number of worker threads to start
+ * @param reactor Pointer to the Reactor used to process finished jobs
+ */
+void Executor::start(unsigned int count, Reactor *reactor)
+{
+	if (mRunning || (count == 0) || (reactor == 0))
+		return;
+
+	mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mEventFd < 0)
+		throw std::runtime_error("Executor: Failed to create eventfd");
+	mReactor = reactor;
+	mReactor->add(mEventFd, this, false);
+
+	// Create all the workers before starting threads (the list of workers
+	// is read by threads when they search a job to steal)
+	for (unsigned int i = 0; i < count; i++)
+		mWorkers.push_back(new ExecutorWorker(this, i));
+
+	mRunning = true;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		ExecutorWorker *worker = mWorkers[i];
+		if (pthread_create(&worker->mThread, NULL, threadMain, worker) == 0)
+			continue;
+		// Failed to create this thread, remove workers not started
+		Log::error() << "Executor: Failed to start worker thread" << Log::endl;
+		pthread_mutex_lock(&mIdleLock);
+		mRunning = false;
+		pthread_cond_broadcast(&mIdleCond);
+		pthread_mutex_unlock(&mIdleLock);
+		for (unsigned int j = 0; j < i; j++)
+			pthread_join(mWorkers[j]->mThread, NULL);
+		while (mWorkers.size())
+		{
+			delete mWorkers.back();
+			mWorkers.pop_back();
+		}
+		stop();
+		throw std::runtime_error("Executor: Failed to start worker threads");
+	}
+}
+
+/**
+ * @brief Stop the worker threads
+ *
+ * Jobs currently processed are finished before threads exit. Jobs that are
+ * still waiting into queues, or waiting for completion, are deleted without
+ * calling their complete() method.
+ */
+void Executor::stop(void)
+{
+	// Wake up all the workers and ask them to exit
+	pthread_mutex_lock(&mIdleLock);
+	mRunning = false;
+	pthread_cond_broadcast(&mIdleCond);
+	pthread_mutex_unlock(&mIdleLock);
+
+	// Wait for all the threads before deleting any worker : a thread that
+	// search a job to steal reads the queues of all the other workers
+	for (unsigned int i = 0; i < mWorkers.size(); i++)
+		pthread_join(mWorkers[i]->mThread, NULL);
+
+	while (mWorkers.size())
+	{
+		ExecutorWorker *worker = mWorkers.back();
+		mWorkers.pop_back();
+		// Delete the jobs that has not been processed
+		while (worker->mJobs.size())
+		{
+			delete worker->mJobs.front();
+			worker->mJobs.pop_front();
+		}
+		delete worker;
+	}
+	mPending = 0;
+
+	while (mDone.size())
+	{
+		delete mDone.back();
+		mDone.pop_back();
+	}
+
+	if (mEventFd >= 0)
+	{
+		if (mReactor)
+			mReactor->remove(mEventFd);
+		close(mEventFd);
+		mEventFd = -1;
+	}
+	mReactor = 0;
+}
+
+/**
+ * @brief Insert a new job into the queue of a worker
+ *
+ * Jobs are given to the workers in turn. Idle workers steal jobs from the
+ * other queues, so the choice of the queue is not critical.
+ *
+ * @param job Pointer to the job to process (deleted after completion)
+ */
+void Executor::submit(ExecutorJob *job)
+{
+	if ((job == 0) || mWorkers.empty())
+		throw std::runtime_error("Executor: not started");
+
+	ExecutorWorker *worker = mWorkers[mNext % mWorkers.size()];
+	mNext++;
+
+	pthread_mutex_lock(&worker->mLock);
+	worker->mJobs.push_back(job);
+	pthread_mutex_unlock(&worker->mLock);
+
+	// Wake up one idle worker (if any)
+	pthread_mutex_lock(&mIdleLock);
+	mPending++;
+	pthread_cond_signal(&mIdleCond);
+	pthread_mutex_unlock(&mIdleLock);
+}
+
+/**
+ * @brief Entry point of worker threads
+ *
+ * @param arg Pointer to the ExecutorWorker of the thread
+ */
+void *Executor::threadMain(void *arg)
+{
+	ExecutorWorker *worker = (ExecutorWorker *)arg;
+	worker->mExecutor->workerLoop(worker);
+	return NULL;
+}
+
+/**
+ * @brief Main loop of a worker thread
+ *
+ * @param worker Pointer to the context of the worker
+ */
+void Executor::workerLoop(ExecutorWorker *worker)
+{
+	while (1)
+	{
+		ExecutorJob *job = workerTake(worker);
+		if (job == 0)
+		{
+			// No job available, wait for a new one
+			pthread_mutex_lock(&mIdleLock);
+			while (mRunning && (mPending == 0))
+				pthread_cond_wait(&mIdleCond, &mIdleLock);
+			bool running = mRunning;
+			pthread_mutex_unlock(&mIdleLock);
+			if ( ! running)
+				break;
+			continue;
+		}
+
+		try {
+			job->run();
+		} catch (std::exception &e) {
+			Log::error() << "Executor: Exception during job: "
+			             << e.what() << Log::endl;
+		} catch (...) {
+			Log::error() << "Executor: Unknown exception during job" << Log::endl;
+		}
+
+		// Give the job back to the Reactor thread
+		pthread_mutex_lock(&mDoneLock);
+		bool wakeup = mDone.empty();
+		mDone.push_back(job);
+		pthread_mutex_unlock(&mDoneLock);
+		// Reactor is woken up only when the list was empty (one event
+		// is enough to process all the finished jobs)
+		if (wakeup)
+		{
+			uint64_t one = 1;
+			if (write(mEventFd, &one, sizeof(one)) < 0)
+				Log::error() << "Executor: Failed to signal job" << Log::endl;
+		}
+	}
+}
+
+/**
+ * @brief Get the next job to process by a worker
+ *
+ * The job is taken from the front of the worker queue. When the local queue
+ * is empty, a job is stolen from the back of another queue.
+ *
+ * @param worker Pointer to the context of the worker
+ * @return ExecutorJob* Pointer to the job (or NULL if no job is available)
+ */
+ExecutorJob *Executor::workerTake(ExecutorWorker *worker)
+{
+	ExecutorJob *job = 0;
+	unsigned int count = mWorkers.size();
+
+	for (unsigned int i = 0; (i < count) && (job == 0); i++)
+	{
+		ExecutorWorker *w = mWorkers[(worker->mIndex + i) % count];
+		pthread_mutex_lock(&w->mLock);
+		if (w->mJobs.size())
+		{
+			if (w == worker)
+			{
+				job = w->mJobs.front();
+				w->mJobs.pop_front();
+			}
+			else
+			{
+				job = w->mJobs.back();
+				w->mJobs.pop_back();
+			}
+		}
+		pthread_mutex_unlock(&w->mLock);
+	}
+
+	if (job)
+	{
+		pthread_mutex_lock(&mIdleLock);
+		mPending--;
+		pthread_mutex_unlock(&mIdleLock);
+	}
+	return job;
+}
+
+// ------------------------- Worker context -------------------------
+
+/**
+ * @brief Constructor of a worker context
+ *
+ * @param executor Pointer to the Executor that own the worker
+ * @param index    Index of the worker into the executor
+ */
+ExecutorWorker::ExecutorWorker(Executor *executor, unsigned int index)
+{
+	mExecutor = executor;
+	mIndex    = index;
+	mJobs.clear();
+	pthread_mutex_init(&mLock, NULL);
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+ExecutorWorker::~ExecutorWorker()
+{
+	pthread_mutex_destroy(&mLock);
+}
+
+} // namespace hermod
+/* EOF */
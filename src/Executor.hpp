@@ -0,0 +1,104 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "Reactor.hpp"
+
+namespace hermod {
+
+class Executor;
+
+/**
+ * @class ExecutorJob
+ * @brief Interface of a task that can be processed by an Executor
+ *
+ * The run() method is called by a worker thread. When it returns, the job is
+ * given back to the thread of the Reactor where complete() is called, then
+ * the job is deleted.
+ */
+class ExecutorJob
+{
+public:
+	virtual ~ExecutorJob() {}
+	virtual void run     (void) = 0;
+	virtual void complete(void) = 0;
+};
+
+/**
+ * @class ExecutorWorker
+ * @brief Context of one worker thread of an Executor
+ *
+ */
+class ExecutorWorker
+{
+	friend class Executor;
+public:
+	ExecutorWorker(Executor *executor, unsigned int index);
+	~ExecutorWorker();
+private:
+	Executor       *mExecutor;
+	unsigned int    mIndex;
+	pthread_t       mThread;
+	pthread_mutex_t mLock;
+	std::deque<ExecutorJob *> mJobs;
+};
+
+/**
+ * @class Executor
+ * @brief Pool of threads used to process jobs out of the Reactor thread
+ *
+ * Each worker has his own queue of jobs. New jobs are distributed to the
+ * queues in turn. A worker takes jobs from the front of his own queue, and
+ * when it is empty, steals jobs from the back of the other queues : a slow
+ * job does not delay the jobs queued behind it while other workers are idle.
+ *
+ * Finished jobs are collected into a list and an eventfd is used to wake up
+ * the Reactor, so completion handlers always run in the Reactor thread.
+ */
+class Executor : public ReactorHandler
+{
+public:
+	Executor();
+	~Executor();
+	void processFd(int fd = -1);
+	unsigned int size(void) const;
+	void start (unsigned int count, Reactor *reactor);
+	void stop  (void);
+	void submit(ExecutorJob *job);
+protected:
+	static void *threadMain(void *arg);
+	void         workerLoop(ExecutorWorker *worker);
+	ExecutorJob *workerTake(ExecutorWorker *worker);
+private:
+	bool         mRunning;
+	int          mEventFd;
+	Reactor     *mReactor;
+	unsigned int mNext;
+	std::vector<ExecutorWorker *> mWorkers;
+	// Jobs waiting into the queues, and idle workers
+	pthread_mutex_t mIdleLock;
+	pthread_cond_t  mIdleCond;
+	unsigned int    mPending;
+	// Finished jobs, waiting for completion into the Reactor thread
+	pthread_mutex_t mDoneLock;
+	std::vector<ExecutorJob *> mDone;
+};
+
+} // namespace hermod
+#endif
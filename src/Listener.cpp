@@ -0,0 +1,373 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <grp.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Listener.hpp"
+#include "Log.hpp"
+
+namespace hermod {
+
+/**
+ * @brief Constructor
+ *
+ * @param address Address where the listener must wait for connections
+ */
+Listener::Listener(const std::string &address)
+{
+	mAddress = address;
+	mFd      = -1;
+	mMode    = -1;
+	mDeferAccept = 0;
+	mNoDelay = false;
+	mReusePort = false;
+	mUnlink  = false;
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+Listener::~Listener()
+{
+	close();
+}
+
+/**
+ * @brief Use a listening socket inherited from a previous instance
+ *
+ * The socket is already bound and listening, only the descriptor flags are
+ * updated. From now, this listener owns the socket (and his file).
+ *
+ * @param fd Descriptor of the inherited socket
+ */
+void Listener::adopt(int fd)
+{
+	if ((mFd >= 0) || (fd < 0))
+		return;
+
+	int flags = fcntl(fd, F_GETFL);
+	if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) ||
+	    (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0))
+		throw std::runtime_error("Invalid inherited socket " + mAddress);
+
+	mFd = fd;
+	mUnlink = (isUnix() && (mAddress.compare(5, 1, "@") != 0));
+}
+
+/**
+ * @brief Close the listening socket
+ *
+ * For unix sockets created with a path, the socket file is removed.
+ */
+void Listener::close(void)
+{
+	if (mFd < 0)
+		return;
+
+	::close(mFd);
+	mFd = -1;
+
+	if (mUnlink)
+	{
+		unlink(mAddress.substr(5).c_str());
+		mUnlink = false;
+	}
+}
+
+/**
+ * @brief Apply the options of this listener to an accepted connection
+ *
+ * @param fd Descriptor of the accepted connection
+ */
+void Listener::configure(int fd)
+{
+	// Nagle algorithm is only used by TCP sockets
+	if (mNoDelay && ! isUnix())
+	{
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+}
+
+/**
+ * @brief Get the address of this listener (as set into config)
+ *
+ * @return string Address of the listener
+ */
+std::string Listener::getAddress(void) const
+{
+	return mAddress;
+}
+
+/**
+ * @brief Get the descriptor of the listening socket
+ *
+ * @return integer Descriptor (or -1 if not open)
+ */
+int Listener::getFd(void) const
+{
+	return mFd;
+}
+
+/**
+ * @brief Test if the address of this listener is a unix domain socket
+ *
+ * @return boolean True for unix sockets
+ */
+bool Listener::isUnix(void) const
+{
+	return (mAddress.compare(0, 5, "unix:") == 0);
+}
+
+/**
+ * @brief Create the socket and start listening
+ *
+ * @param backlog Max length of the queue of pending connections
+ */
+void Listener::open(int backlog)
+{
+	if (mFd >= 0)
+		return;
+
+	try {
+		if (isUnix())
+			openUnix(backlog);
+		else
+			openInet(backlog);
+	} catch (...) {
+		close();
+		throw;
+	}
+}
+
+/**
+ * @brief Create and bind a TCP socket
+ *
+ * @param backlog Max length of the queue of pending connections
+ */
+void Listener::openInet(int backlog)
+{
+	struct sockaddr_in addr;
+	std::string host;
+	std::string port(mAddress);
+
+	// Split host and port (if any)
+	size_t sep = mAddress.rfind(':');
+	if (sep != std::string::npos)
+	{
+		host = mAddress.substr(0, sep);
+		port = mAddress.substr(sep + 1);
+	}
+
+	memset((char *)&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port   = htons(atoi(port.c_str()));
+	addr.sin_addr.s_addr = INADDR_ANY;
+	if ( ! host.empty() && (host != "*") &&
+	     (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1))
+		throw std::runtime_error("Invalid listen address " + mAddress);
+
+	mFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (mFd < 0)
+		throw std::runtime_error("Failed to create socket");
+
+	// Allow to restart quickly (connections in TIME_WAIT)
+	int one = 1;
+	setsockopt(mFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	// Allow other event loops to listen on the same address
+	if (mReusePort &&
+	    (setsockopt(mFd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0))
+		throw std::runtime_error("Failed to set SO_REUSEPORT on " + mAddress);
+
+	if (bind(mFd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		throw std::runtime_error("Failed to bind socket " + mAddress);
+
+	// Wake up the server only when the first datas has been received
+	if (mDeferAccept > 0)
+		setsockopt(mFd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+		           &mDeferAccept, sizeof(mDeferAccept));
+
+	if (listen(mFd, backlog) < 0)
+		throw std::runtime_error("Failed to listen on " + mAddress);
+}
+
+/**
+ * @brief Create and bind a unix domain socket
+ *
+ * When a socket file already exists with the same path, it is removed if no
+ * process listen on it anymore (stale socket of a previous instance).
+ *
+ * @param backlog Max length of the queue of pending connections
+ */
+void Listener::openUnix(int backlog)
+{
+	struct sockaddr_un addr;
+	std::string path = mAddress.substr(5);
+	bool abstract = (path.length() && (path[0] == '@'));
+
+	if (path.empty() || (path.length() >= sizeof(addr.sun_path)))
+		throw std::runtime_error("Invalid unix socket path " + mAddress);
+
+	memset((char *)&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path.data(), path.length());
+	socklen_t addrLen = offsetof(struct sockaddr_un, sun_path) + path.length();
+	// Abstract sockets start with a NULL byte (no file on disk)
+	if (abstract)
+		addr.sun_path[0] = 0;
+	else
+		addrLen += 1;
+
+	mFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (mFd < 0)
+		throw std::runtime_error("Failed to create socket");
+
+	// Search a socket file left by a previous instance
+	struct stat st;
+	if ( ! abstract && (lstat(path.c_str(), &st) == 0))
+	{
+		if ( ! S_ISSOCK(st.st_mode))
+			throw std::runtime_error("File exists and is not a socket " + path);
+		// If nobody accept connections, the socket is stale
+		if (connect(mFd, (struct sockaddr *)&addr, addrLen) == 0)
+			throw std::runtime_error("Socket already in use " + path);
+		if (errno != ECONNREFUSED)
+			throw std::runtime_error("Failed to test socket " + path);
+		Log::info() << "Server: Remove stale socket " << path << Log::endl;
+		unlink(path.c_str());
+		// A socket can not be reused after a failed connect
+		::close(mFd);
+		mFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (mFd < 0)
+			throw std::runtime_error("Failed to create socket");
+	}
+
+	if (bind(mFd, (struct sockaddr *)&addr, addrLen) < 0)
+		throw std::runtime_error("Failed to bind socket " + mAddress);
+	// From now, the socket file must be removed on close
+	mUnlink = ( ! abstract);
+
+	if ( ! abstract)
+	{
+		// Set the group of the socket file
+		if ( ! mGroup.empty())
+		{
+			struct group *grp = getgrnam(mGroup.c_str());
+			if ((grp == 0) || (chown(path.c_str(), -1, grp->gr_gid) < 0))
+				throw std::runtime_error("Failed to set socket group " + mGroup);
+		}
+		// Set the access permissions of the socket file
+		if ((mMode >= 0) && (chmod(path.c_str(), mMode) < 0))
+			throw std::runtime_error("Failed to set socket mode " + path);
+	}
+
+	if (listen(mFd, backlog) < 0)
+		throw std::runtime_error("Failed to listen on " + mAddress);
+}
+
+/**
+ * @brief Forget the socket file of this listener
+ *
+ * Used by child processes that inherit the socket : the file is owned by the
+ * parent, so it is not removed when the child close the listener.
+ */
+void Listener::release(void)
+{
+	mUnlink = false;
+}
+
+/**
+ * @brief Set the TCP_DEFER_ACCEPT delay (TCP sockets only)
+ *
+ * @param seconds Max time to wait for datas, or 0 to disable
+ */
+void Listener::setDeferAccept(int seconds)
+{
+	mDeferAccept = seconds;
+}
+
+/**
+ * @brief Set the group that own the socket file (unix sockets only)
+ *
+ * @param group Name of the group
+ */
+void Listener::setGroup(const std::string &group)
+{
+	mGroup = group;
+}
+
+/**
+ * @brief Set the access permissions of the socket file (unix sockets only)
+ *
+ * @param mode Permissions (like chmod) or -1 to keep default
+ */
+void Listener::setMode(int mode)
+{
+	mMode = mode;
+}
+
+/**
+ * @brief Enable TCP_NODELAY on accepted connections (TCP sockets only)
+ *
+ * @param enable True to disable the Nagle algorithm
+ */
+void Listener::setNoDelay(bool enable)
+{
+	mNoDelay = enable;
+}
+
+/**
+ * @brief Open a balanced socket (SO_REUSEPORT) for TCP addresses
+ *
+ * @param enable True to allow many sockets to listen on the same address
+ */
+void Listener::setReusePort(bool enable)
+{
+	mReusePort = enable;
+}
+
+/**
+ * @brief Use the socket of another listener (already open)
+ *
+ * The descriptor is duplicated, so both listeners accept connections from the
+ * same queue. The socket file is only removed by the original listener.
+ *
+ * @param src Pointer to the listener to share
+ */
+void Listener::share(const Listener *src)
+{
+	if ((mFd >= 0) || (src == 0) || (src->getFd() < 0))
+		return;
+
+	mFd = fcntl(src->getFd(), F_DUPFD_CLOEXEC, 0);
+	if (mFd < 0)
+		throw std::runtime_error("Failed to share socket " + mAddress);
+	mUnlink = false;
+}
+
+} // namespace hermod
+/* EOF */
@@ -0,0 +1,73 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef LISTENER_HPP
+#define LISTENER_HPP
+
+#include <string>
+
+namespace hermod {
+
+/**
+ * @class Listener
+ * @brief Listening socket used by servers to accept incoming connections
+ *
+ * The address of a listener is a string that can take these forms :
+ * - "9000" or "*:9000" : TCP port on all interfaces
+ * - "127.0.0.1:9000"   : TCP port on one (IPv4) interface
+ * - "unix:/run/hermod.sock" : Unix domain socket with a path
+ * - "unix:@hermod"     : Unix domain socket into the abstract namespace
+ *
+ * Listening sockets are non-blocking, so a server can accept connections
+ * until EAGAIN without waiting. When many event loops listen on the same TCP
+ * address, each of them opens his own socket with SO_REUSEPORT and the kernel
+ * balances connections. Unix sockets can not be balanced this way : they are
+ * opened once, then shared (see share). A socket can also be inherited from a
+ * previous instance of hermod, during an upgrade (see adopt).
+ */
+class Listener
+{
+public:
+	explicit Listener(const std::string &address);
+	~Listener();
+	void adopt  (int fd);
+	void close  (void);
+	void configure(int fd);
+	std::string getAddress(void) const;
+	int  getFd  (void) const;
+	bool isUnix (void) const;
+	void open   (int backlog);
+	void release(void);
+	void setDeferAccept(int seconds);
+	void setGroup(const std::string &group);
+	void setMode (int mode);
+	void setNoDelay(bool enable);
+	void setReusePort(bool enable);
+	void share  (const Listener *src);
+protected:
+	void openInet(int backlog);
+	void openUnix(int backlog);
+private:
+	std::string mAddress;
+	std::string mGroup;
+	int  mFd;
+	int  mMode;
+	int  mDeferAccept;
+	bool mNoDelay;
+	bool mReusePort;
+	bool mUnlink;
+};
+
+} // namespace hermod
+#endif
@@ -23,6 +23,12 @@
 
 namespace hermod {
 
+// Index of each level into the set of streams of a thread
+#define LOG_DEBUG   0
+#define LOG_INFO    1
+#define LOG_WARNING 2
+#define LOG_ERROR   3
+
 Log *       Log::mInstance = NULL;
 LogCtrl     Log::endl(0);
 
@@ -33,18 +39,10 @@ LogCtrl     Log::endl(0);
 Log::Log()
 {
 	mBuffer.clear();
-	// Initialize 'error' stream
-	mError.setLevel(99);
-	mError.setBuffer( &mBuffer );
-	// Initialize 'warning' stream
-	mWarning.setLevel(30);
-	mWarning.setBuffer( &mBuffer );
-	// Initialize 'info' stream
-	mInfo.setLevel(20);
-	mInfo.setBuffer( &mBuffer );
-	// Initialize 'debug' stream
-	mDebug.setLevel(10);
-	mDebug.setBuffer( &mBuffer );
+	pthread_mutex_init(&mLock, NULL);
+	pthread_mutex_init(&mSyncLock, NULL);
+	// Streams are allocated for each thread on first use
+	pthread_key_create(&mStreams, freeStreams);
 }
 
 /**
@@ -53,6 +51,12 @@ Log::Log()
  */
 Log::~Log()
 {
+	// Streams of other threads are released when they exit
+	freeStreams(pthread_getspecific(mStreams));
+	pthread_setspecific(mStreams, NULL);
+	pthread_key_delete(mStreams);
+	pthread_mutex_destroy(&mSyncLock);
+	pthread_mutex_destroy(&mLock);
 }
 
 /**
@@ -100,7 +104,7 @@ LogStream &Log::debug(void)
 	// Get the Log singleton object
 	Log *l = getInstance();
 	// Return the debug LogStream
-	return l->mDebug;
+	return l->getStreams()[LOG_DEBUG];
 }
 
 /**
@@ -117,7 +121,7 @@ LogStream &Log::error(void)
 	// Get the Log singleton object
 	Log *l = getInstance();
 	// Return the error LogStream
-	return l->mError;
+	return l->getStreams()[LOG_ERROR];
 }
 
 /**
@@ -134,7 +138,7 @@ LogStream &Log::info(void)
 	// Get the Log singleton object
 	Log *l = getInstance();
 	// Return the info Logstream
-	return l->mInfo;
+	return l->getStreams()[LOG_INFO];
 }
 
 /**
@@ -151,15 +155,50 @@ LogStream &Log::warning(void)
 	// Get the Log singleton object
 	Log *l = getInstance();
 	// Return the warning LogStream
-	return l->mWarning;
+	return l->getStreams()[LOG_WARNING];
+}
+
+/**
+ * @brief Free the streams of a thread (called when the thread exit)
+ *
+ * @param streams Pointer to the set of streams
+ */
+void Log::freeStreams(void *streams)
+{
+	if (streams)
+		delete[] (LogStream *)streams;
+}
+
+/**
+ * @brief Get the set of streams of the current thread
+ *
+ * @return LogStream* Pointer to an array of streams (one for each level)
+ */
+LogStream *Log::getStreams(void)
+{
+	LogStream *streams = (LogStream *)pthread_getspecific(mStreams);
+	if (streams)
+		return streams;
+
+	streams = new LogStream[4];
+	streams[LOG_DEBUG  ].setLevel(10);
+	streams[LOG_INFO   ].setLevel(20);
+	streams[LOG_WARNING].setLevel(30);
+	streams[LOG_ERROR  ].setLevel(99);
+	for (int i = 0; i < 4; i++)
+		streams[i].setBuffer(&mBuffer, &mLock);
+	pthread_setspecific(mStreams, streams);
+
+	return streams;
 }
 
 /**
  * @brief Set the file where logs must be written
  *
  * @param filename Name of the file to use
+ * @param append   True to keep the current content of the file
  */
-void Log::setFile(const std::string &filename)
+void Log::setFile(const std::string &filename, bool append)
 {
 	// Sanity check
 	if (filename.empty())
@@ -176,7 +215,13 @@ void Log::setFile(const std::string &filename)
 	l->mFilename = filename;
 
 	// Open the target file
-	l->mFile.open(l->mFilename.c_str(), std::ios::out | std::ios::trunc);
+	if ( ! append)
+	{
+		l->mFile.open(l->mFilename.c_str(), std::ios::out | std::ios::trunc);
+		l->mFile.close();
+	}
+	// Always write at the end of file (another process may use it)
+	l->mFile.open(l->mFilename.c_str(), std::ios::out | std::ios::app);
 	if ( ! l->mFile.is_open())
 	{
 		l->mFilename.clear();
@@ -190,16 +235,31 @@ void Log::setFile(const std::string &filename)
  * For better performances, log messages are not directly written. All streams
  * put datas into a global buffer into memory. This static method is used to
  * request a flush from memory to target output.
+ *
+ * Many event loops may call this method : when another thread is already
+ * writing, it returns immediately (new messages are written by next sync).
  */
 void Log::sync(void)
 {
 	Log *l = getInstance();
+	std::string buffer;
 
-	if (l->mFile.is_open())
-		l->writeToFile(l->mBuffer);
-	else
-		std::cout << l->mBuffer << std::flush;
-	l->mBuffer.clear();
+	if (pthread_mutex_trylock(&l->mSyncLock) != 0)
+		return;
+
+	// Take the content of the buffer, threads can continue to log
+	pthread_mutex_lock(&l->mLock);
+	buffer.swap(l->mBuffer);
+	pthread_mutex_unlock(&l->mLock);
+
+	if ( ! buffer.empty())
+	{
+		if (l->mFile.is_open())
+			l->writeToFile(buffer);
+		else
+			std::cout << buffer << std::flush;
+	}
+	pthread_mutex_unlock(&l->mSyncLock);
 }
 
 /**
@@ -225,6 +285,7 @@ void Log::writeToFile(const std::string &msg)
 LogStream::LogStream()
 {
 	mBuffer = 0;
+	mLock   = 0;
 	mLevel  = 0;
 }
 
@@ -236,6 +297,7 @@ LogStream::LogStream()
 LogStream::LogStream(int level)
 {
 	mBuffer = 0;
+	mLock   = 0;
 	mLevel  = level;
 }
 
@@ -263,10 +325,12 @@ int LogStream::getLevel(void) const
  * @brief Set the output buffer
  *
  * @param buffer Pointer to the output buffer to use
+ * @param lock   Pointer to the mutex that protect the buffer (optional)
  */
-void LogStream::setBuffer(std::string *buffer)
+void LogStream::setBuffer(std::string *buffer, pthread_mutex_t *lock)
 {
 	mBuffer = buffer;
+	mLock   = lock;
 }
 
 /**
@@ -372,7 +436,13 @@ LogStream& operator<<(LogStream &ls, LogCtrl &ctrl)
 	oss << ls.mLine << "\n";
 	
 	if (ls.mBuffer)
+	{
+		if (ls.mLock)
+			pthread_mutex_lock(ls.mLock);
 		ls.mBuffer->append( oss.str() );
+		if (ls.mLock)
+			pthread_mutex_unlock(ls.mLock);
+	}
 	ls.mLine.clear();
 	return ls;
 }
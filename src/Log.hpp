@@ -19,6 +19,7 @@
 #include <iostream>
 #include <sstream>
 #include <netinet/in.h>
+#include <pthread.h>
 #include "Session.hpp"
 #include "String.hpp"
 
@@ -47,7 +48,7 @@ public:
 	explicit LogStream(int level);
 	void append   (const std::string &msg);
 	int  getLevel (void) const;
-	void setBuffer(std::string *buffer);
+	void setBuffer(std::string *buffer, pthread_mutex_t *lock = 0);
 	void setLevel (int level);
 public:
 	friend LogStream& operator<<(LogStream &ls, const char msg[]);
@@ -62,12 +63,16 @@ private:
 	int mLevel;
 	std::string  mLine;
 	std::string *mBuffer;
+	pthread_mutex_t *mLock;
 };
 
 /**
  * @class Log
  * @brief A global logging system for Hermod
  *
+ * Each thread has his own set of streams, so messages can be written by
+ * different threads at the same time. Complete lines (see endl) are then
+ * inserted into the global buffer, written to output by sync().
  */
 class Log
 {
@@ -75,7 +80,7 @@ public:
 	~Log();
 	static void destroy();
 	static Log* getInstance();
-	static void setFile(const std::string &filename);
+	static void setFile(const std::string &filename, bool append = false);
 	static void sync(void);
 public:
 	static LogStream &error  (void);
@@ -83,9 +88,11 @@ public:
 	static LogStream &info   (void);
 	static LogStream &debug  (void);
 protected:
+	LogStream *getStreams(void);
 	void writeToFile(const std::string &msg);
 private:
 	Log();
+	static void freeStreams(void *streams);
 public:
 	static LogCtrl   endl;
 private:
@@ -94,10 +101,9 @@ private:
 	std::fstream mFile;
 	std::string  mFilename;
 	std::string  mBuffer;
-	LogStream    mDebug;
-	LogStream    mInfo;
-	LogStream    mWarning;
-	LogStream    mError;
+	pthread_mutex_t mLock;
+	pthread_mutex_t mSyncLock;
+	pthread_key_t   mStreams;
 };
 
 } // namespace hermod
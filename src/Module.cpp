@@ -113,9 +113,10 @@ void Module::setName(const String &name)
 /**
  * @brief Free a page previously allocated by newPage
  *
- * When a module register pages (see RouterTarget) this module must contains
- * two methods to allocate and free them. If the module does not expose any
- * page, this method may not be overloaded.
+ * When a module register pages (see RouterTarget) without a page type (see
+ * RouteTarget::setPage) this module must contains two methods to allocate and
+ * free them. If the module does not expose any page, or registers the type of
+ * its pages, this method may not be overloaded.
  *
  * @param page Pointer to the page to free
  */
@@ -140,8 +141,10 @@ void Module::freePage(Page *page)
  *
  * When a module contains Pages, they must ne registered them into router as
  * targets. After module loading, this method is called to inform the module
- * of available router(s). If the module does not expose page, this method may
- * not be overloaded.
+ * of available router(s). The type of each page should be registered here
+ * (see RouteTarget::setPage) so the router allocates them from a pool without
+ * calling newPage. If the module does not expose page, this method may not be
+ * overloaded.
  *
  * @param router Pointer to an active Router
  */
@@ -153,6 +156,8 @@ void Module::initRouter(Router *router)
 /**
  * @brief Allocate a new Page
  *
+ * Only used for the targets registered without a page type.
+ *
  * @param  name  Name of the page model to allocate
  * @return Page* Pointer to the newly allocated Page
  */
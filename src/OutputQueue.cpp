@@ -0,0 +1,224 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include "OutputQueue.hpp"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+namespace hermod {
+
+/**
+ * @brief Default constructor
+ *
+ */
+OutputQueue::OutputQueue()
+{
+	mLength = 0;
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+OutputQueue::~OutputQueue()
+{
+	clear();
+}
+
+/**
+ * @brief Copy datas at the end of the queue
+ *
+ * @param data Pointer to the datas to copy
+ * @param len  Length of the datas
+ */
+void OutputQueue::append(const char *data, size_t len)
+{
+	struct iovec iov;
+
+	if ((data == 0) || (len == 0))
+		return;
+
+	// Save a copy of the datas (elements of a deque are never moved)
+	mStore.push_back(std::string(data, len));
+
+	iov.iov_base = (void *)mStore.back().data();
+	iov.iov_len  = len;
+	mIov.push_back(iov);
+	mLength += len;
+}
+
+/**
+ * @brief Insert a reference to datas at the end of the queue (no copy)
+ *
+ * The referenced datas must stay valid until the queue has been flushed.
+ *
+ * @param data Pointer to the datas
+ * @param len  Length of the datas
+ */
+void OutputQueue::appendRef(const char *data, size_t len)
+{
+	struct iovec iov;
+
+	if ((data == 0) || (len == 0))
+		return;
+
+	// No local copy for this segment
+	mStore.push_back(std::string());
+
+	iov.iov_base = (void *)data;
+	iov.iov_len  = len;
+	mIov.push_back(iov);
+	mLength += len;
+}
+
+/**
+ * @brief Remove all the datas of the queue (without sending them)
+ *
+ */
+void OutputQueue::clear(void)
+{
+	mIov.clear();
+	mStore.clear();
+	mLength = 0;
+}
+
+/**
+ * @brief Copy referenced datas into buffers owned by the queue
+ *
+ * After this call, the queue does not reference external datas anymore.
+ * Segments that are already a copy are not modified.
+ */
+void OutputQueue::detach(void)
+{
+	for (size_t i = 0; i < mIov.size(); i++)
+	{
+		struct iovec &iov = mIov[i];
+		// This segment is already a local copy
+		if (mStore[i].length())
+			continue;
+		mStore[i].assign((char *)iov.iov_base, iov.iov_len);
+		iov.iov_base = (void *)mStore[i].data();
+	}
+}
+
+/**
+ * @brief Move the whole content of the queue into one contiguous buffer
+ *
+ * This is used when datas are not written by the caller but given to an
+ * asynchronous operation : the buffer must stay valid until the end of the
+ * operation, and referenced datas may be released before. The queue is empty
+ * after this call.
+ *
+ * @param buffer Reference to the string where datas are copied
+ */
+void OutputQueue::extract(std::string &buffer)
+{
+	buffer.clear();
+	buffer.reserve(mLength);
+
+	std::deque<struct iovec>::iterator it;
+	for (it = mIov.begin(); it != mIov.end(); ++it)
+		buffer.append((const char *)it->iov_base, it->iov_len);
+
+	clear();
+}
+
+/**
+ * @brief Write the content of the queue to a descriptor
+ *
+ * Sockets are written without SIGPIPE : a client that has closed his
+ * connection is reported as a write error, and must not stop the server.
+ *
+ * @param  fd Descriptor where datas must be written
+ * @return boolean True if the queue is empty after flush
+ */
+bool OutputQueue::flush(int fd)
+{
+	struct iovec iov[IOV_MAX];
+
+	while (mIov.size())
+	{
+		int count = 0;
+		// Prepare a list of buffers
+		std::deque<struct iovec>::iterator it;
+		for (it = mIov.begin(); (it != mIov.end()) && (count < IOV_MAX); ++it)
+			iov[count++] = *it;
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov    = iov;
+		msg.msg_iovlen = count;
+		ssize_t len = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		// Not a socket, use a simple write
+		if ((len < 0) && (errno == ENOTSOCK))
+			len = writev(fd, iov, count);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return false;
+			throw std::runtime_error("OutputQueue: write error");
+		}
+		mLength -= len;
+
+		// Remove sent buffers from the queue
+		while (len > 0)
+		{
+			struct iovec &first = mIov.front();
+			if ((size_t)len < first.iov_len)
+			{
+				// Partially sent buffer, update it
+				first.iov_base = (char *)first.iov_base + len;
+				first.iov_len -= len;
+				break;
+			}
+			len -= first.iov_len;
+			mIov.pop_front();
+			mStore.pop_front();
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Test if the queue contains datas to send
+ *
+ * @return boolean True if the queue is empty
+ */
+bool OutputQueue::isEmpty(void) const
+{
+	return (mIov.size() == 0);
+}
+
+/**
+ * @brief Get the number of bytes waiting into the queue
+ *
+ * @return size_t Number of bytes
+ */
+size_t OutputQueue::length(void) const
+{
+	return mLength;
+}
+
+} // namespace hermod
+/* EOF */
@@ -0,0 +1,59 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef OUTPUTQUEUE_HPP
+#define OUTPUTQUEUE_HPP
+
+#include <deque>
+#include <string>
+#include <sys/uio.h>
+
+namespace hermod {
+
+/**
+ * @class OutputQueue
+ * @brief Buffer used to collect datas before writing them to a socket
+ *
+ * Servers produce responses by small pieces (protocol headers, HTTP headers,
+ * content ...). Instead of writing each of them with a dedicated system call,
+ * they are queued and written all together with writev() when flush() is
+ * called. Datas can be copied into the queue, or only referenced when the
+ * caller can guarantee that they stay valid until the next flush.
+ *
+ * On a non-blocking socket, flush() may not be able to write everything. In
+ * this case detach() must be called before referenced datas are released : it
+ * copies the remaining referenced datas into the queue.
+ */
+class OutputQueue
+{
+public:
+	OutputQueue();
+	~OutputQueue();
+	void   append   (const char *data, size_t len);
+	void   appendRef(const char *data, size_t len);
+	void   clear    (void);
+	void   detach   (void);
+	void   extract  (std::string &buffer);
+	bool   flush    (int fd);
+	bool   isEmpty  (void) const;
+	size_t length   (void) const;
+private:
+	// For each segment, the local copy of datas (empty for references)
+	std::deque<struct iovec> mIov;
+	std::deque<std::string>  mStore;
+	size_t mLength;
+};
+
+} // namespace hermod
+#endif
@@ -14,7 +14,6 @@
  */
 #include <stdexcept>
 #include <string>
-#include "Config.hpp"
 #include "Log.hpp"
 #include "Page.hpp"
 #include "Request.hpp"
@@ -23,6 +22,9 @@
 
 namespace hermod {
 
+// Settings used by pages allocated outside of a Route
+static const RoutePolicy pageDefaultPolicy;
+
 /**
  * @brief Default constructor
  *
@@ -33,6 +35,7 @@ Page::Page(void)
 	mResponse = NULL;
 	mSession  = NULL;
 	mUseSession = false;
+	mPolicy   = &pageDefaultPolicy;
 }
 
 /**
@@ -41,7 +44,8 @@ Page::Page(void)
  */
 Page::~Page(void)
 {
-	// Nothing to do but needed for derivated classes
+	// Pages deleted by their module may still use a session
+	releaseSession();
 }
 
 /**
@@ -145,23 +149,17 @@ void Page::initSession(int mode)
 	if (mSession)
 		return;
 	
-	Config       *cfg  = Config::getInstance();
 	SessionCache *sc   = SessionCache::getInstance();
 	Session      *sess = NULL;
-	std::string   sessId;
-	std::string   cookieName;
 	
 	if (mode == 0)
 	{
-		String cfgSessionMode( cfg->get("global", "session_mode") );
-		if (cfgSessionMode == "cookie")
-			mode = 1;
-		else if (cfgSessionMode == "token")
-			mode = 2;
-		else
+		// Use the session mode of the route
+		mode = mPolicy->getSessionMode();
+		if (mode == RoutePolicy::SessionNone)
 		{
-			Log::info() << "Page: Could not load session, unknown mode ";
-			Log::info() << cfgSessionMode << Log::endl;
+			Log::info() << "Page: Could not load session, disabled for this route"
+			            << Log::endl;
 			return;
 		}
 		Log::debug() << "Page::initSession config mode " << mode << Log::endl;
@@ -172,13 +170,13 @@ void Page::initSession(int mode)
 	if ( ! mSession)
 	{
 		try {
-			sess = sc->create();
+			sess = sc->create(mPolicy->getSessionTtl());
 			if (sess == NULL)
 				throw runtime_error("Failed to create a new session");
 			Log::debug() << "Page::initSession create session " << sess->getId() << Log::endl;
 			if (mode == 1)
 			{
-				String cookie( cookieName );
+				String cookie( mPolicy->getSessionCookie() );
 				cookie += "=" + sess->getId();
 				mResponse->header()->addHeader("Set-Cookie", cookie);
 				Log::debug() << "Page: create session " << sess->getId() << Log::endl;
@@ -195,7 +193,6 @@ void Page::initSession(int mode)
  */
 void Page::loadSession(int mode)
 {
-	Config       *cfg  = Config::getInstance();
 	SessionCache *sc   = SessionCache::getInstance();
 	Session      *sess = NULL;
 
@@ -203,11 +200,8 @@ void Page::loadSession(int mode)
 	{
 		// Find Session ID using cookie
 		try {
-			// Try to get the cookie name from config
-			String cookieName( cfg->get("global", "session_cookie") );
-			// If this parameter is absent
-			if (cookieName.isEmpty())
-				cookieName = "HERMOD_SESSION";
+			// Get the cookie name from the settings of the route
+			const String &cookieName = mPolicy->getSessionCookie();
 			String sessId = mRequest->getCookieByName(cookieName, false);
 			sess = sc->getById(sessId.toStdStr());
 			if (sess == 0)
@@ -242,6 +236,45 @@ void Page::loadSession(int mode)
 	}
 }
 
+/**
+ * @brief Reset the page before it returns into the pool of his target
+ *
+ * Pages allocated by a PagePool are reused for many requests. This method is
+ * called at the end of a request to forget it. Pages that keep some state
+ * of the request must overload it (and call this one).
+ */
+void Page::reset(void)
+{
+	releaseSession();
+	mRequest  = NULL;
+	mResponse = NULL;
+	mPolicy   = &pageDefaultPolicy;
+}
+
+/**
+ * @brief Release the session used by the page (if any)
+ *
+ * Sessions given by the SessionCache are referenced while the page uses
+ * them, so they are not removed by the cleaning of the cache.
+ */
+void Page::releaseSession(void)
+{
+	if (mSession == NULL)
+		return;
+	SessionCache::getInstance()->release(mSession);
+	mSession = NULL;
+}
+
+/**
+ * @brief Get the settings of the route used to process the request
+ *
+ * @return RoutePolicy* Pointer to the policy (never NULL)
+ */
+const RoutePolicy *Page::policy(void)
+{
+	return mPolicy;
+}
+
 /**
  * @brief Get access to the request
  *
@@ -290,6 +323,22 @@ Session *Page::session(void)
 	return mSession;
 }
 
+/**
+ * @brief Set the settings of the route used to process the request
+ *
+ * This method is called by the server with the policy of the Route, before
+ * the response is set (see setReponse).
+ *
+ * @param policy Pointer to the policy of the route
+ */
+void Page::setPolicy(const RoutePolicy *policy)
+{
+	if (policy)
+		mPolicy = policy;
+	else
+		mPolicy = &pageDefaultPolicy;
+}
+
 /**
  * @brief Set the request associated with this page
  *
@@ -303,11 +352,20 @@ void Page::setRequest(Request *obj)
 /**
  * @brief Set the response object that will contains the page result
  *
+ * The response settings of the route (content type, cache) are applied to
+ * this response, the page can modify them later.
+ *
  * @param obj Pointer to a response object
  */
 void Page::setReponse(Response *obj)
 {
 	mResponse = obj;
+	if (obj == 0)
+		return;
+	if ( ! mPolicy->getContentType().isEmpty())
+		obj->header()->setContentType(mPolicy->getContentType());
+	if ( ! mPolicy->getCacheControl().isEmpty())
+		obj->header()->addHeader("Cache-Control", mPolicy->getCacheControl());
 }
 
 /**
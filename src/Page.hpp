@@ -25,6 +25,7 @@
 #include "ContentJson.hpp"
 #include "Request.hpp"
 #include "Response.hpp"
+#include "RoutePolicy.hpp"
 #include "Session.hpp"
 #include "String.hpp"
 
@@ -45,6 +46,7 @@ public:
 	virtual ~Page();
 	void   setRequest(Request   *obj);
 	void   setReponse(Response  *obj);
+	void   setPolicy (const RoutePolicy *policy);
 	void   initSession(int mode = 0);
 	void   loadSession(int mode = 0);
 	
@@ -58,15 +60,20 @@ public:
 	virtual String getArg(int n);
 	virtual int getArgCount(void);
 	virtual int process() = 0;
+	virtual void reset(void);
 protected:
+	const RoutePolicy *policy(void);
 	Session  *session (void);
 	Request  *request (void);
 	Response *response(void);
+private:
+	void      releaseSession(void);
 private:
 	Request  *mRequest;
 	Response *mResponse;
 	Session  *mSession;
 	bool      mUseSession;
+	const RoutePolicy *mPolicy;
 };
 
 } // namespace hermod
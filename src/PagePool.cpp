@@ -0,0 +1,142 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include "Page.hpp"
+#include "PagePool.hpp"
+
+namespace hermod {
+
+// Slot of the current thread into the pools (-1 until first use)
+static __thread int poolThreadSlot = -1;
+// Number of slots already given to threads
+static int poolSlotCount = 0;
+
+/**
+ * @brief Constructor of the pool
+ *
+ * @param factory Pointer to the factory used to allocate new pages
+ */
+PagePool::PagePool(PageFactory *factory)
+{
+	mFactory = factory;
+	pthread_mutex_init(&mSharedLock, NULL);
+}
+
+/**
+ * @brief Destructor, delete all the free pages and the factory
+ *
+ * The pool is deleted with its RouteTarget, when the Router is not used
+ * anymore, so all the pages have been returned at this time.
+ */
+PagePool::~PagePool()
+{
+	for (int i = 0; i < POOL_SLOTS; i++)
+	{
+		std::vector<Page *> &pages = mSlots[i].pages;
+		for (size_t j = 0; j < pages.size(); j++)
+			delete pages[j];
+	}
+	for (size_t j = 0; j < mShared.size(); j++)
+		delete mShared[j];
+	pthread_mutex_destroy(&mSharedLock);
+	delete mFactory;
+}
+
+/**
+ * @brief Get a page from the pool, or allocate a new one if the pool is empty
+ *
+ * @return Page* Pointer to the page (NULL if allocation failed)
+ */
+Page *PagePool::get(void)
+{
+	Page *page = NULL;
+	int slot = threadSlot();
+
+	if (slot < POOL_SLOTS)
+	{
+		std::vector<Page *> &pages = mSlots[slot].pages;
+		if ( ! pages.empty())
+		{
+			page = pages.back();
+			pages.pop_back();
+			return page;
+		}
+	}
+	else
+	{
+		pthread_mutex_lock(&mSharedLock);
+		if ( ! mShared.empty())
+		{
+			page = mShared.back();
+			mShared.pop_back();
+		}
+		pthread_mutex_unlock(&mSharedLock);
+		if (page)
+			return page;
+	}
+	return mFactory->create();
+}
+
+/**
+ * @brief Return a page to the pool (see get)
+ *
+ * The page is reset and kept for a next request. When the list of the
+ * thread is already full, the page is deleted.
+ *
+ * @param page Pointer to the page to release
+ */
+void PagePool::put(Page *page)
+{
+	int slot = threadSlot();
+
+	page->reset();
+
+	if (slot < POOL_SLOTS)
+	{
+		std::vector<Page *> &pages = mSlots[slot].pages;
+		if (pages.size() < POOL_MAX)
+		{
+			pages.push_back(page);
+			return;
+		}
+	}
+	else
+	{
+		pthread_mutex_lock(&mSharedLock);
+		if (mShared.size() < POOL_MAX)
+		{
+			mShared.push_back(page);
+			page = NULL;
+		}
+		pthread_mutex_unlock(&mSharedLock);
+		if (page == NULL)
+			return;
+	}
+	delete page;
+}
+
+/**
+ * @brief Get the slot of the current thread
+ *
+ * @return integer Index of the slot (POOL_SLOTS or more for shared list)
+ */
+int PagePool::threadSlot(void)
+{
+	if (poolThreadSlot < 0)
+		poolThreadSlot = __atomic_fetch_add(&poolSlotCount, 1, __ATOMIC_RELAXED);
+	return poolThreadSlot;
+}
+
+} // namespace hermod
+/* EOF */
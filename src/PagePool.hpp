@@ -0,0 +1,83 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef PAGEPOOL_HPP
+#define PAGEPOOL_HPP
+
+#include <vector>
+#include <pthread.h>
+
+namespace hermod {
+
+class Page;
+
+/**
+ * @class PageFactory
+ * @brief Interface used by a RouteTarget to allocate the pages of a module
+ *
+ */
+class PageFactory
+{
+public:
+	virtual ~PageFactory() {}
+	virtual Page *create(void) = 0;
+};
+
+/**
+ * @class PageFactoryType
+ * @brief Factory of one type of page (see RouteTarget::setPage)
+ *
+ */
+template <class T>
+class PageFactoryType : public PageFactory
+{
+public:
+	Page *create(void) { return new T(); }
+};
+
+/**
+ * @class PagePool
+ * @brief Pool of pages allocated for one RouteTarget
+ *
+ * When a page has been processed, it is not deleted but reset (see
+ * Page::reset) and kept into the pool for the next request. Each thread
+ * that processes pages (reactor or worker) gets a slot with its own list of
+ * free pages, so get and put do not need any lock. Threads created after
+ * the first POOL_SLOTS use a shared list protected by a mutex.
+ */
+class PagePool
+{
+public:
+	explicit PagePool(PageFactory *factory);
+	~PagePool();
+	Page *get(void);
+	void  put(Page *page);
+private:
+	static int threadSlot(void);
+private:
+	static const int POOL_SLOTS = 32;
+	static const unsigned int POOL_MAX = 16;
+	struct Slot
+	{
+		std::vector<Page *> pages;
+	} __attribute__((aligned(64)));
+private:
+	PageFactory *mFactory;
+	Slot mSlots[POOL_SLOTS];
+	std::vector<Page *> mShared;
+	pthread_mutex_t     mSharedLock;
+};
+
+} // namespace hermod
+#endif
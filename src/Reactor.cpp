@@ -0,0 +1,208 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#include "Log.hpp"
+#include "Reactor.hpp"
+
+namespace hermod {
+
+#define REACTOR_MAX_EVENTS 64
+
+/**
+ * @brief Default constructor
+ *
+ */
+Reactor::Reactor()
+{
+	mHandlers.clear();
+	mEvents.resize(REACTOR_MAX_EVENTS);
+
+	mFd = epoll_create1(EPOLL_CLOEXEC);
+	if (mFd < 0)
+		throw std::runtime_error("Reactor: Failed to create epoll instance");
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+Reactor::~Reactor()
+{
+	if (mFd >= 0)
+	{
+		close(mFd);
+		mFd = -1;
+	}
+}
+
+/**
+ * @brief Register a descriptor and the handler to call on events
+ *
+ * @param fd      Descriptor to watch (for incoming datas)
+ * @param handler Pointer to the object that will process events
+ * @param edge    True to use edge-triggered notifications
+ */
+void Reactor::add(int fd, ReactorHandler *handler, bool edge)
+{
+	struct epoll_event ev;
+
+	if ((fd < 0) || (handler == 0))
+		return;
+
+	ev.events  = EPOLLIN | EPOLLRDHUP;
+	if (edge)
+		ev.events |= EPOLLET;
+	ev.data.fd = fd;
+
+	if (epoll_ctl(mFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		throw std::runtime_error("Reactor: Failed to register descriptor");
+
+	// The handlers table is indexed by descriptor number
+	if ((unsigned int)fd >= mHandlers.size())
+	{
+		mHandlers.resize(fd + 1, 0);
+		mMasks.resize(fd + 1, 0);
+	}
+	mHandlers[fd] = handler;
+	mMasks[fd]    = ev.events;
+}
+
+/**
+ * @brief Stop watching a descriptor
+ *
+ * This method should be called before closing the descriptor. If the
+ * descriptor has already been closed, the kernel has already removed it from
+ * the epoll set and only the local handler entry is cleared.
+ *
+ * @param fd Descriptor to remove
+ */
+void Reactor::remove(int fd)
+{
+	if ((fd < 0) || ((unsigned int)fd >= mHandlers.size()))
+		return;
+
+	if (mHandlers[fd] == 0)
+		return;
+
+	// Errors are ignored (descriptor may already be closed)
+	epoll_ctl(mFd, EPOLL_CTL_DEL, fd, NULL);
+
+	mHandlers[fd] = 0;
+}
+
+/**
+ * @brief Create a new epoll instance with the same descriptors
+ *
+ * After a fork, parent and child share the same epoll instance : an event
+ * would be received by both processes, and descriptors added by one of them
+ * would be watched by the other. This method must be called by the child to
+ * get his own instance. All the registered descriptors are added again.
+ */
+void Reactor::reopen(void)
+{
+	int fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("Reactor: Failed to create epoll instance");
+	if (mFd >= 0)
+		close(mFd);
+	mFd = fd;
+
+	for (unsigned int i = 0; i < mHandlers.size(); i++)
+	{
+		struct epoll_event ev;
+
+		if (mHandlers[i] == 0)
+			continue;
+		ev.events  = mMasks[i];
+		ev.data.fd = i;
+		if (epoll_ctl(mFd, EPOLL_CTL_ADD, i, &ev) < 0)
+			throw std::runtime_error("Reactor: Failed to register descriptor");
+	}
+}
+
+/**
+ * @brief Wait for events and dispatch them to registered handlers
+ *
+ * @param timeout Max time to wait in milliseconds (-1 for infinite)
+ * @return integer Number of processed events (or -1 if interrupted)
+ */
+int Reactor::wait(int timeout)
+{
+	int count;
+
+	count = epoll_wait(mFd, &mEvents[0], mEvents.size(), timeout);
+	if (count < 0)
+	{
+		// A signal has been received, let the caller test his state
+		if (errno == EINTR)
+			return -1;
+		throw std::runtime_error("Reactor: epoll_wait failed");
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		int fd = mEvents[i].data.fd;
+
+		// The descriptor may have been removed by a previous handler
+		if ((unsigned int)fd >= mHandlers.size())
+			continue;
+		ReactorHandler *handler = mHandlers[fd];
+		if (handler == 0)
+			continue;
+
+		handler->processFd(fd);
+	}
+
+	return count;
+}
+
+/**
+ * @brief Enable or disable notifications when a descriptor becomes writable
+ *
+ * This is used by handlers that have pending output datas : they are called
+ * again when some space is available into the socket send buffer.
+ *
+ * @param fd     Descriptor to modify (must be registered)
+ * @param enable True to receive output events, false to stop them
+ */
+void Reactor::watchOutput(int fd, bool enable)
+{
+	struct epoll_event ev;
+
+	if ((fd < 0) || ((unsigned int)fd >= mHandlers.size()))
+		return;
+	if (mHandlers[fd] == 0)
+		return;
+
+	ev.events = mMasks[fd];
+	if (enable)
+		ev.events |=  EPOLLOUT;
+	else
+		ev.events &= ~EPOLLOUT;
+	// Nothing to do if the mask is not modified
+	if (ev.events == mMasks[fd])
+		return;
+	ev.data.fd = fd;
+
+	if (epoll_ctl(mFd, EPOLL_CTL_MOD, fd, &ev) < 0)
+		throw std::runtime_error("Reactor: Failed to modify descriptor");
+
+	mMasks[fd] = ev.events;
+}
+
+} // namespace hermod
+/* EOF */
@@ -0,0 +1,64 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <vector>
+#include <sys/epoll.h>
+
+namespace hermod {
+
+/**
+ * @class ReactorHandler
+ * @brief Interface of objects that can receive events from a Reactor
+ *
+ */
+class ReactorHandler
+{
+public:
+	virtual ~ReactorHandler() {}
+	virtual void processFd(int fd = -1) = 0;
+};
+
+/**
+ * @class Reactor
+ * @brief Event loop based on epoll, used to dispatch events on descriptors
+ *
+ * Each descriptor watched by the Reactor is registered with an handler. When
+ * an event is detected on a descriptor, the processFd() method of his handler
+ * is called. By default descriptors are registered in edge-triggered mode :
+ * the handler must consume all available datas (until EAGAIN) before returning
+ * or no more event will be received. Handlers are also called when a socket
+ * becomes writable, if output has been requested with watchOutput().
+ */
+class Reactor
+{
+public:
+	Reactor();
+	~Reactor();
+	void add   (int fd, ReactorHandler *handler, bool edge = true);
+	void remove(int fd);
+	void reopen(void);
+	int  wait  (int timeout = -1);
+	void watchOutput(int fd, bool enable);
+private:
+	int mFd;
+	std::vector<ReactorHandler *>   mHandlers;
+	std::vector<unsigned int>       mMasks;
+	std::vector<struct epoll_event> mEvents;
+};
+
+} // namespace hermod
+#endif
@@ -0,0 +1,393 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <stdexcept>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "ReactorThread.hpp"
+#include "ServerFastcgi.hpp"
+#include "ServerHttp.hpp"
+#include "ServerUring.hpp"
+#include "ServerUwsgi.hpp"
+
+namespace hermod {
+
+// Values written on the eventfd to control the thread (they can be combined)
+#define REACTOR_THREAD_STOP   1
+#define REACTOR_THREAD_DRAIN  2
+#define REACTOR_THREAD_ROUTER 4
+
+/**
+ * @brief Constructor
+ *
+ * @param index Index of this event loop (0 is the main thread of the App)
+ */
+ReactorThread::ReactorThread(unsigned int index)
+{
+	mIndex   = index;
+	mRunning = false;
+	mStarted = false;
+	mDraining = false;
+	mCpu     = -1;
+	mEventFd = -1;
+	mReactor = 0;
+	mRouter  = 0;
+	mServer  = 0;
+	mNextRouter = 0;
+	mRetired.clear();
+	pthread_mutex_init(&mNextLock, NULL);
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+ReactorThread::~ReactorThread()
+{
+	stop();
+
+	if (mServer)
+	{
+		delete mServer;
+		mServer = 0;
+	}
+	if (mRouter)
+	{
+		delete mRouter;
+		mRouter = 0;
+	}
+	if (mNextRouter)
+	{
+		delete mNextRouter;
+		mNextRouter = 0;
+	}
+	while (mRetired.size())
+	{
+		delete mRetired.back();
+		mRetired.pop_back();
+	}
+	pthread_mutex_destroy(&mNextLock);
+	if (mEventFd >= 0)
+	{
+		close(mEventFd);
+		mEventFd = -1;
+	}
+	if (mReactor)
+	{
+		delete mReactor;
+		mReactor = 0;
+	}
+}
+
+/**
+ * @brief Delete the old routers that are not used anymore
+ *
+ */
+void ReactorThread::cleanRouters(void)
+{
+	std::vector<Router *>::iterator it;
+	for (it = mRetired.begin(); it != mRetired.end(); )
+	{
+		if ((*it)->isUsed())
+		{
+			++it;
+			continue;
+		}
+		delete (*it);
+		it = mRetired.erase(it);
+	}
+}
+
+/**
+ * @brief Ask the thread to drain his server, then to exit
+ *
+ * The thread stops accepting connections and exits by itself when all the
+ * current connections are finished (see isDrained).
+ */
+void ReactorThread::drain(void)
+{
+	if ( ! mStarted)
+		return;
+
+	uint64_t value = REACTOR_THREAD_DRAIN;
+	if (write(mEventFd, &value, sizeof(value)) < 0)
+		Log::error() << "ReactorThread: Failed to drain thread" << Log::endl;
+}
+
+/**
+ * @brief Get the CPU associated with an event loop
+ *
+ * Event loops are associated with the CPUs allowed for the process, in turn.
+ *
+ * @param index Index of the event loop
+ * @return integer CPU number (or -1 if not available)
+ */
+int ReactorThread::getCpu(unsigned int index)
+{
+	cpu_set_t set;
+	int count;
+
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) < 0)
+		return -1;
+	count = CPU_COUNT(&set);
+	if (count == 0)
+		return -1;
+
+	index = index % count;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if ( ! CPU_ISSET(cpu, &set))
+			continue;
+		if (index == 0)
+			return cpu;
+		index--;
+	}
+	return -1;
+}
+
+/**
+ * @brief Get the server of this event loop
+ *
+ * @return Server* Pointer to the server
+ */
+Server *ReactorThread::getServer(void)
+{
+	return mServer;
+}
+
+/**
+ * @brief Test if the thread has finished after a drain
+ *
+ * @return boolean True if the thread is not running anymore
+ */
+bool ReactorThread::isDrained(void)
+{
+	if ( ! mStarted)
+		return true;
+	if (pthread_tryjoin_np(mThread, NULL) != 0)
+		return false;
+	mStarted = false;
+	return true;
+}
+
+/**
+ * @brief Handler called by the Reactor when the thread must stop (or drain)
+ *
+ * @param fd Descriptor where the event has been detected (eventfd)
+ */
+void ReactorThread::processFd(int fd)
+{
+	uint64_t value;
+	(void)fd;
+
+	if (read(mEventFd, &value, sizeof(value)) < 0)
+		return;
+	if (value & REACTOR_THREAD_ROUTER)
+	{
+		pthread_mutex_lock(&mNextLock);
+		Router *router = mNextRouter;
+		mNextRouter = 0;
+		pthread_mutex_unlock(&mNextLock);
+		if (router)
+		{
+			// Requests in progress keep the old router until their end
+			mServer->setRouter(router);
+			mRetired.push_back(mRouter);
+			mRouter = router;
+		}
+	}
+	if (value & REACTOR_THREAD_DRAIN)
+	{
+		mDraining = true;
+		mServer->drain();
+	}
+	if (value & REACTOR_THREAD_STOP)
+		mRunning = false;
+}
+
+/**
+ * @brief Pin a thread on one CPU
+ *
+ * @param thread Thread to pin
+ * @param cpu    CPU number
+ * @return boolean True if success
+ */
+bool ReactorThread::setAffinity(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return false;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return (pthread_setaffinity_np(thread, sizeof(set), &set) == 0);
+}
+
+/**
+ * @brief Give a new router to the thread (after a reload)
+ *
+ * The router is created by the calling thread, then the event loop uses it
+ * for the next requests.
+ *
+ * @param router Pointer to the new router (owned by the thread)
+ */
+void ReactorThread::setRouter(Router *router)
+{
+	if ( ! mStarted)
+	{
+		delete router;
+		return;
+	}
+
+	pthread_mutex_lock(&mNextLock);
+	// A router given but not used yet is replaced
+	if (mNextRouter)
+		delete mNextRouter;
+	mNextRouter = router;
+	pthread_mutex_unlock(&mNextLock);
+
+	uint64_t value = REACTOR_THREAD_ROUTER;
+	if (write(mEventFd, &value, sizeof(value)) < 0)
+		Log::error() << "ReactorThread: Failed to set router" << Log::endl;
+}
+
+/**
+ * @brief Create the objects of this event loop, and start the thread
+ *
+ * Objects are created by the calling thread, so configuration errors are
+ * reported immediately. Then the new thread only waits and process events.
+ *
+ * @param modules Pointer to the cache of loaded modules (used by Router)
+ * @param first   Pointer to the server of the main event loop
+ * @param cpu     CPU where the thread must run (or -1 for any)
+ */
+void ReactorThread::start(ModuleCache *modules, Server *first, int cpu)
+{
+	if (mStarted)
+		return;
+
+	mCpu = cpu;
+
+	mReactor = new Reactor;
+
+	// Descriptor used to stop the thread
+	mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mEventFd < 0)
+		throw std::runtime_error("ReactorThread: Failed to create eventfd");
+	mReactor->add(mEventFd, this, false);
+
+	// Each event loop has his own Router (no shared state)
+	mRouter = new Router;
+	mRouter->setModuleCache(modules);
+	mRouter->reload();
+
+	// Use the same protocol than the main event loop
+	Server *server;
+	if (dynamic_cast<ServerHttp *>(first))
+		server = new ServerHttp();
+	else if (dynamic_cast<ServerUring *>(first))
+		server = new ServerUring();
+	// uwsgi server is also an SCGI server, test it first
+	else if (dynamic_cast<ServerUwsgi *>(first))
+		server = new ServerUwsgi();
+	else if (dynamic_cast<ServerScgi *>(first))
+		server = new ServerScgi();
+	else
+		server = new ServerFastcgi();
+	mServer = server;
+	server->setRouter(mRouter);
+	server->setReactor(mReactor);
+	server->setReusePort(true, first);
+	server->start();
+	if (server->getFd() < 0)
+		throw std::runtime_error("ReactorThread: No listening socket");
+
+	mRunning = true;
+	if (pthread_create(&mThread, NULL, threadMain, this) != 0)
+	{
+		mRunning = false;
+		throw std::runtime_error("ReactorThread: Failed to start thread");
+	}
+	mStarted = true;
+
+	if ((mCpu >= 0) && ! setAffinity(mThread, mCpu))
+		Log::warning() << "ReactorThread: Failed to set affinity of thread "
+		               << (int)mIndex << " on CPU " << mCpu << Log::endl;
+}
+
+/**
+ * @brief Stop the thread (wait the end of event processing)
+ *
+ */
+void ReactorThread::stop(void)
+{
+	if ( ! mStarted)
+		return;
+
+	// Wake up the event loop
+	uint64_t value = REACTOR_THREAD_STOP;
+	if (write(mEventFd, &value, sizeof(value)) < 0)
+		Log::error() << "ReactorThread: Failed to stop thread" << Log::endl;
+	pthread_join(mThread, NULL);
+	mStarted = false;
+
+	if (mServer)
+		mServer->stop();
+}
+
+/**
+ * @brief Entry point of the thread
+ *
+ * @param arg Pointer to the ReactorThread object
+ */
+void *ReactorThread::threadMain(void *arg)
+{
+	ReactorThread *rt = (ReactorThread *)arg;
+	rt->loop();
+	return NULL;
+}
+
+/**
+ * @brief Main loop of the thread
+ *
+ */
+void ReactorThread::loop(void)
+{
+	try {
+		while (mRunning)
+		{
+			// Wait and dispatch events
+			mReactor->wait(-1);
+			// Flush Log
+			Log::sync();
+			// Delete the old routers (after a reload)
+			if (mRetired.size())
+				cleanRouters();
+			// After a drain, exit when all connections are finished
+			if (mDraining && mServer->isIdle())
+				break;
+		}
+	} catch (std::exception &e) {
+		Log::error() << "ReactorThread " << (int)mIndex << ": "
+		             << e.what() << Log::endl;
+	}
+}
+
+} // namespace hermod
+/* EOF */
@@ -0,0 +1,73 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef REACTORTHREAD_HPP
+#define REACTORTHREAD_HPP
+
+#include <vector>
+#include <pthread.h>
+#include "ModuleCache.hpp"
+#include "Reactor.hpp"
+#include "Router.hpp"
+#include "Server.hpp"
+
+namespace hermod {
+
+/**
+ * @class ReactorThread
+ * @brief Additional event loop, running into a dedicated thread
+ *
+ * Each ReactorThread has his own Reactor, Router and FastCGI server (with his
+ * own listening sockets and connections). Threads do not share any object of
+ * the request path : connections are balanced by the kernel (SO_REUSEPORT)
+ * and each of them is processed from accept to response by one thread.
+ */
+class ReactorThread : public ReactorHandler
+{
+public:
+	explicit ReactorThread(unsigned int index);
+	~ReactorThread();
+	void    drain    (void);
+	Server *getServer(void);
+	bool    isDrained(void);
+	void processFd(int fd = -1);
+	void setRouter(Router *router);
+	void start(ModuleCache *modules, Server *first, int cpu = -1);
+	void stop (void);
+public:
+	static int  getCpu(unsigned int index);
+	static bool setAffinity(pthread_t thread, int cpu);
+protected:
+	static void *threadMain(void *arg);
+	void cleanRouters(void);
+	void loop(void);
+private:
+	unsigned int mIndex;
+	bool         mRunning;
+	bool         mStarted;
+	bool         mDraining;
+	int          mCpu;
+	int          mEventFd;
+	pthread_t    mThread;
+	Reactor     *mReactor;
+	Router      *mRouter;
+	Server      *mServer;
+	// Router given by a reload (see setRouter), and old ones still used
+	Router      *mNextRouter;
+	pthread_mutex_t mNextLock;
+	std::vector<Router *> mRetired;
+};
+
+} // namespace hermod
+#endif
@@ -12,6 +12,7 @@
  *
  * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
  */
+#include <cstring>
 #include <stdexcept>
 #include "Request.hpp"
 #include "Log.hpp"
@@ -21,6 +22,73 @@ using namespace std;
 
 namespace hermod {
 
+/**
+ * @struct KnownParam
+ * @brief Name of a well-known parameter
+ *
+ */
+struct KnownParam
+{
+	const char  *name;
+	unsigned int len;
+};
+
+#define KNOWN_PARAM(name) { name, sizeof(name) - 1 }
+
+// Names of the well-known parameters (same order as Request::Param)
+static constexpr KnownParam knownParams[Request::paramCount] = {
+	KNOWN_PARAM("REQUEST_METHOD"), KNOWN_PARAM("SCRIPT_NAME"),
+	KNOWN_PARAM("QUERY_STRING"),   KNOWN_PARAM("CONTENT_TYPE"),
+	KNOWN_PARAM("CONTENT_LENGTH"), KNOWN_PARAM("HTTP_COOKIE"),
+	KNOWN_PARAM("HTTP_ACCEPT"),    KNOWN_PARAM("HTTP_ORIGIN"),
+	KNOWN_PARAM("HTTP_HOST"),      KNOWN_PARAM("HTTP_USER_AGENT"),
+	KNOWN_PARAM("REQUEST_URI"),    KNOWN_PARAM("PATH_INFO"),
+	KNOWN_PARAM("REMOTE_ADDR"),    KNOWN_PARAM("REMOTE_PORT"),
+	KNOWN_PARAM("SERVER_NAME"),    KNOWN_PARAM("SERVER_PROTOCOL")
+};
+
+/**
+ * @brief Hash of a parameter name (at least 2 characters)
+ *
+ * The coefficients are chosen so there is no collision between the names of
+ * well-known parameters (checked at compile time, see ParamTable).
+ */
+static constexpr unsigned int paramHash(const char *name, unsigned int len)
+{
+	return ((len * 3) + ((unsigned char)name[1] * 3) +
+	        ((unsigned char)name[len - 1] * 4)) & 31;
+}
+
+/**
+ * @struct ParamTable
+ * @brief Table of the well-known parameters indexed by hash of their name
+ *
+ */
+struct ParamTable
+{
+	signed char slot[32];
+
+	constexpr ParamTable() : slot()
+	{
+		for (int i = 0; i < 32; i++)
+			slot[i] = -1;
+		for (int i = 0; i < Request::paramCount; i++)
+			slot[paramHash(knownParams[i].name, knownParams[i].len)] = i;
+	}
+	constexpr bool isPerfect(void) const
+	{
+		for (int i = 0; i < Request::paramCount; i++)
+		{
+			if (slot[paramHash(knownParams[i].name, knownParams[i].len)] != i)
+				return false;
+		}
+		return true;
+	}
+};
+
+static constexpr ParamTable paramTable;
+static_assert(paramTable.isPerfect(), "Collision into hash of well-known parameters");
+
 /**
  * @brief Default constructor
  *
@@ -28,11 +96,20 @@ namespace hermod {
 Request::Request(Server *server)
 {
 	mBody   = 0;
+	mParamBuffer = 0;
 	mServer = server;
 	mMethod = Undef;
 	mType   = typeUndef;
 
+	mPath    = 0;
+	mPathLen = 0;
 	mUri.clear();
+
+	for (int i = 0; i < paramCount; i++)
+	{
+		mKnownValue[i] = 0;
+		mKnownLen[i]   = 0;
+	}
 }
 
 /**
@@ -46,6 +123,59 @@ Request::~Request()
 		delete mBody;
 		mBody = 0;
 	}
+	if (mParamBuffer)
+	{
+		delete mParamBuffer;
+		mParamBuffer = 0;
+	}
+}
+
+/**
+ * @brief Insert an HTTP header parameter without copy
+ *
+ * Name and value are not copied, they must point into the buffer given with
+ * setParamBuffer() (or stay valid until the Request is deleted). Well-known
+ * parameters are saved into their slot, others into the list of parameters.
+ *
+ * @param name     Pointer to the parameter name
+ * @param nameLen  Length of the name
+ * @param value    Pointer to the parameter value
+ * @param valueLen Length of the value
+ */
+void Request::addParam(const char *name,  unsigned int nameLen,
+                       const char *value, unsigned int valueLen)
+{
+	int known = findParam(name, nameLen);
+	if (known >= 0)
+	{
+		setKnownParam(known, value, valueLen);
+		return;
+	}
+
+	RequestParam param;
+
+	param.name     = name;
+	param.nameLen  = nameLen;
+	param.value    = value;
+	param.valueLen = valueLen;
+	mParams.push_back(param);
+}
+
+/**
+ * @brief Add an argument to the requested URI (after the route)
+ *
+ * The argument is a slice of the path, it is not copied.
+ *
+ * @param data Pointer to the argument
+ * @param len  Length of the argument
+ */
+void Request::addUriArg(const char *data, unsigned int len)
+{
+	RequestUri arg;
+
+	arg.data = data;
+	arg.len  = len;
+	mUri.push_back(arg);
 }
 
 /**
@@ -66,6 +196,26 @@ unsigned int Request::countUriArgs(void)
 	return count;
 }
 
+/**
+ * @brief Find the slot of a well-known parameter
+ *
+ * @param name Pointer to the name of the parameter
+ * @param len  Length of the name
+ * @return integer Index of the parameter (see Param), or -1 if not known
+ */
+int Request::findParam(const char *name, unsigned int len)
+{
+	if (len < 2)
+		return -1;
+
+	int slot = paramTable.slot[paramHash(name, len)];
+	if ((slot < 0) || (knownParams[slot].len != len) ||
+	    memcmp(knownParams[slot].name, name, len))
+		return -1;
+
+	return slot;
+}
+
 /**
  * @brief Get the value of a cookie
  *
@@ -206,17 +356,66 @@ Request::Method Request::getMethod(void)
  */
 String Request::getParam (const String &name)
 {
-	String value;
+	unsigned int len;
+	const char  *value = getParam(name.data(), name.length(), len);
 
-	std::map<String, String>::iterator it;
-	it = mHeaderParameters.find(name);
+	if (value == 0)
+		return String();
 
-	if (it != mHeaderParameters.end())
-		value = mHeaderParameters[name];
+	return String(value, len);
+}
 
-	return value;
+/**
+ * @brief Read the value of a well-known parameter, without copy
+ *
+ * @param param Index of the parameter
+ * @param len   Set to the length of the value
+ * @return char* Pointer to the value (not nul terminated), NULL if absent
+ */
+const char *Request::getParam(Param param, unsigned int &len)
+{
+	len = mKnownLen[param];
+	return mKnownValue[param];
 }
 
+/**
+ * @brief Read the value of an environment variable, without copy
+ *
+ * @param name    Pointer to the name of the variable
+ * @param nameLen Length of the name
+ * @param len     Set to the length of the value
+ * @return char* Pointer to the value (not nul terminated), NULL if absent
+ */
+const char *Request::getParam(const char *name, unsigned int nameLen,
+                              unsigned int &len)
+{
+	int known = findParam(name, nameLen);
+	if (known >= 0)
+		return getParam((Param)known, len);
+
+	// Search into parameters saved as slices (the last one wins)
+	for (size_t i = mParams.size(); i > 0; i--)
+	{
+		const RequestParam &p = mParams[i - 1];
+		if ((p.nameLen != nameLen) ||
+		    (p.nameLen && memcmp(p.name, name, p.nameLen)))
+			continue;
+		len = p.valueLen;
+		return p.value;
+	}
+
+	len = 0;
+	if (mHeaderParameters.empty())
+		return 0;
+
+	std::map<String, String>::iterator it;
+	it = mHeaderParameters.find(String(name, nameLen));
+	if (it == mHeaderParameters.end())
+		return 0;
+
+	len = it->second.length();
+	return it->second.data();
+}
 /**
  * @brief Get the value of a posted variable
  *
@@ -263,9 +462,23 @@ Request::ContentType Request::getType(void)
 	return mType;
 }
 
+/**
+ * @brief Get the requested path (SCRIPT_NAME without the leading '/')
+ *
+ * @param len Set to the length of the path
+ * @return char* Pointer to the path (not nul terminated)
+ */
+const char *Request::getPath(unsigned int &len)
+{
+	len = mPathLen;
+	return mPath;
+}
+
 /**
  * @brief Get page URI or optional argument
  *
+ * Before routing, the URI is the whole requested path.
+ *
  * @param n Position of the requested argument (0 for URI hitself)
  * @return string Value of the argument, or the URI
  */
@@ -274,7 +487,9 @@ String Request::getUri(unsigned int n = 0)
 	String uri;
 	
 	if (n < mUri.size())
-		uri = mUri.at(n);
+		uri = String(mUri[n].data, mUri[n].len);
+	else if ((n == 0) && mPath)
+		uri = String(mPath, mPathLen);
 	
 	return uri;
 }
@@ -308,9 +523,11 @@ bool Request::hasFormValue(const String &name)
  */
 bool Request::isAccept(const String &type)
 {
-	String acceptTypes = getParam("ACCEPT");
-	if (acceptTypes.isEmpty())
+	unsigned int len;
+	const char  *accept = getParam(paramHttpAccept, len);
+	if ((accept == 0) || (len == 0))
 		return false;
+	String acceptTypes(accept, len);
 
 	// Find the separator for parameters
 	int pSep = acceptTypes.indexOf(';');
@@ -434,15 +651,68 @@ void Request::setBody(String *body)
  */
 void Request::setHeaderParameter(const String &name, const String &value)
 {
-	mHeaderParameters[ name ] = value;
+	String &param = mHeaderParameters[ name ];
+	param = value;
+
+	// A well-known parameter is a slice of the saved value
+	int known = findParam(name.data(), name.length());
+	if (known >= 0)
+		setKnownParam(known, param.data(), param.length());
+}
+
+/**
+ * @brief Set the value of a well-known parameter (see addParam)
+ *
+ * @param param Index of the parameter
+ * @param value Pointer to the value (not copied)
+ * @param len   Length of the value
+ */
+void Request::setKnownParam(int param, const char *value, unsigned int len)
+{
+	mKnownValue[param] = value;
+	mKnownLen[param]   = len;
 
-	if (name == "SCRIPT_NAME")
+	if (param == paramScriptName)
 	{
-		String u = value.left(1);
-		if (u == "/")
-			u = value.right(value.length() - 1);
-		mUri.push_back(u);
+		// Remove the leading '/' (if any)
+		if (len && (value[0] == '/'))
+		{
+			value++;
+			len--;
+		}
+		mPath    = value;
+		mPathLen = len;
+	}
+}
+
+/**
+ * @brief Set the buffer that contains the datas of parameters slices
+ *
+ * When a previous buffer is replaced, the parameters saved as slices of it
+ * (well-known slots, list of parameters, path and URI arguments) are removed
+ * before the buffer is deleted, so no slice points to released memory.
+ *
+ * @param buffer Pointer to the buffer (the Request get ownership)
+ */
+void Request::setParamBuffer(String *buffer)
+{
+	if (mParamBuffer)
+	{
+		for (int i = 0; i < paramCount; i++)
+		{
+			mKnownValue[i] = 0;
+			mKnownLen[i]   = 0;
+		}
+		mParams.clear();
+		mPath    = 0;
+		mPathLen = 0;
+		mUri.clear();
+		delete mParamBuffer;
 	}
+	mParamBuffer = buffer;
+
+	// Reserve space for usual parameters (avoid reallocations)
+	mParams.reserve(32);
 }
 
 /**
@@ -456,64 +726,23 @@ void Request::setType(ContentType type)
 }
 
 /**
- * @brief Update the URI / arguments split position according to the route
+ * @brief Set the route of the request, the arguments are removed
+ *
+ * The route is not copied, it must stay valid until the Request is deleted
+ * (routes are kept by the Router used by the request).
  *
- * @param route Reference to the route URI
+ * @param route Pointer to the route URI
+ * @param len   Length of the route URI
  */
-void Request::setUri(const String &route)
+void Request::setRoute(const char *route, unsigned int len)
 {
-	if (mUri.size() == 0)
-		return;
-	
-	try {
-		// Get full URI string
-		String args = getParam("SCRIPT_NAME");
-		if (args.isEmpty())
-			throw runtime_error("Query string empty (or not found)");
-		// If the first char is a '/' remove it
-		if (args.left(1) == "/")
-			args = args.right( args.length() - 1 );
-		// Keep only the tail (where args are)
-		args.remove(0, route.length());
-		if (args.length())
-		{
-			if (args[0] == '/')
-				args.remove(0, 1);
-		}
-
-		// Clear the current URI argument array
-		mUri.clear();
-		// Set the requested route as arg(0)
-		mUri.push_back(route);
+	RequestUri uri;
 
-		// If the requested URI contains args after the route hitself
-		if (args.length() > 0)
-		{
-			// Split arg string into an array of args
-			for (int pos = 0; pos >= 0; )
-			{
-				String token;
-				int start = pos;
-				// Find the next token separator
-				pos = args.indexOf('/', pos);
-				if (pos >= 0)
-				{
-					token = args.mid(start, pos - start);
-					pos++;
-				}
-				else
-				{
-					token = args.right(args.length() - start);
-				}
-				// Save the item
-				mUri.push_back(token);
-			}
-		}
-
-	} catch (std::exception &e) {
-		Log::error() << "setUri failed "
-		             << e.what() << Log::endl;
-	}
+	uri.data = route;
+	uri.len  = len;
+	mUri.clear();
+	mUri.reserve(8);
+	mUri.push_back(uri);
 }
 
 } // namespace hermod
@@ -16,6 +16,7 @@
 #define REQUEST_HPP
 
 #include <map>
+#include <vector>
 #include "ModuleCache.hpp"
 #include "Page.hpp"
 #include "Server.hpp"
@@ -23,6 +24,30 @@
 
 namespace hermod {
 
+/**
+ * @struct RequestParam
+ * @brief Header parameter saved as a slice of a buffer owned by the Request
+ *
+ */
+struct RequestParam
+{
+	const char  *name;
+	unsigned int nameLen;
+	const char  *value;
+	unsigned int valueLen;
+};
+
+/**
+ * @struct RequestUri
+ * @brief Element of the requested URI (route or argument) saved as a slice
+ *
+ */
+struct RequestUri
+{
+	const char  *data;
+	unsigned int len;
+};
+
 /**
  * @class Request
  * @brief The Request class handle received datas and environment of an incoming request
@@ -30,6 +55,10 @@ namespace hermod {
  * When hermod receive an incoming connection from a client, datas are saved into a
  * Request object. This object is then used to dispatch the request to a module and by
  * the page to get uri, parameters, form datas ...
+ *
+ * The well-known CGI parameters (see Param) are saved into fixed slots, found
+ * with a perfect hash of their name when parameters are decoded. Other
+ * parameters are saved into a flat list.
  */
 class Request
 {
@@ -42,6 +71,14 @@ public:
 	enum ContentType { typeUndef,
 	                   plainText, urlEncoded, multipartForm
 	};
+	enum Param { paramRequestMethod, paramScriptName, paramQueryString,
+	             paramContentType, paramContentLength, paramHttpCookie,
+	             paramHttpAccept, paramHttpOrigin, paramHttpHost,
+	             paramHttpUserAgent, paramRequestUri, paramPathInfo,
+	             paramRemoteAddr, paramRemotePort, paramServerName,
+	             paramServerProtocol,
+	             paramCount
+	};
 public:
 	explicit Request(Server *server);
 	~Request();
@@ -49,25 +86,42 @@ public:
 	String  getContentType(void);
 	Method  getMethod(void);
 	String  getParam (const String &name);
+	const char *getParam(Param param, unsigned int &len);
+	const char *getParam(const char *name, unsigned int nameLen,
+	                     unsigned int &len);
+	const char *getPath(unsigned int &len);
 	String  getUri   (unsigned int n);
 	String  getFormValue (const String &name);
 	String  getCookieByName(const String &name, bool allowEmpty);
 	ContentType getType(void);
 	bool    hasFormValue (const String &name);
 	bool    isAccept(const String &type);
+	void    addParam(const char *name,  unsigned int nameLen,
+	                 const char *value, unsigned int valueLen);
+	void    addUriArg(const char *data, unsigned int len);
 	void    setBody (String *body);
 	void    setHeaderParameter(const String &name, const String &value);
+	void    setParamBuffer(String *buffer);
+	void    setRoute(const char *route, unsigned int len);
 	void    setType (ContentType type);
-	void    setUri  (const String &route);
+	static int findParam(const char *name, unsigned int len);
 protected:
 	void    loadFormInputs(void);
+	void    setKnownParam(int param, const char *value, unsigned int len);
 private:
 	Server        *mServer;
 	Method         mMethod;
 	ContentType    mType;
 	String        *mBody;
-	std::vector<String>       mUri;
+	const char                *mPath;
+	unsigned int               mPathLen;
+	std::vector<RequestUri>    mUri;
 	std::map <String, String> mHeaderParameters;
+	// Values of the well-known parameters (NULL when not received)
+	const char               *mKnownValue[paramCount];
+	unsigned int              mKnownLen  [paramCount];
+	std::vector<RequestParam> mParams;
+	String                   *mParamBuffer;
 	std::map <String, String> mFormParameters;
 };
 
@@ -13,12 +13,120 @@
  * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
  */
 #include <iostream>
+#include <pthread.h>
 #include "Log.hpp"
 #include "Response.hpp"
 #include "Request.hpp"
 
 namespace hermod {
 
+/**
+ * @class ResponseCout
+ * @brief Stream buffer installed on std::cout to catch output of pages
+ *
+ * Pages may run at the same time into different threads, so the buffer of
+ * std::cout can not simply be replaced by the buffer of a Response. Instead,
+ * this object is installed once and forwards datas to the buffer selected by
+ * the current thread (or to the original std::cout buffer).
+ */
+class ResponseCout : public std::streambuf
+{
+public:
+	static void init(void);
+	static std::streambuf *getTarget(void);
+	static void setTarget(std::streambuf *target);
+protected:
+	int overflow(int c);
+	std::streamsize xsputn(const char *s, std::streamsize n);
+	int sync(void);
+private:
+	static pthread_once_t  mOnce;
+	static pthread_key_t   mKey;
+	static std::streambuf *mDefault;
+	static ResponseCout    mInstance;
+};
+
+pthread_once_t  ResponseCout::mOnce = PTHREAD_ONCE_INIT;
+pthread_key_t   ResponseCout::mKey;
+std::streambuf *ResponseCout::mDefault = NULL;
+ResponseCout    ResponseCout::mInstance;
+
+/**
+ * @brief Install the forwarding buffer on std::cout (called once)
+ *
+ */
+void ResponseCout::init(void)
+{
+	pthread_key_create(&mKey, NULL);
+	mDefault = std::cout.rdbuf();
+	std::cout.rdbuf(&mInstance);
+}
+
+/**
+ * @brief Get the buffer where cout datas are written for current thread
+ *
+ * @return streambuf* Pointer to the buffer (NULL if cout is not redirected)
+ */
+std::streambuf *ResponseCout::getTarget(void)
+{
+	pthread_once(&mOnce, init);
+	return (std::streambuf *)pthread_getspecific(mKey);
+}
+
+/**
+ * @brief Set the buffer where cout datas are written for current thread
+ *
+ * @param target Pointer to the buffer (or NULL to use the original cout)
+ */
+void ResponseCout::setTarget(std::streambuf *target)
+{
+	pthread_once(&mOnce, init);
+	pthread_setspecific(mKey, target);
+}
+
+/**
+ * @brief Forward one char to the target buffer
+ *
+ */
+int ResponseCout::overflow(int c)
+{
+	std::streambuf *target = (std::streambuf *)pthread_getspecific(mKey);
+	if (target == NULL)
+		target = mDefault;
+
+	if (c == traits_type::eof())
+		return traits_type::not_eof(c);
+	return target->sputc(traits_type::to_char_type(c));
+}
+
+/**
+ * @brief Forward a block of datas to the target buffer
+ *
+ */
+std::streamsize ResponseCout::xsputn(const char *s, std::streamsize n)
+{
+	std::streambuf *target = (std::streambuf *)pthread_getspecific(mKey);
+	if (target == NULL)
+		target = mDefault;
+
+	return target->sputn(s, n);
+}
+
+/**
+ * @brief Flush the target buffer
+ *
+ */
+int ResponseCout::sync(void)
+{
+	std::streambuf *target = (std::streambuf *)pthread_getspecific(mKey);
+	if (target == NULL)
+		target = mDefault;
+
+	return target->pubsync();
+}
+
+// ------------------------------ Response ------------------------------
+
 /**
  * @brief Default constructor
  *
@@ -27,6 +135,7 @@ namespace hermod {
 Response::Response(Request *request)
 {
 	mContent     = 0;
+	mCoutActive  = false;
 	mCoutBackup  = NULL;
 	mRequest     = NULL;
 	mServer      = 0;
@@ -50,15 +159,20 @@ Response::~Response()
 /**
  * @brief Redirect standard cout to a local stream
  *
+ * The redirection only applies to the current thread : pages processed at
+ * the same time by other threads write into their own Response.
  */
 void Response::catchCout(void)
 {
-	// Backup cout's streambuf
-	mCoutBackup = std::cout.rdbuf();
+	if (mCoutActive)
+		return;
+	// Backup current target of cout for this thread
+	mCoutBackup = ResponseCout::getTarget();
 	// Clear the intermediate buffer
 	mCoutBuffer.str(std::string());
 	// Redirect cout to intermediate buffer
-	std::cout.rdbuf(mCoutBuffer.rdbuf());
+	ResponseCout::setTarget(mCoutBuffer.rdbuf());
+	mCoutActive = true;
 }
 
 /**
@@ -87,18 +201,20 @@ ResponseHeader *Response::header(void)
  */
 void Response::releaseCout(void)
 {
-	if (mCoutBackup == NULL)
+	if ( ! mCoutActive)
 		return;
-	// Restore cout from the savec backup
-	std::cout.rdbuf(mCoutBackup);
+	// Restore cout from the saved backup
+	ResponseCout::setTarget(mCoutBackup);
 	mCoutBackup = NULL;
+	mCoutActive = false;
 }
 
 /**
  * @brief Send response to the remote FastCGI peer
  *
  * This method is called at the end of process to send header and http data to
- * the client.
+ * the client. Servers may buffer output and write it later, so all the datas
+ * given to the server are kept alive by the Response until it is deleted.
  */
 void Response::send(void)
 {
@@ -106,16 +222,19 @@ void Response::send(void)
 		return;
 
 	// Send Header
-	mServer->send( mHeader.getHeader() );
+	mSendHeader = mHeader.getHeader();
+	mServer->send(mSendHeader);
 	// Send Content
 	if (mContent)
 	{
 		const char *ptrContent = mContent->getCBuffer();
-		mServer->send(ptrContent, mContent->size());
+		if (mContent->size())
+			mServer->send(ptrContent, mContent->size());
 	}
 	// Send cout buffer
-	std::string s = mCoutBuffer.str();
-	mServer->send(s.c_str(), s.length());
+	mSendCout = mCoutBuffer.str();
+	if (mSendCout.length())
+		mServer->send(mSendCout.c_str(), mSendCout.length());
 }
 
 /**
@@ -143,9 +262,10 @@ void Response::setRequest(Request *request)
 	mRequest = request;
 
 	// Process "Origin" header
-	String oh = request->getParam("HTTP_ORIGIN");
-	if ( ! oh.isEmpty())
-		mHeader.addHeader("Access-Control-Allow-Origin", oh);
+	unsigned int len;
+	const char  *oh = request->getParam(Request::paramHttpOrigin, len);
+	if (oh && len)
+		mHeader.addHeader("Access-Control-Allow-Origin", String(oh, len));
 
 	// Allow credentials control
 	mHeader.addHeader("Access-Control-Allow-Credentials", "true");
@@ -47,8 +47,12 @@ private:
 	ResponseHeader    mHeader;
 	Server           *mServer;
 	Content          *mContent;
+	bool              mCoutActive;
 	std::streambuf   *mCoutBackup;
 	std::stringstream mCoutBuffer;
+	// Datas given to the server, kept until the Response is deleted
+	String            mSendHeader;
+	std::string       mSendCout;
 };
 
 } // namespace hermod
@@ -54,12 +54,30 @@ void Route::freePage(Page *page)
 	if (mTarget == 0)
 		return;
 
+	// Pages of a registered type are kept into the pool of the target
+	PagePool *pool = mTarget->getPool();
+	if (pool)
+	{
+		pool->put(page);
+		return;
+	}
+
 	mod = mTarget->getModule();
 
 	// Call module to free the page
 	mod->freePage(page);
 }
 
+/**
+ * @brief Get the settings used to process the requests of this route
+ *
+ * @return RoutePolicy* Pointer to the policy of the route
+ */
+RoutePolicy *Route::getPolicy(void)
+{
+	return &mPolicy;
+}
+
 RouteTarget *Route::getTarget(void)
 {
 	return mTarget;
@@ -84,6 +102,11 @@ Page *Route::newPage(void)
 	if (mTarget == 0)
 		return 0;
 
+	// Get a page from the pool of the target, if the module registered one
+	PagePool *pool = mTarget->getPool();
+	if (pool)
+		return pool->get();
+
 	mod  = mTarget->getModule();
 	name = mTarget->getName();
 
@@ -101,24 +124,5 @@ void Route::setUri(const String &uri)
 	mUri = uri;
 }
 
-// ------------------------- Friend operators -------------------------
-
-/**
- * @brief Test if a Route match with an URL given into a String
- *
- * @param src Reference to a Route object  (left member of "==")
- * @param str Reference to a String object (right member of "==")
- * @return boolean True if the two strings are equal
- */
-bool operator==(Route *route, const String &uri)
-{
-	int len = route->getUri().length();
-	
-	if (route->getUri() == uri.left(len))
-		return true;
-
-	return false;
-}
-
 } // namespace hermod
 /* EOF */
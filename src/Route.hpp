@@ -16,6 +16,7 @@
 #define ROUTE_HPP
 
 #include <vector>
+#include "RoutePolicy.hpp"
 #include "RouteTarget.hpp"
 #include "String.hpp"
 
@@ -34,17 +35,16 @@ public:
 	Route (void);
 	~Route();
 	void    freePage(Page *page);
+	RoutePolicy *getPolicy(void);
 	RouteTarget *getTarget(void);
 	String      &getUri(void);
 	Page   *newPage (void);
 	void    setTarget(RouteTarget *target);
 	void    setUri   (const String &uri);
-public:
-	friend bool operator==(Route *, const String&);
-
 private:
 	RouteTarget *mTarget;
 	String       mUri;
+	RoutePolicy  mPolicy;
 };
 
 } // namespace hermod
@@ -0,0 +1,222 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cstring>
+#include "RouteNode.hpp"
+
+namespace hermod {
+
+/**
+ * @brief Get the length of the first segment of a path
+ *
+ * @param path Pointer to the path
+ * @param len  Length of the path
+ * @return integer Length of the segment (up to the first '/')
+ */
+static unsigned int segmentLength(const char *path, unsigned int len)
+{
+	const char *sep = (const char *)memchr(path, '/', len);
+	return (sep ? (sep - path) : len);
+}
+
+/**
+ * @brief Compare two segments (like strcmp, shorter first when equal)
+ *
+ */
+static int segmentCompare(const char *a, unsigned int aLen,
+                          const char *b, unsigned int bLen)
+{
+	int diff = memcmp(a, b, (aLen < bLen) ? aLen : bLen);
+	if (diff)
+		return diff;
+	return ((int)aLen - (int)bLen);
+}
+
+/**
+ * @brief Default constructor
+ *
+ */
+RouteNode::RouteNode()
+{
+	mLabel.clear();
+	mKeyLen = 0;
+	mRoute  = 0;
+	mChildren.clear();
+}
+
+/**
+ * @brief Default destructor, delete all the sub-tree
+ *
+ * Routes are owned by the Router, they are not deleted here.
+ */
+RouteNode::~RouteNode()
+{
+	while (mChildren.size())
+	{
+		delete mChildren.back();
+		mChildren.pop_back();
+	}
+}
+
+/**
+ * @brief Find the child that starts with a segment
+ *
+ * @param segment Pointer to the segment
+ * @param len     Length of the segment
+ * @param pos     Set to the position of the child (or where it should be)
+ * @return RouteNode* Pointer to the child (or NULL if not found)
+ */
+RouteNode *RouteNode::findChild(const char *segment, unsigned int len, size_t &pos)
+{
+	size_t low  = 0;
+	size_t high = mChildren.size();
+
+	while (low < high)
+	{
+		size_t mid = (low + high) / 2;
+		RouteNode *child = mChildren[mid];
+		int diff = segmentCompare(child->mLabel.data(), child->mKeyLen,
+		                          segment, len);
+		if (diff == 0)
+		{
+			pos = mid;
+			return child;
+		}
+		if (diff < 0)
+			low  = mid + 1;
+		else
+			high = mid;
+	}
+	pos = low;
+	return 0;
+}
+
+/**
+ * @brief Insert a route into the sub-tree of this node
+ *
+ * If a route is already registered for the same path, the first one is kept.
+ *
+ * @param uri   Pointer to the path of the route, relative to this node
+ * @param len   Length of the path
+ * @param route Pointer to the route
+ */
+void RouteNode::insert(const char *uri, unsigned int len, Route *route)
+{
+	RouteNode *node = this;
+
+	while (len)
+	{
+		unsigned int keyLen = segmentLength(uri, len);
+		size_t pos;
+		RouteNode *child = node->findChild(uri, keyLen, pos);
+
+		// No child for this segment, the remaining path is a new leaf
+		if (child == 0)
+		{
+			child = new RouteNode();
+			child->mLabel.assign(uri, len);
+			child->mKeyLen = keyLen;
+			child->mRoute  = route;
+			node->mChildren.insert(node->mChildren.begin() + pos, child);
+			return;
+		}
+
+		// Length of the common segments of the child label and the path
+		const char  *label    = child->mLabel.data();
+		unsigned int labelLen = child->mLabel.length();
+		unsigned int common   = keyLen;
+		while (common < labelLen)
+		{
+			unsigned int next = common + 1;
+			if (next > len)
+				break;
+			next += segmentLength(uri + next, len - next);
+			if ((next > labelLen) || (memcmp(label, uri, next) != 0) ||
+			    ((next < labelLen) && (label[next] != '/')))
+				break;
+			common = next;
+		}
+
+		// The path diverges inside the label, split the child
+		if (common < labelLen)
+		{
+			RouteNode *split = new RouteNode();
+			split->mLabel.assign(label, common);
+			split->mKeyLen = keyLen;
+			child->mLabel.erase(0, common + 1);
+			child->mKeyLen = segmentLength(child->mLabel.data(),
+			                               child->mLabel.length());
+			split->mChildren.push_back(child);
+			node->mChildren[pos] = split;
+			child = split;
+		}
+
+		// Continue with the segments after the child
+		node = child;
+		if (common < len)
+			common++;
+		uri += common;
+		len -= common;
+	}
+
+	if (node->mRoute == 0)
+		node->mRoute = route;
+}
+
+/**
+ * @brief Find the route of the longest prefix of a path
+ *
+ * @param path     Pointer to the path (without leading '/')
+ * @param len      Length of the path
+ * @param matchLen Set to the length of the path used by the route
+ * @return Route* Pointer to the route (or NULL if not found)
+ */
+Route *RouteNode::match(const char *path, unsigned int len, unsigned int &matchLen)
+{
+	RouteNode *node = this;
+	Route *route = mRoute;
+	unsigned int pos = 0;
+
+	matchLen = 0;
+
+	while (pos < len)
+	{
+		size_t index;
+		unsigned int keyLen = segmentLength(path + pos, len - pos);
+		node = node->findChild(path + pos, keyLen, index);
+		if (node == 0)
+			break;
+
+		// The whole label must match, and end on a segment boundary
+		unsigned int labelLen = node->mLabel.length();
+		if ((labelLen > (len - pos)) ||
+		    (memcmp(node->mLabel.data() + keyLen, path + pos + keyLen,
+		            labelLen - keyLen) != 0) ||
+		    (((pos + labelLen) < len) && (path[pos + labelLen] != '/')))
+			break;
+		pos += labelLen;
+
+		if (node->mRoute)
+		{
+			route    = node->mRoute;
+			matchLen = pos;
+		}
+		// Skip the separator
+		pos++;
+	}
+	return route;
+}
+
+} // namespace hermod
+/* EOF */
@@ -0,0 +1,57 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef ROUTENODE_HPP
+#define ROUTENODE_HPP
+
+#include <string>
+#include <vector>
+
+namespace hermod {
+
+class Route;
+
+/**
+ * @class RouteNode
+ * @brief Node of the radix tree used by the Router to find routes
+ *
+ * The tree is keyed on path segments (parts of the URI separated by '/').
+ * Each node holds one or more segments (a chain of nodes without branch is
+ * merged into one node), and the route registered for the path that ends on
+ * this node (if any). The children of a node never start with the same
+ * segment, they are sorted by their first segment so the right one is found
+ * with a binary search.
+ *
+ * A lookup walks the tree once along the requested path and returns the
+ * route of the longest prefix that ends on a segment boundary : a route
+ * "hello" matches "hello" and "hello/world" but not "helloworld".
+ */
+class RouteNode
+{
+public:
+	RouteNode();
+	~RouteNode();
+	void   insert(const char *uri,  unsigned int len, Route *route);
+	Route *match (const char *path, unsigned int len, unsigned int &matchLen);
+protected:
+	RouteNode *findChild(const char *segment, unsigned int len, size_t &pos);
+private:
+	std::string  mLabel;   // Segments of this node (without separator at ends)
+	unsigned int mKeyLen;  // Length of the first segment of the label
+	Route       *mRoute;
+	std::vector<RouteNode *> mChildren;
+};
+
+} // namespace hermod
+#endif
@@ -0,0 +1,188 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <string>
+#include "Config.hpp"
+#include "Log.hpp"
+#include "RoutePolicy.hpp"
+
+namespace hermod {
+
+/**
+ * @brief Default constructor, set default values (without config)
+ *
+ * Without a session mode, pages can not load sessions (like an unknown mode
+ * of the global config).
+ */
+RoutePolicy::RoutePolicy(void)
+{
+	mSessionMode   = SessionNone;
+	mSessionCookie = "HERMOD_SESSION";
+	mSessionTtl    = 0;
+}
+
+/**
+ * @brief Get the value of the Cache-Control header (empty for none)
+ *
+ * @return String Value of the header
+ */
+const String &RoutePolicy::getCacheControl(void) const
+{
+	return mCacheControl;
+}
+
+/**
+ * @brief Get the default content type of the responses (empty for none)
+ *
+ * @return String Mime-type of the responses
+ */
+const String &RoutePolicy::getContentType(void) const
+{
+	return mContentType;
+}
+
+/**
+ * @brief Get the name of the cookie that contains the session ID
+ *
+ * @return String Name of the cookie
+ */
+const String &RoutePolicy::getSessionCookie(void) const
+{
+	return mSessionCookie;
+}
+
+/**
+ * @brief Get the way the session ID is sent by clients
+ *
+ * @return integer Session mode (see SessionMode)
+ */
+int RoutePolicy::getSessionMode(void) const
+{
+	return mSessionMode;
+}
+
+/**
+ * @brief Get the TTL of the new sessions
+ *
+ * @return integer TTL in seconds (0 for default, negative for infinite)
+ */
+int RoutePolicy::getSessionTtl(void) const
+{
+	return mSessionTtl;
+}
+
+/**
+ * @brief Load the default settings from the global section of config
+ *
+ */
+void RoutePolicy::load(void)
+{
+	Config *cfg = Config::getInstance();
+
+	const char *keys[] = { "session_mode", "session_cookie", "session_ttl",
+	                       "cache_control", "content_type", 0 };
+	for (int i = 0; keys[i]; i++)
+	{
+		String value( cfg->get("global", keys[i]) );
+		if (value.isEmpty())
+			continue;
+		set(keys[i], value);
+	}
+}
+
+/**
+ * @brief Set the value of one setting
+ *
+ * @param name  Name of the setting (same as the global config key)
+ * @param value New value for this setting
+ * @return boolean True if the setting is known and the value is valid
+ */
+bool RoutePolicy::set(const String &name, const String &value)
+{
+	std::string n( name.toStdStr() );
+	std::string v( value.toStdStr() );
+
+	if (n.compare("session_mode") == 0)
+	{
+		if (v.compare("cookie") == 0)
+			mSessionMode = SessionCookie;
+		else if (v.compare("token") == 0)
+			mSessionMode = SessionToken;
+		else if (v.compare("none") == 0)
+			mSessionMode = SessionNone;
+		else
+		{
+			Log::warning() << "RoutePolicy: Unknown session mode "
+			               << value << Log::endl;
+			mSessionMode = SessionNone;
+			return false;
+		}
+	}
+	else if (n.compare("session_cookie") == 0)
+		mSessionCookie = value;
+	else if (n.compare("session_ttl") == 0)
+	{
+		mSessionTtl = value.toInt();
+		// A nul (or negative) value is used for infinite TTL
+		if (mSessionTtl <= 0)
+			mSessionTtl = -1;
+	}
+	else if (n.compare("cache_control") == 0)
+		mCacheControl = value;
+	else if (n.compare("content_type") == 0)
+		mContentType = value;
+	else
+	{
+		Log::warning() << "RoutePolicy: Unknown option " << name << Log::endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Override settings with a list of options
+ *
+ * Options are "name=value" pairs separated by spaces (or tabs), like
+ * "session_mode=token cache_control=no-store".
+ *
+ * @param options String with the list of options
+ */
+void RoutePolicy::setOptions(const String &options)
+{
+	std::string opts( options.toStdStr() );
+	size_t pos = 0;
+
+	while (pos < opts.length())
+	{
+		size_t begin = opts.find_first_not_of(" \t", pos);
+		if (begin == std::string::npos)
+			break;
+		size_t end = opts.find_first_of(" \t", begin);
+		if (end == std::string::npos)
+			end = opts.length();
+		pos = end;
+
+		std::string opt( opts.substr(begin, end - begin) );
+		size_t sep = opt.find('=');
+		if (sep == std::string::npos)
+		{
+			Log::warning() << "RoutePolicy: Malformed option " << opt << Log::endl;
+			continue;
+		}
+		set(opt.substr(0, sep), opt.substr(sep + 1));
+	}
+}
+
+} // namespace hermod
+/* EOF */
@@ -0,0 +1,54 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef ROUTEPOLICY_HPP
+#define ROUTEPOLICY_HPP
+
+#include "String.hpp"
+
+namespace hermod {
+
+/**
+ * @class RoutePolicy
+ * @brief Settings used to process the requests of a Route
+ *
+ * The settings of the global section (session mode, cookie name ...) are
+ * read once when the routes are loaded, then each route can override them
+ * with options (see setOptions). So pages use these values without any
+ * lookup into the configuration.
+ */
+class RoutePolicy
+{
+public:
+	enum SessionMode { SessionNone = 0, SessionCookie = 1, SessionToken = 2 };
+public:
+	RoutePolicy(void);
+	const String &getCacheControl (void) const;
+	const String &getContentType  (void) const;
+	const String &getSessionCookie(void) const;
+	int  getSessionMode(void) const;
+	int  getSessionTtl (void) const;
+	void load(void);
+	bool set(const String &name, const String &value);
+	void setOptions(const String &options);
+private:
+	int    mSessionMode;
+	String mSessionCookie;
+	int    mSessionTtl;
+	String mCacheControl;
+	String mContentType;
+};
+
+} // namespace hermod
+#endif
@@ -27,9 +27,19 @@ RouteTarget::RouteTarget(void)
 {
 	mValid  = false;
 	mModule = (Module *)0x00;
+	mPool   = NULL;
 	mName.clear();
 }
 
+/**
+ * @brief Default destructor, delete the pool of pages (if any)
+ *
+ */
+RouteTarget::~RouteTarget()
+{
+	delete mPool;
+}
+
 /**
  * @brief Set the current state of the target to "disabled"
  *
@@ -72,6 +82,16 @@ const String &RouteTarget::getName(void)
 	return mName;
 }
 
+/**
+ * @brief Get the pool used to allocate the pages of this target
+ *
+ * @return PagePool* Pointer to the pool (NULL if no factory registered)
+ */
+PagePool *RouteTarget::getPool(void)
+{
+	return mPool;
+}
+
 /**
  * @brief Test the current state of the target (enabled ... or not)
  *
@@ -82,6 +102,21 @@ bool RouteTarget::isEnabled(void)
 	return mValid;
 }
 
+/**
+ * @brief Set the factory used to allocate the pages of this target
+ *
+ * The target takes ownership of the factory, it is deleted with the pool.
+ *
+ * @param factory Pointer to the factory
+ */
+void RouteTarget::setFactory(PageFactory *factory)
+{
+	delete mPool;
+	mPool = NULL;
+	if (factory)
+		mPool = new PagePool(factory);
+}
+
 /**
  * @brief Set the Module associated with this target
  *
@@ -16,6 +16,7 @@
 #define ROUTETARGET_HPP
 
 #include <vector>
+#include "PagePool.hpp"
 #include "String.hpp"
 
 namespace hermod {
@@ -30,22 +31,39 @@ class Page;
  * The Router subsystem map a list of known URL to a list of "targets" that
  * known how to process the request. This class is used to define this targets
  * as a "page" managed by a "module".
+ *
+ * A module should register the type of the page with setPage when the target
+ * is created (see Module::initRouter). Pages are then allocated by a pool of
+ * the target and reused between requests. Without this, pages are allocated
+ * by Module::newPage with the name of the target.
  */
 class RouteTarget
 {
 public:
 	RouteTarget   (void);
+	~RouteTarget();
 	void    disable(void);
 	void    enable(void);
 	bool    isEnabled(void);
 	Module *getModule(void);
 	const String &getName(void);
+	PagePool     *getPool(void);
+	void    setFactory(PageFactory *factory);
 	void    setModule(Module *module);
 	void    setName  (const String &name);
+	/**
+	 * @brief Register the type of page allocated for this target
+	 *
+	 */
+	template <class T> void setPage(void)
+	{
+		setFactory(new PageFactoryType<T>());
+	}
 private:
 	bool    mValid;
 	String  mName;
 	Module *mModule;
+	PagePool *mPool;
 };
 
 } // namespace hermod
@@ -12,7 +12,9 @@
  *
  * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
  */
+#include <cstring>
 #include <stdexcept>
+#include <string>
 #include "Config.hpp"
 #include "Log.hpp"
 #include "Router.hpp"
@@ -28,7 +30,10 @@ Router::Router(void)
 {
 	mModules = 0;
 	mRoutes.clear();
+	mTree    = new RouteNode();
 	mTargets.clear();
+	mUsers   = 0;
+	pthread_mutex_init(&mUsersLock, NULL);
 }
 
 /**
@@ -38,6 +43,19 @@ Router::Router(void)
 Router::~Router()
 {
 	clean();
+	delete mTree;
+	pthread_mutex_destroy(&mUsersLock);
+}
+
+/**
+ * @brief Declare a new user of this Router (a request in progress)
+ *
+ */
+void Router::acquire(void)
+{
+	pthread_mutex_lock(&mUsersLock);
+	mUsers++;
+	pthread_mutex_unlock(&mUsersLock);
 }
 
 /**
@@ -47,6 +65,8 @@ Router::~Router()
 void Router::clean(void)
 {
 	// Clear the route(s) cache
+	delete mTree;
+	mTree = new RouteNode();
 	while(mRoutes.size())
 	{
 		Route *r = mRoutes.back();
@@ -65,6 +85,11 @@ void Router::clean(void)
 /**
  * @brief This method create a new Route and register it into router
  *
+ * The separators at both ends of the URI are removed, so "/path/" and "path"
+ * are the same route. When many routes use the same URI, the first one is
+ * used by requests. The route gets the default settings of the Router, they
+ * can be modified later with getPolicy.
+ *
  * @param  uri    String that contains the URI
  * @param  target Pointer to the RouteTarget to use for requests on this route
  * @return Route* Pointer the the newly allocated Route.
@@ -79,15 +104,21 @@ Route *Router::createRoute(const String &uri, RouteTarget *target)
 		routeUri = uri.right( uri.length() - 1 );
 	else
 		routeUri = uri;
+	// Remove the last '/' character(s) (if any)
+	while (routeUri.length() && (routeUri[routeUri.length() - 1] == '/'))
+		routeUri.truncate(routeUri.length() - 1);
 
 	// Instanciate a ne Route object
 	route = new Route();
 	// Configure it
 	route->setUri(routeUri);
 	route->setTarget(target);
+	*route->getPolicy() = mPolicy;
 
 	// Register this Route into local Router cache
 	mRoutes.push_back(route);
+	// Insert it into the tree used to find routes
+	mTree->insert(route->getUri().data(), route->getUri().length(), route);
 
 	return route;
 }
@@ -137,60 +168,78 @@ RouteTarget *Router::createTarget(Module *module, const String &name, bool en)
  */
 Route *Router::find(const String &uri)
 {
-	Route *route = 0;
+	unsigned int matchLen;
 
-	try {
-		// Parse all entries of Route cache
-		std::vector<Route *>::iterator it;
-		for (it = mRoutes.begin(); it != mRoutes.end(); ++it)
-		{
-			if (! ((*it) == uri))
-				continue;
-			route = (*it);
-			break;
-		}
-		if (route == NULL)
-		{
-			Log::warning() << "Router: No loaded module or page match route "
-			               << uri << Log::endl;
-		}
-	} catch (std::exception &e) {
-		Log::error() << "Router error: " << e.what() << Log::endl;
-		return NULL;
+	Route *route = mTree->match(uri.data(), uri.length(), matchLen);
+	if (route == NULL)
+	{
+		Log::warning() << "Router: No loaded module or page match route "
+		               << uri << Log::endl;
 	}
-
 	return route;
 }
 
 /**
  * @brief Find a route based on a Request
  *
+ * The route is the longest prefix of the requested path, the following
+ * segments are saved into the Request as arguments (slices of the path).
+ *
  * @param  r      Pointer to the source Request
  * @return Route* Pointer to a route if URI is found
  */
 Route *Router::find(Request *r)
 {
-	String uri = r->getUri(0);
-	if (uri.isEmpty())
-		uri = ":index:";
-	
-	Route *route = 0;
+	unsigned int len;
+	unsigned int matchLen;
+	const char *path = r->getPath(len);
 
-	try {
-		route = find(uri);
+	if (len == 0)
+	{
+		path = ":index:";
+		len  = 7;
+	}
 
-		// If a valid target has been found
-		if (route)
-			// Update Request URI and args
-			r->setUri( route->getUri() );
-	} catch (std::exception &e) {
-		Log::error() << "Router error: " << e.what() << Log::endl;
+	// Not found, servers log it and use the 404 route
+	Route *route = mTree->match(path, len, matchLen);
+	if (route == NULL)
 		return NULL;
+
+	// Update Request URI and args
+	String &routeUri = route->getUri();
+	r->setRoute(routeUri.data(), routeUri.length());
+	unsigned int pos = matchLen;
+	if ((pos < len) && (path[pos] == '/'))
+		pos++;
+	if (pos < len)
+	{
+		while (1)
+		{
+			const char *sep = (const char *)memchr(path + pos, '/', len - pos);
+			unsigned int end = (sep ? (sep - path) : len);
+			r->addUriArg(path + pos, end - pos);
+			if (sep == 0)
+				break;
+			pos = end + 1;
+		}
 	}
 
 	return route;
 }
 
+/**
+ * @brief Test if some requests in progress use this Router
+ *
+ * @return boolean True if the Router is used
+ */
+bool Router::isUsed(void)
+{
+	pthread_mutex_lock(&mUsersLock);
+	bool used = (mUsers > 0);
+	pthread_mutex_unlock(&mUsersLock);
+	return used;
+}
+
 /**
  * @brief Find into config a route that match an URI or a system name
  *
@@ -318,6 +367,10 @@ void Router::reload(void)
 	// Clear the current router config (if any)
 	clean();
 
+	// Load the default settings of routes
+	mPolicy = RoutePolicy();
+	mPolicy.load();
+
 	// First, reload routes and Target defined by Modules
 	try {
 		if (!mModules)
@@ -354,9 +407,19 @@ void Router::reload(void)
 				break;
 
 			String routeUri = key->getName();
+			std::string value( key->getValue() );
+			String options;
+
+			// Options of the route follow the target name
+			size_t sepPos = value.find_first_of(" \t");
+			if (sepPos != std::string::npos)
+			{
+				options = value.substr(sepPos + 1);
+				value.erase(sepPos);
+			}
 
 			// Find a target for this route
-			target = this->findTarget( key->getValue() );
+			target = this->findTarget(value);
 			if (target == 0)
 			{
 				Log::warning() << "Router: Failed to (re)load config for URI "
@@ -367,12 +430,27 @@ void Router::reload(void)
 			route = createRoute(routeUri, target);
 			if (route == 0)
 				throw std::runtime_error("Failed to create route");
+			// Override the default settings
+			if ( ! options.isEmpty())
+				route->getPolicy()->setOptions(options);
 		}
 	} catch (std::exception &e) {
 		Log::info() << "Router error: " << e.what() << Log::endl;
 	}
 }
 
+/**
+ * @brief Remove a user of this Router (the request is complete)
+ *
+ */
+void Router::release(void)
+{
+	pthread_mutex_lock(&mUsersLock);
+	if (mUsers > 0)
+		mUsers--;
+	pthread_mutex_unlock(&mUsersLock);
+}
+
 /**
  * @brief Define the ModuleCache to use when search/access Modules
  *
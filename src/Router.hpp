@@ -16,9 +16,12 @@
 #define ROUTER_HPP
 
 #include <vector>
+#include <pthread.h>
 #include "Config.hpp"
 #include "ModuleCache.hpp"
 #include "Route.hpp"
+#include "RouteNode.hpp"
+#include "RoutePolicy.hpp"
 #include "RouteTarget.hpp"
 #include "String.hpp"
 
@@ -31,12 +34,22 @@ class Request;
  * @class Router
  * @brief The router class is used to amange a collection of URI <-> page pair
  *
+ * Routes are compiled into a radix tree keyed on path segments (see
+ * RouteNode), so the route of a request is found with one walk along his
+ * path, whatever the number of routes. The settings used by the pages
+ * (session, cache ...) are resolved for each route when it is loaded (see
+ * RoutePolicy), so requests do not read the configuration.
+ *
+ * When the configuration is reloaded, a new Router replaces the current one.
+ * Requests in progress still use the old Router : each of them holds it (see
+ * acquire and release) so it is only deleted when it is not used anymore.
  */
 class Router
 {
 public:
 	Router (void);
 	~Router();
+	void acquire(void);
 	void clean(void);
 	Route       *createRoute(const String &uri, RouteTarget *target);
 	RouteTarget *createTarget(Module *module);
@@ -45,6 +58,8 @@ public:
 	void removeTarget(RouteTarget *target);
 	Route       *find(const String &uri);
 	Route       *find(Request *r);
+	bool isUsed (void);
+	void release(void);
 	void setModuleCache(ModuleCache *mc);
 protected:
 	ConfigKey   *findConfigRoute(const String &uri);
@@ -53,7 +68,13 @@ protected:
 private:
 	ModuleCache *mModules;
 	std::vector<Route *>       mRoutes;
+	RouteNode                 *mTree;
+	// Default settings of the routes (global section of config)
+	RoutePolicy                mPolicy;
 	std::vector<RouteTarget *> mTargets;
+	// Number of requests in progress that use this Router
+	unsigned int    mUsers;
+	pthread_mutex_t mUsersLock;
 };
 
 } // namespace hermod
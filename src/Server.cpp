@@ -13,12 +13,22 @@
  * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
  */
 #include <cstdlib>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include "Config.hpp"
 #include "Log.hpp"
 #include "Server.hpp"
 
 namespace hermod {
 
+// Environment variable used to give listening sockets to a new instance
+#define SERVER_ENV_FDS "HERMOD_FDS"
+
+std::map<std::string, int> Server::mInherited;
+bool Server::mInheritedLoaded = false;
+
 /**
  * @brief Default constructor
  *
@@ -26,7 +36,17 @@ namespace hermod {
 Server::Server()
 {
 	mFd = -1;
-	mRouter = NULL;
+	mExecutor = NULL;
+	mReactor = NULL;
+	mRouter  = NULL;
+	mReusePort = false;
+	mFirst   = NULL;
+	mLoops   = 1;
+
+	mStats.accepted = 0;
+	mStats.refused  = 0;
+	mStats.wakeups  = 0;
+	mStats.batchMax = 0;
 }
 
 /**
@@ -35,23 +55,253 @@ Server::Server()
  */
 Server::~Server(void)
 {
-	// Nothing to do but needed for derivated classes
+	closeListeners();
 }
 
 /**
- * @brief Get the descriptor used by server to listen for events
+ * @brief Close all the listening sockets of the server
  *
- * @param index Index to get (when server can handle multiple connection)
- * @return integer Descriptor ID
  */
-int Server::getFd(unsigned int index)
+void Server::closeListeners(void)
+{
+	while (mListeners.size())
+	{
+		Listener *l = mListeners.back();
+		mListeners.pop_back();
+		if (mReactor)
+			mReactor->remove(l->getFd());
+		delete l;
+	}
+	mFd = -1;
+}
+
+/**
+ * @brief Stop accepting connections, and finish the current ones
+ *
+ * Default implementation for servers that do not keep connections between
+ * events : listening sockets are simply closed.
+ */
+void Server::drain(void)
+{
+	stop();
+}
+
+/**
+ * @brief Get the list of listening sockets, to give them to a new instance
+ *
+ * The result is the HERMOD_FDS environment variable (name and value). The
+ * value is a list of "descriptor=address" separated by ";" (see
+ * takeInherited).
+ *
+ * @param fds Reference to a vector where descriptors are added
+ * @return string Environment variable for the new instance
+ */
+std::string Server::exportListeners(std::vector<int> &fds)
 {
-	if (index != 0)
-		return (-1);
+	std::string result;
 
+	std::vector<Listener *>::iterator it;
+	for (it = mListeners.begin(); it != mListeners.end(); ++it)
+	{
+		if ((*it)->getFd() < 0)
+			continue;
+		if ( ! result.empty())
+			result += ";";
+		result += String::number((*it)->getFd()).toStdStr();
+		result += "=";
+		result += (*it)->getAddress();
+		fds.push_back((*it)->getFd());
+	}
+	return std::string(SERVER_ENV_FDS "=") + result;
+}
+
+/**
+ * @brief Get the main descriptor of the server (listening socket)
+ *
+ * @return integer Descriptor ID
+ */
+int Server::getFd(void)
+{
 	return mFd;
 }
 
+/**
+ * @brief Search the listening socket associated with a descriptor
+ *
+ * @param fd Descriptor to search
+ * @return Listener* Pointer to the listener (or NULL if fd is not a listener)
+ */
+Listener *Server::getListener(int fd)
+{
+	std::vector<Listener *>::iterator it;
+	for (it = mListeners.begin(); it != mListeners.end(); ++it)
+	{
+		if ((*it)->getFd() == fd)
+			return *it;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Search the listening socket associated with an address
+ *
+ * @param address Address of the listener (as set into config)
+ * @return Listener* Pointer to the listener (or NULL if not found)
+ */
+Listener *Server::findListener(const std::string &address)
+{
+	std::vector<Listener *>::iterator it;
+	for (it = mListeners.begin(); it != mListeners.end(); ++it)
+	{
+		if ((*it)->getAddress() == address)
+			return *it;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Get the number of event loops that listen on the same addresses
+ *
+ * @return integer Number of event loops (1 without reactors)
+ */
+unsigned int Server::getLoops(void) const
+{
+	// The count is set on the first server, used by all the event loops
+	if (mFirst)
+		return mFirst->mLoops;
+	return mLoops;
+}
+
+/**
+ * @brief Get the counters of accepted connections
+ *
+ * @return ServerStats Copy of the counters
+ */
+ServerStats Server::getStats(void)
+{
+	return mStats;
+}
+
+/**
+ * @brief Test if the server has no more connection in progress
+ *
+ * @return boolean True if the server can be stopped without losing requests
+ */
+bool Server::isIdle(void)
+{
+	return true;
+}
+
+/**
+ * @brief Open the listening sockets defined into config
+ *
+ * Each "listen" key of the global section defines one listening socket. When
+ * there is no listen key, the server listen on the TCP port defined by the
+ * "port" key (or the specified default port). Opened sockets are registered
+ * into the Reactor (level-triggered).
+ *
+ * When many servers listen on the same addresses (one for each event loop)
+ * TCP sockets are opened with SO_REUSEPORT, and unix sockets opened by the
+ * first server are shared.
+ *
+ * @param port Default TCP port
+ */
+void Server::openListeners(int port)
+{
+	Config *cfg = Config::getInstance();
+	size_t pos = 0;
+
+	while (1)
+	{
+		String address = cfg->get("global", "listen", &pos);
+		if (address.isEmpty())
+			break;
+		mListeners.push_back(new Listener(address));
+		pos++;
+	}
+	// Compatibility with old config : use the "port" key
+	if (mListeners.empty())
+	{
+		ConfigKey *keyPort = cfg->getKey("global", "port");
+		if (keyPort)
+			port = keyPort->getInteger();
+		mListeners.push_back(new Listener(String::number(port)));
+	}
+
+	// Permissions of unix socket files
+	int mode = -1;
+	String cfgMode = cfg->get("global", "listen_mode");
+	if ( ! cfgMode.isEmpty())
+		mode = strtol(cfgMode.data(), 0, 8);
+	String cfgGroup = cfg->get("global", "listen_group");
+
+	// Max length of the queue of pending connections
+	int backlog = SOMAXCONN;
+	ConfigKey *key = cfg->getKey("global", "backlog");
+	if (key && (key->getInteger() > 0))
+		backlog = key->getInteger();
+	// Options of TCP sockets
+	int deferAccept = 1;
+	key = cfg->getKey("global", "tcp_defer_accept");
+	if (key)
+		deferAccept = key->getInteger();
+	bool noDelay = true;
+	key = cfg->getKey("global", "tcp_nodelay");
+	if (key)
+		noDelay = key->getBoolean(true);
+
+	std::vector<Listener *>::iterator it;
+	for (it = mListeners.begin(); it != mListeners.end(); )
+	{
+		Listener *l = *it;
+		try {
+			l->setMode (mode);
+			l->setGroup(cfgGroup);
+			l->setDeferAccept(deferAccept);
+			l->setNoDelay(noDelay);
+			l->setReusePort(mReusePort);
+			int inherited = takeInherited(l->getAddress());
+			if (inherited >= 0)
+			{
+				l->adopt(inherited);
+				Log::info() << "Server: Use inherited socket for "
+				            << l->getAddress() << Log::endl;
+			}
+			else if (mFirst && l->isUnix())
+				l->share(mFirst->findListener(l->getAddress()));
+			else
+				l->open(backlog);
+			if (l->getFd() < 0)
+				throw std::runtime_error("Listener not available " + l->getAddress());
+			Log::info() << "Server: Listen on " << l->getAddress() << Log::endl;
+			if (mReactor)
+				mReactor->add(l->getFd(), this, false);
+			++it;
+		} catch (std::exception &e) {
+			Log::error() << "Server: " << e.what() << Log::endl;
+			it = mListeners.erase(it);
+			delete l;
+		}
+	}
+
+	// Inherited sockets not used anymore (config modified)
+	if (mFirst == 0)
+	{
+		std::map<std::string, int>::iterator itInh;
+		for (itInh = mInherited.begin(); itInh != mInherited.end(); ++itInh)
+		{
+			Log::info() << "Server: Close inherited socket "
+			            << itInh->first << Log::endl;
+			::close(itInh->second);
+		}
+		mInherited.clear();
+	}
+
+	// The first listener is used as main descriptor of the server
+	if (mListeners.size())
+		mFd = mListeners.front()->getFd();
+}
+
 /**
  * @brief Default event handler - Must be overloaded
  *
@@ -64,9 +314,21 @@ void Server::processFd(int fd)
 {
 	Log::warning() << "Server: Event on descriptor " << fd
 	               << " but no processing function available !" << Log::endl;
-	// Close server FD to avoid further error
-	close(mFd);
-	mFd = -1;
+	// Close server sockets to avoid further error
+	closeListeners();
+}
+
+/**
+ * @brief Give the ownership of listening sockets to another process
+ *
+ * This is used by worker processes (prefork mode) : sockets are inherited from
+ * the master process, so socket files must not be removed by workers.
+ */
+void Server::releaseListeners(void)
+{
+	std::vector<Listener *>::iterator it;
+	for (it = mListeners.begin(); it != mListeners.end(); ++it)
+		(*it)->release();
 }
 
 /**
@@ -79,6 +341,51 @@ void Server::send(const String &content)
 	send(content.data(), content.length());
 }
 
+/**
+ * @brief Set the Executor used to process pages out of the Reactor thread
+ *
+ * When no executor is set, pages are processed by the Reactor thread itself.
+ *
+ * @param executor Pointer to the Executor to use (or NULL)
+ */
+void Server::setExecutor(Executor *executor)
+{
+	mExecutor = executor;
+}
+
+/**
+ * @brief Set the number of event loops that listen on the same addresses
+ *
+ * @param count Number of event loops (reactors)
+ */
+void Server::setLoops(unsigned int count)
+{
+	mLoops = (count ? count : 1);
+}
+
+/**
+ * @brief Set the Reactor where the server must register his descriptors
+ *
+ * @param reactor Pointer to the Reactor to use
+ */
+void Server::setReactor(Reactor *reactor)
+{
+	mReactor = reactor;
+}
+
+/**
+ * @brief Configure the server to run with other servers on the same addresses
+ *
+ * @param enable True if many servers listen on the same addresses
+ * @param first  Pointer to the server that owns shared sockets (unix), or
+ *               NULL for the first server itself
+ */
+void Server::setReusePort(bool enable, Server *first)
+{
+	mReusePort = enable;
+	mFirst     = first;
+}
+
 /**
  * @brief Set the router associated with this server
  *
@@ -89,5 +396,55 @@ void Server::setRouter(Router *router)
 	mRouter = router;
 }
 
+/**
+ * @brief Get a listening socket received from a previous instance
+ *
+ * During an upgrade, the old instance starts the new one with the list of
+ * his listening sockets into the HERMOD_FDS environment variable. This list
+ * is decoded on first call, then each socket can be taken once.
+ *
+ * @param address Address of the listener (as set into config)
+ * @return integer Descriptor of the socket (or -1 if not inherited)
+ */
+int Server::takeInherited(const std::string &address)
+{
+	if ( ! mInheritedLoaded)
+	{
+		mInheritedLoaded = true;
+		const char *env = getenv(SERVER_ENV_FDS);
+		std::string list(env ? env : "");
+		size_t pos = 0;
+		while (pos < list.length())
+		{
+			size_t end = list.find(';', pos);
+			if (end == std::string::npos)
+				end = list.length();
+			std::string item = list.substr(pos, end - pos);
+			pos = end + 1;
+
+			size_t sep = item.find('=');
+			if ((sep == std::string::npos) || (sep == 0))
+				continue;
+			int fd = atoi(item.substr(0, sep).c_str());
+			// Ignore descriptors that are not (or no more) sockets
+			int type;
+			socklen_t len = sizeof(type);
+			if ((fd < 3) ||
+			    (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0))
+				continue;
+			mInherited[item.substr(sep + 1)] = fd;
+		}
+		// Child processes must not use this list
+		unsetenv(SERVER_ENV_FDS);
+	}
+
+	std::map<std::string, int>::iterator it = mInherited.find(address);
+	if (it == mInherited.end())
+		return -1;
+	int fd = it->second;
+	mInherited.erase(it);
+	return fd;
+}
+
 } // namespace hermod
 /* EOF */
@@ -15,10 +15,29 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
+#include <map>
+#include <string>
+#include <vector>
+#include "Executor.hpp"
+#include "Listener.hpp"
+#include "Reactor.hpp"
 #include "Router.hpp"
 
 namespace hermod {
 
+/**
+ * @struct ServerStats
+ * @brief Counters of accepted connections
+ *
+ */
+struct ServerStats
+{
+	unsigned long accepted; // Number of accepted connections
+	unsigned long refused;  // Connections closed because of max_conns
+	unsigned long wakeups;  // Number of events on listening sockets
+	unsigned int  batchMax; // Max connections accepted for one event
+};
+
 /**
  * @class Server
  * @brief This class define a generic server skeleton
@@ -26,25 +45,54 @@ namespace hermod {
  * Hermod is designed to serve requests from different sources. A link or an
  * endpoint that can handle requests from outside world is named a server.
  * This class must be used as a parent class for each specific server
- * implementations.
+ * implementations. A server does not wait for events by itself, it registers
+ * his descriptors into the Reactor of the App and receive events through the
+ * processFd() method.
  */
-class Server
+class Server : public ReactorHandler
 {
 public:
 	Server();
 	virtual ~Server();
 
-	virtual int  getFd    (unsigned int index = 0);
+	virtual void drain(void);
+	std::string exportListeners(std::vector<int> &fds);
+	int  getFd(void);
+	unsigned int getLoops(void) const;
+	virtual ServerStats getStats(void);
+	virtual bool isIdle(void);
 	virtual void processFd(int fd = -1);
+	void releaseListeners(void);
 	virtual void send     (const String &content);
 	virtual void send     (const char *data, int len) = 0;
+	virtual void setExecutor(Executor *executor);
+	void setLoops(unsigned int count);
+	virtual void setReactor(Reactor *reactor);
 	virtual void setRouter(Router *router);
+	void setReusePort(bool enable, Server *first = 0);
 	virtual void start(void) = 0;
 	virtual void stop (void) = 0;
 
+protected:
+	void closeListeners(void);
+	Listener *findListener(const std::string &address);
+	Listener *getListener(int fd);
+	void openListeners (int port);
+	static int takeInherited(const std::string &address);
 protected:
 	int mFd;
-	Router *mRouter;
+	Executor *mExecutor;
+	Reactor *mReactor;
+	Router  *mRouter;
+	std::vector<Listener *> mListeners;
+	bool     mReusePort;
+	Server  *mFirst;
+	unsigned int mLoops;
+	ServerStats mStats;
+private:
+	// Listening sockets received from a previous instance (upgrade)
+	static std::map<std::string, int> mInherited;
+	static bool mInheritedLoaded;
 };
 
 } // namespace hermod
@@ -14,12 +14,12 @@
  */
 #include <string>
 #include <cstdlib>
+#include <cerrno>
 #include <cstring>
+#include <sys/socket.h>
 #include <unistd.h>
-#include "Config.hpp"
 #include "Log.hpp"
 #include "Response.hpp"
-#include "Router.hpp"
 #include "ServerFastcgi.hpp"
 #include "String.hpp"
 
@@ -38,6 +38,28 @@ namespace hermod {
 #define FCGI_UNKNOWN_TYPE       11
 #define FCGI_MAXTYPE (FCGI_UNKNOWN_TYPE)
 
+// Mask for flags of FCGI_BEGIN_REQUEST
+#define FCGI_KEEP_CONN  1
+
+// Roles (FCGI_BEGIN_REQUEST)
+#define FCGI_RESPONDER  1
+
+// Values for protocolStatus (FCGI_END_REQUEST)
+#define FCGI_REQUEST_COMPLETE 0
+#define FCGI_CANT_MPX_CONN    1
+#define FCGI_OVERLOADED       2
+#define FCGI_UNKNOWN_ROLE     3
+
+// Max length of the content of a record, the content of longer streams is
+// split into multiple records (multiple of 8 to keep records aligned)
+#define FCGI_MAX_CONTENT  65528
+
+// Initial size of the receive buffer of a connection. The buffer grows (up
+// to the size of the largest record) if needed
+#define FCGI_RX_SIZE       16384
+// Size of the chunks used to save the content of streams
+#define FCGI_CHUNK_SIZE    65536
+
 typedef struct
 {
 	unsigned char version;
@@ -56,21 +78,13 @@ typedef struct
  *
  */
 ServerFastcgi::ServerFastcgi()
-  : Server()
+  : ServerStream(9000)
 {
-	mMode = 0; // Define as server
-	mPort = 9000;
-
-	mState = 0;
-
-	mClients.clear();
-	mRxBuffer = 0;
-	mRxHeaderLength = 0;
-	mBody = 0;
-	mHeaders  = 0;
-
-	mRequest  = 0;
-	mResponse = 0;
+	mCurrent  = 0;
+	mRequests.clear();
+	mRxBuffer.clear();
+	mRxStart  = 0;
+	mRxEnd    = 0;
 }
 
 /**
@@ -79,319 +93,151 @@ ServerFastcgi::ServerFastcgi()
  */
 ServerFastcgi::~ServerFastcgi()
 {
-	// Clean the client objects (if any)
-	while(mClients.size())
-	{
-		ServerFastcgi *c = mClients.back();
-		mClients.pop_back();
-		delete c;
-	}
+	// Delete all the requests in progress (if any)
+	requestClear();
+}
 
-	// Close the client or the server socket (if open)
-	if (mFd >= 0)
-	{
-		close(mFd);
-		mFd = -1;
-	}
+/**
+ * @brief Decode the length of a name or a value (name-value pairs)
+ *
+ * Lengths up to 127 bytes are encoded on one byte, longer ones on four bytes
+ * with the high bit of the first byte set.
+ *
+ * @param data  Pointer to the encoded pairs
+ * @param len   Length of the encoded pairs
+ * @param pos   Position of the length to decode (updated)
+ * @param value Decoded length
+ * @return boolean False if the length is truncated
+ */
+static bool decodeLength(const unsigned char *data, unsigned int len,
+                         unsigned int &pos, unsigned int &value)
+{
+	if (pos >= len)
+		return false;
 
-	// If a Request has been allocated, delete it
-	if (mRequest)
-	{
-		delete mRequest;
-		mRequest = 0;
-	}
-	// If a Response has been allocated, delete it
-	if (mResponse)
-	{
-		delete mResponse;
-		mResponse = 0;
-	}
-	// If a Body has been allocated and not used by Request, delete it
-	if (mBody)
+	if ((data[pos] & 0x80) == 0)
 	{
-		delete mBody;
-		mBody = 0;
-	}
-	// If a Body has been allocated and not pushed into Request
-	if (mHeaders)
-	{
-		delete mHeaders;
-		mHeaders = 0;
+		value = data[pos];
+		pos += 1;
+		return true;
 	}
+
+	if ((pos + 4) > len)
+		return false;
+	value = ((data[pos] & 0x7F) << 24) | (data[pos + 1] << 16) |
+	        (data[pos + 2] <<  8) |  data[pos + 3];
+	pos += 4;
+	return true;
 }
 
 /**
- * @brief Decode a FCGI packet with parameters
+ * @brief Decode the parameters (PARAMS stream) of a request
+ *
+ * Parameters are not copied : the Request get ownership of the PARAMS buffer
+ * and each parameter is saved as a slice of this buffer.
  *
+ * @param req    Pointer to the request that has received parameters
+ * @param buffer Pointer to the content of the PARAMS stream
  */
-void ServerFastcgi::clientDecodeParam(void)
+void ServerFastcgi::clientDecodeParam(FastcgiRequest *req, String *buffer)
 {
-	char *ptr;
+	const unsigned char *data = (const unsigned char *)buffer->data();
+	unsigned int len = buffer->length();
+	unsigned int pos = 0;
 
-	// Sanity check
-	if (mHeaders == 0)
-		return;
-
-	ptr = (char *)mHeaders->data();
+	// Give buffer to Request, slices are valid until Request is deleted
+	req->mRequest->setParamBuffer(buffer);
 
-	// A packet may contains multiple parameters, decode each
-	for (unsigned int i = 0; i < mHeaders->length(); )
+	// The stream may contains multiple parameters, decode each
+	while (pos < len)
 	{
-		int nameLen, valueLen;
-		char argName [128];
-		char argValue[128];
+		unsigned int nameLen, valueLen;
 
-		if (ptr[0] & 0x80)
-		{
-			Log::error() << "Server: HTTP Parameter name too long " << nameLen << Log::endl;
-			return;
-		}
-		if (ptr[1] & 0x80)
+		if ( ! decodeLength(data, len, pos, nameLen) ||
+		     ! decodeLength(data, len, pos, valueLen) ||
+		     (nameLen > (len - pos)) ||
+		     (valueLen > (len - pos - nameLen)) )
 		{
-			Log::error() << "Server: HTTP Parameter value too long " << valueLen << Log::endl;
+			Log::error() << "Server: Malformed FastCGI parameters" << Log::endl;
 			return;
 		}
 
-		// First two bytes contains fields lengths
-		nameLen  = ptr[0];
-		valueLen = ptr[1];
-
-		ptr += 2;
-		i   += 2;
-
-		// Extract the parameter name
-		bzero(argName, 128);
-		strncpy(argName, (char *)ptr, nameLen);
-		ptr += nameLen;
-		i   += nameLen;
-		// Extract the parameter value
-		bzero(argValue, 128);
-		strncpy(argValue, (char *)ptr, valueLen);
-		ptr += valueLen;
-		i   += valueLen;
-
 		// Add this HTTP parameter into Request
-		mRequest->setHeaderParameter(argName, argValue);
+		req->mRequest->addParam((const char *)data + pos, nameLen,
+		                        (const char *)data + pos + nameLen, valueLen);
+		pos += (nameLen + valueLen);
 	}
 }
 
+/**
+ * @brief Create the object used for an accepted connection
+ *
+ * @return ServerStream* Pointer to the new client object
+ */
+ServerStream *ServerFastcgi::clientCreate(void)
+{
+	return new ServerFastcgi();
+}
+
+/**
+ * @brief Handler called when datas are available on a client socket
+ *
+ * Client sockets are registered into the Reactor in edge-triggered mode, so
+ * this method read and process records until the socket is empty (EAGAIN).
+ * Each read takes as many bytes as the receive buffer can hold, then all the
+ * complete records of the buffer are processed.
+ */
 void ServerFastcgi::clientEvent(void)
 {
 	int len;
 
 	try {
-		FCGI_Record   *rec;
-		unsigned int   recLen;
-
 		// Sanity check
 		if (mRouter == 0)
 			throw -3;
 
-		//
-		if (mRxHeaderLength < 8)
+		// Consume all available datas (edge-triggered socket)
+		while (mFd >= 0)
 		{
-			len = 8 - mRxHeaderLength;
-
-			len = read(mFd, mRxHeader + mRxHeaderLength, len);
-			// If read length is 0, socket has been closed
-			if (len == 0)
-				throw -1;
-			// A negative value is returned in case of error
-			if (len < 0)
-				throw runtime_error("ERROR reading from socket");
-
-			mRxHeaderLength += len;
-
-			if (mRxHeaderLength < 8)
-				return;
-
-			rec = (FCGI_Record *)mRxHeader;
-			recLen = (rec->contentLengthB0) | (rec->contentLengthB1 << 8);
-			recLen += rec->paddingLength;
-			mRxBuffer = (unsigned char *)malloc(recLen);
-			if (mRxBuffer == 0)
-				throw std::bad_alloc();
-			mRxLength = 0;
-
-			if (recLen != 0)
+			// Process the records already received (if any)
+			clientParse();
+			if (mFd < 0)
+				break;
+
+			// Stop reading while the web server does not read responses,
+			// or when connection will be closed. Remaining records will be
+			// read when output queue has been flushed (see processFd)
+			if ((mTxQueue.length() > mTxLimit) || ( ! mKeepConn))
+			{
+				flush();
 				return;
-		}
+			}
 
-		//
-		rec = (FCGI_Record *)mRxHeader;
-		recLen = (rec->contentLengthB0) | (rec->contentLengthB1 << 8);
+			// Allocate the receive buffer on first use
+			if (mRxBuffer.size() == 0)
+				mRxBuffer.resize(FCGI_RX_SIZE);
 
-		if (mRxLength < recLen)
-		{
-			// Compute length of data to get
-			len = (recLen + rec->paddingLength) - mRxLength;
-			// Get datas from socket
-			len = read(mFd, mRxBuffer + mRxLength, len);
+			// Get as many datas as possible from socket
+			len = recv(mFd, &mRxBuffer[mRxEnd], mRxBuffer.size() - mRxEnd,
+			           MSG_DONTWAIT);
 			// If read length is 0, socket has been closed
 			if (len == 0)
 				throw -1;
 			// A negative value is returned in case of error
 			if (len < 0)
-				throw runtime_error("ERROR reading from socket");
-
-			// Update length of received datas
-			mRxLength += len;
-			if (mRxLength < (recLen + rec->paddingLength))
-				return;
-		}
-
-		if (rec->type == FCGI_BEGIN_REQUEST)
-		{
-			// Save the request ID
-			mRecId = (rec->requestIdB1 << 8) | rec->requestIdB0;
-
-			// Instanciate a Request
-			mRequest = new Request(this);
-			// Instanciate a Response for this request
-			mResponse = new Response(mRequest);
-			mResponse->setServer(this);
-
-			mState = 1;
-		}
-		else if (rec->type == FCGI_PARAMS)
-		{
-			if (recLen)
-			{
-				char *pIn, *pOut;
-				unsigned int j;
-
-				if (mHeaders)
-				{
-					String *newHeaders;
-					String *oldHeaders = mHeaders;
-					// Allocate a String to hold HTTP headers, and get it
-					newHeaders = new String();
-					newHeaders->reserve(oldHeaders->length() + recLen);
-					// Copy already saved datas
-					pIn  = oldHeaders->data();
-					pOut = newHeaders->data();
-					for (j = 0; j < oldHeaders->length(); j++)
-						*pOut++ = *pIn++;
-					// Append received data into new buffer
-					pIn  = (char *)mRxBuffer;
-					for (j = 0; j < recLen; j++)
-						*pOut++ = *pIn++;
-
-					mHeaders = newHeaders;
-					delete oldHeaders;
-				}
-				else
-				{
-					// Allocate a String to hold HTTP headers, and get it
-					mHeaders = new String();
-					mHeaders->reserve(recLen);
-					// Copy received data into new buffer
-					pIn  = (char *)mRxBuffer;
-					pOut = mHeaders->data();
-					for (j = 0; j < recLen; j++)
-						*pOut++ = *pIn++;
-				}
-			}
-			if (recLen == 0)
-			{
-				if (mHeaders)
-				{
-					clientDecodeParam();
-				}
-				mState = 2;
-			}
-		}
-		else if (rec->type == FCGI_STDIN)
-		{
-			if (recLen)
-			{
-				char *pIn, *pOut;
-				unsigned int j;
-
-				if (mBody)
-				{
-					String *newBody;
-					String *oldBody = mBody;
-					// Allocate a String to hold body, and get it
-					newBody = new String();
-					newBody->reserve(oldBody->length() + recLen);
-					// Copy already saved datas
-					pIn  = oldBody->data();
-					pOut = newBody->data();
-					for (j = 0; j < oldBody->length(); j++)
-						*pOut++ = *pIn++;
-					// Append received data into new buffer
-					pIn  = (char *)mRxBuffer;
-					for (j = 0; j < recLen; j++)
-						*pOut++ = *pIn++;
-
-					mBody = newBody;
-					delete oldBody;
-				}
-				else
-				{
-					// Allocate a String to hold body, and get it
-					mBody = new String();
-					mBody->reserve(recLen);
-					// Copy received data into new buffer
-					pIn  = (char *)mRxBuffer;
-					pOut = mBody->data();
-					for (j = 0; j < recLen; j++)
-						*pOut++ = *pIn++;
-				}
-			}
-			if (recLen == 0)
 			{
-				// Set this body into Request (give owership of buffer)
-				mRequest->setBody(mBody);
-				mBody = 0;
-
-				Route *route = mRouter->find(mRequest);
-				if ( ! route)
-				{
-					Log::info() << "Server: Not found: "
-					            << mRequest->getUri(0) << Log::endl;
-					route = mRouter->find(":404:");
-				}
-				if (route)
+				// No more data available for now, send pending records
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
 				{
-					Page *page = route->newPage();
-					if (page)
-					{
-						mResponse->catchCout();
-						try {
-							page->setRequest(mRequest);
-							page->setReponse(mResponse);
-							page->initSession();
-							page->process();
-						} catch (std::exception &e) {
-							Log::warning() << "Server: Exception during page processing: "
-								       << e.what() << Log::endl;
-						}
-						mResponse->releaseCout();
-						route->freePage(page);
-					}
-					else
-					{
-						mResponse->header()->setRetCode(404, "Not found");
-					}
+					flush();
+					return;
 				}
-				else
-					mResponse->header()->setRetCode(404, "Not found");
-
-				mResponse->send();
-				sendEndRequest();
-				close(mFd);
-				mFd = -1;
+				if (errno == EINTR)
+					continue;
+				throw runtime_error("ERROR reading from socket");
 			}
-		}
-
-		// Processing complete, discard packet
-		free(mRxBuffer);
-		mRxBuffer = 0;
-		mRxLength = 0;
-		mRxHeaderLength = 0;
-
+			mRxEnd += len;
+		} /* while */
 	} catch(int ecode) {
 		Log::error() << "Server: clientEvent " << mFd
 		             << " ecode=" << ecode << Log::endl;
@@ -407,80 +253,292 @@ void ServerFastcgi::clientEvent(void)
 	}
 }
 
-int ServerFastcgi::getFd(unsigned int index)
+/**
+ * @brief Test if the connection has no request in progress
+ *
+ * @return boolean True if there is no request
+ */
+bool ServerFastcgi::clientIdle(void)
 {
-	int fd;
+	return mRequests.empty();
+}
 
-	if (index == 0)
-		fd = mFd;
-	else
+/**
+ * @brief Process all the complete records of the receive buffer
+ *
+ * When the last record of the buffer is incomplete, it is kept (moved to the
+ * beginning of the buffer if needed) and will be processed when the missing
+ * datas are received.
+ */
+void ServerFastcgi::clientParse(void)
+{
+	while (mFd >= 0)
 	{
-		ServerFastcgi *client = 0;
+		unsigned int avail = (mRxEnd - mRxStart);
+		unsigned int need  = 8;
+		FCGI_Record *rec = 0;
 
-		if (index <= mClients.size())
+		if (avail >= 8)
 		{
-			client = mClients.at(index - 1);
-			fd = client->getFd();
+			rec  = (FCGI_Record *)&mRxBuffer[mRxStart];
+			need = 8 + ((rec->contentLengthB1 << 8) | rec->contentLengthB0)
+			         + rec->paddingLength;
 		}
-		else
-			fd = -1;
-	}
 
-	return(fd);
+		// The record is incomplete, more datas must be received
+		if (avail < need)
+		{
+			// All datas has been processed, buffer can be reused from start
+			if (avail == 0)
+			{
+				mRxStart = 0;
+				mRxEnd   = 0;
+			}
+			// Not enough space at the end of the buffer for the record
+			else if ((mRxStart + need) > mRxBuffer.size())
+			{
+				memmove(&mRxBuffer[0], &mRxBuffer[mRxStart], avail);
+				mRxStart = 0;
+				mRxEnd   = avail;
+				if (need > mRxBuffer.size())
+					mRxBuffer.resize(need);
+			}
+			return;
+		}
+
+		// Process the record (content is used directly from buffer)
+		mRxStart += need;
+		clientRecord(rec->type,
+		             (rec->requestIdB1 << 8) | rec->requestIdB0,
+		             (unsigned char *)rec + 8,
+		             (rec->contentLengthB1 << 8) | rec->contentLengthB0);
+		// Close the connection if requested
+		clientClose();
+
+		// Stop processing records when output must be sent first
+		if ((mTxQueue.length() > mTxLimit) || ( ! mKeepConn))
+			return;
+	}
 }
 
 /**
- * @brief Handler called when an event is detected on server socket
+ * @brief Process a complete record received from the web server
  *
+ * One connection can carry many requests at the same time (multiplexing).
+ * Each record is associated with the in-flight request with the same ID.
+ *
+ * @param type Type of the record
+ * @param id   Request ID of the record
+ * @param data Pointer to the content of the record
+ * @param len  Length of the content
  */
-void ServerFastcgi::processFd(int fd)
+void ServerFastcgi::clientRecord(int type, unsigned short id,
+                                 unsigned char *data, unsigned int len)
 {
-	if (mMode == 1)
+	FastcgiRequest *req = 0;
+
+	// Management records (request ID 0)
+	if (type == FCGI_GET_VALUES)
+	{
+		sendValues(data, len);
+		return;
+	}
+	// Unknown (or unsupported) record type
+	if ((type != FCGI_BEGIN_REQUEST) && (type != FCGI_ABORT_REQUEST) &&
+	    (type != FCGI_PARAMS)        && (type != FCGI_STDIN) &&
+	    (type != FCGI_DATA))
 	{
-		clientEvent();
+		unsigned char body[8];
+		memset(body, 0, 8);
+		body[0] = type;
+		sendRecord(FCGI_UNKNOWN_TYPE, 0, (char *)body, 8);
+		return;
 	}
-	else
+
+	// Search the request associated with this ID
+	std::map<unsigned short, FastcgiRequest *>::iterator it;
+	it = mRequests.find(id);
+	if (it != mRequests.end())
+		req = it->second;
+
+	if (type == FCGI_BEGIN_REQUEST)
 	{
-		if ( (fd == mFd) || (fd == -1) )
-			serverEvent();
+		if (req)
+		{
+			Log::warning() << "Server: FastCGI request ID " << id
+			               << " already in progress" << Log::endl;
+			return;
+		}
+		// Only the "responder" role is supported
+		if ((len < 3) || (((data[0] << 8) | data[1]) != FCGI_RESPONDER))
+		{
+			sendEndRequest(id, FCGI_UNKNOWN_ROLE);
+			return;
+		}
+		// Refuse the request if the max number of requests is reached
+		if (isOverloaded())
+		{
+			Log::warning() << "Server: Overloaded, request refused" << Log::endl;
+			sendEndRequest(id, FCGI_OVERLOADED);
+			if ( ! (data[2] & FCGI_KEEP_CONN))
+				mKeepConn = false;
+			return;
+		}
+
+		req = new FastcgiRequest(id);
+		// Test if the connection must be kept open after request
+		req->mKeepConn = (data[2] & FCGI_KEEP_CONN);
+
+		// Instanciate a Request
+		req->mRequest = new Request(this);
+		// Instanciate a Response for this request
+		req->mResponse = new Response(req->mRequest);
+		req->mResponse->setServer(this);
+		// The request uses the current router until the end, even if a
+		// new one is set by a reload
+		req->mRouter = mRouter;
+		req->mRouter->acquire();
+
+		mRequests[id] = req;
+		requestAcquire();
+		return;
+	}
+
+	// Other records must be associated with a known request
+	if (req == 0)
+		return;
+
+	if (type == FCGI_ABORT_REQUEST)
+	{
+		// The page is running, request is ended when page is complete
+		if (req->mRunning)
+		{
+			req->mAborted = true;
+			return;
+		}
+		sendEndRequest(id);
+		requestRemove(req);
+	}
+	// No more datas are expected when the page is running
+	else if (req->mRunning)
+		return;
+	// Refuse a stream larger than the limit : the request is ended, and
+	// the connection closed without reading the remaining records
+	else if (((type == FCGI_PARAMS) &&
+	          ((req->mParams.length() + len) > mBodyLimit)) ||
+	         ((type == FCGI_STDIN) &&
+	          ((req->mStdin.length()  + len) > mBodyLimit)))
+	{
+		Log::warning() << "Server: FastCGI request too large (request ID "
+		               << id << ")" << Log::endl;
+		sendEndRequest(id);
+		requestRemove(req);
+		mKeepConn = false;
+	}
+	else if (type == FCGI_PARAMS)
+	{
+		// The stream has been ended by an empty record, parameters of the
+		// Request are slices of his buffer : later records are ignored
+		if (req->mParamsDone)
+		{
+			Log::warning() << "Server: FastCGI PARAMS record after end of "
+			               << "stream (request ID " << id << ")" << Log::endl;
+			return;
+		}
+		if (len)
+			req->mParams.append(data, len);
 		else
 		{
-			ServerFastcgi *client;
+			req->mParamsDone = true;
+			clientDecodeParam(req, req->mParams.release());
+		}
+	}
+	else if (type == FCGI_STDIN)
+	{
+		if (len)
+			req->mStdin.append(data, len);
+		else
+			requestProcess(req);
+	}
+}
 
-			// Search the client associated with requested fd
-			std::vector<ServerFastcgi *>::iterator it;
-			for (it = mClients.begin(); it != mClients.end(); ++it)
-			{
-				if (fd == (*it)->getFd())
-				{
-					client = *it;
-					break;
-				}
-			}
+/**
+ * @brief Process a request when all his datas has been received
+ *
+ * The page is processed by ServerStream, then the response is sent by
+ * requestDone.
+ *
+ * @param req Pointer to the request to process
+ */
+void ServerFastcgi::requestProcess(FastcgiRequest *req)
+{
+	// Set the body into Request (give owership of buffer)
+	if (req->mStdin.length())
+		req->mRequest->setBody(req->mStdin.release());
 
-			// If a client has been found
-			if (client)
-			{
-				client->processFd();
-				// If the client socket has ben closed
-				if (client->getFd() < 0)
-				{
-					// Search the client into local cache
-					std::vector<ServerFastcgi *>::iterator it;
-					for (it = mClients.begin(); it != mClients.end(); ++it)
-					{
-						if (client != (*it))
-							continue;
-						// Remove client from local cache
-						mClients.erase(it);
-						// Delete it
-						delete client;
-						break;
-					}
-				}
-			}
+	requestSubmit(req);
+}
+
+/**
+ * @brief Send the response of a request, when his page is complete
+ *
+ * @param request Pointer to the processed request
+ */
+void ServerFastcgi::requestDone(StreamRequest *request)
+{
+	FastcgiRequest *req = static_cast<FastcgiRequest *>(request);
+	Response *response = req->mResponse;
+
+	// Connection closed (or request aborted) during page processing
+	if ((mFd < 0) || req->mAborted)
+	{
+		if (mFd >= 0)
+		{
+			sendEndRequest(req->mId);
+			flush();
 		}
+		requestRemove(req);
+		return;
 	}
+
+	// Records sent by the Response use the ID of the current request
+	mCurrent = req;
+	response->send();
+	// Send a STDOUT record without content to finish STDOUT step
+	send(0, 0);
+	mCurrent = 0;
+	sendEndRequest(req->mId);
+	// Response datas are referenced by the output queue, write them now
+	flush();
+
+	// If the web server does not want to reuse the connection
+	if ( ! req->mKeepConn)
+		mKeepConn = false;
+
+	requestRemove(req);
+}
+
+/**
+ * @brief Remove a request from the list of in-flight requests, and delete it
+ *
+ * @param req Pointer to the request to remove
+ */
+void ServerFastcgi::requestRemove(FastcgiRequest *req)
+{
+	mRequests.erase(req->mId);
+	delete req;
+
+	requestRelease();
+}
+
+/**
+ * @brief Delete all the requests in progress of the connection
+ *
+ */
+void ServerFastcgi::requestClear(void)
+{
+	while (mRequests.size())
+		requestRemove(mRequests.begin()->second);
 }
 
 /**
@@ -491,198 +549,239 @@ void ServerFastcgi::processFd(int fd)
  */
 void ServerFastcgi::send(const char *data, int len)
 {
-	FCGI_Record rec;
-
-	// Create a FCGI record header
-	rec.version = 1;
-	rec.type    = FCGI_STDOUT;
-	rec.requestIdB1     = (mRecId <<   8);
-	rec.requestIdB0     = (mRecId & 0xFF);
-	rec.contentLengthB1 = ( len   >>   8);
-	rec.contentLengthB0 = ( len   & 0xFF);
-	rec.paddingLength   = 0;
-	rec.reserved        = 0;
-	// Send it
-	write(mFd, &rec, 8);
-
-	if (len > 0)
-		write(mFd, data, len);
+	// Datas can only be sent as response of a request
+	if (mCurrent == 0)
+		return;
 
-	return;
+	// Response datas stay valid until the request is finished, no copy
+	sendRecord(FCGI_STDOUT, mCurrent->mId, data, len, true);
 }
 
 /**
  * @brief Finish a FCGI transaction by sending END_REQUEST
  *
+ * @param id     Request ID of the finished request
+ * @param status Protocol status (complete, overloaded, unknown role ...)
  */
-void ServerFastcgi::sendEndRequest(void)
+void ServerFastcgi::sendEndRequest(unsigned short id, int status)
 {
-	FCGI_Record rec;
 	char buffer[8];
 
-	// Send a STDOUT record without content to finish STDOUT step
-	send(0, 0);
-
-	// Create a FCGI record header
-	rec.version = 1;
-	rec.type    = FCGI_END_REQUEST;
-	rec.requestIdB1     = (mRecId <<   8);
-	rec.requestIdB0     = (mRecId & 0xFF);
-	rec.contentLengthB1 = 0;
-	rec.contentLengthB0 = 8;
-	rec.paddingLength   = 0;
-	rec.reserved        = 0;
-	// Send it
-	write(mFd, &rec, 8);
-
 	// Set appStatus value
 	buffer[0] = 0;
 	buffer[1] = 0;
 	buffer[2] = 0;
 	buffer[3] = 0;
 	// Set protocolStatus value
-	buffer[4] = 0; // FCGI_REQUEST_COMPLETE
+	buffer[4] = status;
 	// Reserved
 	buffer[5] = 0;
 	buffer[6] = 0;
 	buffer[7] = 0;
 	// Send it
-	write(mFd, buffer, 8);
+	sendRecord(FCGI_END_REQUEST, id, buffer, 8);
 }
 
-void ServerFastcgi::serverEvent(void)
+/**
+ * @brief Send a FastCGI record to the web server
+ *
+ * Records are added to the output queue, they are really written on the next
+ * flush. When the content is longer than the max size of a record, it is
+ * split into multiple records. Each record is padded to a multiple of 8 bytes.
+ *
+ * @param type Type of the record
+ * @param id   Request ID (0 for management records)
+ * @param data Pointer to the content of the record
+ * @param len  Length of the content
+ * @param ref  True if data stay valid until next flush (no copy)
+ */
+void ServerFastcgi::sendRecord(int type, unsigned short id,
+                               const char *data, unsigned int len, bool ref)
 {
-	ServerFastcgi *client = 0;
-	int fd = -1;
+	static const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	FCGI_Record rec;
 
-	if (mRouter == 0)
+	do
 	{
-		Log::error() << "Server-FastCGI: Failed to process FD (no router)" << Log::endl;
-		Log::sync();
-		// Stop the server to avoid infinite error loop
-		stop();
-		return;
-	}
-
-	try {
-		struct sockaddr_in client_addr;
-		socklen_t clilen;
+		unsigned int recLen = len;
+		if (recLen > FCGI_MAX_CONTENT)
+			recLen = FCGI_MAX_CONTENT;
+		unsigned int padLen = (8 - (recLen & 7)) & 7;
+
+		// Create a FCGI record header
+		rec.version = 1;
+		rec.type    = type;
+		rec.requestIdB1     = (id     >>   8);
+		rec.requestIdB0     = (id     & 0xFF);
+		rec.contentLengthB1 = (recLen >>   8);
+		rec.contentLengthB0 = (recLen & 0xFF);
+		rec.paddingLength   = padLen;
+		rec.reserved        = 0;
+		mTxQueue.append((char *)&rec, 8);
+
+		// Add the content of the record
+		if (ref)
+			mTxQueue.appendRef(data, recLen);
+		else
+			mTxQueue.append(data, recLen);
+		mTxQueue.appendRef(padding, padLen);
 
-		clilen = sizeof(client_addr);
-		fd = accept(mFd, (struct sockaddr *)&client_addr, &clilen);
-		if (fd < 0) 
-			throw runtime_error("ERROR on accept");
+		data += recLen;
+		len  -= recLen;
+	} while (len > 0);
+}
 
-		// Create a new object to handle client connection
-		client = new ServerFastcgi();
-		client->setClient(fd);
-		client->setRouter(mRouter);
+/**
+ * @brief Answer to a FCGI_GET_VALUES management record
+ *
+ * The web server can query some variables to know the capabilities of the
+ * application. Only known variables are returned into the result record.
+ * Limits are the ones of the listening server (see ServerStream::start), they
+ * are based on configuration and on the number of descriptors available for
+ * the process. These limits apply to each event loop : with many reactors,
+ * the values are multiplied by the number of loops that share the addresses.
+ *
+ * @param data Pointer to the content of the GET_VALUES record
+ * @param len  Length of the content
+ */
+void ServerFastcgi::sendValues(unsigned char *data, unsigned int len)
+{
+	ServerFastcgi *server = static_cast<ServerFastcgi *>(mParent ? mParent : this);
+	unsigned int loops = server->getLoops();
+	std::string result;
 
-		mClients.push_back(client);
-	} catch(...) {
-		Log::error() << "Server: Failed to accept incoming connection" << Log::endl;
-		// Delete/clean the client object (if any)
-		if (client)
-		{
-			delete client;
-			client = 0;
-		}
-		// Close the socket (if already opened)
-		if (fd >= 0)
-			close(fd);
+	for (unsigned int i = 0; i < len; )
+	{
+		unsigned int nameLen, valueLen;
+		if ( ! decodeLength(data, len, i, nameLen) ||
+		     ! decodeLength(data, len, i, valueLen) ||
+		     (nameLen > (len - i)) || (valueLen > (len - i - nameLen)))
+			break;
+		std::string name((char *)data + i, nameLen);
+		i += (nameLen + valueLen);
+
+		std::string value;
+		if (name == "FCGI_MAX_CONNS")
+			value = String::number(server->mMaxConns * loops).toStdStr();
+		else if (name == "FCGI_MAX_REQS")
+			value = String::number(server->mMaxReqs * loops).toStdStr();
+		else if (name == "FCGI_MPXS_CONNS")
+			value = "1";
+		else
+			continue;
 
-		throw;
+		result += (char)name.length();
+		result += (char)value.length();
+		result += name;
+		result += value;
 	}
+
+	// Send the result (management record, ID is 0)
+	sendRecord(FCGI_GET_VALUES_RESULT, 0, result.data(), result.length());
 }
 
-void ServerFastcgi::setClient(int fd)
-{
-	// Define this object as client
-	mMode = 1;
+// ------------------------- FastCGI requests -------------------------
 
-	// Save the specified socket
-	mFd = fd;
+/**
+ * @brief Constructor of an in-flight request
+ *
+ * @param id FastCGI request ID
+ */
+FastcgiRequest::FastcgiRequest(unsigned short id)
+  : StreamRequest()
+{
+	mId       = id;
+	mKeepConn = false;
+	mAborted  = false;
+	mParamsDone = false;
 }
 
+// ------------------------- FastCGI streams -------------------------
+
 /**
- * @brief Set the (tcp) port number where server must listen
+ * @brief Default constructor
  *
- * @param num Port number to use
  */
-void ServerFastcgi::setPort(int num)
+FastcgiStream::FastcgiStream()
 {
-	mPort = num;
+	mLength = 0;
 }
 
 /**
- * @brief Start the FCGI server
+ * @brief Append the content of a record at the end of the stream
  *
- * This method allow to start FCGI server.
+ * @param data Pointer to the datas to append
+ * @param len  Length of the datas
  */
-void ServerFastcgi::start(void)
+void FastcgiStream::append(const unsigned char *data, unsigned int len)
 {
-	Config *cfg = Config::getInstance();
+	while (len)
+	{
+		// Allocate a new chunk when the last one is full
+		if ((mChunks.size() == 0) ||
+		    (mChunks.back().length() == mChunks.back().capacity()))
+		{
+			mChunks.push_back(std::string());
+			mChunks.back().reserve(FCGI_CHUNK_SIZE);
+		}
+		std::string &chunk = mChunks.back();
 
-	// If a server socket already defined
-	if (mFd > 0)
-		// Nothing to do, server is started
-		return;
+		unsigned int part = chunk.capacity() - chunk.length();
+		if (part > len)
+			part = len;
+		chunk.append((const char *)data, part);
 
-	try {
-		// Define the TCP port to listen
-		ConfigKey *keyPort = cfg->getKey("global", "port");
-		if (keyPort)
-			mPort = keyPort->getInteger();
-	} catch(...) {
-		// In case of error, use default config
-		mPort = 9000;
+		mLength += part;
+		data    += part;
+		len     -= part;
 	}
+}
 
-	try {
-		struct sockaddr_in serv_addr;
-
-		// First, create a socket for input connections
-		mFd = socket(AF_INET, SOCK_STREAM, 0);
-		if (mFd < 0)
-			throw std::runtime_error("Failed to create socket");
-
-		// Set the socket configuration
-		memset((char *)&serv_addr, 0, sizeof(serv_addr));
-		serv_addr.sin_family = AF_INET;
-		serv_addr.sin_addr.s_addr = INADDR_ANY;
-		serv_addr.sin_port = htons(mPort);
-		// Start listening on server socket
-		if (bind(mFd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
-			throw std::runtime_error("Failed to bind socket");
-		listen(mFd, 5);
-
-	} catch (std::exception &e) {
-		Log::error() << "Server: Server NOT started: "
-		             << e.what() << Log::endl;
-	} catch (...) {
-		Log::error() << "Server: Server NOT started: "
-		             << "Unknown reason" << Log::endl;
-		if (mFd >= 0)
-		{
-			close(mFd);
-			mFd = -1;
-		};
-	}
+/**
+ * @brief Delete all the datas of the stream
+ *
+ */
+void FastcgiStream::clear(void)
+{
+	mChunks.clear();
+	mLength = 0;
+}
+
+/**
+ * @brief Get the length of the stream
+ *
+ * @return size_t Number of bytes saved into the stream
+ */
+size_t FastcgiStream::length(void) const
+{
+	return mLength;
 }
 
 /**
- * @brief Stop the FastCGI server.
+ * @brief Get the whole stream as one String, and clear the stream
  *
- * This method allow to stop FastCGI server without deleting it.
+ * @return String* Pointer to a new String (the caller must delete it)
  */
-void ServerFastcgi::stop(void)
+String *FastcgiStream::release(void)
 {
-	if (mFd >= 0)
+	String *str = new String();
+
+	if (mLength == 0)
+		return str;
+
+	// Allocate the String with the final length, then copy chunks
+	str->reserve(mLength);
+	char *ptr = str->data();
+	std::deque<std::string>::iterator it;
+	for (it = mChunks.begin(); it != mChunks.end(); ++it)
 	{
-		// Close FastCGI server socket
-		close(mFd);
-		mFd = -1;
+		memcpy(ptr, it->data(), it->length());
+		ptr += it->length();
 	}
+
+	clear();
+
+	return str;
 }
 
 } // namespace hermod
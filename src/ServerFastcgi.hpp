@@ -15,45 +15,91 @@
 #ifndef SERVER_FASTCGI_HPP
 #define SERVER_FASTCGI_HPP
 
+#include <deque>
+#include <map>
+#include <string>
 #include <vector>
-#include "Request.hpp"
-#include "Response.hpp"
-#include "Server.hpp"
+#include "ServerStream.hpp"
 
 namespace hermod {
 
-class ServerFastcgi : public Server
+/**
+ * @class FastcgiStream
+ * @brief Storage used to collect the content of a FastCGI stream
+ *
+ * Streams (PARAMS, STDIN) are received as a sequence of records. Their content
+ * is saved into large chunks, so previous datas are never copied again when a
+ * new record is received. The whole stream is copied only once, at the end.
+ */
+class FastcgiStream
+{
+public:
+	FastcgiStream();
+	void    append (const unsigned char *data, unsigned int len);
+	void    clear  (void);
+	size_t  length (void) const;
+	String *release(void);
+private:
+	std::deque<std::string> mChunks;
+	size_t mLength;
+};
+
+/**
+ * @class FastcgiRequest
+ * @brief Context of a FastCGI request in progress on a connection
+ *
+ */
+class FastcgiRequest : public StreamRequest
+{
+	friend class ServerFastcgi;
+public:
+	explicit FastcgiRequest(unsigned short id);
+private:
+	unsigned short mId;
+	bool      mKeepConn;
+	bool      mAborted;
+	bool      mParamsDone;   // End of the PARAMS stream has been received
+	FastcgiStream mParams;
+	FastcgiStream mStdin;
+};
+
+/**
+ * @class ServerFastcgi
+ * @brief Native implementation of a FastCGI server
+ *
+ * Connections are handled by ServerStream, this class decodes the records.
+ * A connection can carry multiple requests at the same time, they are
+ * identified by their FastCGI request ID.
+ */
+class ServerFastcgi : public ServerStream
 {
 public:
 	ServerFastcgi();
 	~ServerFastcgi();
-	int  getFd    (unsigned int index = 0);
-	void processFd(int fd = -1);
 	void send     (const char *data, int len);
-	void setClient(int fd);
-	void setPort(int num);
-	void start(void);
-	void stop (void);
 protected:
-	void clientDecodeParam(void);
+	void clientDecodeParam(FastcgiRequest *req, String *buffer);
+	ServerStream *clientCreate(void);
 	void clientEvent(void);
-	void serverEvent(void);
-	void sendEndRequest(void);
-private:
-	int mMode;
-	int mPort;
-	int mState;
-	std::vector <ServerFastcgi *> mClients;
-	unsigned char  mRxHeader[8];
-	unsigned int   mRxHeaderLength;
-	unsigned char *mRxBuffer;
-	unsigned int   mRxLength;
-private:
-	unsigned short mRecId;
-	String   *mHeaders;
-	String   *mBody;
-	Request  *mRequest;
-	Response *mResponse;
+	bool clientIdle (void);
+	void clientParse(void);
+	void clientRecord(int type, unsigned short id,
+	                  unsigned char *data, unsigned int len);
+	void requestClear  (void);
+	void requestDone   (StreamRequest *req);
+	void requestProcess(FastcgiRequest *req);
+	void requestRemove (FastcgiRequest *req);
+	void sendEndRequest(unsigned short id, int status = 0);
+	void sendRecord(int type, unsigned short id,
+	                const char *data, unsigned int len, bool ref = false);
+	void sendValues(unsigned char *data, unsigned int len);
+protected:
+	std::vector<unsigned char> mRxBuffer;
+	unsigned int   mRxStart;
+	unsigned int   mRxEnd;
+protected:
+	std::map<unsigned short, FastcgiRequest *> mRequests;
+	FastcgiRequest *mCurrent;
 };
 
 } // namespace hermod
@@ -0,0 +1,1068 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <string>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "Response.hpp"
+#include "ServerHttp.hpp"
+#include "String.hpp"
+
+namespace hermod {
+
+// Initial size of the receive buffer of a connection. The buffer grows (up
+// to the max size of a request header) if needed
+#define HTTP_RX_SIZE       16384
+// Max size of the header of a request (request line and fields)
+#define HTTP_HEAD_MAX      65536
+// Max length of a line of the chunked encoding (chunk size and extensions)
+#define HTTP_LINE_MAX       4096
+// Initial allocation for the body of a request, it grows when needed (the
+// Content-Length given by the client is not trusted for allocation)
+#define HTTP_BODY_RESERVE  1048576
+// Max amount of datas read (and dropped) from a client after an error, before
+// closing the connection
+#define HTTP_LINGER_MAX    1048576
+
+// States of the reception of a request body
+#define HTTP_BODY_NONE       0
+#define HTTP_BODY_DATA       1
+#define HTTP_BODY_CHUNK_SIZE 2
+#define HTTP_BODY_CHUNK_DATA 3
+#define HTTP_BODY_CHUNK_END  4
+#define HTTP_BODY_TRAILER    5
+
+/**
+ * @brief Default constructor
+ *
+ */
+ServerHttp::ServerHttp()
+  : ServerStream(8080)
+{
+	mCurrent  = 0;
+	mReply    = 0;
+	mRxBuffer.clear();
+	mRxStart  = 0;
+	mRxEnd    = 0;
+	mRxScan   = 0;
+	mLinger   = 0;
+	mShutdown = false;
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+ServerHttp::~ServerHttp()
+{
+	// Delete the request in progress (if any)
+	requestClear();
+}
+
+/**
+ * @brief Compare a string with a name, without case
+ *
+ * @param str  Pointer to the string to test
+ * @param len  Length of the string
+ * @param name Name to compare with (nul terminated)
+ * @return boolean True if the string is the same name
+ */
+static bool isName(const char *str, unsigned int len, const char *name)
+{
+	return ((strlen(name) == len) && (strncasecmp(str, name, len) == 0));
+}
+
+/**
+ * @brief Test if a comma separated list of tokens contains a token
+ *
+ * This is used to read header fields like "Connection" or
+ * "Transfer-Encoding" where tokens are not case sensitive.
+ *
+ * @param str   Pointer to the list of tokens
+ * @param len   Length of the list
+ * @param token Token to search (nul terminated)
+ * @param last  If true, the token must be the last one of the list
+ * @return boolean True if the token has been found
+ */
+static bool hasToken(const char *str, unsigned int len,
+                     const char *token, bool last = false)
+{
+	bool found = false;
+	unsigned int pos = 0;
+
+	while (pos < len)
+	{
+		// Skip separators and spaces before the token
+		while ((pos < len) &&
+		       ((str[pos] == ',') || (str[pos] == ' ') || (str[pos] == '\t')))
+			pos++;
+		if (pos >= len)
+			break;
+		unsigned int start = pos;
+		while ((pos < len) && (str[pos] != ','))
+			pos++;
+		unsigned int end = pos;
+		while ((end > start) && ((str[end - 1] == ' ') || (str[end - 1] == '\t')))
+			end--;
+		found = isName(str + start, end - start, token);
+		if (found && ! last)
+			return true;
+	}
+	return found;
+}
+
+/**
+ * @brief Receive the body of a request (if any)
+ *
+ * Datas are consumed from the receive buffer as soon as they are received,
+ * so the buffer never holds more than the header of the next request. The
+ * chunked encoding is decoded on the fly.
+ *
+ * @param req Pointer to the request that receives a body
+ * @return integer 1 if the body is complete, 0 if more datas are needed,
+ *                 -1 if the body is malformed, or -2 if it is too large
+ */
+int ServerHttp::clientBody(HttpRequest *req)
+{
+	while (1)
+	{
+		const char  *data  = &mRxBuffer[0] + mRxStart;
+		unsigned int avail = (mRxEnd - mRxStart);
+
+		if (req->mBodyState == HTTP_BODY_NONE)
+			return 1;
+
+		// Content of the body (or of a chunk)
+		if ((req->mBodyState == HTTP_BODY_DATA) ||
+		    (req->mBodyState == HTTP_BODY_CHUNK_DATA))
+		{
+			unsigned int part = avail;
+			if (part > req->mBodyLeft)
+				part = req->mBodyLeft;
+			req->mBody.append(data, part);
+			req->mBodyLeft -= part;
+			mRxStart       += part;
+			if (req->mBodyLeft)
+				return 0;
+			if (req->mBodyState == HTTP_BODY_DATA)
+				req->mBodyState = HTTP_BODY_NONE;
+			else
+				req->mBodyState = HTTP_BODY_CHUNK_END;
+			continue;
+		}
+
+		// Other states of the chunked encoding work with complete lines
+		const char *eol = (const char *)memchr(data, '\n', avail);
+		if (eol == 0)
+			return (avail > HTTP_LINE_MAX) ? -1 : 0;
+		unsigned int lineLen = (eol - data);
+		if (lineLen && (data[lineLen - 1] == '\r'))
+			lineLen--;
+		mRxStart += (eol - data) + 1;
+
+		if (req->mBodyState == HTTP_BODY_CHUNK_SIZE)
+		{
+			unsigned long long size = 0;
+			unsigned int i;
+			for (i = 0; i < lineLen; i++)
+			{
+				int c = data[i];
+				if      ((c >= '0') && (c <= '9')) c = c - '0';
+				else if ((c >= 'a') && (c <= 'f')) c = c - 'a' + 10;
+				else if ((c >= 'A') && (c <= 'F')) c = c - 'A' + 10;
+				else
+					break;
+				// Refuse sizes that can not be handled
+				if (size >> 40)
+					return -1;
+				size = (size << 4) | c;
+			}
+			// The whole body must not exceed the limit
+			if (size > (mBodyLimit - std::min(mBodyLimit,
+			                                  (unsigned long long)req->mBody.length())))
+				return -2;
+			// At least one digit, then chunk extensions (ignored)
+			if ((i == 0) || ((i < lineLen) && (data[i] != ';') &&
+			                 (data[i] != ' ') && (data[i] != '\t')))
+				return -1;
+			if (size == 0)
+				req->mBodyState = HTTP_BODY_TRAILER;
+			else
+			{
+				req->mBodyLeft  = size;
+				req->mBodyState = HTTP_BODY_CHUNK_DATA;
+			}
+		}
+		else if (req->mBodyState == HTTP_BODY_CHUNK_END)
+		{
+			// A chunk must be followed by an empty line
+			if (lineLen)
+				return -1;
+			req->mBodyState = HTTP_BODY_CHUNK_SIZE;
+		}
+		else if (req->mBodyState == HTTP_BODY_TRAILER)
+		{
+			// Trailer fields are ignored, an empty line ends the body
+			if (lineLen == 0)
+			{
+				req->mBodyState = HTTP_BODY_NONE;
+				return 1;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Close the connection of a client
+ *
+ * After an error, the connection is not closed immediately : datas sent by
+ * the client may still be in transit, and closing the socket with unread
+ * datas resets the connection (the error response may be lost). When the
+ * response has been sent, the output is shut down and the datas received
+ * are dropped until the client closes (lingering close).
+ *
+ * @return boolean True if the connection has been closed
+ */
+bool ServerHttp::clientClose(void)
+{
+	if ((mLinger == 0) || (mFd < 0))
+		return ServerStream::clientClose();
+
+	if ( ! mShutdown)
+	{
+		// Send the error response first
+		flush();
+		if ((mFd >= 0) && ( ! mTxQueue.isEmpty()))
+			return false;
+		requestClear();
+		if (mFd < 0)
+			return true;
+		shutdown(mFd, SHUT_WR);
+		mShutdown = true;
+	}
+
+	// Drop received datas until the client closes the connection
+	while (1)
+	{
+		char buffer[4096];
+		int len = recv(mFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if ((len < 0) && (errno == EINTR))
+			continue;
+		if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			return false;
+		if ((len <= 0) || ((unsigned int)len >= mLinger))
+			break;
+		mLinger -= len;
+	}
+	close(mFd);
+	mFd = -1;
+	return true;
+}
+
+/**
+ * @brief Create the object used for an accepted connection
+ *
+ * @return ServerStream* Pointer to the new client object
+ */
+ServerStream *ServerHttp::clientCreate(void)
+{
+	return new ServerHttp();
+}
+
+/**
+ * @brief Handler called when datas are available on a client socket
+ *
+ * Client sockets are registered into the Reactor in edge-triggered mode, so
+ * this method read and process requests until the socket is empty (EAGAIN).
+ * While the page of a request is running, the socket is not read : it will
+ * be read again when the page is complete (see clientResume).
+ */
+void ServerHttp::clientEvent(void)
+{
+	int len;
+
+	try {
+		// Sanity check
+		if (mRouter == 0)
+			throw -3;
+
+		// Allocate the receive buffer on first use
+		if (mRxBuffer.size() == 0)
+			mRxBuffer.resize(HTTP_RX_SIZE);
+
+		// Consume all available datas (edge-triggered socket)
+		while (mFd >= 0)
+		{
+			// Process the requests already received (if any)
+			clientParse();
+			if (mFd < 0)
+				break;
+
+			// The connection will be closed, no more request is read
+			if ( ! mKeepConn)
+			{
+				clientClose();
+				return;
+			}
+			// Stop reading while the client does not read responses, or
+			// when a page is running
+			if ((mTxQueue.length() > mTxLimit) ||
+			    (mCurrent && mCurrent->mRunning))
+			{
+				flush();
+				return;
+			}
+
+			// Get as many datas as possible from socket
+			len = recv(mFd, &mRxBuffer[mRxEnd], mRxBuffer.size() - mRxEnd,
+			           MSG_DONTWAIT);
+			// If read length is 0, socket has been closed
+			if (len == 0)
+				throw -1;
+			// A negative value is returned in case of error
+			if (len < 0)
+			{
+				// No more data available for now, send pending responses
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				{
+					flush();
+					return;
+				}
+				if (errno == EINTR)
+					continue;
+				if (errno == ECONNRESET)
+					throw -1;
+				throw runtime_error("ERROR reading from socket");
+			}
+			mRxEnd += len;
+		} /* while */
+	} catch(int ecode) {
+		// Connections closed by clients are not errors (keep-alive)
+		if (ecode != -1)
+			Log::error() << "Server: clientEvent " << mFd
+			             << " ecode=" << ecode << Log::endl;
+		if (ecode == -1)
+		{
+			close (mFd);
+			mFd = -1;
+		}
+		if (ecode == -3)
+			throw std::runtime_error("ServerHttp: missing Router");
+	} catch(...) {
+		Log::error() << "Server: Http::clientEvent" << Log::endl;
+	}
+}
+
+/**
+ * @brief Parse the header of a request, and create the request
+ *
+ * The header is copied once into a buffer given to the Request. The request
+ * line and the fields are then saved as slices of this buffer, with the names
+ * defined by CGI (RFC3875) : fixed names are static strings, and names of the
+ * other fields ("HTTP_" and the field name in upper case) are written after
+ * the copy of the header.
+ *
+ * @param data Pointer to the header (request line and fields)
+ * @param len  Length of the header, including the final empty line
+ * @return integer Zero on success, or the HTTP status of the error
+ */
+int ServerHttp::clientHead(const char *data, unsigned int len)
+{
+	// Refuse the request if the max number of requests is reached
+	if (isOverloaded())
+	{
+		Log::warning() << "Server: Overloaded, request refused" << Log::endl;
+		return 503;
+	}
+
+	// Count the lines to get the max size of translated names
+	unsigned int lines = 0;
+	const char *ptr = data;
+	while ((ptr = (const char *)memchr(ptr, '\n', data + len - ptr)) != 0)
+	{
+		lines++;
+		ptr++;
+	}
+
+	HttpRequest *req = new HttpRequest();
+	req->mRequest = new Request(this);
+
+	// Copy the header into a buffer owned by the Request
+	String *buffer = new String();
+	buffer->reserve(len + len + (lines * 5));
+	req->mRequest->setParamBuffer(buffer);
+	char *head  = buffer->data();
+	char *names = head + len;
+	memcpy(head, data, len);
+	const char *end = head + len;
+
+	// Request line : method, target and protocol version
+	const char *eol = (const char *)memchr(head, '\n', len);
+	const char *lineEnd = eol;
+	if ((lineEnd > head) && (lineEnd[-1] == '\r'))
+		lineEnd--;
+	const char *method = head;
+	const char *target = (const char *)memchr(head, ' ', lineEnd - head);
+	const char *proto  = 0;
+	if (target && (target != method))
+	{
+		target++;
+		proto = (const char *)memchr(target, ' ', lineEnd - target);
+	}
+	if ((proto == 0) || (proto == target))
+	{
+		delete req;
+		return 400;
+	}
+	unsigned int methodLen = (target - method - 1);
+	unsigned int targetLen = (proto - target);
+	unsigned int protoLen  = (lineEnd - ++proto);
+	if ((protoLen != 8) || memcmp(proto, "HTTP/1.", 7) ||
+	    (proto[7] < '0') || (proto[7] > '9'))
+	{
+		int status = ((protoLen > 5) && ! memcmp(proto, "HTTP/", 5)) ? 505 : 400;
+		delete req;
+		return status;
+	}
+	req->mMinor = (proto[7] - '0');
+	req->mHead  = ((methodLen == 4) && (memcmp(method, "HEAD", 4) == 0));
+
+	// Absolute form of the target (used with proxies), keep only the path
+	const char *targetEnd = target + targetLen;
+	const char *path = target;
+	if (path[0] != '/')
+	{
+		const char *sep = (const char *)memchr(path, ':', targetLen);
+		if ((sep == 0) || ((sep + 3) > targetEnd) ||
+		    (sep[1] != '/') || (sep[2] != '/'))
+		{
+			delete req;
+			return 400;
+		}
+		path = (const char *)memchr(sep + 3, '/', targetEnd - sep - 3);
+		if (path == 0)
+			path = targetEnd;
+	}
+	unsigned int pathLen = (targetEnd - path);
+	const char *query = (const char *)memchr(path, '?', pathLen);
+	unsigned int queryLen = 0;
+	if (query)
+	{
+		queryLen = (path + pathLen - query - 1);
+		pathLen  = (query - path);
+		query++;
+	}
+	else
+		query = path + pathLen;
+	// Refuse paths that try to go up ("/../")
+	for (unsigned int i = 0; (i + 3) <= pathLen; i++)
+	{
+		if ((path[i] == '/') && (path[i + 1] == '.') && (path[i + 2] == '.') &&
+		    (((i + 3) == pathLen) || (path[i + 3] == '/')))
+		{
+			delete req;
+			return 400;
+		}
+	}
+
+	Request *request = req->mRequest;
+	request->addParam("REQUEST_METHOD", 14, method, methodLen);
+	request->addParam("REQUEST_URI",    11, target, targetLen);
+	request->addParam("SCRIPT_NAME",    11, path,   pathLen);
+	request->addParam("QUERY_STRING",   12, query,  queryLen);
+	request->addParam("SERVER_PROTOCOL",15, proto,  protoLen);
+
+	// Header fields
+	bool connClose = false;
+	bool chunked   = false;
+	bool encoded   = false;
+	bool hasLength = false;
+	unsigned long long length = 0;
+	const char *line = eol + 1;
+	while (line < end)
+	{
+		eol = (const char *)memchr(line, '\n', end - line);
+		lineEnd = eol;
+		if ((lineEnd > line) && (lineEnd[-1] == '\r'))
+			lineEnd--;
+		// Empty line, end of header
+		if (lineEnd == line)
+			break;
+		// Obsolete line folding is refused (RFC7230 3.2.4)
+		const char *colon = (const char *)memchr(line, ':', lineEnd - line);
+		if ((line[0] == ' ') || (line[0] == '\t') ||
+		    (colon == 0) || (colon == line))
+		{
+			delete req;
+			return 400;
+		}
+		unsigned int nameLen = (colon - line);
+		const char *value = colon + 1;
+		while ((value < lineEnd) && ((*value == ' ') || (*value == '\t')))
+			value++;
+		const char *valueEnd = lineEnd;
+		while ((valueEnd > value) &&
+		       ((valueEnd[-1] == ' ') || (valueEnd[-1] == '\t')))
+			valueEnd--;
+		unsigned int valueLen = (valueEnd - value);
+
+		if (isName(line, nameLen, "Content-Length"))
+		{
+			unsigned long long num = 0;
+			unsigned int i;
+			for (i = 0; (i < valueLen) && (value[i] >= '0') && (value[i] <= '9'); i++)
+			{
+				if (num >> 40)
+					break;
+				num = (num * 10) + (value[i] - '0');
+			}
+			// Malformed, or different from a previous Content-Length
+			if ((i == 0) || (i < valueLen) || (hasLength && (num != length)))
+			{
+				delete req;
+				return 400;
+			}
+			hasLength = true;
+			length    = num;
+			request->addParam("CONTENT_LENGTH", 14, value, valueLen);
+		}
+		else if (isName(line, nameLen, "Content-Type"))
+			request->addParam("CONTENT_TYPE", 12, value, valueLen);
+		else
+		{
+			if (isName(line, nameLen, "Connection"))
+				connClose |= hasToken(value, valueLen, "close");
+			else if (isName(line, nameLen, "Transfer-Encoding"))
+			{
+				encoded = true;
+				chunked = hasToken(value, valueLen, "chunked", true);
+			}
+			else if (isName(line, nameLen, "Expect"))
+				req->mExpect = isName(value, valueLen, "100-continue");
+
+			// Translate the field name : HTTP_ prefix, upper case, and '_'
+			// in place of '-'
+			memcpy(names, "HTTP_", 5);
+			for (unsigned int i = 0; i < nameLen; i++)
+			{
+				char c = line[i];
+				if ((c <= ' ') || (c == 127))
+				{
+					delete req;
+					return 400;
+				}
+				if ((c >= 'a') && (c <= 'z'))
+					c = c - 'a' + 'A';
+				else if (c == '-')
+					c = '_';
+				names[5 + i] = c;
+			}
+			request->addParam(names, nameLen + 5, value, valueLen);
+			names += (nameLen + 5);
+		}
+		line = eol + 1;
+	}
+
+	// Only the chunked encoding is supported, and a message can not have
+	// a length and an encoding (RFC7230 3.3.3)
+	if (encoded && (hasLength || (req->mMinor == 0)))
+	{
+		delete req;
+		return 400;
+	}
+	if (encoded && ! chunked)
+	{
+		delete req;
+		return 501;
+	}
+
+	// Connections are persistent by default since HTTP/1.1. Responses to
+	// HTTP/1.0 clients are not chunked, so their end is the end of connection
+	req->mKeepConn = ((req->mMinor > 0) && ! connClose);
+
+	// Refuse a body larger than the limit before receiving it
+	if (length > mBodyLimit)
+	{
+		delete req;
+		return 413;
+	}
+
+	if (chunked)
+		req->mBodyState = HTTP_BODY_CHUNK_SIZE;
+	else if (length)
+	{
+		req->mBodyState = HTTP_BODY_DATA;
+		req->mBodyLeft  = length;
+		req->mBody.reserve(std::min(length, (unsigned long long)HTTP_BODY_RESERVE));
+	}
+	if (req->mBodyState == HTTP_BODY_NONE)
+		req->mExpect = false;
+
+	// Instanciate a Response for this request (after the parameters, some
+	// fields like Origin are used)
+	req->mResponse = new Response(req->mRequest);
+	req->mResponse->setServer(this);
+	// The request uses the current router until the end, even if a
+	// new one is set by a reload
+	req->mRouter = mRouter;
+	req->mRouter->acquire();
+
+	mCurrent = req;
+	requestAcquire();
+	return 0;
+}
+
+/**
+ * @brief Test if the connection has no request in progress
+ *
+ * @return boolean True if there is no request
+ */
+bool ServerHttp::clientIdle(void)
+{
+	return (mCurrent == 0);
+}
+
+/**
+ * @brief Process all the complete requests of the receive buffer
+ *
+ * The end of the header is searched only into the new datas, so a header
+ * received with many packets is not scanned again from start. Requests of a
+ * connection are processed in order : when a page is running, the following
+ * requests stay into the buffer.
+ */
+void ServerHttp::clientParse(void)
+{
+	while (mFd >= 0)
+	{
+		// The connection will be closed, following datas are ignored
+		if ( ! mKeepConn)
+			return;
+		// A page is running, next requests will be processed later
+		if (mCurrent && mCurrent->mRunning)
+			return;
+
+		if (mCurrent == 0)
+		{
+			char *buffer = &mRxBuffer[0];
+			unsigned int headLen = 0;
+
+			// Empty lines before a request are ignored (RFC7230 3.5)
+			while ((mRxStart < mRxEnd) &&
+			       ((buffer[mRxStart] == '\r') || (buffer[mRxStart] == '\n')))
+				mRxStart++;
+
+			// Search the empty line at the end of the header
+			unsigned int pos = std::max(mRxScan, mRxStart);
+			while (pos < mRxEnd)
+			{
+				char *eol = (char *)memchr(buffer + pos, '\n', mRxEnd - pos);
+				if (eol == 0)
+				{
+					pos = mRxEnd;
+					break;
+				}
+				pos = (eol - buffer);
+				if ((pos + 1) < mRxEnd && (buffer[pos + 1] == '\n'))
+					headLen = pos + 2 - mRxStart;
+				else if (((pos + 2) < mRxEnd) && (buffer[pos + 1] == '\r') &&
+				         (buffer[pos + 2] == '\n'))
+					headLen = pos + 3 - mRxStart;
+				// The end of line may be the begining of an empty line
+				else if (((pos + 2) >= mRxEnd) &&
+				         (((pos + 1) == mRxEnd) || (buffer[pos + 1] == '\r')))
+					break;
+				if (headLen)
+					break;
+				pos++;
+			}
+			mRxScan = pos;
+
+			// The header is incomplete, more datas must be received
+			if (headLen == 0)
+			{
+				if ((mRxEnd - mRxStart) >= HTTP_HEAD_MAX)
+				{
+					sendError(431, "Request Header Fields Too Large");
+					return;
+				}
+				rxCompact();
+				return;
+			}
+
+			int status = clientHead(buffer + mRxStart, headLen);
+			mRxStart += headLen;
+			mRxScan   = mRxStart;
+			if (status)
+			{
+				if (status == 400)
+					sendError(400, "Bad Request");
+				else if (status == 413)
+					sendError(413, "Payload Too Large");
+				else if (status == 501)
+					sendError(501, "Not Implemented");
+				else if (status == 503)
+					sendError(503, "Service Unavailable");
+				else
+					sendError(505, "HTTP Version Not Supported");
+				return;
+			}
+		}
+
+		// Receive the body of the request (if any)
+		int complete = clientBody(mCurrent);
+		if (complete < 0)
+		{
+			requestRemove(mCurrent);
+			if (complete == -2)
+				sendError(413, "Payload Too Large");
+			else
+				sendError(400, "Bad Request");
+			return;
+		}
+		if (complete == 0)
+		{
+			// The client waits an interim response before sending body
+			if (mCurrent->mExpect)
+			{
+				static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+				mTxQueue.appendRef(cont, sizeof(cont) - 1);
+				mCurrent->mExpect = false;
+			}
+			rxCompact();
+			return;
+		}
+
+		requestProcess(mCurrent);
+		// Close the connection if requested
+		clientClose();
+
+		// Stop processing requests when output must be sent first
+		if ((mTxQueue.length() > mTxLimit) || ( ! mKeepConn))
+			return;
+	}
+}
+
+/**
+ * @brief Read the next requests when the page of a request is complete
+ *
+ * The socket is not read while a page is running, pipelined requests and new
+ * datas are processed now.
+ */
+void ServerHttp::clientResume(void)
+{
+	clientEvent();
+}
+
+/**
+ * @brief Send the response of a request, when his page is complete
+ *
+ * @param request Pointer to the processed request
+ */
+void ServerHttp::requestDone(StreamRequest *request)
+{
+	HttpRequest *req = static_cast<HttpRequest *>(request);
+
+	// Connection closed during page processing
+	if (mFd < 0)
+	{
+		requestRemove(req);
+		return;
+	}
+
+	// When the server is drained, the connection is closed after response
+	if (isDraining())
+		req->mKeepConn = false;
+
+	// Datas sent by the Response are formatted for this request
+	mReply = req;
+	req->mResponse->send();
+	// Response without header (should not happen), send an empty one
+	if ( ! req->mHeaderSent)
+		sendHeader(req, "", 0);
+	// Last chunk (without trailer)
+	if (req->mChunked)
+		mTxQueue.appendRef("0\r\n\r\n", 5);
+	mReply = 0;
+	// Response datas are referenced by the output queue, write them now
+	flush();
+
+	// If the client does not want to reuse the connection
+	if ( ! req->mKeepConn)
+		mKeepConn = false;
+
+	requestRemove(req);
+}
+
+/**
+ * @brief Process a request when all his datas has been received
+ *
+ * The page is processed by ServerStream, then the response is sent by
+ * requestDone.
+ *
+ * @param req Pointer to the request to process
+ */
+void ServerHttp::requestProcess(HttpRequest *req)
+{
+	// With the chunked encoding, the length is known at the end only
+	unsigned int len = 0;
+	if (req->mBody.length() &&
+	    (req->mRequest->getParam(Request::paramContentLength, len) == 0 || len == 0))
+		req->mRequest->setHeaderParameter("CONTENT_LENGTH",
+		                                  String::number(req->mBody.length()));
+	// Set the body into Request
+	if (req->mBody.length())
+	{
+		req->mRequest->setBody(new String(req->mBody.data(), req->mBody.length()));
+		std::string().swap(req->mBody);
+	}
+
+	requestSubmit(req);
+}
+
+/**
+ * @brief Remove the request in progress of the connection, and delete it
+ *
+ * @param req Pointer to the request to remove
+ */
+void ServerHttp::requestRemove(HttpRequest *req)
+{
+	if (mCurrent == req)
+		mCurrent = 0;
+	delete req;
+
+	requestRelease();
+}
+
+/**
+ * @brief Delete the request in progress of the connection (if any)
+ *
+ */
+void ServerHttp::requestClear(void)
+{
+	if (mCurrent)
+		requestRemove(mCurrent);
+}
+
+/**
+ * @brief Make room at the end of the receive buffer
+ *
+ * Pending datas are moved to the beginning of the buffer. If the buffer is
+ * full of an incomplete header, it is enlarged (up to the max header size).
+ */
+void ServerHttp::rxCompact(void)
+{
+	unsigned int avail = (mRxEnd - mRxStart);
+
+	// All datas has been processed, buffer can be reused from start
+	if (avail == 0)
+	{
+		mRxStart = 0;
+		mRxEnd   = 0;
+		mRxScan  = 0;
+		return;
+	}
+	// There is still some space at the end of the buffer
+	if (mRxEnd < mRxBuffer.size())
+		return;
+
+	if (mRxStart)
+	{
+		memmove(&mRxBuffer[0], &mRxBuffer[mRxStart], avail);
+		mRxScan -= std::min(mRxScan, mRxStart);
+		mRxStart = 0;
+		mRxEnd   = avail;
+	}
+	else if (mRxBuffer.size() < HTTP_HEAD_MAX)
+		mRxBuffer.resize(std::min(mRxBuffer.size() * 2, (size_t)HTTP_HEAD_MAX));
+}
+
+/**
+ * @brief Send data as response of a request
+ *
+ * The first datas sent by a Response are the CGI header, translated into an
+ * HTTP header. Then the content is sent as chunks (HTTP/1.1 clients) or as
+ * is (HTTP/1.0 clients, or when the page has set a Content-Length).
+ *
+ * @param data Pointer to a buffer with datas to send
+ * @param len  Length of the buffer
+ */
+void ServerHttp::send(const char *data, int len)
+{
+	HttpRequest *req = mReply;
+
+	// Datas can only be sent as response of a request
+	if (req == 0)
+		return;
+
+	if ( ! req->mHeaderSent)
+	{
+		sendHeader(req, data, len);
+		return;
+	}
+	if (req->mNoBody || (len <= 0))
+		return;
+
+	// Response datas stay valid until the request is finished, no copy
+	if (req->mChunked)
+	{
+		char size[16];
+		int sizeLen = snprintf(size, sizeof(size), "%x\r\n", len);
+		mTxQueue.append(size, sizeLen);
+		mTxQueue.appendRef(data, len);
+		mTxQueue.appendRef("\r\n", 2);
+	}
+	else
+		mTxQueue.appendRef(data, len);
+}
+
+/**
+ * @brief Send an error response, and close the connection after it
+ *
+ * Used when a request can not be processed (malformed, too large ...). The
+ * following datas of the connection can not be trusted anymore : they are
+ * dropped, and the connection is closed as soon as the response is sent.
+ *
+ * @param code   HTTP status code
+ * @param reason Reason phrase of the status
+ */
+void ServerHttp::sendError(int code, const char *reason)
+{
+	std::string response("HTTP/1.1 ");
+
+	Log::info() << "Server: HTTP error " << code << " " << reason << Log::endl;
+
+	response += String::number(code).toStdStr() + " " + reason + "\r\n";
+	response += "Content-Length: 0\r\n";
+	response += "Connection: close\r\n\r\n";
+	mTxQueue.append(response.data(), response.length());
+
+	// Drop the remaining datas of the receive buffer
+	mRxStart = 0;
+	mRxEnd   = 0;
+	mRxScan  = 0;
+
+	mKeepConn = false;
+	mLinger   = HTTP_LINGER_MAX;
+	clientClose();
+}
+
+/**
+ * @brief Translate the CGI header of a Response into an HTTP header
+ *
+ * The "Status" field of the CGI header becomes the status line, the other
+ * fields are sent unmodified. Then the fields that depend on the connection
+ * (Transfer-Encoding, Connection) are added.
+ *
+ * @param req  Pointer to the request of the response
+ * @param data Pointer to the CGI header
+ * @param len  Length of the CGI header
+ */
+void ServerHttp::sendHeader(HttpRequest *req, const char *data, unsigned int len)
+{
+	std::string fields;
+	std::string status("200 OK");
+	bool hasLength = false;
+	int  code = 200;
+
+	const char *end = data + len;
+	while (data < end)
+	{
+		const char *eol = (const char *)memchr(data, '\n', end - data);
+		if (eol == 0)
+			eol = end;
+		unsigned int lineLen = (eol - data);
+		if (lineLen && (data[lineLen - 1] == '\r'))
+			lineLen--;
+
+		if ((lineLen > 7) && (strncasecmp(data, "Status:", 7) == 0))
+		{
+			const char *value = data + 7;
+			while ((value < (data + lineLen)) && (*value == ' '))
+				value++;
+			if (((data + lineLen - value) >= 3) && (value[0] >= '1') &&
+			    (value[0] <= '5'))
+			{
+				status.assign(value, data + lineLen - value);
+				code = atoi(value);
+			}
+		}
+		else if (lineLen)
+		{
+			if ((lineLen > 15) && (strncasecmp(data, "Content-Length:", 15) == 0))
+				hasLength = true;
+			fields.append(data, lineLen);
+			fields.append("\r\n");
+		}
+		data = eol + 1;
+	}
+
+	// Some responses never have a body (RFC7230 3.3.3)
+	req->mNoBody  = (req->mHead || (code < 200) || (code == 204) || (code == 304));
+	// Without known length, the body is chunked (only HTTP/1.1 clients
+	// support it) or ended by the end of connection
+	req->mChunked = ( ! req->mNoBody && ! hasLength && (req->mMinor > 0));
+	if ( ! req->mNoBody && ! hasLength && ! req->mChunked)
+		req->mKeepConn = false;
+
+	char date[64];
+	struct tm tm;
+	time_t now = time(0);
+	gmtime_r(&now, &tm);
+	strftime(date, sizeof(date), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+
+	std::string header("HTTP/1.1 ");
+	header.reserve(fields.length() + 128);
+	header += status + "\r\n";
+	header += date;
+	header += fields;
+	if (req->mChunked)
+		header += "Transfer-Encoding: chunked\r\n";
+	if ( ! req->mKeepConn)
+		header += "Connection: close\r\n";
+	header += "\r\n";
+	mTxQueue.append(header.data(), header.length());
+
+	req->mHeaderSent = true;
+}
+
+// --------------------------- HTTP requests ---------------------------
+
+/**
+ * @brief Default constructor
+ *
+ */
+HttpRequest::HttpRequest()
+  : StreamRequest()
+{
+	mMinor      = 1;
+	mKeepConn   = false;
+	mExpect     = false;
+	mHead       = false;
+	mBodyState  = HTTP_BODY_NONE;
+	mBodyLeft   = 0;
+	mHeaderSent = false;
+	mChunked    = false;
+	mNoBody     = false;
+}
+
+} // namespace hermod
+/* EOF */
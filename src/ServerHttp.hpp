@@ -0,0 +1,101 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef SERVER_HTTP_HPP
+#define SERVER_HTTP_HPP
+
+#include <string>
+#include <vector>
+#include "ServerStream.hpp"
+
+namespace hermod {
+
+/**
+ * @class HttpRequest
+ * @brief Context of an HTTP request in progress on a connection
+ *
+ */
+class HttpRequest : public StreamRequest
+{
+	friend class ServerHttp;
+public:
+	HttpRequest();
+private:
+	unsigned char mMinor;     // Minor version of the protocol (HTTP/1.x)
+	bool      mKeepConn;
+	bool      mExpect;        // Client waits for "100 Continue"
+	bool      mHead;          // HEAD request, no body into response
+	// Reception of the body
+	int       mBodyState;
+	unsigned long long mBodyLeft;
+	std::string mBody;
+	// Emission of the response
+	bool      mHeaderSent;
+	bool      mChunked;
+	bool      mNoBody;
+};
+
+/**
+ * @class ServerHttp
+ * @brief Native implementation of an HTTP/1.1 server
+ *
+ * Connections are handled by ServerStream. They are kept open between
+ * requests (keep-alive) and clients can send many requests without waiting
+ * responses (pipelining) : requests of a connection are processed one at a
+ * time, in order, the next ones wait into the receive buffer.
+ *
+ * The header of a request is parsed when it is complete, without copying
+ * each field : the header is copied once into a buffer owned by the Request,
+ * and fields are saved as slices of this buffer with the names used by CGI
+ * (REQUEST_METHOD, SCRIPT_NAME, HTTP_HOST ...). Bodies are received with a
+ * Content-Length or with the chunked encoding, and responses to HTTP/1.1
+ * clients are sent with the chunked encoding.
+ */
+class ServerHttp : public ServerStream
+{
+public:
+	ServerHttp();
+	~ServerHttp();
+	void send     (const char *data, int len);
+protected:
+	int  clientBody (HttpRequest *req);
+	bool clientClose(void);
+	ServerStream *clientCreate(void);
+	void clientEvent(void);
+	int  clientHead (const char *data, unsigned int len);
+	bool clientIdle (void);
+	void clientParse(void);
+	void clientResume(void);
+	void requestClear  (void);
+	void requestDone   (StreamRequest *req);
+	void requestProcess(HttpRequest *req);
+	void requestRemove (HttpRequest *req);
+	void rxCompact(void);
+	void sendError (int code, const char *reason);
+	void sendHeader(HttpRequest *req, const char *data, unsigned int len);
+private:
+	std::vector<char> mRxBuffer;
+	unsigned int   mRxStart;
+	unsigned int   mRxEnd;
+	unsigned int   mRxScan;
+	// Datas that can still be dropped before closing, after an error
+	unsigned int   mLinger;
+	bool           mShutdown;
+private:
+	HttpRequest *mCurrent;
+	HttpRequest *mReply;
+};
+
+} // namespace hermod
+#endif
@@ -12,7 +12,14 @@
  *
  * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
  */
+#include <cerrno>
+#include <stdexcept>
 #include <string>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <fcgio.h>
 #include <fcgios.h> // For OS_* functions
 #include "Config.hpp"
@@ -32,8 +39,12 @@ namespace hermod {
 ServerLibFcgi::ServerLibFcgi()
   : Server()
 {
-	mFCGX = 0;
 	mPort = 9000;
+	mEventFd = -1;
+	mThreads.clear();
+	pthread_key_create(&mCurrent, NULL);
+	pthread_mutex_init(&mStatsLock, NULL);
+	pthread_mutex_init(&mRouterLock, NULL);
 }
 
 /**
@@ -42,8 +53,34 @@ ServerLibFcgi::ServerLibFcgi()
  */
 ServerLibFcgi::~ServerLibFcgi()
 {
+	// Close kept-alive connections (if any)
+	stop();
+
 	// Free fcgi
 	OS_LibShutdown();
+
+	pthread_mutex_destroy(&mRouterLock);
+	pthread_mutex_destroy(&mStatsLock);
+	pthread_key_delete(mCurrent);
+}
+
+/**
+ * @brief Get the counters of accepted connections
+ *
+ * Counters are updated by worker threads (threaded mode), so they are
+ * copied under lock.
+ *
+ * @return ServerStats Copy of the counters
+ */
+ServerStats ServerLibFcgi::getStats(void)
+{
+	ServerStats stats;
+
+	pthread_mutex_lock(&mStatsLock);
+	stats = mStats;
+	pthread_mutex_unlock(&mStatsLock);
+
+	return stats;
 }
 
 /**
@@ -110,14 +147,14 @@ void ServerLibFcgi::loadHttpParameters(Request *req, FCGX_Request *fcgi)
  *
  * This is th main processing method of this server. When an event is
  * detected on FCGI socket (mainly new connection) this method call
- * libfcgi to appept and decode it. Then, router is used to call a
- * page that handle the URI/method.
+ * libfcgi to appept and decode it. When the web server use FCGI_KEEP_CONN,
+ * the connection is not closed at the end of the request : his socket is
+ * registered into the Reactor and the next requests are read from it.
  */
 void ServerLibFcgi::processFd(int fd)
 {
-	FCGX_Request fcgiReq;
-	Request  *req;
-	Response *rsp;
+	FCGX_Request *fcgiReq;
+	Listener     *listener = 0;
 
 	if (mRouter == 0)
 	{
@@ -126,29 +163,107 @@ void ServerLibFcgi::processFd(int fd)
 		return;
 	}
 
-	if ((fd != mFd) && (fd != -1))
+	if (fd == -1)
+		fd = mFd;
+	listener = getListener(fd);
+	if (listener)
 	{
-		Log::error() << "Server: Failed to process FD (unknown fd)" << Log::endl;
-		Log::sync();
-		return;
+		// Allocate a new libfcgi request for an incoming connection
+		fcgiReq = new FCGX_Request;
+		FCGX_InitRequest(fcgiReq, fd, 0);
+		pthread_mutex_lock(&mStatsLock);
+		mStats.wakeups++;
+		pthread_mutex_unlock(&mStatsLock);
+	}
+	else
+	{
+		std::map<int, FCGX_Request *>::iterator it;
+		it = mKeepConns.find(fd);
+		if (it == mKeepConns.end())
+		{
+			Log::error() << "Server: Failed to process FD (unknown fd)" << Log::endl;
+			Log::sync();
+			return;
+		}
+		fcgiReq = it->second;
+		mKeepConns.erase(it);
+		mReactor->remove(fd);
+
+		// Test if the web server has closed the connection (this must be
+		// detected here, else libfcgi would wait for a new connection)
+		char c;
+		if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0)
+		{
+			FCGX_Free(fcgiReq, 1);
+			delete fcgiReq;
+			return;
+		}
 	}
 
-	FCGX_InitRequest(&fcgiReq, mFd, 0);
-
-	if (FCGX_Accept_r(&fcgiReq) != 0)
+	if (FCGX_Accept_r(fcgiReq) != 0)
 	{
 		Log::info() << "FastCGI interrupted during accept." << Log::endl;
 		Log::sync();
+		FCGX_Free(fcgiReq, 1);
+		delete fcgiReq;
 		return;
 	}
 
-	// Save a (temporary) copy of FCGX request
-	mFCGX = &fcgiReq;
+	// Set options of a new connection (TCP_NODELAY ...)
+	if (listener)
+	{
+		listener->configure(fcgiReq->ipcFd);
+		pthread_mutex_lock(&mStatsLock);
+		mStats.accepted++;
+		mStats.batchMax = 1;
+		pthread_mutex_unlock(&mStatsLock);
+	}
+
+	processRequest(fcgiReq);
+
+	// Finish LibFCGI request (socket is closed if not kept-alive)
+	FCGX_Finish_r(fcgiReq);
+
+	// If the connection is kept-alive, wait for the next request
+	if (fcgiReq->ipcFd >= 0)
+	{
+		mKeepConns[fcgiReq->ipcFd] = fcgiReq;
+		mReactor->add(fcgiReq->ipcFd, this, false);
+	}
+	else
+	{
+		FCGX_Free(fcgiReq, 0);
+		delete fcgiReq;
+	}
+}
+
+/**
+ * @brief Process a request received by libfcgi
+ *
+ * The request is decoded into a Request object, then router is used to call
+ * a page that handle the URI/method.
+ *
+ * @param fcgiReq Pointer to an accepted LibFCGI request
+ */
+void ServerLibFcgi::processRequest(FCGX_Request *fcgiReq)
+{
+	Request  *req;
+	Response *rsp;
+	Router   *router;
+
+	// Save the current FCGX request of this thread (used by send)
+	pthread_setspecific(mCurrent, fcgiReq);
+
+	// Get the current router, it is used until the end of the request
+	pthread_mutex_lock(&mRouterLock);
+	router = mRouter;
+	router->acquire();
+	pthread_mutex_unlock(&mRouterLock);
 
 	// Instanciate a new Request
 	req = new Request(this);
-	loadHttpParameters(req, &fcgiReq);
-	loadHttpBody(req, &fcgiReq);
+	loadHttpParameters(req, fcgiReq);
+	loadHttpBody(req, fcgiReq);
 	// Instanciate a new Response
 	rsp = new Response( req );
 	rsp->setServer(this);
@@ -171,12 +286,12 @@ void ServerLibFcgi::processFd(int fd)
 	{
 		Route *route = 0;
 
-		route = mRouter->find(req);
+		route = router->find(req);
 		if ( ! route)
 		{
 			Log::info() << "Request an unknown URL: ";
 			Log::info() << req->getUri(0) << Log::endl;
-			route = mRouter->find(":404:");
+			route = router->find(":404:");
 		}
 		if (route)
 		{
@@ -190,6 +305,7 @@ void ServerLibFcgi::processFd(int fd)
 				rsp->catchCout();
 
 				try {
+					page->setPolicy( route->getPolicy() );
 					page->setRequest( req );
 					page->setReponse( rsp );
 					page->initSession();
@@ -224,10 +340,8 @@ void ServerLibFcgi::processFd(int fd)
 	delete req;
 	req = 0;
 
-	// Finish LibFCGI request and free memory
-	FCGX_Finish_r(&fcgiReq);
-	FCGX_Free(&fcgiReq, 0);
-	mFCGX = 0;
+	router->release();
+	pthread_setspecific(mCurrent, NULL);
 }
 
 /**
@@ -238,10 +352,14 @@ void ServerLibFcgi::processFd(int fd)
  */
 void ServerLibFcgi::send(const char *data, int len)
 {
-	if ( (mFCGX == 0) || (data == 0) )
+	FCGX_Request *fcgiReq;
+
+	// Get the request processed by the calling thread
+	fcgiReq = (FCGX_Request *)pthread_getspecific(mCurrent);
+	if ( (fcgiReq == 0) || (data == 0) )
 		return;
 
-	FCGX_PutStr(data, len, mFCGX->out);
+	FCGX_PutStr(data, len, fcgiReq->out);
 }
 
 /**
@@ -254,6 +372,18 @@ void ServerLibFcgi::setPort(int num)
 	mPort = num;
 }
 
+/**
+ * @brief Set the router used to process the next requests
+ *
+ * @param router Pointer to the router to use
+ */
+void ServerLibFcgi::setRouter(Router *router)
+{
+	pthread_mutex_lock(&mRouterLock);
+	mRouter = router;
+	pthread_mutex_unlock(&mRouterLock);
+}
+
 /**
  * @brief Start the FCGI server
  *
@@ -261,21 +391,53 @@ void ServerLibFcgi::setPort(int num)
  */
 void ServerLibFcgi::start(void)
 {
-	Config *cfg = Config::getInstance();
-
-	// Define the TCP port to listen
-	ConfigKey *keyPort = cfg->getKey("global", "port");
-	if (keyPort)
-		mPort = keyPort->getInteger();
-
 	// Initialize library
 	FCGX_Init();
 
-	std::string fcgiPort(":");
-	fcgiPort += String::number(mPort).toStdStr();
+	// Open listening sockets (TCP and/or unix domain sockets). They are
+	// registered into Reactor (level-triggered, libfcgi accept one
+	// connection for each call of processFd)
+	openListeners(mPort);
+}
+
+/**
+ * @brief Start the worker threads (threaded mode)
+ *
+ * Listening sockets are removed from the Reactor : new connections are only
+ * accepted by the workers. This method must be called after start().
+ *
+ * @param count Number of worker threads
+ */
+void ServerLibFcgi::startWorkers(unsigned int count)
+{
+	if (mThreads.size() || (count == 0) || mListeners.empty())
+		return;
+
+	// Descriptor used to stop the threads
+	mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mEventFd < 0)
+		throw std::runtime_error("ServerLibFcgi: Failed to create eventfd");
 
-	// Open the FCGI socket
-	mFd = FCGX_OpenSocket(fcgiPort.c_str(), 4);
+	// Connections are accepted by workers only
+	std::vector<Listener *>::iterator it;
+	for (it = mListeners.begin(); it != mListeners.end(); ++it)
+	{
+		if (mReactor)
+			mReactor->remove((*it)->getFd());
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, threadMain, this) != 0)
+		{
+			Log::error() << "ServerLibFcgi: Failed to start worker thread" << Log::endl;
+			break;
+		}
+		mThreads.push_back(thread);
+	}
+	if (mThreads.empty())
+		throw std::runtime_error("ServerLibFcgi: Failed to start worker threads");
 }
 
 /**
@@ -285,12 +447,158 @@ void ServerLibFcgi::start(void)
  */
 void ServerLibFcgi::stop(void)
 {
-	if (mFd >= 0)
+	// Stop the worker threads (requests in progress are finished)
+	if (mEventFd >= 0)
+	{
+		uint64_t one = 1;
+		if (write(mEventFd, &one, sizeof(one)) < 0)
+			Log::error() << "ServerLibFcgi: Failed to stop workers" << Log::endl;
+		while (mThreads.size())
+		{
+			pthread_join(mThreads.back(), NULL);
+			mThreads.pop_back();
+		}
+		close(mEventFd);
+		mEventFd = -1;
+	}
+
+	// Close all kept-alive connections
+	std::map<int, FCGX_Request *>::iterator it;
+	for (it = mKeepConns.begin(); it != mKeepConns.end(); ++it)
 	{
-		// Close FCGI socket
-		OS_IpcClose(mFd);
-		mFd = -1;
+		if (mReactor)
+			mReactor->remove(it->first);
+		FCGX_Free(it->second, 1);
+		delete it->second;
 	}
+	mKeepConns.clear();
+
+	// Close FCGI sockets
+	closeListeners();
+}
+
+/**
+ * @brief Entry point of worker threads
+ *
+ * @param arg Pointer to the server
+ */
+void *ServerLibFcgi::threadMain(void *arg)
+{
+	ServerLibFcgi *server = (ServerLibFcgi *)arg;
+	server->workerLoop();
+	return NULL;
+}
+
+/**
+ * @brief Main loop of a worker thread (threaded mode)
+ *
+ * Each worker has his own FCGX_Request. It waits for a new connection on the
+ * listening sockets, or for the next request of his kept-alive connection.
+ * Listening sockets are shared by all workers : when many of them are woken
+ * up for the same connection, only one can accept it, others wait again.
+ */
+void ServerLibFcgi::workerLoop(void)
+{
+	std::vector<struct pollfd> fds;
+	FCGX_Request fcgiReq;
+
+	FCGX_InitRequest(&fcgiReq, mFd, 0);
+
+	while (1)
+	{
+		struct pollfd pfd;
+		pfd.events  = POLLIN;
+		pfd.revents = 0;
+
+		fds.clear();
+		pfd.fd = mEventFd;
+		fds.push_back(pfd);
+		if (fcgiReq.ipcFd >= 0)
+		{
+			// Wait the next request of the kept-alive connection
+			pfd.fd = fcgiReq.ipcFd;
+			fds.push_back(pfd);
+		}
+		else
+		{
+			// Wait a new connection
+			std::vector<Listener *>::iterator it;
+			for (it = mListeners.begin(); it != mListeners.end(); ++it)
+			{
+				pfd.fd = (*it)->getFd();
+				fds.push_back(pfd);
+			}
+		}
+
+		if (poll(&fds[0], fds.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Log::error() << "ServerLibFcgi: poll failed" << Log::endl;
+			break;
+		}
+		// Server is stopping
+		if (fds[0].revents)
+			break;
+
+		Listener *listener = 0;
+		if (fcgiReq.ipcFd >= 0)
+		{
+			// Test if the web server has closed the connection
+			char c;
+			if (recv(fcgiReq.ipcFd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0)
+			{
+				FCGX_Free(&fcgiReq, 1);
+				FCGX_InitRequest(&fcgiReq, mFd, 0);
+				continue;
+			}
+		}
+		else
+		{
+			for (unsigned int i = 1; i < fds.size(); i++)
+			{
+				if (fds[i].revents == 0)
+					continue;
+				listener = getListener(fds[i].fd);
+				break;
+			}
+			if (listener == 0)
+				continue;
+			FCGX_InitRequest(&fcgiReq, listener->getFd(), 0);
+			pthread_mutex_lock(&mStatsLock);
+			mStats.wakeups++;
+			pthread_mutex_unlock(&mStatsLock);
+		}
+
+		// Connection already accepted by another worker (or closed)
+		if (FCGX_Accept_r(&fcgiReq) != 0)
+		{
+			FCGX_Free(&fcgiReq, 1);
+			FCGX_InitRequest(&fcgiReq, mFd, 0);
+			continue;
+		}
+
+		if (listener)
+		{
+			listener->configure(fcgiReq.ipcFd);
+			pthread_mutex_lock(&mStatsLock);
+			mStats.accepted++;
+			mStats.batchMax = 1;
+			pthread_mutex_unlock(&mStatsLock);
+		}
+
+		processRequest(&fcgiReq);
+
+		// Finish LibFCGI request (socket is closed if not kept-alive)
+		FCGX_Finish_r(&fcgiReq);
+		if (fcgiReq.ipcFd < 0)
+			FCGX_Free(&fcgiReq, 0);
+
+		// Flush Log
+		Log::sync();
+	}
+
+	FCGX_Free(&fcgiReq, 1);
 }
 
 } // namespace hermod
@@ -15,29 +15,55 @@
 #ifndef SERVER_LIBFCGI_HPP
 #define SERVER_LIBFCGI_HPP
 
+#include <map>
+#include <vector>
+#include <pthread.h>
 #include <fcgio.h>
 #include "Request.hpp"
 #include "Server.hpp"
 
 namespace hermod {
 
+/**
+ * @class ServerLibFcgi
+ * @brief FastCGI server based on libfcgi
+ *
+ * By default, connections are accepted and processed by the thread of the
+ * Reactor, one request at a time. With startWorkers(), the server uses a pool
+ * of threads : each one has his own FCGX_Request, accepts connections and
+ * processes their requests (libfcgi allows FCGX_Accept_r from many threads).
+ */
 class ServerLibFcgi : public Server
 {
 public:
 	ServerLibFcgi();
 	~ServerLibFcgi();
+	ServerStats getStats(void);
 	void processFd(int fd = -1);
 	void send     (const char *data, int len);
 	void setPort(int num);
+	void setRouter(Router *router);
 	void start(void);
+	void startWorkers(unsigned int count);
 	void stop (void);
 protected:
 	void loadHttpBody      (Request *req, FCGX_Request *fcgi);
 	void loadHttpParameters(Request *req, FCGX_Request *fcgi);
+	void processRequest    (FCGX_Request *fcgi);
+	static void *threadMain(void *arg);
+	void workerLoop(void);
 private:
 	int mPort;
 	int mSocketFd;
-	FCGX_Request *mFCGX;
+	std::map<int, FCGX_Request *> mKeepConns;
+	// Request processed by the calling thread (used by send)
+	pthread_key_t mCurrent;
+	// Worker threads (threaded mode)
+	std::vector<pthread_t> mThreads;
+	int             mEventFd;
+	pthread_mutex_t mStatsLock;
+	// Router may be replaced while workers process requests
+	pthread_mutex_t mRouterLock;
 };
 
 } // namespace hermod
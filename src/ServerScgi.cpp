@@ -0,0 +1,471 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <string>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "Response.hpp"
+#include "ServerScgi.hpp"
+#include "String.hpp"
+
+namespace hermod {
+
+// Initial size of the receive buffer of a connection. The buffer grows (up
+// to the max size of a request header) if needed
+#define SCGI_RX_SIZE       16384
+// Max size of the header of a request (all the parameters), plus some bytes
+// for the framing (netstring length, uwsgi packet header)
+#define SCGI_HEAD_MAX      65536
+#define SCGI_HEAD_EXTRA       16
+// Initial allocation for the body of a request, it grows when needed (the
+// CONTENT_LENGTH given by the web server is not trusted for allocation)
+#define SCGI_BODY_RESERVE  1048576
+
+/**
+ * @brief Default constructor
+ *
+ */
+ServerScgi::ServerScgi()
+  : ServerStream(4000)
+{
+	mCurrent  = 0;
+	mReply    = 0;
+	mRxBuffer.clear();
+	mRxEnd    = 0;
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+ServerScgi::~ServerScgi()
+{
+	// Delete the request in progress (if any)
+	requestClear();
+}
+
+/**
+ * @brief Create the object used for an accepted connection
+ *
+ * @return ServerStream* Pointer to the new client object
+ */
+ServerStream *ServerScgi::clientCreate(void)
+{
+	return new ServerScgi();
+}
+
+/**
+ * @brief Handler called when datas are available on a client socket
+ *
+ * Client sockets are registered into the Reactor in edge-triggered mode, so
+ * this method reads until the socket is empty (EAGAIN). When the request is
+ * complete, the socket is not read anymore : the connection is only used to
+ * send the response.
+ */
+void ServerScgi::clientEvent(void)
+{
+	int len;
+
+	try {
+		// Sanity check
+		if (mRouter == 0)
+			throw -3;
+
+		// Allocate the receive buffer on first use
+		if (mRxBuffer.size() == 0)
+			mRxBuffer.resize(SCGI_RX_SIZE);
+
+		// Consume all available datas (edge-triggered socket)
+		while ((mFd >= 0) && mKeepConn)
+		{
+			// The request has been received, wait the end of the page
+			if (mCurrent && mCurrent->mRunning)
+				return;
+
+			// The buffer is full with an incomplete header, enlarge it
+			if (mRxEnd == mRxBuffer.size())
+				mRxBuffer.resize(std::min(mRxBuffer.size() * 2,
+				                 (size_t)(SCGI_HEAD_MAX + SCGI_HEAD_EXTRA)));
+
+			// Get as many datas as possible from socket
+			len = recv(mFd, &mRxBuffer[mRxEnd], mRxBuffer.size() - mRxEnd,
+			           MSG_DONTWAIT);
+			// If read length is 0, socket has been closed
+			if (len == 0)
+				throw -1;
+			// A negative value is returned in case of error
+			if (len < 0)
+			{
+				// No more data available for now
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+					return;
+				if (errno == EINTR)
+					continue;
+				if (errno == ECONNRESET)
+					throw -1;
+				throw runtime_error("ERROR reading from socket");
+			}
+			mRxEnd += len;
+
+			// Process the received datas
+			clientParse();
+		} /* while */
+	} catch(int ecode) {
+		// Web server may close the connection before the end of request
+		if (ecode != -1)
+			Log::error() << "Server: clientEvent " << mFd
+			             << " ecode=" << ecode << Log::endl;
+		if (ecode == -1)
+		{
+			close (mFd);
+			mFd = -1;
+		}
+		if (ecode == -3)
+			throw std::runtime_error("ServerScgi: missing Router");
+	} catch(...) {
+		Log::error() << "Server: Scgi::clientEvent" << Log::endl;
+	}
+}
+
+/**
+ * @brief Parse the header of a request, and create the request
+ *
+ * The SCGI header is a netstring : the length of the parameters (decimal),
+ * a colon, the parameters and a comma. Each parameter is a name and a value,
+ * both nul terminated.
+ *
+ * @param data Pointer to the received datas
+ * @param len  Length of the received datas
+ * @return integer Length of the header, 0 if the header is incomplete, or -1
+ *                 if the header is malformed
+ */
+int ServerScgi::clientHead(const char *data, unsigned int len)
+{
+	unsigned int size = 0;
+	unsigned int pos;
+
+	// Length of the netstring
+	for (pos = 0; (pos < len) && (data[pos] >= '0') && (data[pos] <= '9'); pos++)
+	{
+		size = (size * 10) + (data[pos] - '0');
+		if (size > SCGI_HEAD_MAX)
+			return -1;
+	}
+	if (pos == len)
+		return 0;
+	if ((pos == 0) || (data[pos] != ':'))
+		return -1;
+	pos++;
+	if (len < (pos + size + 1))
+		return 0;
+	if (data[pos + size] != ',')
+		return -1;
+
+	const char *params = requestCreate(data + pos, size);
+	const char *end = params + size;
+	while (params < end)
+	{
+		const char *name  = params;
+		const char *value = (const char *)memchr(name, 0, end - name);
+		if ((value == 0) || (value == name))
+			return -1;
+		value++;
+		const char *valueEnd = (const char *)memchr(value, 0, end - value);
+		if (valueEnd == 0)
+			return -1;
+		if ( ! requestParam(name, value - name - 1, value, valueEnd - value))
+			return -1;
+		params = valueEnd + 1;
+	}
+	return (pos + size + 1);
+}
+
+/**
+ * @brief Test if the connection has no request in progress
+ *
+ * @return boolean True if there is no request
+ */
+bool ServerScgi::clientIdle(void)
+{
+	return (mCurrent == 0);
+}
+
+/**
+ * @brief Process the datas of the receive buffer
+ *
+ * The header is parsed when it is complete, then the following datas are
+ * added to the body of the request. When the body is complete, the request
+ * is processed.
+ */
+void ServerScgi::clientParse(void)
+{
+	unsigned int start = 0;
+
+	if (mCurrent == 0)
+	{
+		// Refuse the request if the max number of requests is reached
+		if (isOverloaded())
+		{
+			Log::warning() << "Server: Overloaded, request refused" << Log::endl;
+			sendError(503, "Service Unavailable");
+			clientClose();
+			return;
+		}
+
+		int headLen = clientHead(&mRxBuffer[0], mRxEnd);
+		if (headLen < 0)
+		{
+			if (mCurrent)
+				requestRemove(mCurrent);
+			sendError(400, "Bad Request");
+			clientClose();
+			return;
+		}
+		// The header is incomplete, more datas must be received
+		if (headLen == 0)
+		{
+			if (mRxEnd >= mRxBuffer.size() &&
+			    (mRxBuffer.size() >= (SCGI_HEAD_MAX + SCGI_HEAD_EXTRA)))
+			{
+				sendError(400, "Bad Request");
+				clientClose();
+			}
+			return;
+		}
+		start = headLen;
+
+		// Refuse a body larger than the limit before receiving it
+		if (mCurrent->mBodyLeft > mBodyLimit)
+		{
+			requestRemove(mCurrent);
+			sendError(413, "Payload Too Large");
+			clientClose();
+			return;
+		}
+	}
+
+	// Receive the body of the request (if any)
+	unsigned int part = (mRxEnd - start);
+	if (part > mCurrent->mBodyLeft)
+		part = mCurrent->mBodyLeft;
+	mCurrent->mBody.append(&mRxBuffer[start], part);
+	mCurrent->mBodyLeft -= part;
+	// All datas are consumed, buffer can be reused from start
+	mRxEnd = 0;
+	if (mCurrent->mBodyLeft)
+		return;
+
+	// The receive buffer is not used anymore
+	std::vector<char>().swap(mRxBuffer);
+
+	requestProcess(mCurrent);
+	// Close the connection when the response has been sent
+	clientClose();
+}
+
+/**
+ * @brief Create the request of the connection, with a copy of the header
+ *
+ * The parameters are then added with requestParam(), as slices of the copy.
+ *
+ * @param data Pointer to the parameters received from the web server
+ * @param len  Length of the parameters
+ * @return char* Pointer to the copy, owned by the Request
+ */
+char *ServerScgi::requestCreate(const char *data, unsigned int len)
+{
+	ScgiRequest *req = new ScgiRequest();
+	req->mRequest = new Request(this);
+
+	String *buffer = new String();
+	buffer->reserve(len);
+	req->mRequest->setParamBuffer(buffer);
+	char *copy = buffer->data();
+	memcpy(copy, data, len);
+
+	mCurrent = req;
+	requestAcquire();
+	return copy;
+}
+
+/**
+ * @brief Send the response of a request, when his page is complete
+ *
+ * @param request Pointer to the processed request
+ */
+void ServerScgi::requestDone(StreamRequest *request)
+{
+	ScgiRequest *req = static_cast<ScgiRequest *>(request);
+
+	// The end of the response is the end of the connection
+	mKeepConn = false;
+
+	// Connection closed during page processing
+	if (mFd < 0)
+	{
+		requestRemove(req);
+		return;
+	}
+
+	// Datas sent by the Response are written into the output queue
+	mReply = req;
+	req->mResponse->send();
+	mReply = 0;
+	// Response datas are referenced by the output queue, write them now
+	flush();
+
+	requestRemove(req);
+}
+
+/**
+ * @brief Add a parameter to the request in progress
+ *
+ * @param name     Pointer to the parameter name
+ * @param nameLen  Length of the name
+ * @param value    Pointer to the parameter value
+ * @param valueLen Length of the value
+ * @return boolean False if the parameter is invalid
+ */
+bool ServerScgi::requestParam(const char *name,  unsigned int nameLen,
+                              const char *value, unsigned int valueLen)
+{
+	// The length of the body follows the header
+	if ((nameLen == 14) && (memcmp(name, "CONTENT_LENGTH", 14) == 0))
+	{
+		unsigned long long length = 0;
+		for (unsigned int i = 0; i < valueLen; i++)
+		{
+			if ((value[i] < '0') || (value[i] > '9') || (length >> 40))
+				return false;
+			length = (length * 10) + (value[i] - '0');
+		}
+		mCurrent->mBodyLeft = length;
+		mCurrent->mBody.reserve(std::min(length, (unsigned long long)SCGI_BODY_RESERVE));
+	}
+	mCurrent->mRequest->addParam(name, nameLen, value, valueLen);
+	return true;
+}
+
+/**
+ * @brief Process a request when all his datas has been received
+ *
+ * The page is processed by ServerStream, then the response is sent by
+ * requestDone.
+ *
+ * @param req Pointer to the request to process
+ */
+void ServerScgi::requestProcess(ScgiRequest *req)
+{
+	// Set the body into Request
+	if (req->mBody.length())
+	{
+		req->mRequest->setBody(new String(req->mBody.data(), req->mBody.length()));
+		std::string().swap(req->mBody);
+	}
+
+	// Instanciate a Response for this request (after the parameters, some
+	// of them like HTTP_ORIGIN are used)
+	req->mResponse = new Response(req->mRequest);
+	req->mResponse->setServer(this);
+	// The request uses the current router until the end, even if a
+	// new one is set by a reload
+	req->mRouter = mRouter;
+	req->mRouter->acquire();
+
+	requestSubmit(req);
+}
+
+/**
+ * @brief Remove the request in progress of the connection, and delete it
+ *
+ * @param req Pointer to the request to remove
+ */
+void ServerScgi::requestRemove(ScgiRequest *req)
+{
+	if (mCurrent == req)
+		mCurrent = 0;
+	delete req;
+
+	requestRelease();
+}
+
+/**
+ * @brief Delete the request in progress of the connection (if any)
+ *
+ */
+void ServerScgi::requestClear(void)
+{
+	if (mCurrent)
+		requestRemove(mCurrent);
+}
+
+/**
+ * @brief Send data as response of a request
+ *
+ * The output of a Response is already a CGI response (header with a Status
+ * field, then the content), it is sent unmodified.
+ *
+ * @param data Pointer to a buffer with datas to send
+ * @param len  Length of the buffer
+ */
+void ServerScgi::send(const char *data, int len)
+{
+	// Datas can only be sent as response of a request
+	if ((mReply == 0) || (len <= 0))
+		return;
+
+	// Response datas stay valid until the request is finished, no copy
+	mTxQueue.appendRef(data, len);
+}
+
+/**
+ * @brief Send an error response, and close the connection after it
+ *
+ * Used when a request can not be processed (malformed, overloaded ...).
+ *
+ * @param code   HTTP status code
+ * @param reason Reason phrase of the status
+ */
+void ServerScgi::sendError(int code, const char *reason)
+{
+	char response[128];
+
+	Log::info() << "Server: SCGI error " << code << " " << reason << Log::endl;
+
+	int len = snprintf(response, sizeof(response),
+	                   "Status: %d %s\r\nContent-Length: 0\r\n\r\n", code, reason);
+	mTxQueue.append(response, len);
+
+	mKeepConn = false;
+}
+
+// --------------------------- SCGI requests ---------------------------
+
+/**
+ * @brief Default constructor
+ *
+ */
+ScgiRequest::ScgiRequest()
+  : StreamRequest()
+{
+	mBodyLeft   = 0;
+}
+
+} // namespace hermod
+/* EOF */
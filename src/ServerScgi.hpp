@@ -0,0 +1,85 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef SERVER_SCGI_HPP
+#define SERVER_SCGI_HPP
+
+#include <string>
+#include <vector>
+#include "ServerStream.hpp"
+
+namespace hermod {
+
+/**
+ * @class ScgiRequest
+ * @brief Context of the request received on an SCGI (or uwsgi) connection
+ *
+ */
+class ScgiRequest : public StreamRequest
+{
+	friend class ServerScgi;
+public:
+	ScgiRequest();
+private:
+	// Reception of the body
+	unsigned long long mBodyLeft;
+	std::string mBody;
+};
+
+/**
+ * @class ServerScgi
+ * @brief Native implementation of an SCGI server
+ *
+ * With SCGI the web server opens one connection for each request. The header
+ * of the request is a single netstring with all the CGI parameters as pairs
+ * of nul terminated strings, followed by the body (CONTENT_LENGTH bytes).
+ * There is no record to decode : the netstring is copied once into a buffer
+ * owned by the Request, and parameters are saved as slices of this copy.
+ * The response is the CGI output of the page (header with a "Status" field,
+ * then the content), and its end is the end of the connection.
+ *
+ * Connections are handled by ServerStream. Only the header is specific to
+ * the protocol (see clientHead), so this class is also the base of the uwsgi
+ * server.
+ */
+class ServerScgi : public ServerStream
+{
+public:
+	ServerScgi();
+	~ServerScgi();
+	void send     (const char *data, int len);
+protected:
+	ServerStream *clientCreate(void);
+	void clientEvent(void);
+	virtual int clientHead(const char *data, unsigned int len);
+	bool clientIdle (void);
+	void clientParse(void);
+	void requestClear  (void);
+	char *requestCreate(const char *data, unsigned int len);
+	void requestDone   (StreamRequest *req);
+	bool requestParam  (const char *name,  unsigned int nameLen,
+	                    const char *value, unsigned int valueLen);
+	void requestProcess(ScgiRequest *req);
+	void requestRemove (ScgiRequest *req);
+	void sendError (int code, const char *reason);
+private:
+	std::vector<char> mRxBuffer;
+	unsigned int   mRxEnd;
+private:
+	ScgiRequest *mCurrent;
+	ScgiRequest *mReply;
+};
+
+} // namespace hermod
+#endif
@@ -0,0 +1,774 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Config.hpp"
+#include "Log.hpp"
+#include "Router.hpp"
+#include "ServerStream.hpp"
+
+namespace hermod {
+
+// Number of descriptors reserved for other uses than client connections
+#define STREAM_RESERVED_FDS    16
+
+// Default amount of pending output datas for a connection, above this limit
+// no more request is read on the connection until output queue is flushed
+#define STREAM_OUTPUT_LIMIT  1048576
+
+// Default number of requests in progress for each thread that process pages
+// (the Reactor thread, or each worker of the Executor)
+#define STREAM_WORKER_REQS   64
+
+// Default max size of a request body received on a connection
+#define STREAM_BODY_LIMIT    8388608
+
+/**
+ * @brief Default constructor
+ *
+ * @param port Default TCP port of the protocol
+ */
+ServerStream::ServerStream(int port)
+  : Server()
+{
+	mMode = 0; // Define as server
+	mPort = port;
+
+	mKeepConn = true;
+	mDraining = false;
+	mParent   = 0;
+
+	mMaxConns = 0;
+	mMaxReqs  = 0;
+	mMaxReqsSet   = false;
+	mRequestCount = 0;
+
+	mClients.clear();
+	mClientCount = 0;
+	mDetached.clear();
+	mRunning  = 0;
+	mTxLimit  = STREAM_OUTPUT_LIMIT;
+	mTxWait   = false;
+	mBodyLimit = STREAM_BODY_LIMIT;
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+ServerStream::~ServerStream()
+{
+	// Clean the client objects (if any)
+	for (size_t i = 0; i < mClients.size(); i++)
+	{
+		if (mClients[i] == 0)
+			continue;
+		delete mClients[i];
+		mClients[i] = 0;
+	}
+	mClients.clear();
+	mClientCount = 0;
+	while (mDetached.size())
+	{
+		delete mDetached.back();
+		mDetached.pop_back();
+	}
+
+	// Close the client socket or the server sockets (if open)
+	if (mMode == 0)
+		closeListeners();
+	else if (mFd >= 0)
+	{
+		close(mFd);
+		mFd = -1;
+	}
+}
+
+/**
+ * @brief Create the client object of an accepted connection
+ *
+ * @param fd       Descriptor of the new connection
+ * @param listener Pointer to the listening socket (or NULL)
+ * @return ServerStream* Pointer to the client, NULL if refused
+ */
+ServerStream *ServerStream::clientAdd(int fd, Listener *listener)
+{
+	ServerStream *client = 0;
+
+	// Refuse the connection if the max number of clients is reached
+	if (mDraining || (mClientCount >= mMaxConns))
+	{
+		if ( ! mDraining)
+			Log::warning() << "Server: Too many connections (max "
+			               << (int)mMaxConns << ")" << Log::endl;
+		close(fd);
+		mStats.refused++;
+		return 0;
+	}
+	mStats.accepted++;
+
+	try {
+		// Set socket options (TCP_NODELAY ...)
+		if (listener)
+			listener->configure(fd);
+
+		// Create a new object to handle client connection
+		client = clientCreate();
+		client->setClient(fd);
+		client->setRouter(mRouter);
+		client->setReactor(mReactor);
+		client->setExecutor(mExecutor);
+		client->mParent  = this;
+		client->mTxLimit = mTxLimit;
+		client->mBodyLimit = mBodyLimit;
+
+		// Insert client into local cache (table indexed by fd)
+		if ((unsigned int)fd >= mClients.size())
+			mClients.resize(fd + 1, 0);
+		mClients[fd] = client;
+		mClientCount++;
+
+		// Start receiving requests
+		clientStart(client);
+	} catch(...) {
+		Log::error() << "Server: Failed to accept incoming connection" << Log::endl;
+		// Delete/clean the client object (if any)
+		if (client)
+		{
+			if (((unsigned int)fd < mClients.size()) &&
+			    (mClients[fd] == client))
+			{
+				mClients[fd] = 0;
+				mClientCount--;
+			}
+			// Socket is closed by the client object
+			delete client;
+		}
+		else
+			close(fd);
+
+		throw;
+	}
+	return client;
+}
+
+/**
+ * @brief Close the connection when it must not be kept open
+ *
+ * @return boolean True if the connection has been closed
+ */
+bool ServerStream::clientClose(void)
+{
+	// When the server is drained, idle connections are closed
+	bool draining = (isDraining() && clientIdle());
+
+	if ((mKeepConn && ! draining) || (mFd < 0))
+		return false;
+
+	// Some pages are running, close when they are complete
+	if (mRunning)
+		return false;
+
+	// Send pending datas (if any) before closing
+	flush();
+	// If some datas are still pending, close later
+	if ((mFd >= 0) && ( ! mTxQueue.isEmpty()))
+		return false;
+
+	// Delete the requests in progress (if any)
+	requestClear();
+
+	if (mFd < 0)
+		return true;
+	close(mFd);
+	mFd = -1;
+	return true;
+}
+
+/**
+ * @brief Delete a client object when his connection has been closed
+ *
+ * If some pages of the connection are still running, the object is kept
+ * into the list of detached clients until the end of these pages.
+ *
+ * @param client Pointer to the client object
+ * @param fd     Descriptor used by the connection (or -1 if already removed)
+ */
+void ServerStream::clientRelease(ServerStream *client, int fd)
+{
+	// Connection is still open, nothing to do
+	if (client->getFd() >= 0)
+		return;
+
+	// Remove client from local cache, and stop watching this descriptor
+	if ((fd >= 0) && ((unsigned int)fd < mClients.size()) &&
+	    (mClients[fd] == client))
+	{
+		mReactor->remove(fd);
+		mClients[fd] = 0;
+		mClientCount--;
+	}
+
+	std::vector<ServerStream *>::iterator it;
+	it = std::find(mDetached.begin(), mDetached.end(), client);
+
+	// Pages still running, the object will be deleted later
+	if (client->mRunning)
+	{
+		if (it == mDetached.end())
+			mDetached.push_back(client);
+		return;
+	}
+
+	if (it != mDetached.end())
+		mDetached.erase(it);
+	delete client;
+}
+
+/**
+ * @brief Called when a page of the connection is complete
+ *
+ * Protocols that stop reading while a page is running can read the next
+ * requests here. By default, nothing is done.
+ */
+void ServerStream::clientResume(void)
+{
+}
+
+/**
+ * @brief Start watching the connection of a new client
+ *
+ * @param client Pointer to the client object (inserted into the table)
+ */
+void ServerStream::clientStart(ServerStream *client)
+{
+	// Register the client socket into the Reactor
+	mReactor->add(client->getFd(), this);
+}
+
+/**
+ * @brief Stop accepting connections, and close them when they are idle
+ *
+ * Connections already queued on the listening sockets are accepted first, so
+ * they are not lost when sockets are closed. Then connections without request
+ * in progress are closed immediately, other ones when their last request is
+ * complete (see clientClose).
+ */
+void ServerStream::drain(void)
+{
+	if ((mMode != 0) || mDraining)
+		return;
+
+	std::vector<Listener *>::iterator it;
+	for (it = mListeners.begin(); it != mListeners.end(); ++it)
+		serverEvent((*it)->getFd());
+
+	mDraining = true;
+	closeListeners();
+
+	for (size_t fd = 0; fd < mClients.size(); fd++)
+	{
+		ServerStream *client = mClients[fd];
+		if (client == 0)
+			continue;
+		if (client->clientClose())
+			clientRelease(client, fd);
+	}
+}
+
+/**
+ * @brief Write all the pending datas of the connection
+ *
+ * Datas are collected into the output queue, and written together with a
+ * single system call (when possible).
+ */
+void ServerStream::flush(void)
+{
+	if (mFd < 0)
+		return;
+
+	try {
+		if (mTxQueue.flush(mFd))
+		{
+			// All datas has been sent, output events are not needed anymore
+			if (mTxWait)
+				mReactor->watchOutput(mFd, false);
+			mTxWait = false;
+			return;
+		}
+		// The socket is full, keep a copy of remaining datas (referenced
+		// responses may be deleted) and wait until socket is writable
+		mTxQueue.detach();
+		if ( ! mTxWait)
+			mReactor->watchOutput(mFd, true);
+		mTxWait = true;
+	} catch (std::exception &e) {
+		Log::error() << "Server: flush failed on " << mFd
+		             << " " << e.what() << Log::endl;
+		mTxQueue.clear();
+		close(mFd);
+		mFd = -1;
+	}
+}
+
+/**
+ * @brief Test if the server of the connection is drained
+ *
+ * @return boolean True if the server is drained
+ */
+bool ServerStream::isDraining(void)
+{
+	return (mParent ? mParent->mDraining : mDraining);
+}
+
+/**
+ * @brief Test if the server has no more connection
+ *
+ * @return boolean True if all connections (and their pages) are finished
+ */
+bool ServerStream::isIdle(void)
+{
+	return ((mClientCount == 0) && mDetached.empty());
+}
+
+/**
+ * @brief Test if the max number of requests in progress is reached
+ *
+ * @return boolean True if a new request must be refused
+ */
+bool ServerStream::isOverloaded(void)
+{
+	return (mParent && (mParent->mRequestCount >= mParent->mMaxReqs));
+}
+
+/**
+ * @brief Handler called when an event is detected on server socket
+ *
+ */
+void ServerStream::processFd(int fd)
+{
+	if (mMode == 1)
+	{
+		// Socket may be writable, try to send pending datas
+		if (mTxWait)
+		{
+			flush();
+			// Close the connection if it was waiting end of output
+			if (clientClose())
+				return;
+		}
+		clientEvent();
+	}
+	else
+	{
+		if (fd == -1)
+			serverEvent(mFd);
+		else if (getListener(fd))
+			serverEvent(fd);
+		else
+		{
+			ServerStream *client = 0;
+
+			// Get the client associated with requested fd
+			if ((fd >= 0) && ((unsigned int)fd < mClients.size()))
+				client = mClients[fd];
+
+			// Unknown descriptor, stop watching it to avoid event loop
+			if (client == 0)
+			{
+				Log::warning() << "Server: Event on unknown descriptor "
+				               << fd << Log::endl;
+				mReactor->remove(fd);
+				return;
+			}
+
+			client->processFd();
+			// If the client socket has ben closed, delete it
+			clientRelease(client, fd);
+		}
+	}
+}
+
+/**
+ * @brief Count a new request in progress on the connection
+ *
+ */
+void ServerStream::requestAcquire(void)
+{
+	if (mParent)
+		mParent->mRequestCount++;
+}
+
+/**
+ * @brief Count the end of a request in progress on the connection
+ *
+ */
+void ServerStream::requestRelease(void)
+{
+	if (mParent)
+		mParent->mRequestCount--;
+}
+
+/**
+ * @brief Find the page of a request and process it
+ *
+ * This method may be called by a worker thread : only the request and his
+ * response are used, not the connection.
+ *
+ * @param req Pointer to the request to process
+ */
+void ServerStream::requestRun(StreamRequest *req)
+{
+	Request  *request  = req->mRequest;
+	Response *response = req->mResponse;
+	Router   *router   = req->mRouter;
+
+	Route *route = router->find(request);
+	if ( ! route)
+	{
+		Log::info() << "Server: Not found: "
+		            << request->getUri(0) << Log::endl;
+		route = router->find(":404:");
+	}
+	if (route)
+	{
+		Page *page = route->newPage();
+		if (page)
+		{
+			response->catchCout();
+			try {
+				page->setPolicy(route->getPolicy());
+				page->setRequest(request);
+				page->setReponse(response);
+				page->initSession();
+				page->process();
+			} catch (std::exception &e) {
+				Log::warning() << "Server: Exception during page processing: "
+				               << e.what() << Log::endl;
+			}
+			response->releaseCout();
+			route->freePage(page);
+		}
+		else
+		{
+			response->header()->setRetCode(404, "Not found");
+		}
+	}
+	else
+		response->header()->setRetCode(404, "Not found");
+}
+
+/**
+ * @brief Process a request when all his datas has been received
+ *
+ * When an Executor is available, the page is processed by a worker thread
+ * and the response is sent later (see StreamJob). Else, the page is processed
+ * immediately.
+ *
+ * @param req Pointer to the request to process
+ */
+void ServerStream::requestSubmit(StreamRequest *req)
+{
+	if (mExecutor && mExecutor->size())
+	{
+		req->mRunning = true;
+		mRunning++;
+		mExecutor->submit(new StreamJob(this, req));
+		return;
+	}
+
+	requestRun(req);
+	requestDone(req);
+}
+
+/**
+ * @brief Handler called when connections are pending on a listening socket
+ *
+ * All the pending connections are accepted (until EAGAIN) so a burst of
+ * connections is processed with one event.
+ *
+ * @param listenFd Descriptor of the listening socket
+ */
+void ServerStream::serverEvent(int listenFd)
+{
+	Listener *listener = getListener(listenFd);
+	unsigned int count = 0;
+
+	if (mRouter == 0)
+	{
+		Log::error() << "Server: Failed to process FD (no router)" << Log::endl;
+		Log::sync();
+		// Stop the server to avoid infinite error loop
+		stop();
+		return;
+	}
+
+	mStats.wakeups++;
+
+	while (1)
+	{
+		int fd;
+
+		// Accept a connection, client sockets are used in non-blocking mode
+		fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			// All pending connections has been accepted
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			// Connection closed by peer before accept, try next one
+			if ((errno == EINTR) || (errno == ECONNABORTED))
+				continue;
+			// Other errors (no more descriptors ...) retry on next event
+			Log::error() << "Server: Failed to accept connection: "
+			             << strerror(errno) << Log::endl;
+			break;
+		}
+
+		if (clientAdd(fd, listener))
+			count++;
+	}
+
+	if (count > mStats.batchMax)
+		mStats.batchMax = count;
+}
+
+/**
+ * @brief Define this object as a client connection
+ *
+ * @param fd Descriptor of the accepted connection
+ */
+void ServerStream::setClient(int fd)
+{
+	// Define this object as client
+	mMode = 1;
+
+	// Save the specified socket
+	mFd = fd;
+}
+
+/**
+ * @brief Set the Executor used to process pages out of the Reactor thread
+ *
+ * The default max number of requests depends on the number of workers, so
+ * it is updated when the executor is set (after the start of the server).
+ *
+ * @param executor Pointer to the Executor to use (or NULL)
+ */
+void ServerStream::setExecutor(Executor *executor)
+{
+	Server::setExecutor(executor);
+
+	if ((mMode == 0) && ! mMaxReqsSet)
+		updateMaxReqs();
+}
+
+/**
+ * @brief Set the (tcp) port number where server must listen
+ *
+ * @param num Port number to use
+ */
+void ServerStream::setPort(int num)
+{
+	mPort = num;
+}
+
+/**
+ * @brief Set the router used to process the next requests
+ *
+ * Open connections use the new router for their next requests, the requests
+ * in progress finish with the router they started with.
+ *
+ * @param router Pointer to the router to use
+ */
+void ServerStream::setRouter(Router *router)
+{
+	mRouter = router;
+
+	for (size_t fd = 0; fd < mClients.size(); fd++)
+	{
+		if (mClients[fd])
+			mClients[fd]->mRouter = router;
+	}
+}
+
+/**
+ * @brief Start the server
+ *
+ * Limits are computed and the listening sockets are opened.
+ */
+void ServerStream::start(void)
+{
+	Config *cfg = Config::getInstance();
+
+	// If server sockets already defined
+	if (mListeners.size())
+		// Nothing to do, server is started
+		return;
+
+	// Compute the max number of connections according to the number of
+	// descriptors available for the process (shared by all event loops)
+	struct rlimit rl;
+	mMaxConns = 1024;
+	if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur != RLIM_INFINITY))
+	{
+		if (rl.rlim_cur > STREAM_RESERVED_FDS)
+			mMaxConns = (rl.rlim_cur - STREAM_RESERVED_FDS) / getLoops();
+	}
+	// The limit can be reduced by config
+	ConfigKey *keyMax = cfg->getKey("global", "max_conns");
+	if (keyMax && (keyMax->getInteger() > 0) &&
+	    ((unsigned int)keyMax->getInteger() < mMaxConns))
+		mMaxConns = keyMax->getInteger();
+	// The max number of requests can be set by config, else it depends on
+	// the number of threads that process pages (see setExecutor)
+	keyMax = cfg->getKey("global", "max_reqs");
+	mMaxReqsSet = (keyMax && (keyMax->getInteger() > 0));
+	if (mMaxReqsSet)
+		mMaxReqs = keyMax->getInteger();
+	else
+		updateMaxReqs();
+	// Max amount of pending output datas for each connection
+	ConfigKey *keyLimit = cfg->getKey("global", "output_limit");
+	if (keyLimit && (keyLimit->getInteger() > 0))
+		mTxLimit = keyLimit->getInteger();
+	// Max size of the body of a request
+	keyLimit = cfg->getKey("global", "max_body");
+	if (keyLimit && (keyLimit->getInteger() > 0))
+		mBodyLimit = keyLimit->getInteger();
+
+	// Open listening sockets (TCP and/or unix domain sockets)
+	openListeners(mPort);
+	if (mListeners.empty())
+		Log::error() << "Server: Server NOT started: "
+		             << "no listening socket" << Log::endl;
+}
+
+/**
+ * @brief Stop the server.
+ *
+ * This method allow to stop the server without deleting it.
+ */
+void ServerStream::stop(void)
+{
+	// Close server sockets
+	closeListeners();
+}
+
+/**
+ * @brief Compute the default max number of requests in progress
+ *
+ * Each thread that process pages (the Reactor thread when there is no
+ * Executor, or each worker) can have a limited queue of requests.
+ */
+void ServerStream::updateMaxReqs(void)
+{
+	unsigned int threads = 1;
+	if (mExecutor && mExecutor->size())
+		threads = mExecutor->size();
+	mMaxReqs = threads * STREAM_WORKER_REQS;
+}
+
+// --------------------------- Stream requests ---------------------------
+
+/**
+ * @brief Default constructor
+ *
+ */
+StreamRequest::StreamRequest()
+{
+	mRunning  = false;
+	mRequest  = 0;
+	mResponse = 0;
+	mRouter   = 0;
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+StreamRequest::~StreamRequest()
+{
+	// If a Response has been allocated, delete it
+	if (mResponse)
+	{
+		delete mResponse;
+		mResponse = 0;
+	}
+	// If a Request has been allocated, delete it
+	if (mRequest)
+	{
+		delete mRequest;
+		mRequest = 0;
+	}
+	// The router is not used anymore by this request
+	if (mRouter)
+	{
+		mRouter->release();
+		mRouter = 0;
+	}
+}
+
+// ----------------------------- Stream jobs -----------------------------
+
+/**
+ * @brief Constructor of a job
+ *
+ * @param client Pointer to the connection that has received the request
+ * @param req    Pointer to the request to process
+ */
+StreamJob::StreamJob(ServerStream *client, StreamRequest *req)
+{
+	mClient  = client;
+	mRequest = req;
+}
+
+/**
+ * @brief Process the page of the request (called by a worker thread)
+ *
+ */
+void StreamJob::run(void)
+{
+	mClient->requestRun(mRequest);
+}
+
+/**
+ * @brief Send the response (called by the Reactor thread)
+ *
+ */
+void StreamJob::complete(void)
+{
+	ServerStream *client = mClient;
+	int fd = client->getFd();
+
+	mRequest->mRunning = false;
+	client->mRunning--;
+
+	client->requestDone(mRequest);
+	// Process the next requests (if the protocol waits the end of pages)
+	client->clientResume();
+	// Close the connection if this was the last request
+	client->clientClose();
+	// Delete the client if the connection has been closed
+	if (client->mParent)
+		client->mParent->clientRelease(client, fd);
+}
+
+} // namespace hermod
+/* EOF */
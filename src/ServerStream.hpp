@@ -0,0 +1,142 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef SERVER_STREAM_HPP
+#define SERVER_STREAM_HPP
+
+#include <vector>
+#include "Executor.hpp"
+#include "OutputQueue.hpp"
+#include "Request.hpp"
+#include "Response.hpp"
+#include "Server.hpp"
+
+namespace hermod {
+
+/**
+ * @class StreamRequest
+ * @brief Common part of the context of a request received on a connection
+ *
+ * Each protocol extends this class with the state of his own framing (ID of
+ * a FastCGI request, body reception of HTTP ...).
+ */
+class StreamRequest
+{
+	friend class ServerStream;
+	friend class StreamJob;
+public:
+	StreamRequest();
+	virtual ~StreamRequest();
+protected:
+	bool      mRunning;
+	Request  *mRequest;
+	Response *mResponse;
+	Router   *mRouter;
+};
+
+class ServerStream;
+
+/**
+ * @class StreamJob
+ * @brief Job used to process the page of a request into a worker thread
+ *
+ */
+class StreamJob : public ExecutorJob
+{
+public:
+	StreamJob(ServerStream *client, StreamRequest *req);
+	void run     (void);
+	void complete(void);
+private:
+	ServerStream  *mClient;
+	StreamRequest *mRequest;
+};
+
+/**
+ * @class ServerStream
+ * @brief Common part of the native servers that use stream sockets
+ *
+ * The same class is used for the listening sockets (server mode) and for each
+ * accepted connection (client mode). This class handles the connections :
+ * accept, table of clients indexed by their descriptor, output queue, drain
+ * and the processing of pages (by the Reactor thread or by an Executor). The
+ * child classes only parse the requests of their protocol (clientEvent) and
+ * format the responses (send, requestDone).
+ *
+ * A connection closed while some of its pages are running is kept (detached)
+ * until the end of these pages. When the server is drained, it stops
+ * listening and connections are closed as soon as they have no more request
+ * in progress.
+ */
+class ServerStream : public Server
+{
+	friend class StreamJob;
+public:
+	explicit ServerStream(int port);
+	virtual ~ServerStream();
+	void drain    (void);
+	bool isIdle   (void);
+	void processFd(int fd = -1);
+	void setClient(int fd);
+	void setExecutor(Executor *executor);
+	void setPort  (int num);
+	void setRouter(Router *router);
+	void start(void);
+	void stop (void);
+protected:
+	ServerStream *clientAdd(int fd, Listener *listener);
+	virtual bool clientClose (void);
+	virtual ServerStream *clientCreate(void) = 0;
+	virtual void clientEvent (void) = 0;
+	virtual bool clientIdle  (void) = 0;
+	void clientRelease(ServerStream *client, int fd);
+	virtual void clientResume(void);
+	virtual void clientStart (ServerStream *client);
+	virtual void flush(void);
+	bool isDraining  (void);
+	bool isOverloaded(void);
+	void requestAcquire(void);
+	virtual void requestClear(void) = 0;
+	virtual void requestDone (StreamRequest *req) = 0;
+	void requestRelease(void);
+	void requestRun    (StreamRequest *req);
+	void requestSubmit (StreamRequest *req);
+	void serverEvent(int listenFd);
+	void updateMaxReqs(void);
+protected:
+	int  mMode;
+	int  mPort;
+	bool mKeepConn;
+	bool mDraining;
+	// Client connections, indexed by their descriptor
+	std::vector <ServerStream *> mClients;
+	unsigned int mClientCount;
+	// Closed connections waiting for the end of their pages
+	std::vector <ServerStream *> mDetached;
+	unsigned int mRunning;
+	OutputQueue  mTxQueue;
+	unsigned int mTxLimit;
+	bool         mTxWait;
+	// Max size of a request body
+	unsigned long long mBodyLimit;
+	ServerStream *mParent;
+protected:
+	unsigned int mMaxConns;
+	unsigned int mMaxReqs;
+	bool         mMaxReqsSet;
+	unsigned int mRequestCount;
+};
+
+} // namespace hermod
+#endif
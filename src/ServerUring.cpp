@@ -0,0 +1,717 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cerrno>
+#include <cstring>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "ServerUring.hpp"
+
+namespace hermod {
+
+// Size of the submission queue
+#define URING_ENTRIES     256
+// Buffers used by receive operations
+#define URING_BUF_GROUP     0
+#define URING_BUF_COUNT   256
+#define URING_BUF_SIZE   8192
+// Initial size of the receive buffer of a connection
+#define URING_RX_SIZE   16384
+// Send buffers larger than this are not kept for the next sends
+#define URING_SEND_KEEP 65536
+// Max number of reap/submit loops for one event of the ring
+#define URING_ROUNDS        8
+
+// Type of the operations, saved into the low bits of their user data. The
+// send operations use the address of their UringSend object (aligned).
+#define URING_OP_SEND       0
+#define URING_OP_ACCEPT     1
+#define URING_OP_RECV       2
+#define URING_OP_CLOSE      3
+#define URING_OP_CANCEL     4
+
+/**
+ * @brief Encode the user data of an operation
+ *
+ * @param fd  Descriptor used by the operation
+ * @param gen Generation of the connection (0 for listening sockets)
+ * @param op  Type of the operation (URING_OP_*)
+ * @return __u64 Value of the user data
+ */
+static inline __u64 ringData(int fd, unsigned int gen, int op)
+{
+	return (((__u64)gen << 32) | ((__u64)fd << 3) | op);
+}
+
+/**
+ * @brief Get the descriptor saved into the user data of an operation
+ *
+ * @param data Value of the user data
+ * @return integer Descriptor
+ */
+static inline int ringDataFd(__u64 data)
+{
+	return ((data >> 3) & 0x1FFFFFFF);
+}
+
+/**
+ * @brief Default constructor
+ *
+ */
+ServerUring::ServerUring()
+  : ServerFastcgi()
+{
+	mUring      = 0;
+	mReaping    = false;
+	mRingFailed = false;
+	mGenCount   = 0;
+	mPending    = 0;
+
+	mGen        = 0;
+	mSending    = false;
+	mRecvArmed  = false;
+	mRecvPaused = false;
+}
+
+/**
+ * @brief Default destructor
+ *
+ */
+ServerUring::~ServerUring()
+{
+	if (mUring)
+	{
+		if (mReactor)
+			mReactor->remove(mUring->getFd());
+		// Closing the ring cancels all the operations in progress
+		delete mUring;
+		mUring = 0;
+	}
+
+	while (mSends.size())
+	{
+		delete mSends.back();
+		mSends.pop_back();
+	}
+	mSendFree.clear();
+}
+
+/**
+ * @brief Submit a multishot accept on a listening socket
+ *
+ * @param listenFd Descriptor of the listening socket
+ */
+void ServerUring::acceptArm(int listenFd)
+{
+	struct io_uring_sqe *sqe = mUring->getSqe();
+
+	sqe->opcode       = IORING_OP_ACCEPT;
+	sqe->fd           = listenFd;
+	sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data    = ringData(listenFd, 0, URING_OP_ACCEPT);
+}
+
+/**
+ * @brief Create the object used for an accepted connection
+ *
+ * @return ServerStream* Pointer to the new client object
+ */
+ServerStream *ServerUring::clientCreate(void)
+{
+	// Without ring, connections are handled like ServerFastcgi ones
+	if (mUring == 0)
+		return new ServerFastcgi();
+	return new ServerUring();
+}
+
+/**
+ * @brief Close the connection when the web server does not want to keep it
+ *
+ * The pending records and the close are submitted together (linked), so the
+ * connection is closed as soon as the records has been sent.
+ *
+ * @return boolean True if the connection has been closed
+ */
+bool ServerUring::clientClose(void)
+{
+	if ((mParent == 0) || (mFd < 0))
+		return false;
+
+	ServerUring *server = static_cast<ServerUring *>(mParent);
+	// When the server is drained, idle connections are closed
+	bool draining = (server->mDraining && mRequests.empty());
+
+	if (mKeepConn && ! draining)
+		return false;
+
+	// Some pages are running, close when they are complete
+	if (mRunning)
+		return false;
+	// A send is in progress, close when it is complete (see ringSend)
+	if (mSending)
+		return false;
+
+	// Delete the other requests in progress (if any)
+	while (mRequests.size())
+		requestRemove(mRequests.begin()->second);
+
+	recvCancel();
+
+	// Send pending records (if any) then close
+	server->mUring->reserve(2);
+	if ( ! mTxQueue.isEmpty())
+		sendSubmit(true);
+	struct io_uring_sqe *sqe = server->mUring->getSqe();
+	sqe->opcode    = IORING_OP_CLOSE;
+	sqe->fd        = mFd;
+	sqe->user_data = ringData(mFd, mGen, URING_OP_CLOSE);
+	server->mPending++;
+	server->ringSubmit();
+
+	mFd = -1;
+	return true;
+}
+
+/**
+ * @brief Process the records received on a connection
+ *
+ * Reception is stopped when the web server does not read responses, and is
+ * restarted when all the pending records has been sent (see ringSend).
+ */
+void ServerUring::clientInput(void)
+{
+	// Process the complete records (and close connection if requested)
+	clientParse();
+	if (mFd < 0)
+		return;
+
+	// Send the responses of the records
+	flush();
+
+	if ((mTxQueue.length() > mTxLimit) && ! mRecvPaused)
+	{
+		mRecvPaused = true;
+		recvCancel();
+	}
+}
+
+/**
+ * @brief Start receiving the records of a new connection
+ *
+ * @param client Pointer to the client object (inserted into the table)
+ */
+void ServerUring::clientStart(ServerStream *client)
+{
+	if (mUring == 0)
+	{
+		ServerFastcgi::clientStart(client);
+		return;
+	}
+
+	ServerUring *conn = static_cast<ServerUring *>(client);
+	conn->mGen = ++mGenCount;
+	conn->recvArm();
+}
+
+/**
+ * @brief Stop accepting connections, and close them when they are idle
+ *
+ * The multishot accepts are cancelled, then the connections already queued on
+ * the listening sockets are accepted like ServerFastcgi does.
+ */
+void ServerUring::drain(void)
+{
+	if ((mMode != 0) || mDraining)
+		return;
+
+	// The ring has not been used, all the connections are ServerFastcgi ones
+	if (mUring == 0)
+	{
+		ServerStream::drain();
+		return;
+	}
+
+	std::vector<Listener *>::iterator it;
+	for (it = mListeners.begin(); it != mListeners.end(); ++it)
+	{
+		struct io_uring_sqe *sqe = mUring->getSqe();
+		sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+		sqe->fd        = -1;
+		sqe->addr      = ringData((*it)->getFd(), 0, URING_OP_ACCEPT);
+		sqe->user_data = ringData(0, 0, URING_OP_CANCEL);
+	}
+	mUring->submit();
+	// Process the connections accepted before the cancel
+	ringReap();
+
+	for (it = mListeners.begin(); it != mListeners.end(); ++it)
+	{
+		while (1)
+		{
+			int fd = accept4((*it)->getFd(), NULL, NULL, SOCK_CLOEXEC);
+			if (fd < 0)
+			{
+				if ((errno == EINTR) || (errno == ECONNABORTED))
+					continue;
+				break;
+			}
+			clientAdd(fd, *it);
+		}
+	}
+
+	mDraining = true;
+	closeListeners();
+
+	for (size_t fd = 0; fd < mClients.size(); fd++)
+	{
+		ServerUring *client = static_cast<ServerUring *>(mClients[fd]);
+		if (client == 0)
+			continue;
+		if (client->clientClose())
+			clientRelease(client, fd);
+	}
+}
+
+/**
+ * @brief Find the client object of a completed operation
+ *
+ * @param fd  Descriptor used by the operation
+ * @param gen Generation of the connection that submitted the operation
+ * @return ServerUring* Pointer to the client (or NULL if closed)
+ */
+ServerUring *ServerUring::findClient(int fd, unsigned int gen)
+{
+	if ((fd < 0) || ((unsigned int)fd >= mClients.size()))
+		return 0;
+
+	ServerUring *client = static_cast<ServerUring *>(mClients[fd]);
+	if ((client == 0) || (client->mGen != gen))
+		return 0;
+	return client;
+}
+
+/**
+ * @brief Send all the pending records to the web server
+ *
+ * Only one send is in progress for a connection : records produced during a
+ * send are kept into the output queue and sent when it is complete.
+ */
+void ServerUring::flush(void)
+{
+	if ((mFd < 0) || mTxQueue.isEmpty())
+		return;
+
+	// Referenced responses may be deleted before the next send, keep a copy
+	if (mSending)
+	{
+		mTxQueue.detach();
+		return;
+	}
+
+	sendSubmit(false);
+	static_cast<ServerUring *>(mParent)->ringSubmit();
+}
+
+/**
+ * @brief Test if the server has no more connection
+ *
+ * @return boolean True if all connections and operations are finished
+ */
+bool ServerUring::isIdle(void)
+{
+	return (ServerStream::isIdle() && (mPending == 0));
+}
+
+/**
+ * @brief Handler called when an event is detected by the Reactor
+ *
+ * @param fd Descriptor of the ring, or of a listening socket
+ */
+void ServerUring::processFd(int fd)
+{
+	// Completions are available on the ring
+	if (mUring && (fd >= 0) && (fd == mUring->getFd()))
+	{
+		ringReap();
+		return;
+	}
+
+	// On the first connection, create the ring that will accept connections
+	if ((mMode == 0) && (mUring == 0) && ! mRingFailed &&
+	    (fd >= 0) && getListener(fd))
+	{
+		if (ringStart())
+			return;
+	}
+
+	ServerStream::processFd(fd);
+}
+
+/**
+ * @brief Submit a multishot receive on the connection
+ *
+ */
+void ServerUring::recvArm(void)
+{
+	ServerUring *server = static_cast<ServerUring *>(mParent);
+	struct io_uring_sqe *sqe = server->mUring->getSqe();
+
+	sqe->opcode    = IORING_OP_RECV;
+	sqe->fd        = mFd;
+	sqe->ioprio    = IORING_RECV_MULTISHOT;
+	sqe->flags     = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	sqe->user_data = ringData(mFd, mGen, URING_OP_RECV);
+	mRecvArmed = true;
+
+	server->ringSubmit();
+}
+
+/**
+ * @brief Cancel the receive of the connection (if any)
+ *
+ */
+void ServerUring::recvCancel(void)
+{
+	if ( ! mRecvArmed)
+		return;
+
+	ServerUring *server = static_cast<ServerUring *>(mParent);
+	struct io_uring_sqe *sqe = server->mUring->getSqe();
+
+	sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+	sqe->fd        = -1;
+	sqe->addr      = ringData(mFd, mGen, URING_OP_RECV);
+	sqe->user_data = ringData(0, 0, URING_OP_CANCEL);
+
+	server->ringSubmit();
+}
+
+/**
+ * @brief Process the completion of an accept
+ *
+ * @param cqe Pointer to the completion
+ */
+void ServerUring::ringAccept(struct io_uring_cqe *cqe)
+{
+	int listenFd = ringDataFd(cqe->user_data);
+	Listener *listener = getListener(listenFd);
+
+	// The multishot accept has been stopped, restart it (unless cancelled)
+	if ( ! (cqe->flags & IORING_CQE_F_MORE) && listener &&
+	     (cqe->res != -ECANCELED))
+		acceptArm(listenFd);
+
+	if (cqe->res < 0)
+	{
+		if (cqe->res != -ECANCELED)
+			Log::error() << "Server: Failed to accept connection: "
+			             << strerror(-cqe->res) << Log::endl;
+		return;
+	}
+
+	clientAdd(cqe->res, listener);
+}
+
+/**
+ * @brief Process the completion of a close
+ *
+ * @param cqe Pointer to the completion
+ */
+void ServerUring::ringClose(struct io_uring_cqe *cqe)
+{
+	mPending--;
+
+	// The linked send has failed, so the close has not been done
+	if (cqe->res == -ECANCELED)
+		close(ringDataFd(cqe->user_data));
+}
+
+/**
+ * @brief Process all the available completions
+ *
+ * Operations prepared while processing completions are submitted together at
+ * the end. Some of them may complete immediately, so the ring is read again.
+ */
+void ServerUring::ringReap(void)
+{
+	struct io_uring_cqe cqe;
+	unsigned long accepted = mStats.accepted;
+
+	mReaping = true;
+	try {
+		for (int round = 0; round < URING_ROUNDS; round++)
+		{
+			unsigned int count = 0;
+
+			while (mUring->next(&cqe))
+			{
+				switch (cqe.user_data & 7)
+				{
+					case URING_OP_SEND:   ringSend  (&cqe); break;
+					case URING_OP_ACCEPT: ringAccept(&cqe); break;
+					case URING_OP_RECV:   ringRecv  (&cqe); break;
+					case URING_OP_CLOSE:  ringClose (&cqe); break;
+					// Completions of cancels (and buffer errors) are not used
+					default: break;
+				}
+				count++;
+			}
+
+			if ((mUring->submit() == 0) && (count == 0))
+				break;
+		}
+	} catch (...) {
+		mReaping = false;
+		throw;
+	}
+	mReaping = false;
+
+	if (mStats.accepted != accepted)
+	{
+		mStats.wakeups++;
+		if ((mStats.accepted - accepted) > mStats.batchMax)
+			mStats.batchMax = (mStats.accepted - accepted);
+	}
+}
+
+/**
+ * @brief Process the completion of a receive
+ *
+ * @param cqe Pointer to the completion
+ */
+void ServerUring::ringRecv(struct io_uring_cqe *cqe)
+{
+	int fd = ringDataFd(cqe->user_data);
+	ServerUring *client = findClient(fd, cqe->user_data >> 32);
+	unsigned short bid = (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+	bool buffer = (cqe->flags & IORING_CQE_F_BUFFER);
+
+	// Connection already closed (datas are dropped)
+	if ((client == 0) || (client->mFd < 0))
+	{
+		if (buffer)
+			mUring->recycle(bid);
+		return;
+	}
+
+	if ( ! (cqe->flags & IORING_CQE_F_MORE))
+		client->mRecvArmed = false;
+
+	if (cqe->res > 0)
+	{
+		client->rxAppend(mUring->getBuffer(bid), cqe->res);
+		mUring->recycle(bid);
+		client->clientInput();
+	}
+	else
+	{
+		if (buffer)
+			mUring->recycle(bid);
+		// Connection closed by the web server (or error). Others results
+		// are a cancel (paused) or no more free buffer (receive again)
+		if ((cqe->res == 0) ||
+		    ((cqe->res != -ENOBUFS) && (cqe->res != -ECANCELED)))
+		{
+			if (cqe->res < 0)
+				Log::error() << "Server: Uring receive failed on " << fd
+				             << " " << strerror(-cqe->res) << Log::endl;
+			client->mTxQueue.clear();
+			close(fd);
+			client->mFd = -1;
+		}
+	}
+
+	if ((client->mFd >= 0) && ! client->mRecvArmed && ! client->mRecvPaused)
+		client->recvArm();
+
+	// If the connection has been closed, delete the client
+	clientRelease(client, fd);
+}
+
+/**
+ * @brief Process the completion of a send
+ *
+ * @param cqe Pointer to the completion
+ */
+void ServerUring::ringSend(struct io_uring_cqe *cqe)
+{
+	UringSend *op = (UringSend *)(uintptr_t)cqe->user_data;
+	int  fd     = op->fd;
+	bool linked = op->close;
+	bool failed = ((cqe->res < 0) || ((size_t)cqe->res < op->data.length()));
+	ServerUring *client = findClient(fd, op->gen);
+
+	// Release the send object, his buffer is reused if not too large
+	if (op->data.capacity() > URING_SEND_KEEP)
+		std::string().swap(op->data);
+	mSendFree.push_back(op);
+	mPending--;
+
+	// The connection is closed by the linked operation (see ringClose)
+	if (linked || (client == 0))
+		return;
+
+	client->mSending = false;
+
+	if (failed)
+	{
+		Log::error() << "Server: Uring send failed on " << fd << Log::endl;
+		client->mTxQueue.clear();
+		client->recvCancel();
+		close(fd);
+		client->mFd = -1;
+		clientRelease(client, fd);
+		return;
+	}
+
+	// Close the connection if it was waiting for the end of output, else
+	// send the records produced during this send (if any)
+	if ( ! client->clientClose())
+		client->flush();
+
+	// Restart reception if it was stopped because of pending output
+	if ((client->mFd >= 0) && client->mRecvPaused &&
+	    (client->mTxQueue.length() <= client->mTxLimit))
+	{
+		client->mRecvPaused = false;
+		client->clientInput();
+		if ((client->mFd >= 0) && ! client->mRecvArmed && ! client->mRecvPaused)
+			client->recvArm();
+	}
+
+	clientRelease(client, fd);
+}
+
+/**
+ * @brief Create the ring, and use it to accept connections
+ *
+ * @return boolean False if io_uring is not available
+ */
+bool ServerUring::ringStart(void)
+{
+	try {
+		mUring = new Uring();
+		mUring->init(URING_ENTRIES);
+		mUring->setBuffers(URING_BUF_GROUP, URING_BUF_COUNT, URING_BUF_SIZE);
+	} catch (std::exception &e) {
+		Log::warning() << "Server: io_uring not available (" << e.what()
+		               << "), use epoll" << Log::endl;
+		delete mUring;
+		mUring = 0;
+		mRingFailed = true;
+		return false;
+	}
+
+	// Listening sockets are not watched anymore, the ring accepts connections
+	std::vector<Listener *>::iterator it;
+	for (it = mListeners.begin(); it != mListeners.end(); ++it)
+	{
+		mReactor->remove((*it)->getFd());
+		acceptArm((*it)->getFd());
+	}
+	// The ring descriptor is readable when completions are available
+	mReactor->add(mUring->getFd(), this, false);
+	mUring->submit();
+
+	return true;
+}
+
+/**
+ * @brief Submit the prepared operations, unless completions are processed
+ *
+ * During ringReap, all the operations are submitted together at the end.
+ */
+void ServerUring::ringSubmit(void)
+{
+	if ( ! mReaping)
+		mUring->submit();
+}
+
+/**
+ * @brief Append received datas to the receive buffer of the connection
+ *
+ * @param data Pointer to the received datas
+ * @param len  Length of the datas
+ */
+void ServerUring::rxAppend(const char *data, unsigned int len)
+{
+	// Allocate the receive buffer on first use
+	if (mRxBuffer.size() == 0)
+		mRxBuffer.resize(URING_RX_SIZE);
+
+	if ((mRxBuffer.size() - mRxEnd) < len)
+	{
+		// Move the incomplete record at the beginning of the buffer
+		if (mRxStart)
+		{
+			memmove(&mRxBuffer[0], &mRxBuffer[mRxStart], mRxEnd - mRxStart);
+			mRxEnd  -= mRxStart;
+			mRxStart = 0;
+		}
+		if ((mRxBuffer.size() - mRxEnd) < len)
+			mRxBuffer.resize(mRxEnd + len);
+	}
+
+	memcpy(&mRxBuffer[mRxEnd], data, len);
+	mRxEnd += len;
+}
+
+/**
+ * @brief Prepare a send of all the pending records
+ *
+ * The records are copied into a buffer owned by the operation. The caller
+ * must submit the operation (see ringSubmit).
+ *
+ * @param close True if the connection is closed by a linked operation
+ */
+void ServerUring::sendSubmit(bool close)
+{
+	ServerUring *server = static_cast<ServerUring *>(mParent);
+	UringSend *op;
+
+	if (server->mSendFree.size())
+	{
+		op = server->mSendFree.back();
+		server->mSendFree.pop_back();
+	}
+	else
+	{
+		op = new UringSend;
+		server->mSends.push_back(op);
+	}
+	op->fd    = mFd;
+	op->gen   = mGen;
+	op->close = close;
+	mTxQueue.extract(op->data);
+
+	struct io_uring_sqe *sqe = server->mUring->getSqe();
+	sqe->opcode    = IORING_OP_SEND;
+	sqe->fd        = mFd;
+	sqe->addr      = (__u64)(uintptr_t)op->data.data();
+	sqe->len       = op->data.length();
+	sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+	sqe->user_data = (__u64)(uintptr_t)op;
+	if (close)
+		sqe->flags = IOSQE_IO_LINK;
+	else
+		mSending = true;
+	server->mPending++;
+}
+
+} // namespace hermod
+/* EOF */
@@ -0,0 +1,108 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef SERVER_URING_HPP
+#define SERVER_URING_HPP
+
+#include <string>
+#include <vector>
+#include "ServerFastcgi.hpp"
+#include "Uring.hpp"
+
+namespace hermod {
+
+/**
+ * @struct UringSend
+ * @brief Datas of a send operation in progress
+ *
+ */
+struct UringSend
+{
+	int  fd;           // Descriptor of the connection
+	unsigned int gen;  // Generation of the connection (see ServerUring)
+	bool close;        // Followed by a linked close of the connection
+	std::string data;  // Copy of the datas, valid until the completion
+};
+
+/**
+ * @class ServerUring
+ * @brief FastCGI server based on io_uring
+ *
+ * The protocol is the one of ServerFastcgi, only the way sockets are used is
+ * different. Instead of waiting a readiness event and calling recv/writev for
+ * each connection, operations are submitted to an io_uring instance and their
+ * completions are processed by batch when the Reactor reports that the ring
+ * is readable :
+ * - one multishot accept for each listening socket
+ * - one multishot receive for each connection, with buffers taken from a ring
+ *   registered once (no buffer reserved for idle connections)
+ * - one send for the pending records, and when the connection must be closed
+ *   a close linked to this send
+ * All the operations prepared during a batch are submitted with one system
+ * call.
+ *
+ * The ring is created by the process (or the thread) that really serves the
+ * connections, on the first event of a listening socket. When io_uring is not
+ * available, the server works like ServerFastcgi.
+ *
+ * Operations of a closed connection may complete after a new connection has
+ * been accepted with the same descriptor. To detect them, a generation number
+ * is given to each connection and is saved into the operations.
+ */
+class ServerUring : public ServerFastcgi
+{
+public:
+	ServerUring();
+	~ServerUring();
+	void drain    (void);
+	bool isIdle   (void);
+	void processFd(int fd = -1);
+protected:
+	void acceptArm   (int listenFd);
+	bool clientClose (void);
+	ServerStream *clientCreate(void);
+	void clientInput (void);
+	void clientStart (ServerStream *client);
+	ServerUring *findClient(int fd, unsigned int gen);
+	void flush(void);
+	void recvArm  (void);
+	void recvCancel(void);
+	void ringAccept(struct io_uring_cqe *cqe);
+	void ringClose (struct io_uring_cqe *cqe);
+	void ringReap  (void);
+	void ringRecv  (struct io_uring_cqe *cqe);
+	void ringSend  (struct io_uring_cqe *cqe);
+	bool ringStart (void);
+	void ringSubmit(void);
+	void rxAppend  (const char *data, unsigned int len);
+	void sendSubmit(bool close);
+private:
+	// Server mode
+	Uring *mUring;
+	bool   mReaping;
+	bool   mRingFailed;
+	unsigned int mGenCount;
+	unsigned int mPending;
+	std::vector<UringSend *> mSends;
+	std::vector<UringSend *> mSendFree;
+private:
+	// Client mode
+	unsigned int mGen;
+	bool mSending;
+	bool mRecvArmed;
+	bool mRecvPaused;
+};
+
+} // namespace hermod
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include "ServerUwsgi.hpp"
+
+namespace hermod {
+
+// Size of the header of a uwsgi packet
+#define UWSGI_HEAD_SIZE 4
+
+/**
+ * @brief Default constructor
+ *
+ */
+ServerUwsgi::ServerUwsgi()
+  : ServerScgi()
+{
+	mPort = 3031;
+}
+
+/**
+ * @brief Create the object used for an accepted connection
+ *
+ * @return ServerStream* Pointer to the new client object
+ */
+ServerStream *ServerUwsgi::clientCreate(void)
+{
+	return new ServerUwsgi();
+}
+
+/**
+ * @brief Parse the header of a request, and create the request
+ *
+ * @param data Pointer to the received datas
+ * @param len  Length of the received datas
+ * @return integer Length of the header, 0 if the header is incomplete, or -1
+ *                 if the header is malformed
+ */
+int ServerUwsgi::clientHead(const char *data, unsigned int len)
+{
+	const unsigned char *head = (const unsigned char *)data;
+
+	if (len < UWSGI_HEAD_SIZE)
+		return 0;
+	// Only the CGI parameters are supported (modifier1 = 0)
+	if (head[0] != 0)
+		return -1;
+	unsigned int size = head[1] | (head[2] << 8);
+	if (len < (UWSGI_HEAD_SIZE + size))
+		return 0;
+
+	const unsigned char *params;
+	params = (const unsigned char *)requestCreate(data + UWSGI_HEAD_SIZE, size);
+	const unsigned char *end = params + size;
+	while (params < end)
+	{
+		if ((end - params) < 2)
+			return -1;
+		unsigned int nameLen = params[0] | (params[1] << 8);
+		const char *name = (const char *)(params + 2);
+		params += 2 + nameLen;
+		if ((nameLen == 0) || ((end - params) < 2))
+			return -1;
+		unsigned int valueLen = params[0] | (params[1] << 8);
+		const char *value = (const char *)(params + 2);
+		params += 2 + valueLen;
+		if (params > end)
+			return -1;
+		if ( ! requestParam(name, nameLen, value, valueLen))
+			return -1;
+	}
+	return (UWSGI_HEAD_SIZE + size);
+}
+
+} // namespace hermod
+/* EOF */
@@ -0,0 +1,44 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef SERVER_UWSGI_HPP
+#define SERVER_UWSGI_HPP
+
+#include "ServerScgi.hpp"
+
+namespace hermod {
+
+/**
+ * @class ServerUwsgi
+ * @brief Native implementation of a uwsgi server
+ *
+ * The uwsgi protocol works like SCGI (one request for each connection, CGI
+ * parameters then the body) with a binary header : a packet of 4 bytes
+ * (modifier1, length of the parameters on 16 bits little endian, modifier2)
+ * followed by the parameters, each one being a name and a value prefixed by
+ * their length (16 bits little endian). Only the packets of CGI parameters
+ * (modifier1 = 0) are supported. The response is the CGI output of the page,
+ * like with SCGI.
+ */
+class ServerUwsgi : public ServerScgi
+{
+public:
+	ServerUwsgi();
+protected:
+	ServerStream *clientCreate(void);
+	int clientHead(const char *data, unsigned int len);
+};
+
+} // namespace hermod
+#endif
@@ -28,6 +28,9 @@ using namespace std;
 
 namespace hermod {
 
+// Directory of the session files
+static ConfigHandle<std::string> cfgPathSession("global", "path_session");
+
 /**
  * @brief Default constructor
  *
@@ -38,6 +41,7 @@ Session::Session()
 	mIsNew = false;
 	mValid = false;
 	mCount = 1;
+	mRefs  = 0;
 	mTtlLast  = time(0);
 	mTtlLimit = TTL_DEFAULT;
 }
@@ -71,8 +75,7 @@ void Session::create(void)
 	// Convert this value to string
 	String rndKey = String::number(rndKeyId);
 	
-	Config  *cfg = Config::getInstance();
-	mFilename  = cfg->get("global", "path_session");
+	mFilename  = cfgPathSession.get();
 	mFilename += "hermod-session-" + rndKey;
 	
 	// Save key to the cache
@@ -129,8 +132,7 @@ void Session::load(String sessId)
 	struct stat buffer;
 	String sessionfile;
 
-	Config  *cfg = Config::getInstance();
-	sessionfile  = cfg->get("global", "path_session");
+	sessionfile  = cfgPathSession.get();
 	sessionfile += "hermod-session-" + sessId;
 
 	if ( stat (sessionfile.data(), &buffer) )
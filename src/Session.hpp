@@ -35,6 +35,7 @@ namespace hermod {
  */
 class Session
 {
+	friend class SessionCache;
 public:
 	Session();
 	void   create(void);
@@ -60,6 +61,8 @@ protected:
 	void   updateTtl(void);
 private:
 	int    mCount;
+	// Number of pages using the session (protected by the SessionCache lock)
+	int    mRefs;
 	int    mTtlLimit;
 	time_t mTtlLast;
 	bool   mIsNew;
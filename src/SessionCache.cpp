@@ -12,13 +12,13 @@
  *
  * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
  */
-#include "Config.hpp"
 #include "SessionCache.hpp"
 #include "Session.hpp"
 
 namespace hermod {
 
 SessionCache* SessionCache::mInstance = NULL;  
+pthread_mutex_t SessionCache::mInstanceLock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * @brief Get a pointer to the cache
@@ -31,10 +31,16 @@ SessionCache* SessionCache::mInstance = NULL;
  */
 SessionCache* SessionCache::getInstance()
 {
+	SessionCache *cache;
+
+	// The cache may be created by any thread
+	pthread_mutex_lock(&mInstanceLock);
 	if ( ! mInstance)
 		mInstance = new SessionCache;
-	
-	return mInstance;
+	cache = mInstance;
+	pthread_mutex_unlock(&mInstanceLock);
+
+	return cache;
 }
 
 /**
@@ -73,12 +79,23 @@ void SessionCache::destroy(void)
  */
 SessionCache::SessionCache()
 {
-	// Nothing to do
+	pthread_mutex_init(&mLock, NULL);
+}
+
+/**
+ * @brief Default (and private) destructor
+ *
+ */
+SessionCache::~SessionCache()
+{
+	pthread_mutex_destroy(&mLock);
 }
 
 /**
  * @brief Clean the cache (delete sessions with expired TTL)
  *
+ * Sessions used by a page are kept, their TTL starts again when they are
+ * released.
  */
 void SessionCache::clean(void)
 {
@@ -86,63 +103,85 @@ void SessionCache::clean(void)
 	if (mInstance == 0)
 		return;
 
+	pthread_mutex_lock(&mInstance->mLock);
 	// Test all cache items
 	std::vector<Session *>::iterator it = mInstance->mCache.begin();
 	while (it != mInstance->mCache.end())
 	{
 		// Get the next session from cache
 		Session *sess = (*it);
-		// Test if the TTL is expired
-		if (sess->isTtlExpired())
+		// Test if the TTL is expired (and the session not used)
+		if ((sess->mRefs == 0) && sess->isTtlExpired())
 		{
 			// Delete the session, and remode it from cache
 			sess->drop();
-			mInstance->mCache.erase(it);
-			it = mInstance->mCache.begin();
+			it = mInstance->mCache.erase(it);
+			delete sess;
 		}
 		else
 			++it;
 	}
+	pthread_mutex_unlock(&mInstance->mLock);
 }
 
 /**
  * @brief Create a new session
  *
+ * @param ttl TTL of the session in seconds (0 for default, negative for
+ *            infinite), see RoutePolicy
  * @return Session* Pointer to the newly created Session
  */
-Session *SessionCache::create(void)
+Session *SessionCache::create(int ttl)
 {
 	// Allocate a new Session object
 	Session *sess = new Session();
 	// Then, use object itself to create a context
 	sess->create();
 
-	// Check if the session TTL is overloaded by config
-	Config *cfg = Config::getInstance();
-	if ( ! cfg->get("global", "session_ttl").isEmpty())
-	{
-		// Get the TTL value from config
-		String cfgTtl = cfg->get("global", "session_ttl");
-		int ttl = cfgTtl.toInt();
-		// If a positive is defined, use it
-		if (ttl > 0)
-			sess->setTtlLimit(ttl);
-		// If a nul (or negative) value is defined, set infinite TTL
-		else
-			sess->setTtlLimit(-1);
-	}
+	// Check if the session TTL is overloaded (by config)
+	if (ttl > 0)
+		sess->setTtlLimit(ttl);
+	// A negative value is used for infinite TTL
+	else if (ttl < 0)
+		sess->setTtlLimit(-1);
 	
-	// Insert this new session into local cache
+	// Insert this new session into local cache, used by the caller
+	pthread_mutex_lock(&mLock);
+	sess->mRefs++;
 	mCache.push_back(sess);
+	pthread_mutex_unlock(&mLock);
 	
 	return sess;
 }
 
+/**
+ * @brief Search a session into the memory cache
+ *
+ * The cache lock must be held by the caller.
+ *
+ * @param id The session identifier
+ * @return Session* Pointer to the Session (or NULL if not into the cache)
+ */
+Session *SessionCache::find(const String &id)
+{
+	std::vector<Session *>::iterator it;
+	for (it = mCache.begin(); it != mCache.end(); ++it)
+	{
+		if (id == (*it)->getId())
+			return (*it);
+	}
+	return NULL;
+}
+
 /**
  * @brief Find and return an existing Session
  *
  * The specified session ID is first searched into the memory cache. If not
- * found, the method try to load session from disk.
+ * found, the method try to load session from disk. The file is read without
+ * holding the cache lock (other pages can use the cache meanwhile), so the
+ * session may have been loaded by another thread in the same time : the one
+ * already into the cache is used. The session is used by the caller until
+ * it is released (see release).
  *
  * @param id The session identifier
  * @return Session* Pointer to the Session
@@ -155,33 +194,63 @@ Session *SessionCache::getById(const String &id)
 	if (id.isEmpty())
 		return NULL;
 	
-	std::vector<Session *>::iterator it;
-	for (it = mCache.begin(); it != mCache.end(); ++it)
+	pthread_mutex_lock(&mLock);
+	sess = find(id);
+	// Session is used by the caller, this is an access (TTL starts again)
+	if (sess)
 	{
-		if (id == (*it)->getId())
-		{
-			sess = (*it);
-			break;
-		}
+		sess->mRefs++;
+		sess->updateTtl();
+		pthread_mutex_unlock(&mLock);
+		return sess;
 	}
-	
+	pthread_mutex_unlock(&mLock);
+
 	// Not found into the cache, try to load from file
+	Session *loaded = new Session();
+	loaded->load(id);
+	if ( ! loaded->isValid() )
+	{
+		delete loaded;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&mLock);
+	// Another thread may have loaded the same session meanwhile
+	sess = find(id);
 	if (sess == NULL)
 	{
-		sess = new Session();
-		sess->load(id);
-		if ( sess->isValid() )
-		{
-			mCache.push_back(sess);
-		}
-		else
-		{
-			delete sess;
-			sess = NULL;
-		}
+		mCache.push_back(loaded);
+		sess = loaded;
+		loaded = NULL;
 	}
+	sess->mRefs++;
+	sess->updateTtl();
+	pthread_mutex_unlock(&mLock);
+
+	if (loaded)
+		delete loaded;
 	return sess;
 }
 
+/**
+ * @brief Release a session given by create or getById
+ *
+ * When the session is not used anymore, its TTL starts from now.
+ *
+ * @param sess Pointer to the Session to release
+ */
+void SessionCache::release(Session *sess)
+{
+	if (sess == NULL)
+		return;
+
+	pthread_mutex_lock(&mLock);
+	if (sess->mRefs > 0)
+		sess->mRefs--;
+	sess->updateTtl();
+	pthread_mutex_unlock(&mLock);
+}
+
 } // namespace hermod
 /* EOF */
@@ -15,6 +15,7 @@
 #ifndef SESSIONCACHE_HPP
 #define SESSIONCACHE_HPP
 #include <vector>
+#include <pthread.h>
 #include "String.hpp"
 
 namespace hermod {
@@ -25,6 +26,10 @@ class Session;
  * @class SessionCache
  * @brief A global memory cache for Session
  *
+ * The cache can be used by pages running into different threads, access to
+ * the list of sessions is protected by a mutex. Each session given to a page
+ * is referenced until the page releases it, so a session in use is never
+ * removed by clean().
  */
 class SessionCache
 {
@@ -33,12 +38,17 @@ public:
 	static SessionCache* getInstance();
 	static void clean(void);
 public:
-	Session *create (void);
+	Session *create (int ttl = 0);
 	Session *getById(const String &id);
+	void     release(Session *sess);
 private:
 	SessionCache();
+	~SessionCache();
+	Session *find(const String &id);
 	static SessionCache   *mInstance;
+	static pthread_mutex_t mInstanceLock;
 	std::vector<Session *> mCache;
+	pthread_mutex_t        mLock;
 };
 
 } // namespace hermod
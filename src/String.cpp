@@ -69,6 +69,22 @@ String::String(const char *src)
 	copy((char *)src, len);
 }
 
+/**
+ * @brief Constructor with a buffer and a length
+ *
+ * @param src Pointer to the datas to copy (no NULL terminator needed)
+ * @param len Number of bytes to copy
+ */
+String::String(const char *src, size_t len)
+{
+	mBuffer = 0;
+	mLength = 0;
+	mSize   = 0;
+
+	// Copy the string
+	copy((char *)src, len);
+}
+
 /**
  * @brief Constructor with copy from an std::string
  *
@@ -33,6 +33,7 @@ public:
 	String();
 	String(const String &src);
 	String(const char *src);
+	String(const char *src, size_t len);
 	String(const std::string &src);
 	~String();
 	String     &append   (const String &src);
@@ -0,0 +1,343 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Uring.hpp"
+
+namespace hermod {
+
+/**
+ * @brief Default constructor
+ *
+ */
+Uring::Uring()
+{
+	mFd         = -1;
+	mSqRing     = 0;
+	mSqRingSize = 0;
+	mSqHead     = 0;
+	mSqTail     = 0;
+	mSqFlags    = 0;
+	mSqArray    = 0;
+	mSqMask     = 0;
+	mSqEntries  = 0;
+	mSqLocal    = 0;
+	mSqes       = 0;
+	mSqesSize   = 0;
+	mCqRing     = 0;
+	mCqRingSize = 0;
+	mCqHead     = 0;
+	mCqTail     = 0;
+	mCqMask     = 0;
+	mCqes       = 0;
+	mBuffers    = 0;
+	mBuffersSize = 0;
+	mBufCount   = 0;
+	mBufSize    = 0;
+	mBufGroup   = 0;
+}
+
+/**
+ * @brief Default destructor
+ *
+ * Closing the instance cancels all the operations in progress.
+ */
+Uring::~Uring()
+{
+	if (mFd >= 0)
+		close(mFd);
+	if (mBuffers)
+		munmap(mBuffers, mBuffersSize);
+	if (mSqes)
+		munmap(mSqes, mSqesSize);
+	if (mCqRing && (mCqRing != mSqRing))
+		munmap(mCqRing, mCqRingSize);
+	if (mSqRing)
+		munmap(mSqRing, mSqRingSize);
+}
+
+/**
+ * @brief Call io_uring_enter to submit operations and/or get completions
+ *
+ * @param toSubmit    Number of prepared operations to submit
+ * @param minComplete Number of completions to wait (with GETEVENTS flag)
+ * @param flags       Flags of io_uring_enter (IORING_ENTER_*)
+ * @return integer Number of submitted operations
+ */
+int Uring::enter(unsigned int toSubmit, unsigned int minComplete,
+                 unsigned int flags)
+{
+	while (1)
+	{
+		int ret = syscall(__NR_io_uring_enter, mFd, toSubmit, minComplete,
+		                  flags, NULL, 0);
+		if (ret >= 0)
+			return ret;
+		if (errno == EINTR)
+			continue;
+		// Completion queue is full, the caller must consume it first
+		if ((errno == EAGAIN) || (errno == EBUSY))
+			return 0;
+		throw std::runtime_error("Uring: io_uring_enter failed");
+	}
+}
+
+/**
+ * @brief Get the address of a provided buffer
+ *
+ * @param bid Buffer ID (given by the completion of a receive)
+ * @return char* Pointer to the buffer
+ */
+char *Uring::getBuffer(unsigned short bid)
+{
+	return (mBuffers + ((size_t)bid * mBufSize));
+}
+
+/**
+ * @brief Get the descriptor of the io_uring instance
+ *
+ * @return integer Descriptor (or -1 if not initialized)
+ */
+int Uring::getFd(void) const
+{
+	return mFd;
+}
+
+/**
+ * @brief Get a free entry of the submission queue
+ *
+ * The entry is cleared, the caller must fill it. When the queue is full, the
+ * prepared operations are submitted first.
+ *
+ * @return io_uring_sqe* Pointer to the submission entry
+ */
+struct io_uring_sqe *Uring::getSqe(void)
+{
+	reserve(1);
+
+	unsigned int index = (mSqLocal & mSqMask);
+	struct io_uring_sqe *sqe = &mSqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	mSqArray[index] = index;
+	mSqLocal++;
+	return sqe;
+}
+
+/**
+ * @brief Create the io_uring instance and map his queues
+ *
+ * @param entries Number of entries of the submission queue
+ */
+void Uring::init(unsigned int entries)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	// Completions of multishot operations are more numerous than submissions
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+	p.cq_entries = entries * 4;
+
+	mFd = syscall(__NR_io_uring_setup, entries, &p);
+	if (mFd < 0)
+		throw std::runtime_error("Uring: io_uring_setup failed");
+
+	mSqRingSize = p.sq_off.array + (p.sq_entries * sizeof(unsigned int));
+	mCqRingSize = p.cq_off.cqes  + (p.cq_entries * sizeof(struct io_uring_cqe));
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (mCqRingSize > mSqRingSize)
+			mSqRingSize = mCqRingSize;
+		mCqRingSize = mSqRingSize;
+	}
+
+	mSqRing = mmap(0, mSqRingSize, PROT_READ | PROT_WRITE,
+	               MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+	if (mSqRing == MAP_FAILED)
+	{
+		mSqRing = 0;
+		throw std::runtime_error("Uring: Failed to map submission ring");
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		mCqRing = mSqRing;
+	else
+	{
+		mCqRing = mmap(0, mCqRingSize, PROT_READ | PROT_WRITE,
+		               MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+		if (mCqRing == MAP_FAILED)
+		{
+			mCqRing = 0;
+			throw std::runtime_error("Uring: Failed to map completion ring");
+		}
+	}
+	mSqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	mSqes = (struct io_uring_sqe *)mmap(0, mSqesSize, PROT_READ | PROT_WRITE,
+	                      MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES);
+	if (mSqes == MAP_FAILED)
+	{
+		mSqes = 0;
+		throw std::runtime_error("Uring: Failed to map submission entries");
+	}
+
+	char *sq = (char *)mSqRing;
+	mSqHead   = (unsigned int *)(sq + p.sq_off.head);
+	mSqTail   = (unsigned int *)(sq + p.sq_off.tail);
+	mSqFlags  = (unsigned int *)(sq + p.sq_off.flags);
+	mSqArray  = (unsigned int *)(sq + p.sq_off.array);
+	mSqMask   = *(unsigned int *)(sq + p.sq_off.ring_mask);
+	mSqEntries = p.sq_entries;
+	mSqLocal  = *mSqTail;
+
+	char *cq = (char *)mCqRing;
+	mCqHead   = (unsigned int *)(cq + p.cq_off.head);
+	mCqTail   = (unsigned int *)(cq + p.cq_off.tail);
+	mCqMask   = *(unsigned int *)(cq + p.cq_off.ring_mask);
+	mCqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+/**
+ * @brief Get the next available completion
+ *
+ * @param cqe Pointer to a completion entry where the result is copied
+ * @return boolean False if there is no more completion
+ */
+bool Uring::next(struct io_uring_cqe *cqe)
+{
+	unsigned int head = *mCqHead;
+	unsigned int tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+	{
+		// Completions that did not fit into the queue are kept by the
+		// kernel, ask for them
+		if ( ! (__atomic_load_n(mSqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+			return false;
+		enter(0, 0, IORING_ENTER_GETEVENTS);
+		tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+			return false;
+	}
+
+	*cqe = mCqes[head & mCqMask];
+	__atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * @brief Give a provided buffer back to the kernel, when his datas are used
+ *
+ * The buffer is given with an operation that is submitted with the next
+ * ones, so no system call is added.
+ *
+ * @param bid Buffer ID
+ */
+void Uring::recycle(unsigned short bid)
+{
+	struct io_uring_sqe *sqe = getSqe();
+
+	sqe->opcode    = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd        = 1;
+	sqe->addr      = (__u64)(uintptr_t)getBuffer(bid);
+	sqe->len       = mBufSize;
+	sqe->off       = bid;
+	sqe->buf_group = mBufGroup;
+	sqe->flags     = IOSQE_CQE_SKIP_SUCCESS;
+	sqe->user_data = URING_DATA_BUFFERS;
+}
+
+/**
+ * @brief Ensure that some entries of the submission queue are free
+ *
+ * Linked operations must be submitted together, so all the entries of a chain
+ * are reserved before preparing the first one.
+ *
+ * @param count Number of needed entries
+ */
+void Uring::reserve(unsigned int count)
+{
+	unsigned int head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+
+	if ((mSqEntries - (mSqLocal - head)) >= count)
+		return;
+
+	submit();
+	head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+	if ((mSqEntries - (mSqLocal - head)) < count)
+		throw std::runtime_error("Uring: submission queue full");
+}
+
+/**
+ * @brief Provide a group of buffers used by receive operations
+ *
+ * Receive operations with IOSQE_BUFFER_SELECT take a buffer from this group
+ * when datas are available, so no memory is reserved for idle connections.
+ *
+ * @param group Buffer group ID (used by the receive operations)
+ * @param count Number of buffers
+ * @param size  Size of each buffer
+ */
+void Uring::setBuffers(unsigned short group, unsigned int count, unsigned int size)
+{
+	mBufGroup = group;
+	mBufCount = count;
+	mBufSize  = size;
+
+	mBuffersSize = (size_t)count * size;
+	void *buffers = mmap(0, mBuffersSize, PROT_READ | PROT_WRITE,
+	                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffers == MAP_FAILED)
+		throw std::runtime_error("Uring: Failed to allocate buffers");
+	mBuffers = (char *)buffers;
+
+	// Give all the buffers with one operation, and wait for the result
+	struct io_uring_sqe *sqe = getSqe();
+	sqe->opcode    = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd        = count;
+	sqe->addr      = (__u64)(uintptr_t)mBuffers;
+	sqe->len       = size;
+	sqe->off       = 0;
+	sqe->buf_group = group;
+	sqe->user_data = URING_DATA_BUFFERS;
+	unsigned int toSubmit = (mSqLocal - *mSqTail);
+	__atomic_store_n(mSqTail, mSqLocal, __ATOMIC_RELEASE);
+	enter(toSubmit, 1, IORING_ENTER_GETEVENTS);
+
+	struct io_uring_cqe cqe;
+	if ( ! next(&cqe) || (cqe.res < 0))
+		throw std::runtime_error("Uring: Failed to provide buffers");
+}
+
+/**
+ * @brief Submit all the prepared operations to the kernel
+ *
+ * @return integer Number of submitted operations
+ */
+int Uring::submit(void)
+{
+	unsigned int toSubmit = (mSqLocal - *mSqTail);
+
+	if (toSubmit == 0)
+		return 0;
+
+	__atomic_store_n(mSqTail, mSqLocal, __ATOMIC_RELEASE);
+	return enter(toSubmit, 0, 0);
+}
+
+} // namespace hermod
+/* EOF */
@@ -0,0 +1,85 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <cstddef>
+#include <linux/io_uring.h>
+
+namespace hermod {
+
+// User data of the operations that give buffers to the kernel, they are only
+// completed on error
+#define URING_DATA_BUFFERS 0xFFFFFFFFFFFFFFFFULL
+
+/**
+ * @class Uring
+ * @brief Minimal wrapper of an io_uring instance
+ *
+ * Only the features used by servers are implemented, directly with system
+ * calls (no dependency to liburing) : submission and completion queues, and
+ * one group of provided buffers used by receive operations. Operations are
+ * prepared into the submission queue with getSqe(), then given to the kernel
+ * all together with submit(). The descriptor of the instance is readable when
+ * completions are available, so it can be watched by the Reactor.
+ */
+class Uring
+{
+public:
+	Uring();
+	~Uring();
+	char *getBuffer (unsigned short bid);
+	int   getFd (void) const;
+	struct io_uring_sqe *getSqe(void);
+	void  init  (unsigned int entries);
+	bool  next  (struct io_uring_cqe *cqe);
+	void  recycle(unsigned short bid);
+	void  reserve(unsigned int count);
+	void  setBuffers(unsigned short group, unsigned int count, unsigned int size);
+	int   submit(void);
+private:
+	int enter(unsigned int toSubmit, unsigned int minComplete,
+	          unsigned int flags);
+private:
+	int    mFd;
+	// Submission queue
+	void  *mSqRing;
+	size_t mSqRingSize;
+	unsigned int *mSqHead;
+	unsigned int *mSqTail;
+	unsigned int *mSqFlags;
+	unsigned int *mSqArray;
+	unsigned int  mSqMask;
+	unsigned int  mSqEntries;
+	unsigned int  mSqLocal;
+	struct io_uring_sqe *mSqes;
+	size_t mSqesSize;
+	// Completion queue
+	void  *mCqRing;
+	size_t mCqRingSize;
+	unsigned int *mCqHead;
+	unsigned int *mCqTail;
+	unsigned int  mCqMask;
+	struct io_uring_cqe *mCqes;
+	// Provided buffers
+	char  *mBuffers;
+	size_t mBuffersSize;
+	unsigned int mBufCount;
+	unsigned int mBufSize;
+	unsigned short mBufGroup;
+};
+
+} // namespace hermod
+#endif
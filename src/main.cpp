@@ -16,6 +16,7 @@
 #include <stdexcept>
 #include <iostream>
 #include <string>
+#include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #include "App.hpp"
@@ -60,10 +61,17 @@ int main(int argc, char **argv)
 	sa.sa_flags   = 0;
 	sa.sa_handler = signal_handler;
 	// Install signal handler
+	sigaction(SIGHUP,  &sa, NULL);
 	sigaction(SIGINT,  &sa, NULL);
+	sigaction(SIGQUIT, &sa, NULL);
 	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR2, &sa, NULL);
+	// A client that closes his connection must not stop the server, write
+	// errors are reported as EPIPE
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
 
-	hermod::App::getInstance()->init()->exec();
+	hermod::App::getInstance()->setCommand(argv)->init()->exec();
 	hermod::App::destroy();
 
 	return(0);
@@ -187,10 +195,17 @@ static void daemonize(void)
 		exit(0);
 	}
 	
-	// The child (now daemon) continue
-	close(0);
-	close(1);
-	close(2);
+	// The child (now daemon) continue, standard descriptors are redirected
+	// to /dev/null (so they are never reused by sockets)
+	int fd = open("/dev/null", O_RDWR);
+	if (fd >= 0)
+	{
+		dup2(fd, 0);
+		dup2(fd, 1);
+		dup2(fd, 2);
+		if (fd > 2)
+			close(fd);
+	}
 	return;
 }
 
@@ -218,9 +233,15 @@ static void help(void)
  */
 static void signal_handler(int sig)
 {
+	if (sig == SIGHUP)
+		hermod::App::sigHup();
 	if (sig == SIGINT)
 		hermod::App::sigInt();
 	if (sig == SIGTERM)
-		hermod::App::sigInt();
+		hermod::App::sigTerm();
+	if (sig == SIGQUIT)
+		hermod::App::sigQuit();
+	if (sig == SIGUSR2)
+		hermod::App::sigUpgrade();
 }
 /* EOF */
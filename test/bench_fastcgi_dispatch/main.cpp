@@ -0,0 +1,263 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Config.hpp"
+#include "Reactor.hpp"
+#include "Router.hpp"
+#include "ServerFastcgi.hpp"
+#include "String.hpp"
+
+using namespace hermod;
+
+/*
+ * This benchmark measures the cost of finding the connection of an event
+ * into the FastCGI server, according to the number of open connections. The
+ * connections are really accepted by the server, then the same sequence of
+ * descriptors is searched with the table of the server (indexed by fd) and
+ * with a copy of the legacy dispatch (linear search into a list of the same
+ * connections). Only the lookup is timed, without socket I/O.
+ */
+
+static int bench_events = 200000;
+static int bench_max    = 10000;
+
+/**
+ * @class BenchServer
+ * @brief FastCGI server that gives access to his table of connections
+ *
+ */
+class BenchServer : public ServerFastcgi
+{
+public:
+	ServerStream *lookup(int fd)
+	{
+		if ((fd >= 0) && ((unsigned int)fd < mClients.size()))
+			return mClients[fd];
+		return 0;
+	}
+	void listClients(std::vector<ServerStream *> &list, std::vector<int> &fds)
+	{
+		list.clear();
+		fds.clear();
+		for (size_t fd = 0; fd < mClients.size(); fd++)
+		{
+			if (mClients[fd] == 0)
+				continue;
+			list.push_back(mClients[fd]);
+			fds.push_back(fd);
+		}
+	}
+};
+
+static void   connectClients(int listenFd, ServerFastcgi *server,
+                             std::vector<int> &clients, int count);
+static double now(void);
+static double legacy_lookup(std::vector<ServerStream *> &list,
+                            std::vector<int> &events);
+static double server_lookup(BenchServer *server, std::vector<int> &events);
+
+/**
+ * @brief Entry point of the benchmark
+ *
+ * @param argc Number of arguments on command line
+ * @param argv Pointer to arguments array
+ */
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg( argv[i] );
+		if ((arg.compare("-n") == 0) && (i + 1 < argc))
+			bench_events = atoi(argv[++i]);
+		else if ((arg.compare("-c") == 0) && (i + 1 < argc))
+			bench_max    = atoi(argv[++i]);
+	}
+
+	// Each connection uses two descriptors (client and server side)
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if ((rl.rlim_cur != RLIM_INFINITY) &&
+		    ((int)(rl.rlim_cur - 64) / 2 < bench_max))
+			bench_max = (rl.rlim_cur - 64) / 2;
+	}
+
+	// Listen on a private socket (abstract namespace)
+	Config *cfg = Config::getInstance();
+	std::string address("unix:@hermod-bench-");
+	address += String::number(getpid()).toStdStr();
+	cfg->set("global", "listen", address);
+
+	Reactor reactor;
+	Router  router;
+	BenchServer *server = new BenchServer();
+	server->setReactor(&reactor);
+	server->setRouter(&router);
+	server->start();
+	if (server->getFd() < 0)
+	{
+		std::cerr << "Failed to open listening socket" << std::endl;
+		return(-1);
+	}
+
+	std::cout << "Lookup of " << bench_events << " events "
+	          << "(time per event, in nanoseconds)" << std::endl;
+
+	std::vector<int> clients;
+	for (int count = 10; ; count *= 10)
+	{
+		// Last pass use the max number of connections
+		if (count > bench_max)
+			count = bench_max;
+		connectClients(server->getFd(), server, clients, count);
+
+		// Both implementations search the same sequence of descriptors
+		std::vector<ServerStream *> list;
+		std::vector<int> fds;
+		server->listClients(list, fds);
+		if (fds.empty())
+			break;
+		std::vector<int> events;
+		unsigned int seed = 1;
+		for (int i = 0; i < bench_events; i++)
+			events.push_back(fds[rand_r(&seed) % fds.size()]);
+
+		double tServer = server_lookup(server, events);
+		double tLegacy = legacy_lookup(list, events);
+
+		std::cout << " * " << fds.size() << " connections : "
+		          << "table " << tServer << " ns, "
+		          << "legacy list " << tLegacy << " ns" << std::endl;
+		if (count == bench_max)
+			break;
+	}
+
+	for (size_t i = 0; i < clients.size(); i++)
+		close(clients[i]);
+	delete server;
+	Config::destroy();
+	return(0);
+}
+
+/**
+ * @brief Open connections to the server until the requested count
+ *
+ */
+static void connectClients(int listenFd, ServerFastcgi *server,
+                           std::vector<int> &clients, int count)
+{
+	struct sockaddr_un addr;
+	socklen_t addrLen = sizeof(addr);
+
+	getsockname(listenFd, (struct sockaddr *)&addr, &addrLen);
+
+	while ((int)clients.size() < count)
+	{
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			break;
+		if (connect(fd, (struct sockaddr *)&addr, addrLen) < 0)
+		{
+			close(fd);
+			break;
+		}
+		clients.push_back(fd);
+		// Accept pending connections before the backlog is full
+		if ((clients.size() % 64) == 0)
+			server->processFd(listenFd);
+	}
+	server->processFd(listenFd);
+}
+
+/**
+ * @brief Get current time (in seconds)
+ *
+ */
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (tv.tv_sec + (tv.tv_usec / 1000000.0));
+}
+
+/**
+ * @brief Legacy lookup (reference)
+ *
+ * The connection of each event is searched into a list, comparing the
+ * descriptor of each connection.
+ */
+static double legacy_lookup(std::vector<ServerStream *> &list,
+                            std::vector<int> &events)
+{
+	size_t found = 0;
+
+	double t0 = now();
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		ServerStream *client = 0;
+		std::vector<ServerStream *>::iterator it;
+		for (it = list.begin(); it != list.end(); ++it)
+		{
+			if (events[i] == (*it)->getFd())
+			{
+				client = *it;
+				break;
+			}
+		}
+		if (client)
+			found++;
+	}
+	double t1 = now();
+
+	if (found != events.size())
+		std::cerr << "Legacy: " << found << " connections found" << std::endl;
+
+	return ((t1 - t0) * 1000000000.0) / events.size();
+}
+
+/**
+ * @brief Lookup used by the server (table indexed by descriptor)
+ *
+ */
+static double server_lookup(BenchServer *server, std::vector<int> &events)
+{
+	size_t found = 0;
+
+	double t0 = now();
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		ServerStream *client = server->lookup(events[i]);
+		if (client && (client->getFd() == events[i]))
+			found++;
+	}
+	double t1 = now();
+
+	if (found != events.size())
+		std::cerr << "Table: " << found << " connections found" << std::endl;
+
+	return ((t1 - t0) * 1000000000.0) / events.size();
+}
+/* EOF */
@@ -0,0 +1,323 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "Reactor.hpp"
+#include "Router.hpp"
+#include "ServerFastcgi.hpp"
+#include "String.hpp"
+
+using namespace hermod;
+
+/*
+ * This benchmark measures the time needed by the FastCGI server to receive
+ * POST requests with a large body. The same stream of records is sent to the
+ * receive path of ServerFastcgi and to a copy of the legacy receive loop
+ * (one malloc per record, one read per header and per content, body copied
+ * again for each new STDIN record).
+ */
+
+static int bench_count   = 20;
+static int bench_body    = 1048576;
+static int bench_record  = 65528;
+
+static std::string  buildRecord(int type, int id, const char *data, int len);
+static std::string  buildStream(void);
+static double       now(void);
+static void        *thread_drain(void *arg);
+static void        *thread_feed (void *arg);
+static int          legacy_receive(int fd);
+static int          server_receive(int fd);
+
+// Number of END_REQUEST records received by the drain thread
+static int drain_count;
+
+/**
+ * @brief Entry point of the benchmark
+ *
+ * @param argc Number of arguments on command line
+ * @param argv Pointer to arguments array
+ */
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg( argv[i] );
+		if ((arg.compare("-n") == 0) && (i + 1 < argc))
+			bench_count  = atoi(argv[++i]);
+		else if ((arg.compare("-s") == 0) && (i + 1 < argc))
+			bench_body   = atoi(argv[++i]);
+		else if ((arg.compare("-r") == 0) && (i + 1 < argc))
+			bench_record = atoi(argv[++i]);
+	}
+	if ((bench_record <= 0) || (bench_record > 65535))
+		bench_record = 65528;
+
+	std::string stream = buildStream();
+
+	std::cout << "Receive " << bench_count << " POST requests of "
+	          << bench_body << " bytes (STDIN records of "
+	          << bench_record << " bytes)" << std::endl;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		int sv[2];
+		pthread_t feeder, drainer;
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+			return(-1);
+
+		std::pair<int, std::string *> feed(sv[1], &stream);
+		pthread_create(&feeder,  0, thread_feed,  &feed);
+		pthread_create(&drainer, 0, thread_drain, &sv[1]);
+
+		double t0 = now();
+		int count;
+		if (pass == 0)
+			count = legacy_receive(sv[0]);
+		else
+			count = server_receive(sv[0]);
+		double t1 = now();
+
+		pthread_join(feeder,  0);
+		pthread_join(drainer, 0);
+		close(sv[1]);
+		// Responses are counted by the drain thread
+		if (count < 0)
+			count = drain_count;
+
+		std::cout << " * " << (pass == 0 ? "legacy path " : "current path")
+		          << " : " << count << " requests, "
+		          << (t1 - t0) * 1000.0 << " ms" << std::endl;
+	}
+	return(0);
+}
+
+/**
+ * @brief Create one FastCGI record
+ *
+ */
+static std::string buildRecord(int type, int id, const char *data, int len)
+{
+	std::string rec;
+	int pad = (8 - (len & 7)) & 7;
+
+	rec += (char)1;
+	rec += (char)type;
+	rec += (char)(id  >> 8);
+	rec += (char)(id  & 0xFF);
+	rec += (char)(len >> 8);
+	rec += (char)(len & 0xFF);
+	rec += (char)pad;
+	rec += (char)0;
+	rec.append(data, len);
+	rec.append(pad, '\0');
+	return rec;
+}
+
+/**
+ * @brief Create the stream of records sent by the (fake) web server
+ *
+ */
+static std::string buildStream(void)
+{
+	std::string stream;
+	std::string params;
+	std::string body(bench_body, 'x');
+	char begin[8] = {0, 1, 1, 0, 0, 0, 0, 0}; // Responder, keep connection
+
+	params += (char)11; params += (char)8;
+	params += "SCRIPT_NAMEnot_here";
+	params += (char)14; params += (char)4;
+	params += "REQUEST_METHODPOST";
+
+	for (int i = 0; i < bench_count; i++)
+	{
+		stream += buildRecord(1, 1, begin, 8);
+		stream += buildRecord(4, 1, params.data(), params.length());
+		stream += buildRecord(4, 1, 0, 0);
+		for (int pos = 0; pos < bench_body; pos += bench_record)
+		{
+			int len = bench_body - pos;
+			if (len > bench_record)
+				len = bench_record;
+			stream += buildRecord(5, 1, body.data() + pos, len);
+		}
+		stream += buildRecord(5, 1, 0, 0);
+	}
+	return stream;
+}
+
+/**
+ * @brief Get current time (in seconds)
+ *
+ */
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (tv.tv_sec + (tv.tv_usec / 1000000.0));
+}
+
+/**
+ * @brief Thread used to read responses, and count END_REQUEST records
+ *
+ */
+static void *thread_drain(void *arg)
+{
+	int  fd = *(int *)arg;
+	char buffer[65536];
+	std::string rx;
+
+	drain_count = 0;
+	while (1)
+	{
+		ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+		if (len <= 0)
+			break;
+		rx.append(buffer, len);
+
+		// Parse complete records
+		size_t pos = 0;
+		while ((rx.length() - pos) >= 8)
+		{
+			const unsigned char *h = (const unsigned char *)rx.data() + pos;
+			size_t total = 8 + ((h[4] << 8) | h[5]) + h[6];
+			if ((rx.length() - pos) < total)
+				break;
+			if (h[1] == 3)
+				drain_count++;
+			pos += total;
+		}
+		rx.erase(0, pos);
+	}
+	return 0;
+}
+
+/**
+ * @brief Thread used to send the stream of records
+ *
+ */
+static void *thread_feed(void *arg)
+{
+	std::pair<int, std::string *> *feed;
+	feed = (std::pair<int, std::string *> *)arg;
+	const char *ptr = feed->second->data();
+	size_t      len = feed->second->length();
+
+	while (len)
+	{
+		ssize_t n = send(feed->first, ptr, len, 0);
+		if (n <= 0)
+			break;
+		ptr += n;
+		len -= n;
+	}
+	// End of stream
+	shutdown(feed->first, SHUT_WR);
+	return 0;
+}
+
+/**
+ * @brief Legacy receive loop (reference)
+ *
+ */
+static int legacy_receive(int fd)
+{
+	unsigned char header[8];
+	String *body = 0;
+	int count = 0;
+
+	while (1)
+	{
+		// Read the record header
+		if (recv(fd, header, 8, MSG_WAITALL) != 8)
+			break;
+		unsigned int len = (header[4] << 8) | header[5];
+		unsigned int total = len + header[6];
+
+		// Allocate a buffer for the record content
+		unsigned char *data = (unsigned char *)malloc(total);
+		if ((total > 0) && (recv(fd, data, total, MSG_WAITALL) != (int)total))
+		{
+			free(data);
+			break;
+		}
+
+		if ((header[1] == 5) && len)
+		{
+			// Copy the old body and the new content into a new buffer
+			unsigned int oldLen = (body ? body->length() : 0);
+			String *newBody = new String();
+			newBody->reserve(oldLen + len);
+			char *pOut = newBody->data();
+			if (body)
+			{
+				char *pIn = body->data();
+				for (unsigned int j = 0; j < oldLen; j++)
+					*pOut++ = *pIn++;
+				delete body;
+			}
+			for (unsigned int j = 0; j < len; j++)
+				*pOut++ = data[j];
+			body = newBody;
+		}
+		else if (header[1] == 5)
+		{
+			delete body;
+			body = 0;
+			count++;
+		}
+		free(data);
+	}
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+	return count;
+}
+
+/**
+ * @brief Receive records with the ServerFastcgi client
+ *
+ */
+static int server_receive(int fd)
+{
+	Reactor reactor;
+	Router  router;
+	ServerFastcgi *client = new ServerFastcgi();
+	client->setClient(fd);
+	client->setRouter(&router);
+	client->setReactor(&reactor);
+
+	// Process events until the socket is closed (end of stream)
+	while (client->getFd() >= 0)
+	{
+		struct pollfd pfd;
+		pfd.fd     = fd;
+		pfd.events = POLLIN;
+		poll(&pfd, 1, -1);
+		client->processFd(fd);
+	}
+	delete client;
+
+	return -1;
+}
+/* EOF */
@@ -0,0 +1,472 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Config.hpp"
+#include "ModuleCache.hpp"
+#include "Reactor.hpp"
+#include "Router.hpp"
+#include "ServerFastcgi.hpp"
+#include "ServerScgi.hpp"
+#include "ServerUwsgi.hpp"
+#include "String.hpp"
+
+using namespace hermod;
+
+/*
+ * This benchmark compares the protocols that can be used behind a web server
+ * (like nginx) on the hello_json route of the Dummy module. Each round sends
+ * one request on many connections and waits for all the responses. The server
+ * runs into its own thread (like a ReactorThread), and the CPU time of this
+ * thread is measured for each protocol :
+ * - FastCGI with connections kept open between requests (fastcgi_keep_conn)
+ * - FastCGI with one connection for each request (nginx default)
+ * - SCGI and uwsgi, that always use one connection for each request
+ */
+
+static int bench_conns  = 64;
+static int bench_rounds = 1000;
+
+// Protocols to compare
+#define PROTO_FCGI_KEEP 0
+#define PROTO_FCGI      1
+#define PROTO_SCGI      2
+#define PROTO_UWSGI     3
+
+/**
+ * @struct BenchServer
+ * @brief Context of the server thread
+ *
+ */
+struct BenchServer
+{
+	Reactor *reactor;
+	bool     running;
+	double   user;     // CPU time of the thread (user), in seconds
+	double   sys;      // CPU time of the thread (system), in seconds
+};
+
+/**
+ * @struct BenchParam
+ * @brief CGI parameter sent with the requests
+ *
+ */
+struct BenchParam
+{
+	const char *name;
+	const char *value;
+};
+
+// Parameters sent by nginx for a simple GET (see fastcgi_params)
+static const BenchParam bench_params[] = {
+	{"CONTENT_LENGTH",  "0"},
+	{"QUERY_STRING",    ""},
+	{"REQUEST_METHOD",  "GET"},
+	{"CONTENT_TYPE",    ""},
+	{"SCRIPT_NAME",     "/hello_json"},
+	{"REQUEST_URI",     "/hello_json"},
+	{"DOCUMENT_URI",    "/hello_json"},
+	{"SERVER_PROTOCOL", "HTTP/1.1"},
+	{"REMOTE_ADDR",     "127.0.0.1"},
+	{"REMOTE_PORT",     "41234"},
+	{"SERVER_NAME",     "localhost"},
+	{"HTTP_HOST",       "localhost"},
+	{"HTTP_ACCEPT",     "*/*"},
+	{0, 0}
+};
+
+static std::string buildFcgi (bool keep);
+static std::string buildRecord(int type, int id, const char *data, int len);
+static std::string buildScgi (void);
+static std::string buildUwsgi(void);
+static int    connectServer(struct sockaddr_un *addr, socklen_t addrLen);
+static double now(void);
+static int    readFcgi(int fd, std::string &rx);
+static int    readClose(int fd);
+static void   run(int proto, Server *server, Reactor *reactor,
+                  const std::string &request);
+static void  *thread_server(void *arg);
+
+/**
+ * @brief Entry point of the benchmark
+ *
+ * @param argc Number of arguments on command line
+ * @param argv Pointer to arguments array
+ */
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg( argv[i] );
+		if ((arg.compare("-c") == 0) && (i + 1 < argc))
+			bench_conns  = atoi(argv[++i]);
+		else if ((arg.compare("-n") == 0) && (i + 1 < argc))
+			bench_rounds = atoi(argv[++i]);
+	}
+
+	// Listen on a private socket (abstract namespace)
+	Config *cfg = Config::getInstance();
+	std::string address("unix:@hermod-bench-");
+	address += String::number(getpid()).toStdStr();
+	cfg->set("global", "listen", address);
+	cfg->set("plugins", "directory", "../../modules/");
+	cfg->set("route", "hello_json", "Dummy:hello_json");
+
+	ModuleCache modules;
+	if (modules.load("dummy.so") == 0)
+	{
+		std::cerr << "Failed to load the Dummy module" << std::endl;
+		return(-1);
+	}
+	Router router;
+	router.setModuleCache(&modules);
+	router.reload();
+
+	std::cout << "Process " << bench_rounds << " rounds of " << bench_conns
+	          << " requests (one per connection) on /hello_json" << std::endl;
+
+	for (int proto = PROTO_FCGI_KEEP; proto <= PROTO_UWSGI; proto++)
+	{
+		Reactor reactor;
+		Server *server;
+		std::string request;
+		if (proto == PROTO_FCGI_KEEP)
+		{
+			server  = new ServerFastcgi();
+			request = buildFcgi(true);
+		}
+		else if (proto == PROTO_FCGI)
+		{
+			server  = new ServerFastcgi();
+			request = buildFcgi(false);
+		}
+		else if (proto == PROTO_SCGI)
+		{
+			server  = new ServerScgi();
+			request = buildScgi();
+		}
+		else
+		{
+			server  = new ServerUwsgi();
+			request = buildUwsgi();
+		}
+		server->setReactor(&reactor);
+		server->setRouter(&router);
+		server->start();
+		if (server->getFd() < 0)
+		{
+			std::cerr << "Failed to open listening socket" << std::endl;
+			return(-1);
+		}
+		run(proto, server, &reactor, request);
+		delete server;
+	}
+
+	Config::destroy();
+	return(0);
+}
+
+/**
+ * @brief Create the records of a GET request, like sent by nginx
+ *
+ * @param keep True if the web server keeps the connection open
+ */
+static std::string buildFcgi(bool keep)
+{
+	std::string req;
+	std::string params;
+	char begin[8] = {0, 1, 0, 0, 0, 0, 0, 0}; // Responder
+
+	if (keep)
+		begin[2] = 1;
+
+	for (const BenchParam *p = bench_params; p->name; p++)
+	{
+		params += (char)strlen(p->name);
+		params += (char)strlen(p->value);
+		params += p->name;
+		params += p->value;
+	}
+
+	req += buildRecord(1, 1, begin, 8);
+	req += buildRecord(4, 1, params.data(), params.length());
+	req += buildRecord(4, 1, 0, 0);
+	req += buildRecord(5, 1, 0, 0);
+	return req;
+}
+
+/**
+ * @brief Create one FastCGI record
+ *
+ */
+static std::string buildRecord(int type, int id, const char *data, int len)
+{
+	std::string rec;
+	int pad = (8 - (len & 7)) & 7;
+
+	rec += (char)1;
+	rec += (char)type;
+	rec += (char)(id  >> 8);
+	rec += (char)(id  & 0xFF);
+	rec += (char)(len >> 8);
+	rec += (char)(len & 0xFF);
+	rec += (char)pad;
+	rec += (char)0;
+	rec.append(data, len);
+	rec.append(pad, '\0');
+	return rec;
+}
+
+/**
+ * @brief Create the netstring of a GET request, like sent by nginx (SCGI)
+ *
+ */
+static std::string buildScgi(void)
+{
+	std::string params;
+
+	for (const BenchParam *p = bench_params; p->name; p++)
+	{
+		params.append(p->name, strlen(p->name) + 1);
+		params.append(p->value, strlen(p->value) + 1);
+	}
+	params.append("SCGI\0" "1\0", 7);
+
+	return (String::number(params.length()).toStdStr() + ":" + params + ",");
+}
+
+/**
+ * @brief Create the packet of a GET request, like sent by nginx (uwsgi)
+ *
+ */
+static std::string buildUwsgi(void)
+{
+	std::string params;
+
+	for (const BenchParam *p = bench_params; p->name; p++)
+	{
+		size_t nameLen  = strlen(p->name);
+		size_t valueLen = strlen(p->value);
+		params += (char)(nameLen & 0xFF);
+		params += (char)(nameLen >> 8);
+		params += p->name;
+		params += (char)(valueLen & 0xFF);
+		params += (char)(valueLen >> 8);
+		params += p->value;
+	}
+
+	std::string req;
+	req += (char)0;
+	req += (char)(params.length() & 0xFF);
+	req += (char)(params.length() >> 8);
+	req += (char)0;
+	return (req + params);
+}
+
+/**
+ * @brief Open a connection to the server
+ *
+ * @return integer Descriptor of the connection (or -1 on error)
+ */
+static int connectServer(struct sockaddr_un *addr, socklen_t addrLen)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)addr, addrLen) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief Get current time (in seconds)
+ *
+ */
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (tv.tv_sec + (tv.tv_usec / 1000000.0));
+}
+
+/**
+ * @brief Read records from a connection until the end of one request
+ *
+ * @return integer Number of bytes of the response (or -1 on error)
+ */
+static int readFcgi(int fd, std::string &rx)
+{
+	char buffer[4096];
+	int  total = 0;
+
+	while (1)
+	{
+		// Parse complete records
+		while (rx.length() >= 8)
+		{
+			const unsigned char *h = (const unsigned char *)rx.data();
+			size_t len = 8 + ((h[4] << 8) | h[5]) + h[6];
+			if (rx.length() < len)
+				break;
+			int type = h[1];
+			total += len;
+			rx.erase(0, len);
+			if (type == 3)
+				return total;
+		}
+		ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+		if (len <= 0)
+			return -1;
+		rx.append(buffer, len);
+	}
+}
+
+/**
+ * @brief Read a response until the connection is closed by the server
+ *
+ * @return integer Number of bytes of the response (or -1 on error)
+ */
+static int readClose(int fd)
+{
+	char buffer[4096];
+	int  total = 0;
+
+	while (1)
+	{
+		ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+		if (len == 0)
+			return total;
+		if (len < 0)
+			return -1;
+		total += len;
+	}
+}
+
+/**
+ * @brief Run the benchmark on one server
+ *
+ */
+static void run(int proto, Server *server, Reactor *reactor,
+                const std::string &request)
+{
+	static const char *names[] = {"fastcgi (keep_conn)", "fastcgi            ",
+	                              "scgi               ", "uwsgi              "};
+	struct sockaddr_un addr;
+	socklen_t addrLen = sizeof(addr);
+	std::vector<int> clients;
+	std::vector<std::string> rx;
+	BenchServer ctx;
+	pthread_t   thread;
+
+	getsockname(server->getFd(), (struct sockaddr *)&addr, &addrLen);
+
+	ctx.reactor = reactor;
+	ctx.running = true;
+	if (pthread_create(&thread, 0, thread_server, &ctx) != 0)
+		return;
+
+	clients.resize(bench_conns, -1);
+	rx.resize(bench_conns);
+
+	long   count = 0;
+	long   bytes = 0;
+	double t0 = now();
+	for (int round = 0; round < bench_rounds; round++)
+	{
+		for (size_t i = 0; i < clients.size(); i++)
+		{
+			if (clients[i] < 0)
+				clients[i] = connectServer(&addr, addrLen);
+			if (clients[i] < 0)
+				continue;
+			send(clients[i], request.data(), request.length(), 0);
+		}
+		for (size_t i = 0; i < clients.size(); i++)
+		{
+			if (clients[i] < 0)
+				continue;
+			int len;
+			if (proto == PROTO_FCGI_KEEP)
+				len = readFcgi(clients[i], rx[i]);
+			else
+			{
+				// The server closes the connection at the end of response
+				len = readClose(clients[i]);
+				close(clients[i]);
+				clients[i] = -1;
+			}
+			if (len < 0)
+				continue;
+			bytes += len;
+			count++;
+		}
+	}
+	double t1 = now();
+
+	for (size_t i = 0; i < clients.size(); i++)
+	{
+		if (clients[i] >= 0)
+			close(clients[i]);
+	}
+	__atomic_store_n(&ctx.running, false, __ATOMIC_RELEASE);
+	pthread_join(thread, 0);
+
+	if (count == 0)
+	{
+		std::cout << " * " << names[proto] << " : no response" << std::endl;
+		return;
+	}
+	std::cout << " * " << names[proto] << " : " << count << " requests ("
+	          << request.length() << " bytes, response "
+	          << (bytes / count) << " bytes), "
+	          << (long)(count / (t1 - t0)) << " req/s, server "
+	          << ((ctx.user + ctx.sys) * 1000000.0) / count << " us/req (user "
+	          << (ctx.user * 1000000.0) / count << ", sys "
+	          << (ctx.sys  * 1000000.0) / count << ")" << std::endl;
+}
+
+/**
+ * @brief Event loop of the server, measure the resources used by the thread
+ *
+ */
+static void *thread_server(void *arg)
+{
+	BenchServer *ctx = (BenchServer *)arg;
+	struct rusage r0, r1;
+
+	getrusage(RUSAGE_THREAD, &r0);
+	while (__atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE))
+		ctx->reactor->wait(50);
+	getrusage(RUSAGE_THREAD, &r1);
+
+	ctx->user = (r1.ru_utime.tv_sec  - r0.ru_utime.tv_sec) +
+	            (r1.ru_utime.tv_usec - r0.ru_utime.tv_usec) / 1000000.0;
+	ctx->sys  = (r1.ru_stime.tv_sec  - r0.ru_stime.tv_sec) +
+	            (r1.ru_stime.tv_usec - r0.ru_stime.tv_usec) / 1000000.0;
+	return 0;
+}
+/* EOF */
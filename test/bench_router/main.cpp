@@ -0,0 +1,152 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License 
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+#include "Request.hpp"
+#include "Router.hpp"
+#include "String.hpp"
+
+using namespace hermod;
+
+/*
+ * This benchmark measures the search of routes into a Router with many
+ * routes (10000 by default). Routes are made of two segments
+ * ("app<n>/res<m>") plus one route for each application ("app<n>"). The
+ * lookups are done like by servers : the Request holds SCRIPT_NAME as a
+ * slice, the Router finds the route and saves the arguments into the
+ * Request. For comparison, the previous linear search (compare each route
+ * with the beginning of the URI) is also measured.
+ */
+
+static int bench_routes  = 10000;
+static int bench_lookups = 1000000;
+
+static double now(void);
+static String linearFind(std::vector<String> &routes, const String &uri);
+
+/**
+ * @brief Entry point of the benchmark
+ *
+ * @param argc Number of arguments on command line
+ * @param argv Pointer to arguments array
+ */
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg( argv[i] );
+		if ((arg.compare("-r") == 0) && (i + 1 < argc))
+			bench_routes  = atoi(argv[++i]);
+		else if ((arg.compare("-n") == 0) && (i + 1 < argc))
+			bench_lookups = atoi(argv[++i]);
+	}
+
+	// Create the routes
+	int apps = 100;
+	int resources = (bench_routes / apps) - 1;
+	if (resources < 1)
+		resources = 1;
+	Router router;
+	std::vector<String> linear;
+	for (int a = 0; a < apps; a++)
+	{
+		String app("app");
+		app += String::number(a);
+		for (int r = 0; r < resources; r++)
+		{
+			String uri(app);
+			uri += "/res";
+			uri += String::number(r);
+			router.createRoute(uri, 0);
+			linear.push_back(uri);
+		}
+		router.createRoute(app, 0);
+		linear.push_back(app);
+	}
+
+	// Requested paths : deep route with arguments, short route, and unknown
+	std::vector<std::string> paths;
+	paths.push_back("/app57/res" + String::number(resources / 2).toStdStr() +
+	                "/item/42");
+	paths.push_back("/app99/unknown/arg");
+	paths.push_back("/application/missing");
+
+	std::cout << "Search " << linear.size() << " routes" << std::endl;
+
+	for (size_t p = 0; p < paths.size(); p++)
+	{
+		const std::string &path = paths[p];
+		Request req(0);
+		req.addParam("SCRIPT_NAME", 11, path.data(), path.length());
+
+		// Search into the radix tree
+		Route *route = 0;
+		double t0 = now();
+		for (int i = 0; i < bench_lookups; i++)
+			route = router.find(&req);
+		double t1 = now();
+
+		// Previous linear search (limited number of lookups, it is slow)
+		String uri(path.data() + 1, path.length() - 1);
+		String found;
+		int count = (bench_lookups / 1000) + 1;
+		double t2 = now();
+		for (int i = 0; i < count; i++)
+			found = linearFind(linear, uri);
+		double t3 = now();
+
+		std::cout << " * " << path << " -> "
+		          << (route ? route->getUri().toStdStr() : std::string("none"))
+		          << " (" << req.countUriArgs() << " args)" << std::endl;
+		std::cout << "     tree   : "
+		          << ((t1 - t0) * 1000000000.0) / bench_lookups << " ns/lookup"
+		          << std::endl;
+		std::cout << "     linear : "
+		          << ((t3 - t2) * 1000000000.0) / count << " ns/lookup ("
+		          << (found.isEmpty() ? std::string("none") : found.toStdStr())
+		          << ")" << std::endl;
+	}
+	return(0);
+}
+
+/**
+ * @brief Previous search of a route, the first one that starts the URI
+ *
+ */
+static String linearFind(std::vector<String> &routes, const String &uri)
+{
+	for (size_t i = 0; i < routes.size(); i++)
+	{
+		if (routes[i] == uri.left(routes[i].length()))
+			return routes[i];
+	}
+	return String();
+}
+
+/**
+ * @brief Get current time (in seconds)
+ *
+ */
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (tv.tv_sec + (tv.tv_usec / 1000000.0));
+}
+/* EOF */
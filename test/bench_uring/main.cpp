@@ -0,0 +1,316 @@
+/*
+ * Hermod - Modular application framework
+ *
+ * Copyright (c) 2019 Cowlab
+ *
+ * Hermod is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 3 as published by the Free Software Foundation. You
+ * should have received a copy of the GNU Lesser General Public
+ * License along with this program, see LICENSE file for more details.
+ * This program is distributed WITHOUT ANY WARRANTY see README file.
+ *
+ * Authors: Saint-Genest Gwenael <gwen@hooligan0.net>
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Config.hpp"
+#include "ModuleCache.hpp"
+#include "Reactor.hpp"
+#include "Router.hpp"
+#include "ServerFastcgi.hpp"
+#include "ServerUring.hpp"
+#include "String.hpp"
+
+using namespace hermod;
+
+/*
+ * This benchmark compares the FastCGI servers on the hello_json route of the
+ * Dummy module. Many connections are opened, then each round sends one
+ * request on every connection and waits for all the responses. The server
+ * runs into its own thread (like a ReactorThread), and the CPU time of this
+ * thread is measured for each backend : with epoll (ServerFastcgi) each
+ * request needs a recv, a writev and a last recv that returns EAGAIN, with
+ * io_uring (ServerUring) all the operations of an event are submitted with
+ * one system call.
+ */
+
+static int bench_conns  = 64;
+static int bench_rounds = 2000;
+
+/**
+ * @struct BenchServer
+ * @brief Context of the server thread
+ *
+ */
+struct BenchServer
+{
+	Reactor *reactor;
+	bool     running;
+	double   user;     // CPU time of the thread (user), in seconds
+	double   sys;      // CPU time of the thread (system), in seconds
+	long     switches; // Number of times the thread has waited for events
+};
+
+static std::string buildRecord(int type, int id, const char *data, int len);
+static std::string buildRequest(void);
+static double now(void);
+static int    readResponse(int fd, std::string &rx);
+static void   run(const char *name, Server *server, Reactor *reactor,
+                  const std::string &request);
+static void  *thread_server(void *arg);
+
+/**
+ * @brief Entry point of the benchmark
+ *
+ * @param argc Number of arguments on command line
+ * @param argv Pointer to arguments array
+ */
+int main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg( argv[i] );
+		if ((arg.compare("-c") == 0) && (i + 1 < argc))
+			bench_conns  = atoi(argv[++i]);
+		else if ((arg.compare("-n") == 0) && (i + 1 < argc))
+			bench_rounds = atoi(argv[++i]);
+	}
+
+	// Listen on a private socket (abstract namespace)
+	Config *cfg = Config::getInstance();
+	std::string address("unix:@hermod-bench-");
+	address += String::number(getpid()).toStdStr();
+	cfg->set("global", "listen", address);
+	cfg->set("plugins", "directory", "../../modules/");
+	cfg->set("route", "hello_json", "Dummy:hello_json");
+
+	ModuleCache modules;
+	if (modules.load("dummy.so") == 0)
+	{
+		std::cerr << "Failed to load the Dummy module" << std::endl;
+		return(-1);
+	}
+	Router router;
+	router.setModuleCache(&modules);
+	router.reload();
+
+	std::string request = buildRequest();
+
+	std::cout << "Process " << bench_rounds << " rounds of " << bench_conns
+	          << " requests (one per connection) on /hello_json" << std::endl;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		Reactor reactor;
+		Server *server;
+		if (pass == 0)
+			server = new ServerFastcgi();
+		else
+			server = new ServerUring();
+		server->setReactor(&reactor);
+		server->setRouter(&router);
+		server->start();
+		if (server->getFd() < 0)
+		{
+			std::cerr << "Failed to open listening socket" << std::endl;
+			return(-1);
+		}
+		run((pass == 0 ? "epoll   " : "io_uring"), server, &reactor, request);
+		delete server;
+	}
+
+	Config::destroy();
+	return(0);
+}
+
+/**
+ * @brief Create one FastCGI record
+ *
+ */
+static std::string buildRecord(int type, int id, const char *data, int len)
+{
+	std::string rec;
+	int pad = (8 - (len & 7)) & 7;
+
+	rec += (char)1;
+	rec += (char)type;
+	rec += (char)(id  >> 8);
+	rec += (char)(id  & 0xFF);
+	rec += (char)(len >> 8);
+	rec += (char)(len & 0xFF);
+	rec += (char)pad;
+	rec += (char)0;
+	rec.append(data, len);
+	rec.append(pad, '\0');
+	return rec;
+}
+
+/**
+ * @brief Create the records of a GET request, like sent by a web server
+ *
+ */
+static std::string buildRequest(void)
+{
+	std::string req;
+	std::string params;
+	char begin[8] = {0, 1, 1, 0, 0, 0, 0, 0}; // Responder, keep connection
+
+	params += (char)11; params += (char)11;
+	params += "SCRIPT_NAME/hello_json";
+	params += (char)14; params += (char)3;
+	params += "REQUEST_METHODGET";
+
+	req += buildRecord(1, 1, begin, 8);
+	req += buildRecord(4, 1, params.data(), params.length());
+	req += buildRecord(4, 1, 0, 0);
+	req += buildRecord(5, 1, 0, 0);
+	return req;
+}
+
+/**
+ * @brief Get current time (in seconds)
+ *
+ */
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (tv.tv_sec + (tv.tv_usec / 1000000.0));
+}
+
+/**
+ * @brief Read records from a connection until the end of one request
+ *
+ * @return integer Number of bytes of the response (or -1 on error)
+ */
+static int readResponse(int fd, std::string &rx)
+{
+	char buffer[4096];
+	int  total = 0;
+
+	while (1)
+	{
+		// Parse complete records
+		while (rx.length() >= 8)
+		{
+			const unsigned char *h = (const unsigned char *)rx.data();
+			size_t len = 8 + ((h[4] << 8) | h[5]) + h[6];
+			if (rx.length() < len)
+				break;
+			int type = h[1];
+			total += len;
+			rx.erase(0, len);
+			if (type == 3)
+				return total;
+		}
+		ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+		if (len <= 0)
+			return -1;
+		rx.append(buffer, len);
+	}
+}
+
+/**
+ * @brief Run the benchmark on one server
+ *
+ */
+static void run(const char *name, Server *server, Reactor *reactor,
+                const std::string &request)
+{
+	struct sockaddr_un addr;
+	socklen_t addrLen = sizeof(addr);
+	std::vector<int> clients;
+	std::vector<std::string> rx;
+	BenchServer ctx;
+	pthread_t   thread;
+
+	getsockname(server->getFd(), (struct sockaddr *)&addr, &addrLen);
+
+	ctx.reactor = reactor;
+	ctx.running = true;
+	if (pthread_create(&thread, 0, thread_server, &ctx) != 0)
+		return;
+
+	for (int i = 0; i < bench_conns; i++)
+	{
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			break;
+		if (connect(fd, (struct sockaddr *)&addr, addrLen) < 0)
+		{
+			close(fd);
+			break;
+		}
+		clients.push_back(fd);
+	}
+	rx.resize(clients.size());
+
+	long   count = 0;
+	long   bytes = 0;
+	double t0 = now();
+	for (int round = 0; round < bench_rounds; round++)
+	{
+		for (size_t i = 0; i < clients.size(); i++)
+			send(clients[i], request.data(), request.length(), 0);
+		for (size_t i = 0; i < clients.size(); i++)
+		{
+			int len = readResponse(clients[i], rx[i]);
+			if (len < 0)
+				break;
+			bytes += len;
+			count++;
+		}
+	}
+	double t1 = now();
+
+	for (size_t i = 0; i < clients.size(); i++)
+		close(clients[i]);
+	__atomic_store_n(&ctx.running, false, __ATOMIC_RELEASE);
+	pthread_join(thread, 0);
+
+	if (count == 0)
+	{
+		std::cout << " * " << name << " : no response" << std::endl;
+		return;
+	}
+	std::cout << " * " << name << " : " << count << " requests ("
+	          << (bytes / count) << " bytes), "
+	          << (long)(count / (t1 - t0)) << " req/s, server "
+	          << ((ctx.user + ctx.sys) * 1000000.0) / count << " us/req (user "
+	          << (ctx.user * 1000000.0) / count << ", sys "
+	          << (ctx.sys  * 1000000.0) / count << "), "
+	          << (double)ctx.switches / count << " waits/req" << std::endl;
+}
+
+/**
+ * @brief Event loop of the server, measure the resources used by the thread
+ *
+ */
+static void *thread_server(void *arg)
+{
+	BenchServer *ctx = (BenchServer *)arg;
+	struct rusage r0, r1;
+
+	getrusage(RUSAGE_THREAD, &r0);
+	while (__atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE))
+		ctx->reactor->wait(50);
+	getrusage(RUSAGE_THREAD, &r1);
+
+	ctx->user = (r1.ru_utime.tv_sec  - r0.ru_utime.tv_sec) +
+	            (r1.ru_utime.tv_usec - r0.ru_utime.tv_usec) / 1000000.0;
+	ctx->sys  = (r1.ru_stime.tv_sec  - r0.ru_stime.tv_sec) +
+	            (r1.ru_stime.tv_usec - r0.ru_stime.tv_usec) / 1000000.0;
+	ctx->switches = (r1.ru_nvcsw - r0.ru_nvcsw);
+	return 0;
+}
+/* EOF */
@@ -16,16 +16,31 @@
 #include <stdexcept>
 #include <iostream>
 #include <string>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include "Reactor.hpp"
 #include "Request.hpp"
 #include "Log.hpp"
+#include "Config.hpp"
+#include "Router.hpp"
+#include "RoutePolicy.hpp"
+#include "ServerFastcgi.hpp"
+#include "Session.hpp"
+#include "SessionCache.hpp"
 #include "String.hpp"
 
 using namespace hermod;
 
+static void ut_ConfigHandle(void);
+static void ut_FastcgiParams(void);
 static void ut_HeaderParameter(void);
+static void ut_ParamSlices(void);
 static void ut_FormValues(void);
+static void ut_Router(void);
+static void ut_RoutePolicy(void);
+static void ut_SessionCache(void);
 
 static int log_level;
 
@@ -49,14 +64,38 @@ int main(int argc, char **argv)
 	}
 
 	try {
+		// Call Config handles unit-test
+		std::cout << " * Test config handles    ";
+		ut_ConfigHandle();
+		std::cout << "[PASS]" << std::endl;
 		// Call Header parameters unit-test
 		std::cout << " * Test header parameters ";
 		ut_HeaderParameter();
 		std::cout << "[PASS]" << std::endl;
+		// Call parameters slices unit-test
+		std::cout << " * Test parameters slices ";
+		ut_ParamSlices();
+		std::cout << "[PASS]" << std::endl;
+		// Call FastCGI parameters unit-test
+		std::cout << " * Test FastCGI params    ";
+		ut_FastcgiParams();
+		std::cout << "[PASS]" << std::endl;
 		// Call Form Values unit-test
 		std::cout << " * Test Form values       ";
 		ut_FormValues();
 		std::cout << "[PASS]" << std::endl;
+		// Call Router unit-test
+		std::cout << " * Test router            ";
+		ut_Router();
+		std::cout << "[PASS]" << std::endl;
+		// Call route policy unit-test
+		std::cout << " * Test route policy      ";
+		ut_RoutePolicy();
+		std::cout << "[PASS]" << std::endl;
+
+		std::cout << " * Test session cache     ";
+		ut_SessionCache();
+		std::cout << "[PASS]" << std::endl;
 	} catch(const char *e) {
 		std::cout << "[FAILED]" << std::endl;
 		if (log_level > 1)
@@ -70,6 +109,132 @@ int main(int argc, char **argv)
 	return(0);
 }
 
+/**
+ * @brief Test typed access to config keys
+ *
+ * 1) Values of keys, default values for missing (or invalid) keys
+ * 2) Modified values, and values parsed by ConfigKey
+ * 3) A new Config object (like a reload) is used by existing handles
+ */
+static void ut_ConfigHandle(void)
+{
+	Config *cfg = Config::getInstance();
+	cfg->set("test", "count", "42");
+	cfg->set("test", "flag", "on");
+	cfg->set("test", "bad_flag", "maybe");
+	cfg->set("test", "name", "hermod");
+
+	ConfigHandle<int>  count("test", "count");
+	ConfigHandle<bool> flag ("test", "flag");
+	ConfigHandle<bool> badFlag("test", "bad_flag", true);
+	ConfigHandle<std::string> name("test", "name");
+	ConfigHandle<int>  missing("test", "missing", 7);
+
+	if ((count.get() != 42) || (flag.get() != true) || (badFlag.get() != true))
+		throw "ConfigHandle: typed values";
+	if ((name.get() != "hermod") || (missing.get() != 7))
+		throw "ConfigHandle: string and default values";
+	// The value of an existing key is modified in place
+	cfg->set("test", "count", "43");
+	if (count.get() != 43)
+		throw "ConfigHandle: modified value";
+
+	ConfigKey *key = cfg->getKey("test", "count");
+	if ((key == 0) || (key->getInteger() != 43) || (key->getBoolean(true) != true))
+		throw "ConfigKey: parsed values";
+
+	// A new Config object is used like a reloaded one
+	Config::destroy();
+	cfg = Config::getInstance();
+	cfg->set("test", "count", "1");
+	if ((count.get() != 1) || (name.get() != "") || (flag.get() != false))
+		throw "ConfigHandle: new config";
+
+	Config::destroy();
+}
+
+/**
+ * @brief Append a FastCGI record to a buffer
+ *
+ * @param out  Buffer where the record is written
+ * @param type Type of the record
+ * @param data Content of the record
+ */
+static void ut_FastcgiRecord(std::string &out, int type, const std::string &data)
+{
+	out += (char)1;
+	out += (char)type;
+	out += (char)0;
+	out += (char)1; // Request ID 1
+	out += (char)(data.length() >> 8);
+	out += (char)(data.length() & 0xFF);
+	out += (char)0;
+	out += (char)0;
+	out += data;
+}
+
+/**
+ * @brief Test the end of the PARAMS stream of a FastCGI request
+ *
+ * The parameters of a request are slices of the PARAMS stream, so records
+ * received after the end of the stream (a second empty record, more datas)
+ * must not replace it. The request is then processed normally : the response
+ * (404, no route loaded) and the END_REQUEST are received.
+ */
+static void ut_FastcgiParams(void)
+{
+	ServerFastcgi *client = 0;
+	Reactor reactor;
+	Router  router;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		throw "FastcgiParams: socketpair";
+
+	try {
+		client = new ServerFastcgi();
+		client->setClient(fds[0]);
+		client->setRouter(&router);
+		client->setReactor(&reactor);
+
+		std::string param("\x0B\x06SCRIPT_NAME/hello", 19);
+		std::string rx;
+		ut_FastcgiRecord(rx, 1, std::string("\x00\x01\x01\x00\x00\x00\x00\x00", 8));
+		ut_FastcgiRecord(rx, 4, param);
+		ut_FastcgiRecord(rx, 4, "");
+		ut_FastcgiRecord(rx, 4, "");
+		ut_FastcgiRecord(rx, 4, param);
+		ut_FastcgiRecord(rx, 4, "");
+		ut_FastcgiRecord(rx, 5, "");
+		if (write(fds[1], rx.data(), rx.length()) != (ssize_t)rx.length())
+			throw 1;
+
+		client->processFd();
+
+		char buffer[4096];
+		ssize_t len = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (len < 16)
+			throw 2;
+		std::string tx(buffer, len);
+		if (tx.find("404") == std::string::npos)
+			throw 3;
+		// The last record is END_REQUEST (type 3) of request 1
+		if ((tx[len - 16 + 1] != 3) || (tx[len - 16 + 3] != 1))
+			throw 4;
+
+		delete client;
+		client = 0;
+		close(fds[1]);
+	} catch(...) {
+		if (client)
+			delete client;
+		else
+			close(fds[0]);
+		close(fds[1]);
+		throw "FastcgiParams: Failed";
+	}
+}
+
 /**
  * @brief Test parsing of Form data
  *
@@ -171,4 +336,266 @@ static void ut_HeaderParameter(void)
 	}
 
 }
+
+/**
+ * @brief Test header parameters saved as slices of a buffer
+ *
+ * 1) Read back parameters that are not NULL terminated into the buffer
+ * 2) Read back a long value (more than 127 bytes)
+ * 3) Test that SCRIPT_NAME is used as URI
+ * 4) Well-known parameters into slots, others into the list (views)
+ */
+static void ut_ParamSlices(void)
+{
+	Request *req = 0;
+
+	try {
+		std::string longValue(300, 'x');
+		String *buffer = new String("SCRIPT_NAME/hello/worldHTTP_COOKIE");
+		buffer->append(longValue.c_str());
+		buffer->append("HTTP_X_TESTfooHTTP_X_TESTbar");
+		char *p = buffer->data();
+
+		req = new Request(0);
+		req->setParamBuffer(buffer);
+		req->addParam(p,      11, p + 11, 12);
+		req->addParam(p + 23, 11, p + 34, 300);
+		req->addParam(p + 334, 11, p + 345, 3);
+		req->addParam(p + 348, 11, p + 359, 3);
+
+		if (req->getParam("SCRIPT_NAME") != "/hello/world")
+			throw 1;
+		if (req->getParam("HTTP_COOKIE") != longValue.c_str())
+			throw 2;
+		if ( ! req->getParam("SCRIPT").isEmpty())
+			throw 3;
+		if (req->getUri(0) != "hello/world")
+			throw 4;
+
+		unsigned int len;
+		const char  *v = req->getParam(Request::paramHttpCookie, len);
+		if ((v != p + 34) || (len != 300))
+			throw 5;
+		if (req->getParam(Request::paramQueryString, len) != 0)
+			throw 6;
+		// The last value of a parameter is used
+		v = req->getParam("HTTP_X_TEST", 11, len);
+		if ((v != p + 359) || (len != 3))
+			throw 7;
+		if (Request::findParam("HTTP_X_TEST", 11) >= 0)
+			throw 8;
+		if ((Request::findParam("SERVER_PROTOCOL", 15) != Request::paramServerProtocol) ||
+		    (Request::findParam("SERVER_NAME", 11) != Request::paramServerName) ||
+		    (Request::findParam("SCRIPT_NAMES", 12) >= 0))
+			throw 9;
+
+		// A new buffer removes the slices of the previous one
+		req->setParamBuffer(new String());
+		if ((req->getParam(Request::paramScriptName, len) != 0) ||
+		    (req->getParam("HTTP_X_TEST", 11, len) != 0) ||
+		    ( ! req->getUri(0).isEmpty()))
+			throw 10;
+
+		delete req;
+		req = 0;
+	} catch(...) {
+		if (req)
+			delete req;
+		throw "ParamSlices: Failed";
+	}
+}
+
+/**
+ * @brief Find the route of a path, and test the arguments of the request
+ *
+ * @param router Pointer to the Router to use
+ * @param path   Requested path (SCRIPT_NAME)
+ * @param route  Expected route URI (or NULL if no route should match)
+ * @param args   Expected arguments, separated by ',' (or NULL)
+ * @return boolean True if the result is the expected one
+ */
+static bool ut_RouterFind(Router *router, const char *path,
+                          const char *route, const char *args)
+{
+	Request req(0);
+	req.setHeaderParameter("SCRIPT_NAME", path);
+
+	Route *r = router->find(&req);
+	if (route == 0)
+		return (r == 0);
+	if ((r == 0) || (r->getUri() != route) || (req.getUri(0) != route))
+		return false;
+
+	std::string expected(args ? args : "");
+	std::string found;
+	for (unsigned int i = 1; i <= req.countUriArgs(); i++)
+	{
+		if (i > 1)
+			found += ",";
+		found += req.getUri(i).toStdStr();
+	}
+	return ((found == expected) &&
+	        ((args != 0) || (req.countUriArgs() == 0)));
+}
+
+/**
+ * @brief Test the search of routes
+ *
+ * 1) A route matches a path only on a segment boundary
+ * 2) The longest route is used, following segments are arguments
+ * 3) System names (:index:) and many routes
+ */
+static void ut_Router(void)
+{
+	Router router;
+
+	router.createRoute("hello", 0);
+	router.createRoute("hello_json", 0);
+	router.createRoute("/api/", 0);
+	router.createRoute("api/v1/users", 0);
+	router.createRoute("api/v1", 0);
+	router.createRoute(":index:", 0);
+
+	if ( ! ut_RouterFind(&router, "/hello", "hello", 0))
+		throw "Router: exact route";
+	if ( ! ut_RouterFind(&router, "/hello_json", "hello_json", 0))
+		throw "Router: route with same prefix";
+	if ( ! ut_RouterFind(&router, "/helloworld", 0, 0))
+		throw "Router: match inside a segment";
+	if ( ! ut_RouterFind(&router, "/hello/a/b", "hello", "a,b"))
+		throw "Router: arguments";
+	if ( ! ut_RouterFind(&router, "/hello/", "hello", 0))
+		throw "Router: trailing separator";
+	if ( ! ut_RouterFind(&router, "/hello/a/", "hello", "a,"))
+		throw "Router: empty argument";
+	if ( ! ut_RouterFind(&router, "/api/v1/users/42", "api/v1/users", "42"))
+		throw "Router: longest route";
+	if ( ! ut_RouterFind(&router, "/api/v1/user", "api/v1", "user"))
+		throw "Router: split node";
+	if ( ! ut_RouterFind(&router, "/api/v2", "api", "v2"))
+		throw "Router: shortest route";
+	if ( ! ut_RouterFind(&router, "/", ":index:", 0))
+		throw "Router: index";
+
+	for (int i = 0; i < 1000; i++)
+	{
+		String route("many/r");
+		route += String::number(i);
+		router.createRoute(route, 0);
+	}
+	for (int i = 0; i < 1000; i += 7)
+	{
+		String route("many/r");
+		route += String::number(i);
+		String path("/");
+		path += route;
+		path += "/x";
+		if ( ! ut_RouterFind(&router, path.data(), route.data(), "x"))
+			throw "Router: many routes";
+	}
+	if ( ! ut_RouterFind(&router, "/many/r1000", 0, 0))
+		throw "Router: many routes, unknown";
+}
+
+/**
+ * @brief Test the settings of routes
+ *
+ * 1) Default values, without config
+ * 2) Values of the global section of config
+ * 3) Options of one route override global values
+ */
+static void ut_RoutePolicy(void)
+{
+	RoutePolicy policy;
+	if ((policy.getSessionMode() != RoutePolicy::SessionNone) ||
+	    (policy.getSessionCookie().toStdStr() != "HERMOD_SESSION") ||
+	    (policy.getSessionTtl() != 0) ||
+	    ( ! policy.getCacheControl().isEmpty()))
+		throw "RoutePolicy: default values";
+
+	Config *cfg = Config::getInstance();
+	cfg->set("global", "session_mode", "token");
+	cfg->set("global", "session_ttl", "0");
+	cfg->set("global", "cache_control", "no-cache");
+	policy.load();
+	if ((policy.getSessionMode() != RoutePolicy::SessionToken) ||
+	    (policy.getSessionTtl() >= 0) ||
+	    (policy.getCacheControl().toStdStr() != "no-cache"))
+		throw "RoutePolicy: global config";
+
+	RoutePolicy route(policy);
+	route.setOptions(" session_mode=cookie\tsession_ttl=60 cache_control=max-age=30"
+	                 " content_type=text/css");
+	if ((route.getSessionMode() != RoutePolicy::SessionCookie) ||
+	    (route.getSessionTtl() != 60) ||
+	    (route.getCacheControl().toStdStr() != "max-age=30") ||
+	    (route.getContentType().toStdStr() != "text/css"))
+		throw "RoutePolicy: route options";
+	if (policy.getSessionMode() != RoutePolicy::SessionToken)
+		throw "RoutePolicy: route options modify global values";
+	Config::destroy();
+}
+
+/**
+ * @brief Test the lifetime of the sessions into the cache
+ *
+ * 1) A session used by a page is not removed, even if its TTL is expired
+ * 2) The TTL of a released session starts again from the release
+ * 3) An expired session is removed when it is not used anymore
+ * 4) A session loaded from file by many threads at once is cached only once
+ */
+static void *ut_SessionLoad(void *arg)
+{
+	String *id = (String *)arg;
+	return SessionCache::getInstance()->getById(*id);
+}
+
+static void ut_SessionCache(void)
+{
+	Config::getInstance()->set("global", "path_session", "/tmp/");
+	SessionCache *cache = SessionCache::getInstance();
+
+	Session *sess = cache->create(1);
+	String id( sess->getId() );
+	sleep(2);
+	SessionCache::clean();
+	if (cache->getById(id) != sess)
+		throw "SessionCache: session in use removed";
+	cache->release(sess);
+	cache->release(sess);
+
+	SessionCache::clean();
+	Session *found = cache->getById(id);
+	if (found != sess)
+		throw "SessionCache: TTL not refreshed by release";
+	cache->release(found);
+
+	sleep(2);
+	SessionCache::clean();
+	if (cache->getById(id) != 0)
+		throw "SessionCache: expired session kept";
+	SessionCache::destroy();
+
+	cache = SessionCache::getInstance();
+	sess = cache->create();
+	id = sess->getId();
+	cache->release(sess);
+	// Save the session file, the next access must load it
+	SessionCache::destroy();
+	cache = SessionCache::getInstance();
+	pthread_t threads[4];
+	void     *result[4];
+	for (int i = 0; i < 4; i++)
+		pthread_create(&threads[i], NULL, ut_SessionLoad, &id);
+	for (int i = 0; i < 4; i++)
+		pthread_join(threads[i], &result[i]);
+	for (int i = 1; i < 4; i++)
+		if ((result[i] == 0) || (result[i] != result[0]))
+			throw "SessionCache: session loaded twice";
+	for (int i = 0; i < 4; i++)
+		cache->release((Session *)result[i]);
+	SessionCache::destroy();
+	unlink(("/tmp/hermod-session-" + id).data());
+	Config::destroy();
+}
 /* EOF */